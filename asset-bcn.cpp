@@ -0,0 +1,701 @@
+#include "framework.h"
+#include "asset-internal.h"
+#include <cfloat>
+#include <emmintrin.h>
+
+namespace Framework
+{
+	// CPU encoder for the BCn block-compressed texture formats.
+	//  * Each 4x4 block gets endpoints along its principal axis (BC1/BC3 color, BC7) or at its
+	//      min and max (BC4/BC5 channels, BC3 alpha).  Color endpoints are then refined once
+	//      by a least-squares fit to the chosen indices, keeping whichever does better.
+	//  * BC7 only uses mode 6 (one subset, RGBA endpoints, 4-bit indices), plus mode 5
+	//      (separate color and alpha) for blocks with alpha.  That handles most content well
+	//      and keeps the encoder simple; the multi-subset modes would help sharp edges
+	//      between unrelated colors.
+	//  * Matching pixels to palette entries is done 4 pixels at a time with SSE2.
+	//  * sRGB formats are encoded on the sRGB values directly, as most encoders do.
+	//  * !!!UNDONE: perceptual channel weights, BC6H for HDR
+
+	namespace AssetCompiler
+	{
+		// A 4x4 block of pixels, with the channels split out, as SSE wants it
+		struct Block
+		{
+			union
+			{
+				__m128	m_vecs[4][4];		// [channel][group of 4 pixels]
+				float	m_vals[4][16];		// [channel][pixel]
+			};
+		};
+
+		static void LoadBlock(
+			const byte4 * pPixels,
+			int2 dims,
+			int xBlock,
+			int yBlock,
+			Block * pBlockOut)
+		{
+			for (int y = 0; y < 4; ++y)
+			{
+				int yPixel = min(yBlock * 4 + y, dims.y - 1);
+				for (int x = 0; x < 4; ++x)
+				{
+					int xPixel = min(xBlock * 4 + x, dims.x - 1);
+					const byte * pPixel = (const byte *)&pPixels[yPixel * dims.x + xPixel];
+					for (int c = 0; c < 4; ++c)
+						pBlockOut->m_vals[c][y * 4 + x] = float(pPixel[c]);
+				}
+			}
+		}
+
+		// Find the nearest palette entry to each pixel, over channels [firstChannel, firstChannel + numChannels).
+		// Returns the total squared error.
+		static float FitIndices(
+			const Block & block,
+			int firstChannel,
+			int numChannels,
+			const float (*palette)[4],
+			int numEntries,
+			int * indicesOut)
+		{
+			__m128 errorTotal = _mm_setzero_ps();
+			for (int iGroup = 0; iGroup < 4; ++iGroup)
+			{
+				__m128 errorBest = _mm_set1_ps(FLT_MAX);
+				__m128i indexBest = _mm_setzero_si128();
+				for (int iEntry = 0; iEntry < numEntries; ++iEntry)
+				{
+					__m128 error = _mm_setzero_ps();
+					for (int c = 0; c < numChannels; ++c)
+					{
+						__m128 diff = _mm_sub_ps(block.m_vecs[firstChannel + c][iGroup], _mm_set1_ps(palette[iEntry][c]));
+						error = _mm_add_ps(error, _mm_mul_ps(diff, diff));
+					}
+					__m128i better = _mm_castps_si128(_mm_cmplt_ps(error, errorBest));
+					errorBest = _mm_min_ps(error, errorBest);
+					indexBest = _mm_or_si128(
+									_mm_andnot_si128(better, indexBest),
+									_mm_and_si128(better, _mm_set1_epi32(iEntry)));
+				}
+				errorTotal = _mm_add_ps(errorTotal, errorBest);
+				_mm_storeu_si128((__m128i *)&indicesOut[iGroup * 4], indexBest);
+			}
+
+			float errors[4];
+			_mm_storeu_ps(errors, errorTotal);
+			return (errors[0] + errors[1]) + (errors[2] + errors[3]);
+		}
+
+		// Find endpoints for a block's first numChannels channels: the extent of the block
+		// along its principal axis (found by power iteration on the covariance matrix)
+		static void FindEndpointsPCA(
+			const Block & block,
+			int numChannels,
+			float * endpoint0Out,
+			float * endpoint1Out)
+		{
+			float mean[4] = {};
+			float mins[4], maxs[4];
+			for (int c = 0; c < numChannels; ++c)
+			{
+				mins[c] = maxs[c] = block.m_vals[c][0];
+				for (int i = 0; i < 16; ++i)
+				{
+					float val = block.m_vals[c][i];
+					mean[c] += val;
+					mins[c] = min(mins[c], val);
+					maxs[c] = max(maxs[c], val);
+				}
+				mean[c] *= (1.0f / 16.0f);
+			}
+
+			float cov[4][4] = {};
+			for (int i = 0; i < 16; ++i)
+			{
+				for (int a = 0; a < numChannels; ++a)
+				{
+					float da = block.m_vals[a][i] - mean[a];
+					for (int b = a; b < numChannels; ++b)
+						cov[a][b] += da * (block.m_vals[b][i] - mean[b]);
+				}
+			}
+			for (int a = 0; a < numChannels; ++a)
+				for (int b = 0; b < a; ++b)
+					cov[a][b] = cov[b][a];
+
+			// Start from the bounding box diagonal, which is usually close already
+			float axis[4];
+			for (int c = 0; c < numChannels; ++c)
+				axis[c] = maxs[c] - mins[c];
+			for (int iter = 0; iter < 8; ++iter)
+			{
+				float axisNext[4] = {};
+				float maxAbs = 0.0f;
+				for (int a = 0; a < numChannels; ++a)
+				{
+					for (int b = 0; b < numChannels; ++b)
+						axisNext[a] += cov[a][b] * axis[b];
+					maxAbs = max(maxAbs, fabsf(axisNext[a]));
+				}
+				if (maxAbs < 1e-6f)
+					break;
+				for (int c = 0; c < numChannels; ++c)
+					axis[c] = axisNext[c] / maxAbs;
+			}
+
+			float lengthSq = 0.0f;
+			for (int c = 0; c < numChannels; ++c)
+				lengthSq += axis[c] * axis[c];
+			if (lengthSq < 1e-6f)
+			{
+				// Solid block
+				for (int c = 0; c < numChannels; ++c)
+					endpoint0Out[c] = endpoint1Out[c] = mean[c];
+				return;
+			}
+			float invLength = 1.0f / sqrtf(lengthSq);
+			for (int c = 0; c < numChannels; ++c)
+				axis[c] *= invLength;
+
+			// Project the pixels onto the axis
+			float tMin = FLT_MAX, tMax = -FLT_MAX;
+			for (int i = 0; i < 16; ++i)
+			{
+				float t = 0.0f;
+				for (int c = 0; c < numChannels; ++c)
+					t += (block.m_vals[c][i] - mean[c]) * axis[c];
+				tMin = min(tMin, t);
+				tMax = max(tMax, t);
+			}
+
+			for (int c = 0; c < numChannels; ++c)
+			{
+				endpoint0Out[c] = clamp(mean[c] + axis[c] * tMin, 0.0f, 255.0f);
+				endpoint1Out[c] = clamp(mean[c] + axis[c] * tMax, 0.0f, 255.0f);
+			}
+		}
+
+		// Least-squares fit of endpoints to a block, given each pixel's index and the
+		// interpolation weight of each index.  Returns false if it's degenerate.
+		static bool RefineEndpoints(
+			const Block & block,
+			int numChannels,
+			const int * indices,
+			const float * weights,
+			float * endpoint0Out,
+			float * endpoint1Out)
+		{
+			float a = 0.0f, b = 0.0f, c = 0.0f;
+			float d0[4] = {}, d1[4] = {};
+			for (int i = 0; i < 16; ++i)
+			{
+				float t = weights[indices[i]];
+				float s = 1.0f - t;
+				a += s * s;
+				b += s * t;
+				c += t * t;
+				for (int ch = 0; ch < numChannels; ++ch)
+				{
+					d0[ch] += s * block.m_vals[ch][i];
+					d1[ch] += t * block.m_vals[ch][i];
+				}
+			}
+
+			float det = a * c - b * b;
+			if (fabsf(det) < 1e-6f)
+				return false;
+			float invDet = 1.0f / det;
+			for (int ch = 0; ch < numChannels; ++ch)
+			{
+				endpoint0Out[ch] = clamp((c * d0[ch] - b * d1[ch]) * invDet, 0.0f, 255.0f);
+				endpoint1Out[ch] = clamp((a * d1[ch] - b * d0[ch]) * invDet, 0.0f, 255.0f);
+			}
+			return true;
+		}
+
+		static void WriteLE(mz_uint64 value, int numBytes, byte * pOut)
+		{
+			for (int i = 0; i < numBytes; ++i)
+				pOut[i] = byte(value >> (8 * i));
+		}
+
+
+
+		// BC1: two RGB565 endpoints and 2-bit indices.  If endpoint 0 > endpoint 1 there are
+		// 4 colors; otherwise 3 colors plus transparent black.
+
+		static int QuantizeRGB565(const float * color)
+		{
+			int r = int(color[0] * (31.0f / 255.0f) + 0.5f);
+			int g = int(color[1] * (63.0f / 255.0f) + 0.5f);
+			int b = int(color[2] * (31.0f / 255.0f) + 0.5f);
+			return (r << 11) | (g << 5) | b;
+		}
+
+		static void UnpackRGB565(int packed, float * colorOut)
+		{
+			int r = (packed >> 11) & 31;
+			int g = (packed >> 5) & 63;
+			int b = packed & 31;
+			colorOut[0] = float((r << 3) | (r >> 2));
+			colorOut[1] = float((g << 2) | (g >> 4));
+			colorOut[2] = float((b << 3) | (b >> 2));
+			colorOut[3] = 255.0f;
+		}
+
+		static void EncodeBC1Block(const Block & blockIn, bool allowTransparent, byte * pOut)
+		{
+			static const float s_weights4[] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+			static const float s_weights3[] = { 0.0f, 1.0f, 0.5f };
+
+			// Replace transparent pixels with the average of the others, so they don't pull
+			// the endpoints around; they'll get the transparent index at the end
+			Block block = blockIn;
+			bool transparent[16] = {};
+			bool anyTransparent = false;
+			if (allowTransparent)
+			{
+				float sum[3] = {};
+				int numOpaque = 0;
+				for (int i = 0; i < 16; ++i)
+				{
+					transparent[i] = (block.m_vals[3][i] < 128.0f);
+					anyTransparent = anyTransparent || transparent[i];
+					if (!transparent[i])
+					{
+						for (int c = 0; c < 3; ++c)
+							sum[c] += block.m_vals[c][i];
+						++numOpaque;
+					}
+				}
+
+				if (numOpaque == 0)
+				{
+					// Endpoints 0, 0 selects 3-color mode, and index 3 everywhere is transparent
+					WriteLE(0xffffffff00000000ULL, 8, pOut);
+					return;
+				}
+
+				for (int i = 0; i < 16; ++i)
+				{
+					if (transparent[i])
+					{
+						for (int c = 0; c < 3; ++c)
+							block.m_vals[c][i] = sum[c] / float(numOpaque);
+					}
+				}
+			}
+
+			float endpoint0[4], endpoint1[4];
+			FindEndpointsPCA(block, 3, endpoint0, endpoint1);
+
+			// Try the PCA endpoints, then a least-squares refinement of them
+			float errorBest = FLT_MAX;
+			int packed0Best = 0, packed1Best = 0;
+			int indicesBest[16] = {};
+			for (int iPass = 0; iPass < 2; ++iPass)
+			{
+				int packed0 = QuantizeRGB565(endpoint0);
+				int packed1 = QuantizeRGB565(endpoint1);
+
+				// Order the endpoints to select 4-color or 3-color mode
+				if (anyTransparent ? (packed0 > packed1) : (packed0 < packed1))
+					std::swap(packed0, packed1);
+
+				int indices[16] = {};
+				float error = 0.0f;
+				int numEntries = anyTransparent ? 3 : 4;
+				const float * weights = anyTransparent ? s_weights3 : s_weights4;
+				float palette[4][4];
+				UnpackRGB565(packed0, palette[0]);
+				UnpackRGB565(packed1, palette[1]);
+				for (int iEntry = 2; iEntry < numEntries; ++iEntry)
+				{
+					for (int c = 0; c < 3; ++c)
+						palette[iEntry][c] = palette[0][c] + (palette[1][c] - palette[0][c]) * weights[iEntry];
+				}
+
+				if (packed0 == packed1)
+				{
+					// Only one color available, and in 3-color mode it's all any index can get
+					for (int i = 0; i < 16; ++i)
+					{
+						for (int c = 0; c < 3; ++c)
+							error += square(block.m_vals[c][i] - palette[0][c]);
+					}
+				}
+				else
+				{
+					error = FitIndices(block, 0, 3, palette, numEntries, indices);
+				}
+
+				if (error < errorBest)
+				{
+					errorBest = error;
+					packed0Best = packed0;
+					packed1Best = packed1;
+					memcpy(indicesBest, indices, sizeof(indices));
+				}
+
+				if (iPass == 0)
+				{
+					// Fit to the unquantized palette weights of the order we ended up with
+					float refined0[4], refined1[4];
+					if (packed0 == packed1 ||
+						!RefineEndpoints(block, 3, indices, weights, refined0, refined1))
+					{
+						break;
+					}
+					memcpy(endpoint0, refined0, sizeof(endpoint0));
+					memcpy(endpoint1, refined1, sizeof(endpoint1));
+				}
+			}
+
+			mz_uint32 indexBits = 0;
+			for (int i = 0; i < 16; ++i)
+			{
+				int index = transparent[i] ? 3 : indicesBest[i];
+				indexBits |= mz_uint32(index) << (2 * i);
+			}
+			WriteLE(mz_uint64(packed0Best) | (mz_uint64(packed1Best) << 16) | (mz_uint64(indexBits) << 32), 8, pOut);
+		}
+
+
+
+		// BC4: two 8-bit endpoints and 3-bit indices, for one channel.  We always use the
+		// 8-value mode (endpoint 0 > endpoint 1), with the endpoints at the channel's min and max.
+
+		static void EncodeBC4Block(const Block & block, int channel, byte * pOut)
+		{
+			float valMin = block.m_vals[channel][0], valMax = valMin;
+			for (int i = 1; i < 16; ++i)
+			{
+				valMin = min(valMin, block.m_vals[channel][i]);
+				valMax = max(valMax, block.m_vals[channel][i]);
+			}
+
+			int endpoint0 = int(valMax);
+			int endpoint1 = int(valMin);
+			mz_uint64 bits = mz_uint64(endpoint0) | (mz_uint64(endpoint1) << 8);
+
+			if (endpoint0 > endpoint1)
+			{
+				float palette[8][4];
+				palette[0][0] = float(endpoint0);
+				palette[1][0] = float(endpoint1);
+				for (int i = 1; i < 7; ++i)
+					palette[i + 1][0] = float((7 - i) * endpoint0 + i * endpoint1) / 7.0f;
+
+				int indices[16];
+				FitIndices(block, channel, 1, palette, 8, indices);
+				for (int i = 0; i < 16; ++i)
+					bits |= mz_uint64(indices[i]) << (16 + 3 * i);
+			}
+
+			WriteLE(bits, 8, pOut);
+		}
+
+
+
+		// BC7 mode 6: RGBA endpoints of 7 bits per channel plus a shared low bit per endpoint,
+		// and 4-bit indices.  The index of the first pixel (the "anchor") drops its top bit,
+		// so the endpoints have to be ordered to make that bit zero.
+		// BC7 mode 5: RGB endpoints of 7 bits per channel with 2-bit indices, and separately,
+		// alpha endpoints of 8 bits with their own 2-bit indices.  Blocks whose alpha doesn't
+		// follow the color get this instead, if it comes out better.
+
+		static const int s_bc7Weights4[] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		static const float s_bc7WeightsFloat[] =
+		{
+			 0.0f / 64.0f,  4.0f / 64.0f,  9.0f / 64.0f, 13.0f / 64.0f,
+			17.0f / 64.0f, 21.0f / 64.0f, 26.0f / 64.0f, 30.0f / 64.0f,
+			34.0f / 64.0f, 38.0f / 64.0f, 43.0f / 64.0f, 47.0f / 64.0f,
+			51.0f / 64.0f, 55.0f / 64.0f, 60.0f / 64.0f, 64.0f / 64.0f,
+		};
+
+		// Quantize an endpoint to 7 bits per channel, choosing whichever low bit fits it better
+		static void QuantizeBC7Endpoint(const float * endpoint, int * quantizedOut, int * pBitOut)
+		{
+			float errorBest = FLT_MAX;
+			for (int pBit = 0; pBit < 2; ++pBit)
+			{
+				int quantized[4];
+				float error = 0.0f;
+				for (int c = 0; c < 4; ++c)
+				{
+					quantized[c] = clamp(int((endpoint[c] - float(pBit)) * 0.5f + 0.5f), 0, 127);
+					error += square(float((quantized[c] << 1) | pBit) - endpoint[c]);
+				}
+				if (error < errorBest)
+				{
+					errorBest = error;
+					memcpy(quantizedOut, quantized, sizeof(quantized));
+					*pBitOut = pBit;
+				}
+			}
+		}
+
+		struct BitWriter
+		{
+			byte *	m_pOut;
+			int		m_bitPos;
+
+			void Write(int value, int numBits)
+			{
+				for (int i = 0; i < numBits; ++i, ++m_bitPos)
+				{
+					if (value & (1 << i))
+						m_pOut[m_bitPos >> 3] |= byte(1 << (m_bitPos & 7));
+				}
+			}
+		};
+
+		static float EncodeBC7Mode6(const Block & block, byte * pOut)
+		{
+			float endpoint0[4], endpoint1[4];
+			FindEndpointsPCA(block, 4, endpoint0, endpoint1);
+
+			// Try the PCA endpoints, then a least-squares refinement of them
+			float errorBest = FLT_MAX;
+			int quantizedBest[2][4] = {};
+			int pBitsBest[2] = {};
+			int indicesBest[16] = {};
+			for (int iPass = 0; iPass < 2; ++iPass)
+			{
+				int quantized[2][4];
+				int pBits[2];
+				QuantizeBC7Endpoint(endpoint0, quantized[0], &pBits[0]);
+				QuantizeBC7Endpoint(endpoint1, quantized[1], &pBits[1]);
+
+				float palette[16][4];
+				for (int c = 0; c < 4; ++c)
+				{
+					int val0 = (quantized[0][c] << 1) | pBits[0];
+					int val1 = (quantized[1][c] << 1) | pBits[1];
+					for (int iEntry = 0; iEntry < 16; ++iEntry)
+					{
+						int weight = s_bc7Weights4[iEntry];
+						palette[iEntry][c] = float(((64 - weight) * val0 + weight * val1 + 32) >> 6);
+					}
+				}
+
+				int indices[16];
+				float error = FitIndices(block, 0, 4, palette, 16, indices);
+				if (error < errorBest)
+				{
+					errorBest = error;
+					memcpy(quantizedBest, quantized, sizeof(quantized));
+					memcpy(pBitsBest, pBits, sizeof(pBits));
+					memcpy(indicesBest, indices, sizeof(indices));
+				}
+
+				if (iPass == 0 && !RefineEndpoints(block, 4, indices, s_bc7WeightsFloat, endpoint0, endpoint1))
+					break;
+			}
+
+			// Make the anchor index's top bit zero
+			if (indicesBest[0] >= 8)
+			{
+				for (int c = 0; c < 4; ++c)
+					std::swap(quantizedBest[0][c], quantizedBest[1][c]);
+				std::swap(pBitsBest[0], pBitsBest[1]);
+				for (int i = 0; i < 16; ++i)
+					indicesBest[i] = 15 - indicesBest[i];
+			}
+
+			memset(pOut, 0, 16);
+			BitWriter writer = { pOut, 0 };
+			writer.Write(1 << 6, 7);			// Mode 6
+			for (int c = 0; c < 4; ++c)
+			{
+				writer.Write(quantizedBest[0][c], 7);
+				writer.Write(quantizedBest[1][c], 7);
+			}
+			writer.Write(pBitsBest[0], 1);
+			writer.Write(pBitsBest[1], 1);
+			writer.Write(indicesBest[0], 3);
+			for (int i = 1; i < 16; ++i)
+				writer.Write(indicesBest[i], 4);
+			ASSERT_ERR(writer.m_bitPos == 128);
+
+			return errorBest;
+		}
+
+		static const int s_bc7Weights2[] = { 0, 21, 43, 64 };
+		static const float s_bc7Weights2Float[] = { 0.0f / 64.0f, 21.0f / 64.0f, 43.0f / 64.0f, 64.0f / 64.0f };
+
+		static float EncodeBC7Mode5(const Block & block, byte * pOut)
+		{
+			// Color: same approach as mode 6, on RGB only
+			float endpoint0[4], endpoint1[4];
+			FindEndpointsPCA(block, 3, endpoint0, endpoint1);
+
+			float errorColorBest = FLT_MAX;
+			int quantizedBest[2][3] = {};
+			int indicesColorBest[16] = {};
+			for (int iPass = 0; iPass < 2; ++iPass)
+			{
+				int quantized[2][3];
+				for (int c = 0; c < 3; ++c)
+				{
+					quantized[0][c] = clamp(int(endpoint0[c] * (127.0f / 255.0f) + 0.5f), 0, 127);
+					quantized[1][c] = clamp(int(endpoint1[c] * (127.0f / 255.0f) + 0.5f), 0, 127);
+				}
+
+				float palette[4][4];
+				for (int c = 0; c < 3; ++c)
+				{
+					int val0 = (quantized[0][c] << 1) | (quantized[0][c] >> 6);
+					int val1 = (quantized[1][c] << 1) | (quantized[1][c] >> 6);
+					for (int iEntry = 0; iEntry < 4; ++iEntry)
+					{
+						int weight = s_bc7Weights2[iEntry];
+						palette[iEntry][c] = float(((64 - weight) * val0 + weight * val1 + 32) >> 6);
+					}
+				}
+
+				int indices[16];
+				float error = FitIndices(block, 0, 3, palette, 4, indices);
+				if (error < errorColorBest)
+				{
+					errorColorBest = error;
+					memcpy(quantizedBest, quantized, sizeof(quantized));
+					memcpy(indicesColorBest, indices, sizeof(indices));
+				}
+
+				if (iPass == 0 && !RefineEndpoints(block, 3, indices, s_bc7Weights2Float, endpoint0, endpoint1))
+					break;
+			}
+
+			// Alpha: endpoints at the min and max
+			int alpha0 = int(block.m_vals[3][0]), alpha1 = alpha0;
+			for (int i = 1; i < 16; ++i)
+			{
+				alpha0 = min(alpha0, int(block.m_vals[3][i]));
+				alpha1 = max(alpha1, int(block.m_vals[3][i]));
+			}
+			float paletteAlpha[4][4];
+			for (int iEntry = 0; iEntry < 4; ++iEntry)
+			{
+				int weight = s_bc7Weights2[iEntry];
+				paletteAlpha[iEntry][0] = float(((64 - weight) * alpha0 + weight * alpha1 + 32) >> 6);
+			}
+			int indicesAlpha[16];
+			float errorAlpha = FitIndices(block, 3, 1, paletteAlpha, 4, indicesAlpha);
+
+			// Make both anchor indices' top bits zero
+			if (indicesColorBest[0] >= 2)
+			{
+				for (int c = 0; c < 3; ++c)
+					std::swap(quantizedBest[0][c], quantizedBest[1][c]);
+				for (int i = 0; i < 16; ++i)
+					indicesColorBest[i] = 3 - indicesColorBest[i];
+			}
+			if (indicesAlpha[0] >= 2)
+			{
+				std::swap(alpha0, alpha1);
+				for (int i = 0; i < 16; ++i)
+					indicesAlpha[i] = 3 - indicesAlpha[i];
+			}
+
+			memset(pOut, 0, 16);
+			BitWriter writer = { pOut, 0 };
+			writer.Write(1 << 5, 6);			// Mode 5
+			writer.Write(0, 2);					// No channel rotation
+			for (int c = 0; c < 3; ++c)
+			{
+				writer.Write(quantizedBest[0][c], 7);
+				writer.Write(quantizedBest[1][c], 7);
+			}
+			writer.Write(alpha0, 8);
+			writer.Write(alpha1, 8);
+			writer.Write(indicesColorBest[0], 1);
+			for (int i = 1; i < 16; ++i)
+				writer.Write(indicesColorBest[i], 2);
+			writer.Write(indicesAlpha[0], 1);
+			for (int i = 1; i < 16; ++i)
+				writer.Write(indicesAlpha[i], 2);
+			ASSERT_ERR(writer.m_bitPos == 128);
+
+			return errorColorBest + errorAlpha;
+		}
+
+		static void EncodeBC7Block(const Block & block, byte * pOut)
+		{
+			float errorMode6 = EncodeBC7Mode6(block, pOut);
+
+			bool opaque = true;
+			for (int i = 0; i < 16; ++i)
+				opaque = opaque && (block.m_vals[3][i] == 255.0f);
+			if (opaque)
+				return;
+
+			byte mode5[16];
+			if (EncodeBC7Mode5(block, mode5) < errorMode6)
+				memcpy(pOut, mode5, sizeof(mode5));
+		}
+
+
+
+		bool EncodeBCn(
+			TEXFMT texfmt,
+			const byte4 * pPixels,
+			int2 dims,
+			std::vector<byte> * pBlocksOut)
+		{
+			ASSERT_ERR(texfmt > TEXFMT_RGBA8 && texfmt < TEXFMT_Count);
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pBlocksOut);
+
+			int blockSize = (texfmt == TEXFMT_BC1 || texfmt == TEXFMT_BC4) ? 8 : 16;
+			int2 dimsBlocks = { (dims.x + 3) / 4, (dims.y + 3) / 4 };
+			pBlocksOut->resize(dimsBlocks.x * dimsBlocks.y * blockSize);
+			byte * pBlocks = &(*pBlocksOut)[0];
+
+			// Encode bands of block rows in parallel.  Small images come out as a single band,
+			// which is just done on this thread.
+			static const int s_blockRowsPerBand = 16;
+			int numBands = (dimsBlocks.y + s_blockRowsPerBand - 1) / s_blockRowsPerBand;
+			return ParallelFor(numBands, 0, [&](int iBand)
+			{
+				int yBlockEnd = min((iBand + 1) * s_blockRowsPerBand, dimsBlocks.y);
+				for (int yBlock = iBand * s_blockRowsPerBand; yBlock < yBlockEnd; ++yBlock)
+				{
+					for (int xBlock = 0; xBlock < dimsBlocks.x; ++xBlock)
+					{
+						Block block;
+						LoadBlock(pPixels, dims, xBlock, yBlock, &block);
+
+						byte * pOut = pBlocks + (yBlock * dimsBlocks.x + xBlock) * blockSize;
+						switch (texfmt)
+						{
+						case TEXFMT_BC1:
+							EncodeBC1Block(block, true, pOut);
+							break;
+						case TEXFMT_BC3:
+							EncodeBC4Block(block, 3, pOut);
+							EncodeBC1Block(block, false, pOut + 8);
+							break;
+						case TEXFMT_BC4:
+							EncodeBC4Block(block, 0, pOut);
+							break;
+						case TEXFMT_BC5:
+							EncodeBC4Block(block, 0, pOut);
+							EncodeBC4Block(block, 1, pOut + 8);
+							break;
+						case TEXFMT_BC7:
+							EncodeBC7Block(block, pOut);
+							break;
+						default:
+							ERR("Missing case for TEXFMT %d", texfmt);
+							return false;
+						}
+					}
+				}
+				return true;
+			});
+		}
+	}
+}
@@ -0,0 +1,296 @@
+#include "framework.h"
+#include "asset-internal.h"
+
+namespace Framework
+{
+	// Content-addressed cache of compiled assets, shared between asset packs (and between
+	// machines, if a cache directory is on a network share).
+	//
+	//  * Entries are keyed by a hash of the asset's source file contents, its asset kind, the
+	//      compiler version and the options that affect it; see ComputeCacheKey.  Meshes and
+	//      material libs refer to other assets by path, so their path goes in the key too;
+	//      textures don't, so identical textures at different paths share an entry.
+	//
+	//  * Each entry is one file, "<cache dir>/<first 2 hex digits>/<16 hex digits>", holding
+	//      the asset's compiled (and compressed) files, plus any extra source files the
+	//      compiler read and their hashes, which must still match for the entry to be used.
+	//
+	//  * Entries are written to a temporary file and renamed into place, so a reader never
+	//      sees a partial entry.  A content hash guards against corruption besides.
+
+	namespace AssetCompiler
+	{
+		static const mz_uint32 s_cacheMagic = 0x48434152;		// "RACH"
+		static const mz_uint32 s_cacheVersion = 1;
+
+		struct CacheHeader
+		{
+			mz_uint32	m_magic;
+			mz_uint32	m_version;
+			mz_uint64	m_key;
+			mz_uint64	m_contentHash;		// Hash of everything after the header
+			int			m_numSources;		// Extra sources, besides the asset's own
+			int			m_numFiles;
+		};
+
+		// Followed by the path, without a terminating zero
+		struct CacheSourceHeader
+		{
+			mz_uint64	m_hash;
+			int			m_pathLength;
+			int			m_padding;
+		};
+
+		// Followed by the suffix (the file's path with the asset path stripped off), then the data
+		struct CacheFileHeader
+		{
+			mz_uint64	m_size;
+			mz_uint64	m_uncompSize;
+			mz_uint32	m_crc;
+			int			m_codec;
+			int			m_suffixLength;
+			int			m_padding;
+		};
+
+		bool ComputeCacheKey(
+			const AssetCompileInfo * pACI,
+			const AssetCompileOptions & options,
+			mz_uint64 * pKeyOut)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pKeyOut);
+
+			mz_uint64 sourceHash;
+			if (!HashFile(pACI->m_pathSrc, &sourceHash))
+				return false;
+
+			mz_uint64 optionsHash = HashAssetOptions(pACI, options);
+
+			Hasher hasher;
+			hasher.Update(&sourceHash, sizeof(sourceHash));
+			hasher.Update(&optionsHash, sizeof(optionsHash));
+			if (pACI->m_ack == ACK_OBJMesh || pACI->m_ack == ACK_OBJMtlLib)
+				hasher.Update(pACI->m_pathSrc, strlen(pACI->m_pathSrc));
+			*pKeyOut = hasher.Digest();
+			return true;
+		}
+
+		static bool FileExists(const char * path)
+		{
+			return (GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES);
+		}
+
+		static std::string CacheEntryPath(const std::string & cacheDir, mz_uint64 key, std::string * pSubdirOut = nullptr)
+		{
+			char keyHex[17];
+			sprintf_s(keyHex, "%016llx", (unsigned long long)key);
+
+			std::string subdir = cacheDir;
+			if (!subdir.empty() && subdir.back() != '/' && subdir.back() != '\\')
+				subdir += '/';
+			subdir.append(keyHex, 2);
+			if (pSubdirOut)
+				*pSubdirOut = subdir;
+
+			return subdir + '/' + keyHex;
+		}
+
+		static bool ParseCacheEntry(
+			const std::vector<byte> & entry,
+			const AssetCompileInfo * pACI,
+			mz_uint64 key,
+			CompiledAsset * pAssetOut)
+		{
+			// Validate the header and contents
+			CacheHeader header;
+			if (entry.size() < sizeof(header))
+				return false;
+			memcpy(&header, &entry[0], sizeof(header));
+			if (header.m_magic != s_cacheMagic ||
+				header.m_version != s_cacheVersion ||
+				header.m_key != key ||
+				header.m_numSources < 0 ||
+				header.m_numFiles < 0 ||
+				header.m_contentHash != HashData(&entry[0] + sizeof(header), entry.size() - sizeof(header)))
+			{
+				return false;
+			}
+
+			size_t offset = sizeof(header);
+
+			// Check the extra sources still match
+			pAssetOut->m_sources.push_back(pACI->m_pathSrc);
+			for (int i = 0; i < header.m_numSources; ++i)
+			{
+				CacheSourceHeader source;
+				if (entry.size() - offset < sizeof(source))
+					return false;
+				memcpy(&source, &entry[offset], sizeof(source));
+				offset += sizeof(source);
+
+				if (source.m_pathLength < 0 || entry.size() - offset < size_t(source.m_pathLength))
+					return false;
+				std::string path((const char *)&entry[offset], source.m_pathLength);
+				offset += source.m_pathLength;
+
+				mz_uint64 hash;
+				if (!FileExists(path.c_str()) || !HashFile(path.c_str(), &hash) || hash != source.m_hash)
+					return false;
+
+				pAssetOut->m_sources.push_back(path);
+			}
+
+			// Read out the files
+			for (int i = 0; i < header.m_numFiles; ++i)
+			{
+				CacheFileHeader file;
+				if (entry.size() - offset < sizeof(file))
+					return false;
+				memcpy(&file, &entry[offset], sizeof(file));
+				offset += sizeof(file);
+
+				if (file.m_suffixLength < 0 ||
+					file.m_codec < 0 || file.m_codec >= CODEC_Count ||
+					entry.size() - offset < size_t(file.m_suffixLength) ||
+					entry.size() - offset - file.m_suffixLength < file.m_size)
+				{
+					return false;
+				}
+
+				pAssetOut->m_files.push_back(CompiledFile());
+				CompiledFile * pFile = &pAssetOut->m_files.back();
+				pFile->m_path = pACI->m_pathSrc;
+				pFile->m_path.append((const char *)&entry[offset], file.m_suffixLength);
+				offset += file.m_suffixLength;
+				pFile->m_data.assign(&entry[offset], &entry[offset] + size_t(file.m_size));
+				offset += size_t(file.m_size);
+				pFile->m_codec = CODEC(file.m_codec);
+				pFile->m_uncompSize = size_t(file.m_uncompSize);
+				pFile->m_crc = file.m_crc;
+			}
+
+			return (offset == entry.size());
+		}
+
+		bool LookupCompileCache(
+			const AssetCompileInfo * pACI,
+			const AssetCompileOptions & options,
+			mz_uint64 key,
+			CompiledAsset * pAssetOut)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pAssetOut);
+
+			for (int iDir = 0, cDir = int(options.m_cacheDirs.size()); iDir < cDir; ++iDir)
+			{
+				std::string entryPath = CacheEntryPath(options.m_cacheDirs[iDir], key);
+				if (!FileExists(entryPath.c_str()))
+					continue;
+
+				std::vector<byte> entry;
+				if (!LoadFile(entryPath.c_str(), &entry))
+					continue;
+
+				if (!ParseCacheEntry(entry, pACI, key, pAssetOut))
+				{
+					// Stale or corrupt; ignore it, and it'll get overwritten if this is the local cache
+					pAssetOut->m_files.clear();
+					pAssetOut->m_sources.clear();
+					continue;
+				}
+
+				// If it came from further down the list, copy it into the first cache dir
+				// so it's quicker to get at next time
+				if (iDir > 0)
+					StoreCompileCache(pACI, options, key, pAssetOut);
+
+				return true;
+			}
+
+			return false;
+		}
+
+		void StoreCompileCache(
+			const AssetCompileInfo * pACI,
+			const AssetCompileOptions & options,
+			mz_uint64 key,
+			const CompiledAsset * pAsset)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pAsset);
+
+			if (options.m_cacheDirs.empty())
+				return;
+
+			// Serialize the entry
+			CacheHeader header = {};
+			header.m_magic = s_cacheMagic;
+			header.m_version = s_cacheVersion;
+			header.m_key = key;
+			header.m_numSources = max(int(pAsset->m_sources.size()) - 1, 0);
+			header.m_numFiles = int(pAsset->m_files.size());
+
+			std::vector<byte> entry(sizeof(header));
+			for (int i = 1, c = int(pAsset->m_sources.size()); i < c; ++i)
+			{
+				const std::string & path = pAsset->m_sources[i];
+
+				CacheSourceHeader source = {};
+				if (!HashFile(path.c_str(), &source.m_hash))
+					return;
+				source.m_pathLength = int(path.size());
+
+				entry.insert(entry.end(), (const byte *)&source, (const byte *)(&source + 1));
+				entry.insert(entry.end(), path.begin(), path.end());
+			}
+
+			size_t assetPathLength = strlen(pACI->m_pathSrc);
+			for (int i = 0, c = int(pAsset->m_files.size()); i < c; ++i)
+			{
+				const CompiledFile * pFile = &pAsset->m_files[i];
+				ASSERT_ERR(pFile->m_path.compare(0, assetPathLength, pACI->m_pathSrc) == 0);
+
+				CacheFileHeader file = {};
+				file.m_size = pFile->m_data.size();
+				file.m_uncompSize = pFile->m_uncompSize;
+				file.m_crc = pFile->m_crc;
+				file.m_codec = pFile->m_codec;
+				file.m_suffixLength = int(pFile->m_path.size() - assetPathLength);
+
+				entry.insert(entry.end(), (const byte *)&file, (const byte *)(&file + 1));
+				entry.insert(entry.end(), pFile->m_path.begin() + assetPathLength, pFile->m_path.end());
+				entry.insert(entry.end(), pFile->m_data.begin(), pFile->m_data.end());
+			}
+
+			header.m_contentHash = HashData(&entry[0] + sizeof(header), entry.size() - sizeof(header));
+			memcpy(&entry[0], &header, sizeof(header));
+
+			// Write it to a temporary file, then move it into place
+			const std::string & cacheDir = options.m_cacheDirs[0];
+			std::string subdir;
+			std::string entryPath = CacheEntryPath(cacheDir, key, &subdir);
+			CreateDirectory(cacheDir.c_str(), nullptr);
+			CreateDirectory(subdir.c_str(), nullptr);
+
+			char tempPath[MAX_PATH];
+			if (GetTempFileName(subdir.c_str(), "tmp", 0, tempPath) == 0)
+			{
+				WARN("Couldn't create temporary file in compile cache %s", subdir.c_str());
+				return;
+			}
+
+			FILE * pFile = nullptr;
+			bool success = (fopen_s(&pFile, tempPath, "wb") == 0 && pFile);
+			if (success)
+			{
+				success = (fwrite(&entry[0], 1, entry.size(), pFile) == entry.size());
+				success = (fclose(pFile) == 0) && success;
+			}
+			if (!success || !MoveFileEx(tempPath, entryPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+			{
+				WARN("Couldn't write compile cache entry %s", entryPath.c_str());
+				DeleteFile(tempPath);
+			}
+		}
+	}
+}
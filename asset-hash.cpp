@@ -0,0 +1,186 @@
+#include "framework.h"
+#include "asset-internal.h"
+
+namespace Framework
+{
+	// 64-bit non-cryptographic hashing, for detecting changes to asset source files.
+	// This is xxHash64 (https://github.com/Cyan4973/xxHash), which runs at several GB/s,
+	// so hashing sources costs little compared to reading them off disk.
+
+	namespace AssetCompiler
+	{
+		static const mz_uint64 s_prime1 = 11400714785074694791ULL;
+		static const mz_uint64 s_prime2 = 14029467366897019727ULL;
+		static const mz_uint64 s_prime3 =  1609587929392839161ULL;
+		static const mz_uint64 s_prime4 =  9650029242287828579ULL;
+		static const mz_uint64 s_prime5 =  2870177450012600261ULL;
+
+		static inline mz_uint64 Rotl(mz_uint64 x, int bits)
+		{
+			return (x << bits) | (x >> (64 - bits));
+		}
+
+		static inline mz_uint64 Read64(const byte * p)
+		{
+			mz_uint64 result;
+			memcpy(&result, p, sizeof(result));
+			return result;
+		}
+
+		static inline mz_uint32 Read32(const byte * p)
+		{
+			mz_uint32 result;
+			memcpy(&result, p, sizeof(result));
+			return result;
+		}
+
+		static inline mz_uint64 Round(mz_uint64 acc, mz_uint64 input)
+		{
+			acc += input * s_prime2;
+			acc = Rotl(acc, 31);
+			return acc * s_prime1;
+		}
+
+		static inline mz_uint64 MergeRound(mz_uint64 acc, mz_uint64 val)
+		{
+			acc ^= Round(0, val);
+			return acc * s_prime1 + s_prime4;
+		}
+
+		// Hasher implementation
+
+		Hasher::Hasher(mz_uint64 seed /* = 0 */)
+		:	m_seed(seed),
+			m_totalSize(0),
+			m_bufferSize(0)
+		{
+			m_acc[0] = seed + s_prime1 + s_prime2;
+			m_acc[1] = seed + s_prime2;
+			m_acc[2] = seed;
+			m_acc[3] = seed - s_prime1;
+		}
+
+		void Hasher::Update(const void * pData, size_t sizeBytes)
+		{
+			ASSERT_ERR(pData || sizeBytes == 0);
+
+			const byte * p = (const byte *)pData;
+			const byte * pEnd = p + sizeBytes;
+			m_totalSize += sizeBytes;
+
+			// Top up a partially filled stripe first
+			if (m_bufferSize > 0)
+			{
+				int bytesToCopy = int(min(size_t(s_stripeSize - m_bufferSize), sizeBytes));
+				memcpy(m_buffer + m_bufferSize, p, bytesToCopy);
+				m_bufferSize += bytesToCopy;
+				p += bytesToCopy;
+				if (m_bufferSize < s_stripeSize)
+					return;
+
+				for (int i = 0; i < 4; ++i)
+					m_acc[i] = Round(m_acc[i], Read64(m_buffer + 8 * i));
+				m_bufferSize = 0;
+			}
+
+			// Then go through whole stripes straight from the input
+			for (; pEnd - p >= s_stripeSize; p += s_stripeSize)
+			{
+				for (int i = 0; i < 4; ++i)
+					m_acc[i] = Round(m_acc[i], Read64(p + 8 * i));
+			}
+
+			// Keep the leftovers for next time
+			m_bufferSize = int(pEnd - p);
+			memcpy(m_buffer, p, m_bufferSize);
+		}
+
+		mz_uint64 Hasher::Digest() const
+		{
+			mz_uint64 h;
+			if (m_totalSize >= s_stripeSize)
+			{
+				h = Rotl(m_acc[0], 1) + Rotl(m_acc[1], 7) + Rotl(m_acc[2], 12) + Rotl(m_acc[3], 18);
+				for (int i = 0; i < 4; ++i)
+					h = MergeRound(h, m_acc[i]);
+			}
+			else
+			{
+				h = m_seed + s_prime5;
+			}
+
+			h += m_totalSize;
+
+			const byte * p = m_buffer;
+			const byte * pEnd = m_buffer + m_bufferSize;
+			for (; pEnd - p >= 8; p += 8)
+			{
+				h ^= Round(0, Read64(p));
+				h = Rotl(h, 27) * s_prime1 + s_prime4;
+			}
+			if (pEnd - p >= 4)
+			{
+				h ^= mz_uint64(Read32(p)) * s_prime1;
+				h = Rotl(h, 23) * s_prime2 + s_prime3;
+				p += 4;
+			}
+			for (; p < pEnd; ++p)
+			{
+				h ^= *p * s_prime5;
+				h = Rotl(h, 11) * s_prime1;
+			}
+
+			// Final avalanche
+			h ^= h >> 33;
+			h *= s_prime2;
+			h ^= h >> 29;
+			h *= s_prime3;
+			h ^= h >> 32;
+
+			return h;
+		}
+
+		mz_uint64 HashData(const void * pData, size_t sizeBytes)
+		{
+			Hasher hasher;
+			hasher.Update(pData, sizeBytes);
+			return hasher.Digest();
+		}
+
+		bool HashFile(const char * path, mz_uint64 * pHashOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pHashOut);
+
+			FILE * pFile = nullptr;
+			if (fopen_s(&pFile, path, "rb") != 0 || !pFile)
+			{
+				WARN("Couldn't open file %s for hashing", path);
+				return false;
+			}
+
+			// Stream the file through in blocks, so big sources don't need to fit in memory
+			static const size_t s_blockSize = 256 * 1024;
+			std::vector<byte> block(s_blockSize);
+			Hasher hasher;
+			for (;;)
+			{
+				size_t bytesRead = fread(&block[0], 1, s_blockSize, pFile);
+				hasher.Update(&block[0], bytesRead);
+				if (bytesRead < s_blockSize)
+					break;
+			}
+
+			bool success = (ferror(pFile) == 0);
+			fclose(pFile);
+			if (!success)
+			{
+				WARN("Couldn't read file %s for hashing", path);
+				return false;
+			}
+
+			*pHashOut = hasher.Digest();
+			return true;
+		}
+	}
+}
@@ -3,6 +3,13 @@
 #define MINIZ_HEADER_FILE_ONLY
 #include "miniz.c"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 namespace Framework
 {
 	// Infrastructure for compiling art source files (such as Wavefront .obj meshes, and
@@ -15,29 +22,65 @@ namespace Framework
 	//      as a directory name in the .zip.  For example, source file "foo/bar/baz.obj" will
 	//      result in a directory "foo/bar/baz.obj/" with files in it for verts, indices, etc.
 	//
-	//  * Compiled data is considered out-of-date and recompiled if the mod time of the source
-	//      file is newer than the mod time of the asset pack (the .zip).
+	//  * Each asset stores a record of the source files it was compiled from, with a content
+	//      hash of each, plus a hash of the compiler version and options that apply to it.
+	//      Compiled data is considered out-of-date and recompiled if any of those change.
+	//      Like git's index, a file next to the pack (not in it, so packs don't depend on
+	//      the machine that compiled them) caches each source's size, mod time and hash, and
+	//      if the size and mod time still match, the file is assumed unchanged without reading it.
 	//
 	//  * Version numbers for the whole pack system and each asset type are also stored in the
 	//      .zip, and mismatches will trigger recompilation.
 	//
-	//  !!!UNDONE: build the list of sources to compile by following dependencies from some root.
+	//  * Each asset kind can have its files compressed, with either zip deflate or our own
+	//      LZ codec (see asset-lz.cpp).  LZ files are stored in the .zip as uncompressed
+	//      entries holding the LZ stream, and marked with a file comment.
+	//
+	//  * Assets are compiled in parallel on a pool of worker threads, each into its own
+	//      in-memory buffer.  The buffers are then written to the .zip one at a time, in the
+	//      order of the asset list, so the pack is byte-identical regardless of thread count.
+	//
+	//  * The .zip also holds a directory of its files sorted by a 64-bit hash of their paths,
+	//      which the pack loads as-is; lookups are a binary search, and can take a precomputed
+	//      hash so that loading lots of assets doesn't build or hash path strings.
+	//
+	//  * Packs switch to Zip64 once they pass 4GB or 64K files, and file sizes and offsets are
+	//      64-bit throughout, so packs of big uncompressed textures are fine.  Each individual
+	//      file is still limited to 4GB (2GB if it's LZ compressed).
+	//
+	//  * Stored files' data is aligned within the pack (64 bytes, or 4KB for big files, by
+	//      default) by padding their local headers' extra field, as Android's zipalign does.
+	//      The mapping is page-aligned, so the data is too when used in-place.
+	//
+	//  * Packs can be mounted as a stack, for patches and DLC, with a merged path-hash directory
+	//      over all of them; each pack stays mapped on its own, and lookups go through to it.
+	//
+	//  * Packs can record the order their files get looked up in, and be laid out again in that
+	//      order, asset by asset, so loading them reads straight through the file.
+	//
+	//  * Updating a pack appends the recompiled assets' files to it, with a new central
+	//      directory, rather than rewriting the whole thing; a journal file rolls back updates
+	//      that get interrupted.  Once enough of the pack is dead space, updates compact it instead.
+	//      Only full compiles and compactions are byte-identical to compiling from scratch.
+	//
+	//  * The list of sources to compile can be built by following references from some root
+	//      assets (see FindAssetDependencies).
 
 	namespace AssetCompiler
 	{
 		enum PACKVER
 		{
-			PACKVER_Current = 3,
+			PACKVER_Current = 6,
 		};
 
 		enum MESHVER
 		{
-			MESHVER_Current = 5,
+			MESHVER_Current = 12,
 		};
 
 		enum MTLVER
 		{
-			MTLVER_Current = 4,
+			MTLVER_Current = 5,
 		};
 
 		enum TEXVER
@@ -53,22 +96,314 @@ namespace Framework
 			TEXVER		m_texver;
 		};
 
+		// A reference from one asset's source file to another's, found by dependency scanning.
+		struct AssetReference
+		{
+			std::string		m_path;			// Resolved relative to the current directory, like m_pathSrc
+			ACK				m_ack;
+			TEXFMT			m_texfmt;
+		};
+
+		// Compiled output for a single asset, buffered in memory until it's written to the pack.
+		struct CompiledFile
+		{
+			std::string			m_path;			// Archive internal path
+			std::vector<byte>	m_data;
+			CODEC				m_codec;		// Compression applied to m_data
+			size_t				m_uncompSize;	// For CODEC_Deflate, zip needs the original size and CRC
+			mz_uint32			m_crc;
+		};
+
+		struct CompiledAsset
+		{
+			std::vector<CompiledFile>	m_files;
+			std::vector<std::string>	m_sources;		// Source files this asset depends on; compilers add
+														// any they read besides the asset's own source
+		};
+
+		// Streaming 64-bit non-cryptographic hash (xxHash64); see asset-hash.cpp
+		class Hasher
+		{
+		public:
+						Hasher(mz_uint64 seed = 0);
+			void		Update(const void * pData, size_t sizeBytes);
+			mz_uint64	Digest() const;
+
+		private:
+			static const int s_stripeSize = 32;
+
+			mz_uint64	m_acc[4];
+			mz_uint64	m_seed;
+			mz_uint64	m_totalSize;
+			byte		m_buffer[s_stripeSize];
+			int			m_bufferSize;
+		};
+
+		mz_uint64 HashData(const void * pData, size_t sizeBytes);
+		bool HashFile(const char * path, mz_uint64 * pHashOut);
+
+		// Hash everything besides the source files that affects how an asset compiles
+		mz_uint64 HashAssetOptions(const AssetCompileInfo * pACI, const AssetCompileOptions & options);
+
+		// Shared compile cache (see asset-cache.cpp)
+		bool ComputeCacheKey(
+			const AssetCompileInfo * pACI,
+			const AssetCompileOptions & options,
+			mz_uint64 * pKeyOut);
+		bool LookupCompileCache(
+			const AssetCompileInfo * pACI,
+			const AssetCompileOptions & options,
+			mz_uint64 key,
+			CompiledAsset * pAssetOut);
+		void StoreCompileCache(
+			const AssetCompileInfo * pACI,
+			const AssetCompileOptions & options,
+			mz_uint64 key,
+			const CompiledAsset * pAsset);
+
+		// Compiles a list of assets on a pool of worker threads.  The caller consumes the results
+		// strictly in list order, which keeps the output deterministic.  Workers are only allowed
+		// to run a bounded distance ahead of the consumer, to cap memory use on big packs.
+		class AssetCompileQueue
+		{
+		public:
+					AssetCompileQueue(
+						const AssetCompileInfo * assets,
+						const int * assetIndices,
+						int numAssetIndices,
+						const AssetCompileOptions & options);
+					~AssetCompileQueue();
+
+			// Block until the i-th asset in the queue is compiled.  Returns false if it failed.
+			// The compiled data stays valid until ReleaseAsset is called for it.
+			bool	WaitForAsset(int i, CompiledAsset ** ppAssetOut);
+
+			// Free the compiled data for the i-th asset.  Must be called in queue order.
+			void	ReleaseAsset(int i);
+
+		private:
+			enum STATE
+			{
+				STATE_Pending,
+				STATE_Compiling,
+				STATE_Succeeded,
+				STATE_Failed,
+			};
+
+			void	WorkerThreadMain();
+			bool	CompileAsset(int i);
+
+			const AssetCompileInfo *	m_assets;
+			AssetCompileOptions			m_options;
+			std::vector<int>			m_assetIndices;
+			std::vector<CompiledAsset>	m_results;
+			std::vector<STATE>			m_states;
+			int							m_iNextToCompile;
+			int							m_iNextToRelease;
+			int							m_maxInFlight;
+			bool						m_quit;
+			std::mutex					m_mutex;
+			std::condition_variable		m_cvWork;			// Signaled when workers may be able to start a job
+			std::condition_variable		m_cvDone;			// Signaled when a job finishes
+			std::vector<std::thread>	m_threads;
+		};
+
+		// Record of the order an asset pack's files were first looked up in (see
+		// AssetPack::StartAccessTrace).
+		struct AccessTrace
+		{
+			std::mutex			m_mutex;
+			std::vector<byte>	m_accessed;			// Per file, whether it's been looked up yet
+			std::vector<int>	m_order;			// Files in the order they were first looked up
+		};
+
+		// A file that has to be decoded into AssetPack::m_data at load time, rather than used
+		// in-place from the archive.
+		struct FileExtract
+		{
+			int				m_iFile;
+			const byte *	m_pLZ;			// LZ stream to decompress, or null to extract through miniz
+			size_t			m_lzSize;
+		};
+
+		// Decoding is split into chunks, so big files can be decompressed on several threads.
+		int GetNumExtractChunks(
+			const FileExtract & extract);
+		bool ExtractFileChunk(
+			mz_zip_archive * pZip,
+			const FileExtract & extract,
+			int iChunk,
+			AssetPack * pPack);
+
+		// Call func(i) for i in [0, count) on up to numThreads threads, including the calling one
+		// (0 = one per logical core).  New threads are only started for cores not already busy
+		// with other ParallelFor calls or compile queue workers, so it's safe to nest; nested
+		// calls mostly just run on the calling thread.  Returns false if any of the calls did.
+		bool ParallelFor(
+			int count,
+			int numThreads,
+			const std::function<bool (int)> & func);
+
+		// Streams an asset pack's data in on a pool of worker threads, an asset at a time.
+		// Compressed files are extracted, and stored files have their pages touched so the
+		// page faults happen in the background instead of on first use.  Assets are processed
+		// in pack order, except that requested ones jump the queue.
+		class AssetStreamer
+		{
+		public:
+					// Takes ownership of the zip reader, which must be reading from memory.
+					AssetStreamer(
+						AssetPack * pPack,
+						mz_zip_archive * pZip,
+						const std::vector<FileExtract> & extracts,
+						int numThreads);
+					~AssetStreamer();
+
+			bool	WaitForFile(int iFile);
+			bool	IsAssetReady(const char * assetPath);
+			void	RequestAsset(const char * assetPath);
+			bool	WaitForAsset(const char * assetPath);
+			bool	WaitForAll();
+
+		private:
+			enum STATE
+			{
+				STATE_Pending,
+				STATE_Loading,
+				STATE_Succeeded,
+				STATE_Failed,
+			};
+
+			struct Job
+			{
+				std::string			m_assetPath;
+				std::vector<int>	m_files;
+				STATE				m_state;
+			};
+
+			void	WorkerThreadMain();
+			bool	LoadJob(int iJob);
+			void	RequestJob(int iJob);		// Caller must hold m_mutex
+			bool	WaitForJob(int iJob);
+
+			AssetPack *								m_pPack;
+			mz_zip_archive							m_zip;
+			std::vector<FileExtract>				m_extracts;
+			std::vector<int>						m_extractForFile;	// -1 for files used in-place
+			std::vector<int>						m_jobForFile;		// -1 for files that are already loaded
+			std::vector<Job>						m_jobs;
+			std::unordered_map<std::string, int>	m_jobForAsset;
+			std::deque<int>							m_jobsRequested;
+			int										m_iNextBackgroundJob;
+			int										m_numJobsDone;
+			int										m_numJobsFailed;
+			bool									m_quit;
+			std::mutex								m_mutex;
+			std::condition_variable					m_cvDone;			// Signaled when a job finishes
+			std::vector<std::thread>				m_threads;
+		};
+
 		// Load an asset pack file from a zip stream (can be in memory or a file).
+		// If pArchive is non-null, it must be the whole archive in memory, outliving the pack;
+		// stored files are then pointed at in-place rather than being copied out.
+		// If pExtractsDeferredOut is non-null, only the pack-level files (version and manifest)
+		// are extracted, and the other files that need extracting are returned for streaming.
 		bool LoadAssetPackFromZip(
 			mz_zip_archive * pZip,
-			AssetPack * pPackOut);
+			byte * pArchive,
+			AssetPack * pPackOut,
+			std::vector<FileExtract> * pExtractsDeferredOut = nullptr);
+
+		// LZ codec; see asset-lz.cpp
+		bool LZCompress(
+			const void * pData,
+			size_t sizeBytes,
+			std::vector<byte> * pCompressedOut);
+		bool LZReadHeader(
+			const byte * pCompressed,
+			size_t compressedSize,
+			int * pSizeOut,
+			int * pNumChunksOut);
+		bool LZDecompressChunk(
+			const byte * pCompressed,
+			size_t compressedSize,
+			int iChunk,
+			byte * pDataOut,
+			int dataSize);
+
+		// Block-compress an image to one of the BCn formats (see asset-bcn.cpp).
+		// The image needn't be a multiple of 4 pixels in size; edge blocks repeat the last
+		// row or column.  Big images are encoded on several threads.
+		bool EncodeBCn(
+			TEXFMT texfmt,
+			const byte4 * pPixels,
+			int2 dims,
+			std::vector<byte> * pBlocksOut);
+
+		// What about a material affects how draws using it get batched; the mesh compiler reads
+		// this from an OBJ's material libs to put its material ranges in order (see asset-mtl.cpp)
+		struct MtlDrawInfo
+		{
+			std::string		m_mtlName;
+			std::string		m_textures;		// The material's texture paths, concatenated
+			bool			m_alphaTest;
+		};
+		bool ReadMtlDrawInfo(const char * path, std::vector<MtlDrawInfo> * pInfosOut);
 
 		// Check that filenames are printable-ASCII-only, lowercase, and there are no backslashes
 		// (this should really be generalized to allow UTF-8 printable chars)
 		bool CheckPathChars(const char * path);
 
+		// Directory of a pack's files by path hash, sorted, so loading a pack doesn't need to hash
+		// or sort anything.  It's built up as files are written, and written to the pack last.
+		struct PathHashEntry
+		{
+			mz_uint64		m_pathHash;		// HashAssetPath of the file's internal path
+			mz_uint32		m_iFile;		// Index of the file in the .zip
+			mz_uint32		m_padding;
+		};
+
+		struct PathHashDirectory
+		{
+			std::vector<PathHashEntry>	m_entries;
+			int							m_numFilesBefore;	// Files that will come ahead of the zip writer's own
+															// in the pack (when appending to one)
+
+					PathHashDirectory();
+			void	AddFile(mz_uint64 pathHash, const mz_zip_archive * pZip);		// Call right after adding it
+		};
+
+		// Sort the directory and write it out to an asset pack .zip file.
+		bool WritePathHashDirectoryToZip(
+			PathHashDirectory * pDirectory,
+			const AssetCompileOptions & options,
+			mz_zip_archive * pZipOut);
+
 		// Write a memory buffer out to an asset pack .zip file.
 		bool WriteAssetDataToZip(
 			const char * assetPath,
 			const char * assetSuffix,
 			const void * pData,
 			size_t sizeBytes,
-			mz_zip_archive * pZipOut);
+			const AssetCompileOptions & options,
+			mz_zip_archive * pZipOut,
+			PathHashDirectory * pDirectory);
+
+		// Copy a memory buffer into a compiled asset, to be written to the pack later.
+		bool WriteAssetData(
+			const char * assetPath,
+			const char * assetSuffix,
+			const void * pData,
+			size_t sizeBytes,
+			CompiledAsset * pAssetOut);
+
+		// Write all the files in a compiled asset out to an asset pack .zip file.
+		// Only files stored uncompressed get aligned; the others are decompressed to the heap anyway.
+		bool WriteCompiledAssetToZip(
+			const CompiledAsset * pAsset,
+			const AssetCompileOptions & options,
+			mz_zip_archive * pZipOut,
+			PathHashDirectory * pDirectory);
 
 		// Parse an asset pack manifest (newline-delimited list of names) into a set structure.
 		void ParseManifest(
@@ -81,28 +416,38 @@ namespace Framework
 		bool CompileFullAssetPackToFile(
 			const char * packPath,
 			const AssetCompileInfo * assets,
-			int numAssets);
+			int numAssets,
+			const AssetCompileOptions & options);
 
 		// Compile an entire asset pack from scratch, to a zip stream (can be in memory or a file).
 		bool CompileFullAssetPackToZip(
 			const AssetCompileInfo * assets,
 			int numAssets,
+			const AssetCompileOptions & options,
 			mz_zip_archive * pZipOut);
 
-		// Check if any assets in a pack are out of date by version number or mod time,
-		// returning a list of ones that need updating (as indices into the assets array).
+		// Check if any assets in a pack are out of date by version number, options, or source
+		// file contents, returning a list of ones that need updating (as indices into the assets array).
 		bool FindOutOfDateAssets(
 			const char * packPath,
 			const AssetCompileInfo * assets,
 			int numAssets,
+			const AssetCompileOptions & options,
 			std::vector<int> * pAssetsToUpdateOut);
 
-		// Update an asset pack in-place by recompiling some assets,
-		// preserving any other data already in the pack for others.
+		// Update an asset pack in-place by recompiling some assets, preserving any other data
+		// already in the pack for others.  The new files are appended to the pack along with a
+		// new directory, unless that would leave too much dead space, in which case the pack is
+		// rewritten to compact it.
 		bool UpdateAssetPack(
 			const char * packPath,
 			const AssetCompileInfo * assets,
 			int numAssets,
-			std::vector<int> const & assetsToUpdate);
+			std::vector<int> const & assetsToUpdate,
+			const AssetCompileOptions & options);
+
+		// Roll back an update to an asset pack that was interrupted partway, if there was one.
+		// Returns false only if there was one and it couldn't be rolled back.
+		bool RecoverAssetPack(const char * packPath);
 	}
 }
@@ -0,0 +1,300 @@
+#include "framework.h"
+#include "asset-internal.h"
+
+namespace Framework
+{
+	// A simple byte-oriented LZ77 codec in the style of LZ4, for asset pack files that need to
+	// decompress as fast as possible.  It compresses worse than deflate, but decodes several
+	// times faster, since there's no entropy coding - just literal runs and back-references.
+	//
+	// The data is split into fixed-size chunks that are compressed independently, so a big
+	// file can be decompressed on several threads at once.  Layout:
+	//
+	//   LZHeader
+	//   32-bit chunk end offsets, one per chunk, relative to the start of the chunk data
+	//   compressed chunks, back to back
+	//
+	// Each chunk is a series of sequences.  A sequence is a token byte (high nibble: literal
+	// count, low nibble: match length - s_minMatch), then extra literal count bytes if the
+	// nibble was 15, the literals, a 16-bit little-endian match offset, then extra match length
+	// bytes if the nibble was 15.  Extra length bytes are 255 for "keep going", and the final
+	// one is less than 255.  The last sequence in a chunk has only literals.
+
+	namespace AssetCompiler
+	{
+		static const mz_uint32 s_lzMagic = 0x315a4c52;		// "RLZ1"
+		static const int s_lzChunkSize = 256 * 1024;
+		static const int s_lzMinMatch = 4;
+		static const int s_lzMaxOffset = 65535;
+		static const int s_lzHashBits = 14;
+
+		struct LZHeader
+		{
+			mz_uint32		m_magic;
+			mz_uint32		m_size;				// Decompressed size in bytes
+			mz_uint32		m_chunkSize;		// Decompressed size of every chunk except the last
+			mz_uint32		m_numChunks;
+		};
+
+		static inline mz_uint32 LZRead32(const byte * p)
+		{
+			mz_uint32 result;
+			memcpy(&result, p, sizeof(result));
+			return result;
+		}
+
+		static inline int LZHash(mz_uint32 seq)
+		{
+			return int((seq * 2654435761u) >> (32 - s_lzHashBits));
+		}
+
+		static void LZWriteLength(int length, std::vector<byte> * pOut)
+		{
+			for (; length >= 255; length -= 255)
+				pOut->push_back(255);
+			pOut->push_back(byte(length));
+		}
+
+		static void LZWriteSequence(
+			const byte * pLiterals,
+			int numLiterals,
+			int offset,
+			int matchLength,
+			std::vector<byte> * pOut)
+		{
+			int matchCode = (matchLength > 0) ? matchLength - s_lzMinMatch : 0;
+			pOut->push_back(byte((min(numLiterals, 15) << 4) | min(matchCode, 15)));
+			if (numLiterals >= 15)
+				LZWriteLength(numLiterals - 15, pOut);
+			pOut->insert(pOut->end(), pLiterals, pLiterals + numLiterals);
+
+			if (matchLength > 0)
+			{
+				pOut->push_back(byte(offset & 0xff));
+				pOut->push_back(byte(offset >> 8));
+				if (matchCode >= 15)
+					LZWriteLength(matchCode - 15, pOut);
+			}
+		}
+
+		static void LZCompressChunk(
+			const byte * pSrc,
+			int size,
+			std::vector<int> * pHashTable,
+			std::vector<byte> * pOut)
+		{
+			// Hash table holds the most recent position of each 4-byte sequence
+			std::fill(pHashTable->begin(), pHashTable->end(), -1);
+			int * hashTable = &(*pHashTable)[0];
+
+			int iAnchor = 0;
+			int i = 0;
+			while (i + s_lzMinMatch <= size)
+			{
+				mz_uint32 seq = LZRead32(pSrc + i);
+				int hash = LZHash(seq);
+				int iCandidate = hashTable[hash];
+				hashTable[hash] = i;
+
+				if (iCandidate < 0 ||
+					i - iCandidate > s_lzMaxOffset ||
+					LZRead32(pSrc + iCandidate) != seq)
+				{
+					++i;
+					continue;
+				}
+
+				// Found a match; extend it as far as it goes
+				int matchLength = s_lzMinMatch;
+				while (i + matchLength < size && pSrc[iCandidate + matchLength] == pSrc[i + matchLength])
+					++matchLength;
+
+				LZWriteSequence(pSrc + iAnchor, i - iAnchor, i - iCandidate, matchLength, pOut);
+
+				i += matchLength;
+				iAnchor = i;
+			}
+
+			// Whatever's left over goes out as literals
+			LZWriteSequence(pSrc + iAnchor, size - iAnchor, 0, 0, pOut);
+		}
+
+		bool LZCompress(
+			const void * pData,
+			size_t sizeBytes,
+			std::vector<byte> * pCompressedOut)
+		{
+			ASSERT_ERR(pData);
+			ASSERT_ERR(sizeBytes > 0);
+			ASSERT_ERR(pCompressedOut);
+
+			if (sizeBytes > 0x7fffffff)
+			{
+				WARN("Data is too big for LZ compression (%lld bytes)", i64(sizeBytes));
+				return false;
+			}
+
+			int size = int(sizeBytes);
+			int numChunks = (size + s_lzChunkSize - 1) / s_lzChunkSize;
+
+			LZHeader header = { s_lzMagic, mz_uint32(size), mz_uint32(s_lzChunkSize), mz_uint32(numChunks) };
+			int chunkDataStart = int(sizeof(header) + numChunks * sizeof(mz_uint32));
+
+			pCompressedOut->clear();
+			pCompressedOut->reserve(chunkDataStart + size + size / 255 + 16 * numChunks);
+			pCompressedOut->resize(chunkDataStart);
+			memcpy(&(*pCompressedOut)[0], &header, sizeof(header));
+
+			std::vector<int> hashTable(1 << s_lzHashBits);
+			const byte * pSrc = (const byte *)pData;
+			for (int iChunk = 0; iChunk < numChunks; ++iChunk)
+			{
+				int chunkStart = iChunk * s_lzChunkSize;
+				LZCompressChunk(pSrc + chunkStart, min(s_lzChunkSize, size - chunkStart), &hashTable, pCompressedOut);
+
+				mz_uint32 chunkEnd = mz_uint32(pCompressedOut->size() - chunkDataStart);
+				memcpy(&(*pCompressedOut)[sizeof(header) + iChunk * sizeof(mz_uint32)], &chunkEnd, sizeof(chunkEnd));
+			}
+
+			return true;
+		}
+
+		bool LZReadHeader(
+			const byte * pCompressed,
+			size_t compressedSize,
+			int * pSizeOut,
+			int * pNumChunksOut)
+		{
+			ASSERT_ERR(pCompressed);
+
+			LZHeader header;
+			if (compressedSize < sizeof(header))
+				return false;
+			memcpy(&header, pCompressed, sizeof(header));
+
+			if (header.m_magic != s_lzMagic ||
+				header.m_size == 0 ||
+				header.m_size > 0x7fffffff ||
+				header.m_chunkSize == 0 ||
+				header.m_numChunks != (header.m_size + header.m_chunkSize - 1) / header.m_chunkSize ||
+				compressedSize < sizeof(header) + header.m_numChunks * sizeof(mz_uint32))
+			{
+				return false;
+			}
+
+			if (pSizeOut)
+				*pSizeOut = int(header.m_size);
+			if (pNumChunksOut)
+				*pNumChunksOut = int(header.m_numChunks);
+
+			return true;
+		}
+
+		static bool LZReadLength(const byte ** ppIn, const byte * pInEnd, int * pLength)
+		{
+			for (;;)
+			{
+				if (*ppIn >= pInEnd)
+					return false;
+				byte b = *(*ppIn)++;
+				*pLength += b;
+				if (*pLength > 0x7fffffff - 255)
+					return false;
+				if (b < 255)
+					return true;
+			}
+		}
+
+		bool LZDecompressChunk(
+			const byte * pCompressed,
+			size_t compressedSize,
+			int iChunk,
+			byte * pDataOut,
+			int dataSize)
+		{
+			ASSERT_ERR(pCompressed);
+			ASSERT_ERR(pDataOut);
+
+			LZHeader header;
+			int numChunks;
+			if (!LZReadHeader(pCompressed, compressedSize, nullptr, &numChunks))
+				return false;
+			memcpy(&header, pCompressed, sizeof(header));
+			if (int(header.m_size) != dataSize || iChunk < 0 || iChunk >= numChunks)
+				return false;
+
+			// Find this chunk's compressed data
+			const byte * pChunkEnds = pCompressed + sizeof(header);
+			size_t chunkDataStart = sizeof(header) + numChunks * sizeof(mz_uint32);
+			mz_uint32 chunkBegin = (iChunk > 0) ? LZRead32(pChunkEnds + (iChunk - 1) * sizeof(mz_uint32)) : 0;
+			mz_uint32 chunkEnd = LZRead32(pChunkEnds + iChunk * sizeof(mz_uint32));
+			if (chunkBegin > chunkEnd || chunkDataStart + chunkEnd > compressedSize)
+				return false;
+
+			const byte * pIn = pCompressed + chunkDataStart + chunkBegin;
+			const byte * pInEnd = pCompressed + chunkDataStart + chunkEnd;
+
+			// Find where it decompresses to
+			int outStart = iChunk * int(header.m_chunkSize);
+			byte * pOutBegin = pDataOut + outStart;
+			byte * pOut = pOutBegin;
+			byte * pOutEnd = pDataOut + min(outStart + int(header.m_chunkSize), dataSize);
+
+			for (;;)
+			{
+				if (pIn >= pInEnd)
+					return false;
+				byte token = *pIn++;
+
+				// Copy literals
+				int numLiterals = token >> 4;
+				if (numLiterals == 15 && !LZReadLength(&pIn, pInEnd, &numLiterals))
+					return false;
+				if (numLiterals > pInEnd - pIn || numLiterals > pOutEnd - pOut)
+					return false;
+				memcpy(pOut, pIn, numLiterals);
+				pIn += numLiterals;
+				pOut += numLiterals;
+
+				// The last sequence has no match
+				if (pIn == pInEnd)
+					break;
+
+				// Copy the match
+				if (pInEnd - pIn < 2)
+					return false;
+				int offset = pIn[0] | (pIn[1] << 8);
+				pIn += 2;
+				int matchLength = token & 15;
+				if (matchLength == 15 && !LZReadLength(&pIn, pInEnd, &matchLength))
+					return false;
+				matchLength += s_lzMinMatch;
+				if (offset == 0 || offset > pOut - pOutBegin || matchLength > pOutEnd - pOut)
+					return false;
+
+				const byte * pMatch = pOut - offset;
+				byte * pMatchEnd = pOut + matchLength;
+				if (offset >= 8)
+				{
+					// Whole 8-byte words never read what they write at this distance.  The last
+					// word may run past the match into output that later sequences overwrite, but
+					// not past this chunk, whose end another thread may be writing.
+					while (pOut < pMatchEnd && pOutEnd - pOut >= 8)
+					{
+						memcpy(pOut, pMatch, 8);
+						pOut += 8;
+						pMatch += 8;
+					}
+				}
+
+				// Closer matches repeat the last few bytes, so they have to go a byte at a time,
+				// as does the tail of a match at the end of the chunk
+				while (pOut < pMatchEnd)
+					*pOut++ = *pMatch++;
+				pOut = pMatchEnd;
+			}
+
+			return (pOut == pOutEnd);
+		}
+	}
+}
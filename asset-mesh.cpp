@@ -1,32 +1,53 @@
 #include "framework.h"
 #include "asset-internal.h"
 #include <algorithm>
-#include <deque>
+#include <emmintrin.h>
 
 namespace Framework
 {
 	// Infrastructure for compiling Wavefront .obj files to vertex/index buffers.
-	//  * Currently uses hard-coded Vertex structure.
+	//  * Builds verts in the Vertex struct, then writes them out in the layout selected by
+	//      AssetCompileInfo::m_vtxfmt, e.g. quantized to 16 bytes; the layout is in the metadata.
+	//  * Parses the .obj from a memory mapping, in line-aligned chunks on all cores,
+	//      then stitches the chunks' results together.
 	//  * Creates a single vertex buffer and index buffer, plus a material map that
 	//      identifies which faces get drawn with each material.
 	//  * Groups together all faces with the same material into a contiguous
 	//      range of indices, so they can be drawn with one draw call.
+	//  * Orders the material ranges by a sort key (shader variant, textures, material), read
+	//      from the .mtl libraries, so drawing them in turn changes the least state.
 	//  * Removes degenerate triangles.
-	//  * Deduplicates verts.
-	//  * Generates normals if necessary.
-	//  * !!!UNDONE: Vertex cache optimization.
+	//  * Deduplicates verts, optionally welding near-duplicates, with separate position, normal
+	//      and UV tolerances (AssetCompileInfo::m_weldPosTolerance etc.).
+	//  * Generates normals if necessary, weighted per AssetCompileInfo::m_normalWeight, and
+	//      MikkTSpace-style tangents if VERTEX_TANGENT is on; both on all cores.
+	//  * Sorts triangles for the post-transform vertex cache (Forsyth), or with
+	//      MESHOPT_Overdraw, for the cache and then outside-in to cut overdraw (Tipsify).
+	//  * Sorts verts into the order they're first used, for the pre-transform cache.
+	//  * Writes 16-bit indices when they fit, optionally splitting big meshes into ranges
+	//      that each fit, with a base vertex (AssetCompileInfo::m_splitForIndex16).
+	//  * Optionally generates LODs by quadric edge-collapse simplification, sharing the
+	//      vertex buffer (AssetCompileInfo::m_lodCount).
+	//  * Cuts each material range into clusters of 64-128 triangles, with bounds and a
+	//      backface cone, for culling at runtime.
+	//  * Writes everything as one versioned blob with 16-byte-aligned sections and material
+	//      names in a string table, so loading is just validation and pointer setup.
 
 	namespace OBJMeshCompiler
 	{
-		static const char * s_suffixMeta		= "/meta";
-		static const char * s_suffixVerts		= "/verts";
-		static const char * s_suffixIndices		= "/indices";
-		static const char * s_suffixMtlMap		= "/material_map";
+		static const char * s_suffixMesh		= "/mesh";
 
 		struct MtlRange
 		{
 			std::string		m_mtlName;
 			int				m_indexStart, m_indexCount;
+			int				m_baseVertex;		// Added to the range's indices; nonzero only after SplitForIndex16
+
+			// Index runs of LODs 1 and up, set by GenerateLODs
+			int				m_lodIndexStarts[Mesh::s_maxLods], m_lodIndexCounts[Mesh::s_maxLods];
+
+			// Set by BuildClusters
+			int				m_clusterStart, m_clusterCount;
 		};
 
 		struct Context
@@ -34,33 +55,96 @@ namespace Framework
 			std::vector<Vertex>		m_verts;
 			std::vector<int>		m_indices;
 			std::vector<MtlRange>	m_mtlRanges;
+			std::vector<Mesh::Cluster>	m_clusters;
 			box3					m_bounds;
 			bool					m_hasNormals;
+			std::unordered_map<std::string, uint>	m_sortKeys;		// By material name; see ComputeSortKeys
 		};
 
 		struct Meta
 		{
-			// Later: vertex format info
-
+			VertexFormat	m_vtxFormat;
+			DXGI_FORMAT		m_indexFormat;		// DXGI_FORMAT_R16_UINT or DXGI_FORMAT_R32_UINT
 			box3			m_bounds;
+			int				m_lodCount;
+			float			m_lodErrors[Mesh::s_maxLods];	// Local-space distance from LOD 0's surface
+		};
+
+		// Most verts that 16-bit indices can address
+		static const int s_index16VertLimit = 65536;
+
+		// A compiled mesh is one blob, used in place from the asset pack: a header holding the
+		// Meta and a table of sections, then the sections, each aligned to s_meshBlobAlign
+		// bytes from the start of the blob.  Material names are in a string table, which the
+		// ranges refer to by index.
+		static const mz_uint32 s_meshBlobMagic = 0x48534d52;	// "RMSH"
+		static const int s_meshBlobAlign = 16;
+
+		enum MESHSECTION
+		{
+			MESHSECTION_Verts,
+			MESHSECTION_Indices,
+			MESHSECTION_MtlRanges,			// MeshBlobMtlRange
+			MESHSECTION_Clusters,			// Mesh::Cluster
+			MESHSECTION_StringOffsets,		// int per string, into MESHSECTION_Strings
+			MESHSECTION_Strings,			// Zero-terminated
+
+			MESHSECTION_Count
+		};
+
+		struct MeshSection
+		{
+			int				m_offset;
+			int				m_size;
+		};
+
+		struct MeshBlobHeader
+		{
+			mz_uint32		m_magic;
+			int				m_version;			// MESHVER
+			int				m_size;				// Whole blob, in bytes
+			int				m_vertCount;
+			int				m_indexCount;
+			int				m_mtlRangeCount;
+			int				m_clusterCount;
+			int				m_stringCount;
+			Meta			m_meta;
+			MeshSection		m_sections[MESHSECTION_Count];
+		};
+
+		struct MeshBlobMtlRange
+		{
+			int				m_mtlName;			// Index into the string table; -1 = no material
+			int				m_indexStart, m_indexCount;
+			int				m_baseVertex;
+			int				m_clusterStart, m_clusterCount;
+			int				m_lodIndexStarts[Mesh::s_maxLods], m_lodIndexCounts[Mesh::s_maxLods];
+			uint			m_sortKey;
 		};
 
 		// Prototype various helper functions
 		bool ParseOBJ(const char * path, Context * pCtxOut);
+		bool ParseOBJMtlLibs(const char * path, std::vector<std::string> * pMtlLibsOut);
 		void RemoveDegenerateTriangles(Context * pCtx);
 		void RemoveEmptyMaterialRanges(Context * pCtx);
-		void DeduplicateVerts(Context * pCtx);
-		void CalculateNormals(Context * pCtx);
+		void DeduplicateVerts(Context * pCtx, float weldPosTolerance, float weldNormalTolerance, float weldUVTolerance);
+		void CalculateNormals(Context * pCtx, NORMALWEIGHT normalWeight);
 		void NormalizeNormals(Context * pCtx);
 #if VERTEX_TANGENT
 		void CalculateTangents(Context * pCtx);
 #endif
+		bool ComputeSortKeys(const char * path, Context * pCtx, std::vector<std::string> * pSourcesOut);
 		void SortMaterials(Context * pCtx);
 		void SortTrianglesForVertexCache(Context * pCtx);
+		void SortTrianglesForOverdraw(Context * pCtx);
 		void SortVerticesForMemoryCache(Context * pCtx);
 		float ComputeACMR(const Context * pCtx, int cacheSize = 32);
+		void SplitForIndex16(Context * pCtx);
+		void GenerateLODs(Context * pCtx, int lodCount, float lodRatio, float * lodErrorsOut);
+		void BuildClusters(Context * pCtx, float3 posTolerance);
 
-		void SerializeMaterialMap(Context * pCtx, std::vector<byte> * pDataOut);
+		void EncodeVerts(const Context * pCtx, const VertexFormat & format, std::vector<byte> * pDataOut);
+		void BuildMeshBlob(const Context * pCtx, const Meta & meta, std::vector<byte> * pBlobOut);
 	}
 
 
@@ -69,12 +153,12 @@ namespace Framework
 
 	bool CompileOBJMeshAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut)
+		AssetCompiler::CompiledAsset * pAssetOut)
 	{
 		ASSERT_ERR(pACI);
 		ASSERT_ERR(pACI->m_pathSrc);
 		ASSERT_ERR(pACI->m_ack == ACK_OBJMesh);
-		ASSERT_ERR(pZipOut);
+		ASSERT_ERR(pAssetOut);
 
 		using namespace AssetCompiler;
 		using namespace OBJMeshCompiler;
@@ -84,42 +168,98 @@ namespace Framework
 		if (!ParseOBJ(pACI->m_pathSrc, &ctx))
 			return false;
 
-		// Clean up the mesh
+		// Clean up the mesh, with the material ranges in draw order
+		if (!ComputeSortKeys(pACI->m_pathSrc, &ctx, &pAssetOut->m_sources))
+			return false;
 		SortMaterials(&ctx);
 		RemoveDegenerateTriangles(&ctx);
 		RemoveEmptyMaterialRanges(&ctx);
-		DeduplicateVerts(&ctx);
+		DeduplicateVerts(&ctx, pACI->m_weldPosTolerance, pACI->m_weldNormalTolerance, pACI->m_weldUVTolerance);
 		if (!ctx.m_hasNormals)
-			CalculateNormals(&ctx);
+			CalculateNormals(&ctx, pACI->m_normalWeight);
 		NormalizeNormals(&ctx);
 #if VERTEX_TANGENT
 		CalculateTangents(&ctx);
 #endif
-		SortTrianglesForVertexCache(&ctx);
+
+		// Optimize the triangle order, and log how the vertex cache fares before and after
+		float acmrBefore = ComputeACMR(&ctx);
+		if (pACI->m_meshopt == MESHOPT_Overdraw)
+			SortTrianglesForOverdraw(&ctx);
+		else
+			SortTrianglesForVertexCache(&ctx);
+		LOG("%s ACMR: %0.3f -> %0.3f", pACI->m_pathSrc, acmrBefore, ComputeACMR(&ctx));
+
 		SortVerticesForMemoryCache(&ctx);
 
-#if 0
-		// This can take awhile on a big mesh, so it's commented out by default
-		LOG("%s ACMR: %0.2f", pACI->m_pathSrc, ComputeACMR(&ctx));
-#endif
+		// Use 16-bit indices if they fit, or if asked to, split the mesh so they do
+		if (int(ctx.m_verts.size()) > s_index16VertLimit && pACI->m_splitForIndex16)
+			SplitForIndex16(&ctx);
+
+		// Simplify LODs, sharing the verts; their indices go after LOD 0's
+		int lodCount = clamp(pACI->m_lodCount, 1, int(Mesh::s_maxLods));
+		float lodErrors[Mesh::s_maxLods] = {};
+		if (lodCount > 1)
+			GenerateLODs(&ctx, lodCount, (pACI->m_lodRatio > 0.0f) ? pACI->m_lodRatio : 0.5f, lodErrors);
+		bool index16 = true;
+		for (int i = 0, c = int(ctx.m_mtlRanges.size()); i < c; ++i)
+		{
+			const MtlRange & range = ctx.m_mtlRanges[i];
+			if (int(ctx.m_verts.size()) - range.m_baseVertex > s_index16VertLimit)
+			{
+				// Indices are relative to the base vertex, so they can only be too big if
+				// there are enough verts past it; check them
+				for (int j = range.m_indexStart, cEnd = j + range.m_indexCount; j < cEnd && index16; ++j)
+					index16 = (ctx.m_indices[j] < s_index16VertLimit);
+			}
+		}
 
 		// Fill out the metadata struct
-		Meta meta =
-		{
-			ctx.m_bounds,
-		};
+		Meta meta = {};
+		InitVertexFormat(pACI->m_vtxfmt, ctx.m_bounds, &meta.m_vtxFormat);
+		meta.m_indexFormat = index16 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+		meta.m_bounds = ctx.m_bounds;
+		meta.m_lodCount = lodCount;
+		memcpy(meta.m_lodErrors, lodErrors, sizeof(lodErrors));
 
-		// Write the data out to the archive
+		// Build clusters for culling, padding their bounds by how far quantization can move verts
+		float3 posTolerance = (pACI->m_vtxfmt == VTXFMT_Quantized) ? meta.m_vtxFormat.m_posScale * (0.5f / 65535.0f) : float3(0.0f);
+		BuildClusters(&ctx, posTolerance);
 
-		std::vector<byte> serializedMaterialMap;
-		SerializeMaterialMap(&ctx, &serializedMaterialMap);
+		// Write the data out to the archive, as a single blob
 
-		if (!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pZipOut) ||
-			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixVerts, &ctx.m_verts[0], ctx.m_verts.size() * sizeof(Vertex), pZipOut) ||
-			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixIndices, &ctx.m_indices[0], ctx.m_indices.size() * sizeof(int), pZipOut) ||
-			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMtlMap, &serializedMaterialMap[0], serializedMaterialMap.size(), pZipOut))
-		{
+		std::vector<byte> blob;
+		BuildMeshBlob(&ctx, meta, &blob);
+
+		return WriteAssetData(pACI->m_pathSrc, s_suffixMesh, &blob[0], blob.size(), pAssetOut);
+	}
+
+
+
+	// Dependency scanning entry point
+
+	bool ScanOBJMeshDependencies(
+		const AssetCompileInfo * pACI,
+		std::vector<AssetCompiler::AssetReference> * pRefsOut)
+	{
+		ASSERT_ERR(pACI);
+		ASSERT_ERR(pACI->m_pathSrc);
+		ASSERT_ERR(pACI->m_ack == ACK_OBJMesh);
+		ASSERT_ERR(pRefsOut);
+
+		using namespace AssetCompiler;
+		using namespace OBJMeshCompiler;
+
+		std::vector<std::string> mtlLibs;
+		if (!ParseOBJMtlLibs(pACI->m_pathSrc, &mtlLibs))
 			return false;
+
+		// Material libs are relative to the OBJ file
+		std::string dirBase = findDirectory(pACI->m_pathSrc);
+		for (int i = 0, c = int(mtlLibs.size()); i < c; ++i)
+		{
+			AssetReference ref = { dirBase + mtlLibs[i], ACK_OBJMtlLib, TEXFMT_RGBA8 };
+			pRefsOut->push_back(ref);
 		}
 
 		return true;
@@ -129,150 +269,505 @@ namespace Framework
 
 	namespace OBJMeshCompiler
 	{
-		bool ParseOBJ(const char * path, Context * pCtxOut)
+		// Memory-mapped, read-only view of a whole source file
+		struct MappedFile
+		{
+			HANDLE			m_hFile;
+			HANDLE			m_hMapping;
+			const char *	m_pData;
+			size_t			m_size;
+		};
+
+		static void UnmapFile(MappedFile * pFile)
+		{
+			ASSERT_ERR(pFile);
+
+			if (pFile->m_pData)
+				UnmapViewOfFile(pFile->m_pData);
+			if (pFile->m_hMapping)
+				CloseHandle(pFile->m_hMapping);
+			if (pFile->m_hFile != INVALID_HANDLE_VALUE)
+				CloseHandle(pFile->m_hFile);
+			pFile->m_hFile = INVALID_HANDLE_VALUE;
+			pFile->m_hMapping = nullptr;
+			pFile->m_pData = nullptr;
+			pFile->m_size = 0;
+		}
+
+		static bool MapFile(const char * path, MappedFile * pFileOut)
 		{
 			ASSERT_ERR(path);
-			ASSERT_ERR(pCtxOut);
+			ASSERT_ERR(pFileOut);
+
+			pFileOut->m_hMapping = nullptr;
+			pFileOut->m_pData = nullptr;
+			pFileOut->m_size = 0;
+
+			pFileOut->m_hFile = CreateFile(
+									path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+									OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (pFileOut->m_hFile == INVALID_HANDLE_VALUE)
+			{
+				WARN("Couldn't open file %s", path);
+				return false;
+			}
 
-			// Read the whole file into memory
-			std::vector<byte> data;
-			if (!LoadFile(path, &data, LFK_Text))
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(pFileOut->m_hFile, &fileSize))
+			{
+				WARN("Couldn't get size of file %s", path);
+				UnmapFile(pFileOut);
 				return false;
+			}
 
-			std::vector<float3> positions;
-			std::vector<float3> normals;
-			std::vector<float2> uvs;
+			// Empty files can't be mapped, but there's nothing to map anyway
+			if (fileSize.QuadPart == 0)
+				return true;
+
+			pFileOut->m_hMapping = CreateFileMapping(pFileOut->m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!pFileOut->m_hMapping)
+			{
+				WARN("Couldn't create file mapping for %s; error 0x%08x", path, GetLastError());
+				UnmapFile(pFileOut);
+				return false;
+			}
+
+			pFileOut->m_pData = (const char *)MapViewOfFile(pFileOut->m_hMapping, FILE_MAP_READ, 0, 0, 0);
+			if (!pFileOut->m_pData)
+			{
+				WARN("Couldn't map view of %s; error 0x%08x", path, GetLastError());
+				UnmapFile(pFileOut);
+				return false;
+			}
+
+			pFileOut->m_size = size_t(fileSize.QuadPart);
+			return true;
+		}
+
+		// Text scanning helpers for the OBJ parser.  These work on [p, pEnd) ranges in the
+		// mapped file, which isn't null-terminated and can't be written to.
+
+		static const char * FindLineEnd(const char * p, const char * pEnd)
+		{
+			// Test 16 bytes at a time for a newline, then find exactly where it is
+			__m128i newline = _mm_set1_epi8('\n');
+			for (; pEnd - p >= 16; p += 16)
+			{
+				__m128i chars = _mm_loadu_si128((const __m128i *)p);
+				if (_mm_movemask_epi8(_mm_cmpeq_epi8(chars, newline)) != 0)
+					break;
+			}
+			while (p < pEnd && *p != '\n')
+				++p;
+			return p;
+		}
+
+		static inline bool IsSpace(char c)
+		{
+			return (c == ' ' || c == '\t' || c == '\r');
+		}
+
+		static inline bool IsDigit(char c)
+		{
+			return (c >= '0' && c <= '9');
+		}
+
+		// Skip whitespace; returns false at the end of the line (including at a comment)
+		static inline bool SkipSpaces(const char ** ppCur, const char * pEnd)
+		{
+			const char * p = *ppCur;
+			while (p < pEnd && IsSpace(*p))
+				++p;
+			*ppCur = p;
+			return (p < pEnd && *p != '#');
+		}
+
+		static inline const char * FindTokenEnd(const char * p, const char * pEnd)
+		{
+			while (p < pEnd && !IsSpace(*p))
+				++p;
+			return p;
+		}
+
+		static bool TokenEquals(const char * pToken, const char * pTokenEnd, const char * keyword)
+		{
+			// Case-insensitive, like the rest of the OBJ tooling
+			for (; pToken < pTokenEnd; ++pToken, ++keyword)
+			{
+				char c = *pToken;
+				if (c >= 'A' && c <= 'Z')
+					c += 'a' - 'A';
+				if (c != *keyword)
+					return false;
+			}
+			return (*keyword == 0);
+		}
 
-			struct OBJVertex { int iPos, iNormal, iUv; };
-			std::vector<OBJVertex> OBJverts;
+		static bool ParseInt(const char ** ppCur, const char * pEnd, int * pOut)
+		{
+			const char * p = *ppCur;
+			bool negative = false;
+			if (p < pEnd && (*p == '-' || *p == '+'))
+			{
+				negative = (*p == '-');
+				++p;
+			}
+			if (p >= pEnd || !IsDigit(*p))
+				return false;
+
+			int value = 0;
+			for (; p < pEnd && IsDigit(*p); ++p)
+				value = value * 10 + (*p - '0');
+
+			*pOut = negative ? -value : value;
+			*ppCur = p;
+			return true;
+		}
+
+		// Decimal float parsing.  The common case, up to 17 significant digits and a small
+		// exponent, converts exactly to double with one multiply or divide (Clinger's fast
+		// path); anything else goes through strtod.  Either way the result matches
+		// float(atof(token)).
+		static const double s_powersOf10[] =
+		{
+			1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+		};
+
+		static bool ParseFloatSlow(const char ** ppCur, const char * pEnd, float * pOut)
+		{
+			char buffer[64];
+			const char * pTokenEnd = FindTokenEnd(*ppCur, pEnd);
+			size_t length = pTokenEnd - *ppCur;
+			if (length == 0 || length >= sizeof(buffer))
+				return false;
+			memcpy(buffer, *ppCur, length);
+			buffer[length] = 0;
+
+			char * pParseEnd = nullptr;
+			double value = strtod(buffer, &pParseEnd);
+			if (pParseEnd == buffer)
+				return false;
 
-			struct OBJFace { int iVertStart, iVertEnd, iIdxStart; };
-			std::vector<OBJFace> OBJfaces;
+			*pOut = float(value);
+			*ppCur += pParseEnd - buffer;
+			return true;
+		}
 
-			struct OBJMtlRange { std::string mtlName; int iFaceStart, iFaceEnd; };
-			std::vector<OBJMtlRange> OBJMtlRanges;
-			OBJMtlRange initialRange = { std::string(), 0, 0, };
-			OBJMtlRanges.push_back(initialRange);
+		static bool ParseFloat(const char ** ppCur, const char * pEnd, float * pOut)
+		{
+			const char * p = *ppCur;
+			bool negative = false;
+			if (p < pEnd && (*p == '-' || *p == '+'))
+			{
+				negative = (*p == '-');
+				++p;
+			}
 
-			// Parse line-by-line
-			TextParsingHelper tph((char *)&data[0], path);
-			while (tph.NextLine())
+			// Gather up to 17 significant digits; any more only affect the exponent
+			static const mz_uint64 s_maxMantissa = 10000000000000000ULL;
+			mz_uint64 mantissa = 0;
+			int exponent = 0;
+			bool anyDigits = false;
+			for (; p < pEnd && IsDigit(*p); ++p)
+			{
+				if (mantissa < s_maxMantissa)
+					mantissa = mantissa * 10 + (*p - '0');
+				else
+					++exponent;
+				anyDigits = true;
+			}
+			if (p < pEnd && *p == '.')
 			{
-				char * pToken = tph.NextToken();
-				if (_stricmp(pToken, "v") == 0)
+				for (++p; p < pEnd && IsDigit(*p); ++p)
 				{
-					char * tokens[3] = {};
-					tph.ExpectTokens(tokens, dim(tokens), "vertex position");
-					tph.ExpectEOL();
+					if (mantissa < s_maxMantissa)
+					{
+						mantissa = mantissa * 10 + (*p - '0');
+						--exponent;
+					}
+					anyDigits = true;
+				}
+			}
+			if (!anyDigits)
+				return ParseFloatSlow(ppCur, pEnd, pOut);
 
-					// Add vertex
-					float3 pos;
-					pos.x = float(atof(tokens[0]));
-					pos.y = float(atof(tokens[1]));
-					pos.z = float(atof(tokens[2]));
-					positions.push_back(pos);
+			if (p < pEnd && (*p == 'e' || *p == 'E'))
+			{
+				const char * pExp = p + 1;
+				int exponentExplicit;
+				if (!ParseInt(&pExp, pEnd, &exponentExplicit))
+					return ParseFloatSlow(ppCur, pEnd, pOut);
+				exponent += exponentExplicit;
+				p = pExp;
+			}
+
+			// Must be followed by a separator, or it's something odd like a hex float
+			if (p < pEnd && !IsSpace(*p) && *p != '#')
+				return ParseFloatSlow(ppCur, pEnd, pOut);
+
+			// Fast path if the mantissa and the power of 10 are both exactly representable
+			if (mantissa > (1ULL << 53) || exponent < -22 || exponent > 22)
+				return ParseFloatSlow(ppCur, pEnd, pOut);
+
+			double value = double(mantissa);
+			if (exponent < 0)
+				value /= s_powersOf10[-exponent];
+			else
+				value *= s_powersOf10[exponent];
+
+			*pOut = float(negative ? -value : value);
+			*ppCur = p;
+			return true;
+		}
+
+		static bool ParseFloats(const char ** ppCur, const char * pEnd, float * pOut, int count)
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				if (!SkipSpaces(ppCur, pEnd) || !ParseFloat(ppCur, pEnd, &pOut[i]))
+					return false;
+			}
+			return true;
+		}
+
+		// Just find the material libraries an OBJ file uses, without parsing the rest of it
+		bool ParseOBJMtlLibs(const char * path, std::vector<std::string> * pMtlLibsOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pMtlLibsOut);
+
+			MappedFile file;
+			if (!MapFile(path, &file))
+				return false;
+
+			// Scan line-by-line
+			int iLine = 0;
+			for (const char * pLine = file.m_pData, * pEndFile = file.m_pData + file.m_size; pLine < pEndFile; )
+			{
+				const char * pEnd = FindLineEnd(pLine, pEndFile);
+				const char * p = pLine;
+				pLine = (pEnd < pEndFile) ? pEnd + 1 : pEnd;
+				++iLine;
+
+				if (!SkipSpaces(&p, pEnd))
+					continue;
+				const char * pToken = p;
+				p = FindTokenEnd(p, pEnd);
+				if (!TokenEquals(pToken, p, "mtllib"))
+					continue;
+
+				if (!SkipSpaces(&p, pEnd))
+				{
+					WARN("%s: syntax error at line %d: expected material library name", path, iLine);
+					continue;
 				}
-				else if (_stricmp(pToken, "vn") == 0)
+
+				// There can be several libraries on one line
+				do
 				{
-					char * tokens[3] = {};
-					tph.ExpectTokens(tokens, dim(tokens), "normal vector");
-					tph.ExpectEOL();
+					const char * pTokenEnd = FindTokenEnd(p, pEnd);
+					std::string mtlLib(p, pTokenEnd);
+					makeLowercase(mtlLib);
+					replaceChars(mtlLib, '\\', '/');
+					pMtlLibsOut->push_back(mtlLib);
+					p = pTokenEnd;
+				}
+				while (SkipSpaces(&p, pEnd));
+			}
+
+			UnmapFile(&file);
+			return true;
+		}
+
+		// OBJ files are parsed in line-aligned chunks, in parallel.  Each chunk gathers its own
+		// lists of positions, face verts, etc., with indices as they appear in the file; then a
+		// prefix sum over the chunks' counts gives each one's offsets into the combined lists,
+		// which resolves relative (negative) indices and lets the chunks write out their verts
+		// and indices in parallel too.
+
+		static const size_t s_objChunkSize = 1024 * 1024;
 
-					// Add normal
+		struct OBJVertex
+		{
+			int		iPos, iUv, iNormal;		// 1-based; 0 = missing
+			int		relativeMask;			// Bits for which of the above are relative to the chunk start
+		};
+
+		struct OBJFace
+		{
+			int		iVertStart, iVertEnd;
+			int		iIdxStart;
+		};
+
+		struct OBJMtlChange
+		{
+			std::string		mtlName;
+			int				iFace;			// First face using the material, within the chunk
+		};
+
+		struct OBJWarning
+		{
+			int				iLine;			// Within the chunk, 1-based
+			const char *	message;
+		};
+
+		struct OBJChunk
+		{
+			const char *				m_pStart;
+			const char *				m_pEnd;
+			int							m_lineCount;
+			int							m_indexCount;
+			std::vector<float3>			m_positions;
+			std::vector<float3>			m_normals;
+			std::vector<float2>			m_uvs;
+			std::vector<OBJVertex>		m_verts;
+			std::vector<OBJFace>		m_faces;
+			std::vector<OBJMtlChange>	m_mtlChanges;
+			std::vector<OBJWarning>		m_warnings;
+
+			// Offsets into the combined lists, filled in after parsing
+			int							m_iLineBase;
+			int							m_iPosBase, m_iNormalBase, m_iUvBase;
+			int							m_iVertBase, m_iIdxBase;
+		};
+
+		static void ParseOBJChunk(OBJChunk * pChunk)
+		{
+			ASSERT_ERR(pChunk);
+
+			const char * pEndChunk = pChunk->m_pEnd;
+			int iLine = 0;
+			for (const char * pLine = pChunk->m_pStart; pLine < pEndChunk; )
+			{
+				const char * pEnd = FindLineEnd(pLine, pEndChunk);
+				const char * p = pLine;
+				pLine = (pEnd < pEndChunk) ? pEnd + 1 : pEnd;
+				++iLine;
+
+				if (!SkipSpaces(&p, pEnd))
+					continue;
+
+				const char * pToken = p;
+				p = FindTokenEnd(p, pEnd);
+
+				if (TokenEquals(pToken, p, "v"))
+				{
+					float3 pos;
+					if (!ParseFloats(&p, pEnd, &pos.x, 3))
+					{
+						OBJWarning warning = { iLine, "expected vertex position" };
+						pChunk->m_warnings.push_back(warning);
+						continue;
+					}
+					pChunk->m_positions.push_back(pos);
+				}
+				else if (TokenEquals(pToken, p, "vn"))
+				{
 					float3 normal;
-					normal.x = float(atof(tokens[0]));
-					normal.y = float(atof(tokens[1]));
-					normal.z = float(atof(tokens[2]));
-					normals.push_back(normal);
+					if (!ParseFloats(&p, pEnd, &normal.x, 3))
+					{
+						OBJWarning warning = { iLine, "expected normal vector" };
+						pChunk->m_warnings.push_back(warning);
+						continue;
+					}
+					pChunk->m_normals.push_back(normal);
 				}
-				else if (_stricmp(pToken, "vt") == 0)
+				else if (TokenEquals(pToken, p, "vt"))
 				{
-					char * tokens[2] = {};
-					tph.ExpectTokens(tokens, dim(tokens), "UVs");
+					float2 uv;
+					if (!ParseFloats(&p, pEnd, &uv.x, 2))
+					{
+						OBJWarning warning = { iLine, "expected UVs" };
+						pChunk->m_warnings.push_back(warning);
+						continue;
+					}
 
 					// OBJ files can have a third texture coordinate, but
-					// currently we just throw it away if it's there
-					(void)tph.NextToken();
-					tph.ExpectEOL();
-
-					// Add UV, flipping V-axis since OBJ UVs use a bottom-up convention
-					float2 uv;
-					uv.x = float(atof(tokens[0]));
-					uv.y = 1.0f - float(atof(tokens[1]));
-					uvs.push_back(uv);
+					// currently we just throw it away if it's there.
+					// Flip V-axis since OBJ UVs use a bottom-up convention.
+					uv.y = 1.0f - uv.y;
+					pChunk->m_uvs.push_back(uv);
 				}
-				else if (_stricmp(pToken, "f") == 0)
+				else if (TokenEquals(pToken, p, "f"))
 				{
-					// Add face
 					OBJFace face = {};
-					face.iVertStart = int(OBJverts.size());
+					face.iVertStart = int(pChunk->m_verts.size());
 
-					while (char * pCtxVert = tph.NextToken())
+					while (SkipSpaces(&p, pEnd))
 					{
-						// Parse vertex specification, with slashes separating position, UV, normal indices
-						// Note that some components may be missing and will be set to zero here
+						// Parse vertex specification, with slashes separating position, UV, normal indices.
+						// Note that some components may be missing and will be set to zero here.
 						OBJVertex vert = {};
-
-						char * pIdx = pCtxVert;
-						while (*pCtxVert && *pCtxVert != '/')
-							++pCtxVert;
-						if (*pCtxVert)
-							*(pCtxVert++) = 0;
-						vert.iPos = atoi(pIdx);
-
-						pIdx = pCtxVert;
-						while (*pCtxVert && *pCtxVert != '/')
-							++pCtxVert;
-						if (*pCtxVert)
-							*(pCtxVert++) = 0;
-						vert.iUv = atoi(pIdx);
-
-						vert.iNormal = atoi(pCtxVert);
+						bool valid = ParseInt(&p, pEnd, &vert.iPos);
+						if (valid && p < pEnd && *p == '/')
+						{
+							++p;
+							if (p < pEnd && *p != '/' && !IsSpace(*p))
+								valid = ParseInt(&p, pEnd, &vert.iUv);
+							if (valid && p < pEnd && *p == '/')
+							{
+								++p;
+								valid = ParseInt(&p, pEnd, &vert.iNormal);
+							}
+						}
+						if (!valid || (p < pEnd && !IsSpace(*p) && *p != '#'))
+						{
+							OBJWarning warning = { iLine, "bad face vertex" };
+							pChunk->m_warnings.push_back(warning);
+							p = FindTokenEnd(p, pEnd);
+							continue;
+						}
 
 						// Handle negative indices - a bizarre OBJ feature that lets you reference
-						// verts by counting backward from the most recent one
+						// verts by counting backward from the most recent one.  For now they're
+						// relative to the start of the chunk; that's fixed up later.
 						if (vert.iPos < 0)
-							vert.iPos += int(positions.size()) + 1;
+						{
+							vert.iPos += int(pChunk->m_positions.size()) + 1;
+							vert.relativeMask |= 1;
+						}
 						if (vert.iUv < 0)
-							vert.iUv += int(uvs.size()) + 1;
+						{
+							vert.iUv += int(pChunk->m_uvs.size()) + 1;
+							vert.relativeMask |= 2;
+						}
 						if (vert.iNormal < 0)
-							vert.iNormal += int(normals.size()) + 1;
+						{
+							vert.iNormal += int(pChunk->m_normals.size()) + 1;
+							vert.relativeMask |= 4;
+						}
 
-						OBJverts.push_back(vert);
+						pChunk->m_verts.push_back(vert);
 					}
 
-					face.iVertEnd = int(OBJverts.size());
+					face.iVertEnd = int(pChunk->m_verts.size());
 
 					if (face.iVertEnd == face.iVertStart)
 					{
-						WARN("%s: syntax error at line %d: missing faces", path, tph.m_iLine);
+						OBJWarning warning = { iLine, "missing faces" };
+						pChunk->m_warnings.push_back(warning);
 						continue;
 					}
 
-					OBJfaces.push_back(face);
+					face.iIdxStart = pChunk->m_indexCount;
+					pChunk->m_indexCount += 3 * max(face.iVertEnd - face.iVertStart - 2, 0);
+					pChunk->m_faces.push_back(face);
 				}
-				else if (_stricmp(pToken, "usemtl") == 0)
+				else if (TokenEquals(pToken, p, "usemtl"))
 				{
-					const char * pMtlName = tph.ExpectOneToken("material name");
-					tph.ExpectEOL();
-					if (!pMtlName)
-						continue;
-
-					// Close the previous range
-					OBJMtlRange * pRange = &OBJMtlRanges.back();
-					pRange->iFaceEnd = int(OBJfaces.size());
-
-					// Start a new range if the previous one was nonempty, else overwrite the previous one
-					if (pRange->iFaceEnd > pRange->iFaceStart)
+					if (!SkipSpaces(&p, pEnd))
 					{
-						OBJMtlRanges.push_back(OBJMtlRange());
-						pRange = &OBJMtlRanges.back();
+						OBJWarning warning = { iLine, "expected material name" };
+						pChunk->m_warnings.push_back(warning);
+						continue;
 					}
 
-					// Start the new range
-					pRange->mtlName = pMtlName;
-					makeLowercase(pRange->mtlName);
-					pRange->iFaceStart = int(OBJfaces.size());
+					OBJMtlChange change;
+					change.mtlName.assign(p, FindTokenEnd(p, pEnd));
+					makeLowercase(change.mtlName);
+					change.iFace = int(pChunk->m_faces.size());
+					pChunk->m_mtlChanges.push_back(change);
 				}
 				else
 				{
@@ -280,60 +775,201 @@ namespace Framework
 				}
 			}
 
-			// Close the last material range
-			OBJMtlRanges.back().iFaceEnd = int(OBJfaces.size());
+			pChunk->m_lineCount = iLine;
+		}
+
+		// Once the chunks' bases are known, resolve their face verts to real vertices
+		// and write out their verts and indices
+		static void ResolveOBJChunk(
+			OBJChunk * pChunk,
+			const std::vector<float3> & positions,
+			const std::vector<float3> & normals,
+			const std::vector<float2> & uvs,
+			Context * pCtx,
+			int * pBadRefCountOut)
+		{
+			ASSERT_ERR(pChunk);
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pBadRefCountOut);
+
+			int cPos = int(positions.size());
+			int cNormal = int(normals.size());
+			int cUv = int(uvs.size());
+			int badRefCount = 0;
 
-			// Convert OBJ verts to vertex buffer
-			pCtxOut->m_verts.reserve(OBJverts.size());
-			for (int iVert = 0, cVert = int(OBJverts.size()); iVert < cVert; ++iVert)
+			Vertex * pVerts = &pCtx->m_verts[pChunk->m_iVertBase];
+			for (int iVert = 0, cVert = int(pChunk->m_verts.size()); iVert < cVert; ++iVert)
 			{
-				OBJVertex objv = OBJverts[iVert];
-				Vertex v = {};
+				OBJVertex objv = pChunk->m_verts[iVert];
+				if (objv.relativeMask & 1)
+					objv.iPos += pChunk->m_iPosBase;
+				if (objv.relativeMask & 2)
+					objv.iUv += pChunk->m_iUvBase;
+				if (objv.relativeMask & 4)
+					objv.iNormal += pChunk->m_iNormalBase;
 
 				// OBJ indices are 1-based; fix that (missing components are zeros)
-				if (objv.iPos > 0)
+				Vertex v = {};
+				if (objv.iPos > 0 && objv.iPos <= cPos)
 					v.m_pos = positions[objv.iPos - 1];
-				if (objv.iNormal > 0)
+				else if (objv.iPos != 0 || objv.relativeMask & 1)
+					++badRefCount;
+				if (objv.iNormal > 0 && objv.iNormal <= cNormal)
 					v.m_normal = normals[objv.iNormal - 1];
-				if (objv.iUv > 0)
+				else if (objv.iNormal != 0 || objv.relativeMask & 4)
+					++badRefCount;
+				if (objv.iUv > 0 && objv.iUv <= cUv)
 					v.m_uv = uvs[objv.iUv - 1];
+				else if (objv.iUv != 0 || objv.relativeMask & 2)
+					++badRefCount;
+
+				pVerts[iVert] = v;
+			}
 
-				pCtxOut->m_verts.push_back(v);
+			// Triangulate the faces
+			int * pIndices = (pChunk->m_indexCount > 0) ? &pCtx->m_indices[pChunk->m_iIdxBase] : nullptr;
+			for (int iFace = 0, cFace = int(pChunk->m_faces.size()); iFace < cFace; ++iFace)
+			{
+				const OBJFace & face = pChunk->m_faces[iFace];
+				int iVertBase = pChunk->m_iVertBase + face.iVertStart;
+				int * pFaceIndices = pIndices + face.iIdxStart;
+				for (int iVert = iVertBase + 2, iVertEnd = pChunk->m_iVertBase + face.iVertEnd; iVert < iVertEnd; ++iVert)
+				{
+					pFaceIndices[0] = iVertBase;
+					pFaceIndices[1] = iVert - 1;
+					pFaceIndices[2] = iVert;
+					pFaceIndices += 3;
+				}
 			}
 
-			// Convert OBJ faces to index buffer
-			for (int iFace = 0, cFace = int(OBJfaces.size()); iFace < cFace; ++iFace)
+			*pBadRefCountOut = badRefCount;
+		}
+
+		bool ParseOBJ(const char * path, Context * pCtxOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pCtxOut);
+
+			MappedFile file;
+			if (!MapFile(path, &file))
+				return false;
+
+			// Split the file into chunks, each ending just after a newline
+			std::vector<OBJChunk> chunks;
+			for (const char * p = file.m_pData, * pEnd = file.m_pData + file.m_size; p < pEnd; )
 			{
-				OBJFace & face = OBJfaces[iFace];
+				const char * pChunkEnd = (size_t(pEnd - p) > s_objChunkSize) ? p + s_objChunkSize : pEnd;
+				pChunkEnd = FindLineEnd(pChunkEnd, pEnd);
+				if (pChunkEnd < pEnd)
+					++pChunkEnd;
+
+				chunks.push_back(OBJChunk());
+				chunks.back().m_pStart = p;
+				chunks.back().m_pEnd = pChunkEnd;
+				chunks.back().m_lineCount = 0;
+				chunks.back().m_indexCount = 0;
+				p = pChunkEnd;
+			}
+			int cChunk = int(chunks.size());
 
-				// Store where the face ended up in the buffer
-				face.iIdxStart = int(pCtxOut->m_indices.size());
+			AssetCompiler::ParallelFor(cChunk, 0, [&](int iChunk)
+			{
+				ParseOBJChunk(&chunks[iChunk]);
+				return true;
+			});
 
-				int iVertBase = face.iVertStart;
+			UnmapFile(&file);
 
-				// Triangulate the face
-				for (int iVert = face.iVertStart + 2; iVert < face.iVertEnd; ++iVert)
+			// Prefix-sum the chunks' counts to find where each goes in the combined lists,
+			// and report any syntax errors now that we know their line numbers
+			int cLine = 0, cPos = 0, cNormal = 0, cUv = 0, cVert = 0, cIdx = 0;
+			for (int iChunk = 0; iChunk < cChunk; ++iChunk)
+			{
+				OBJChunk * pChunk = &chunks[iChunk];
+				pChunk->m_iLineBase = cLine;
+				pChunk->m_iPosBase = cPos;
+				pChunk->m_iNormalBase = cNormal;
+				pChunk->m_iUvBase = cUv;
+				pChunk->m_iVertBase = cVert;
+				pChunk->m_iIdxBase = cIdx;
+
+				cLine += pChunk->m_lineCount;
+				cPos += int(pChunk->m_positions.size());
+				cNormal += int(pChunk->m_normals.size());
+				cUv += int(pChunk->m_uvs.size());
+				cVert += int(pChunk->m_verts.size());
+				cIdx += pChunk->m_indexCount;
+
+				for (int i = 0, c = int(pChunk->m_warnings.size()); i < c; ++i)
 				{
-					pCtxOut->m_indices.push_back(iVertBase);
-					pCtxOut->m_indices.push_back(iVert - 1);
-					pCtxOut->m_indices.push_back(iVert);
+					const OBJWarning & warning = pChunk->m_warnings[i];
+					WARN("%s: syntax error at line %d: %s", path, pChunk->m_iLineBase + warning.iLine, warning.message);
 				}
 			}
 
-			// Add one more OBJface as a sentinel for the next part
-			OBJFace faceSentinel = { 0, 0, int(pCtxOut->m_indices.size()) };
-			OBJfaces.push_back(faceSentinel);
+			if (cPos == 0)
+			{
+				WARN("%s: no vertex positions found", path);
+				return false;
+			}
 
-			// Convert OBJ material ranges (in terms of faces) to ranges in terms of indices
-			for (int iRange = 0, cRange = int(OBJMtlRanges.size()); iRange < cRange; ++iRange)
+			// Gather the positions, normals and UVs into combined lists
+			std::vector<float3> positions(cPos);
+			std::vector<float3> normals(cNormal);
+			std::vector<float2> uvs(cUv);
+			AssetCompiler::ParallelFor(cChunk, 0, [&](int iChunk)
+			{
+				OBJChunk * pChunk = &chunks[iChunk];
+				std::copy(pChunk->m_positions.begin(), pChunk->m_positions.end(), positions.begin() + pChunk->m_iPosBase);
+				std::copy(pChunk->m_normals.begin(), pChunk->m_normals.end(), normals.begin() + pChunk->m_iNormalBase);
+				std::copy(pChunk->m_uvs.begin(), pChunk->m_uvs.end(), uvs.begin() + pChunk->m_iUvBase);
+				return true;
+			});
+
+			// Convert OBJ verts to vertex buffer and faces to index buffer
+			pCtxOut->m_verts.resize(cVert);
+			pCtxOut->m_indices.resize(cIdx);
+			std::vector<int> badRefCounts(cChunk);
+			AssetCompiler::ParallelFor(cChunk, 0, [&](int iChunk)
+			{
+				ResolveOBJChunk(&chunks[iChunk], positions, normals, uvs, pCtxOut, &badRefCounts[iChunk]);
+				return true;
+			});
+
+			int badRefCount = 0;
+			for (int iChunk = 0; iChunk < cChunk; ++iChunk)
+				badRefCount += badRefCounts[iChunk];
+			if (badRefCount > 0)
+				WARN("%s: %d face vertex components refer to nonexistent data; left as zeros", path, badRefCount);
+
+			// Build the material ranges from the chunks' usemtl changes
+			MtlRange rangeCur = { std::string(), 0, 0, };
+			for (int iChunk = 0; iChunk < cChunk; ++iChunk)
 			{
-				OBJMtlRange & objrange = OBJMtlRanges[iRange];
-				int iIdxStart = OBJfaces[objrange.iFaceStart].iIdxStart;
-				int iIdxEnd = OBJfaces[objrange.iFaceEnd].iIdxStart;
-				MtlRange range = { objrange.mtlName, iIdxStart, iIdxEnd - iIdxStart, };
-				pCtxOut->m_mtlRanges.push_back(range);
+				const OBJChunk & chunk = chunks[iChunk];
+				for (int i = 0, c = int(chunk.m_mtlChanges.size()); i < c; ++i)
+				{
+					const OBJMtlChange & change = chunk.m_mtlChanges[i];
+					int iIdx = chunk.m_iIdxBase +
+								((change.iFace < int(chunk.m_faces.size())) ?
+									chunk.m_faces[change.iFace].iIdxStart :
+									chunk.m_indexCount);
+
+					// Close the previous range, keeping it if it's nonempty, else overwriting it
+					rangeCur.m_indexCount = iIdx - rangeCur.m_indexStart;
+					if (rangeCur.m_indexCount > 0)
+						pCtxOut->m_mtlRanges.push_back(rangeCur);
+
+					// Start the new range
+					rangeCur.m_mtlName = change.mtlName;
+					rangeCur.m_indexStart = iIdx;
+				}
 			}
 
+			// Close the last material range
+			rangeCur.m_indexCount = cIdx - rangeCur.m_indexStart;
+			pCtxOut->m_mtlRanges.push_back(rangeCur);
+
 			pCtxOut->m_bounds = boxAround(int(positions.size()), &positions[0]);
 			pCtxOut->m_hasNormals = !normals.empty();
 
@@ -423,45 +1059,82 @@ namespace Framework
 			pCtx->m_mtlRanges.resize(iWrite);
 		}
 
-		void DeduplicateVerts(Context * pCtx)
+		// Key identifying a vertex for deduplication: the raw bits of its components, or with
+		// welding, the grid cell each component falls in.
+		// Note: m_tangent not included because it isn't part of the .obj format,
+		// and hasn't been computed yet at this stage in the compilation process
+		struct VertexKey
 		{
-			ASSERT_ERR(pCtx);
+			mz_uint32	m_bits[8];
+		};
 
-			// Set up a hash table for vertices
+		static inline mz_uint32 VertexKeyComponent(float value, float weldScale)
+		{
+			if (weldScale > 0.0f)
+				value = floorf(value * weldScale + 0.5f);
 
-			struct VertexHasher
-			{
-				std::hash<float> fh;
-				size_t operator () (const Vertex & v) const
-				{
-					return fh(v.m_pos.x) ^ fh(v.m_pos.y) ^ fh(v.m_pos.z) ^
-						   fh(v.m_normal.x) ^ fh(v.m_normal.y) ^ fh(v.m_normal.z) ^
-						   fh(v.m_uv.x) ^ fh(v.m_uv.y);
-					// Note: m_tangent not included because it isn't part of the .obj format,
-					// and hasn't been computed yet at this stage in the compilation process
-				}
-			};
+			// -0 and +0 should match
+			if (value == 0.0f)
+				value = 0.0f;
+
+			mz_uint32 bits;
+			memcpy(&bits, &value, sizeof(bits));
+			return bits;
+		}
+
+		// Scales to quantize each attribute by, for welding; 0 = exact matches only
+		struct WeldScales
+		{
+			float	m_pos;
+			float	m_normal;
+			float	m_uv;
+		};
+
+		static inline void MakeVertexKey(const Vertex & vert, const WeldScales & scales, VertexKey * pKeyOut)
+		{
+			pKeyOut->m_bits[0] = VertexKeyComponent(vert.m_pos.x, scales.m_pos);
+			pKeyOut->m_bits[1] = VertexKeyComponent(vert.m_pos.y, scales.m_pos);
+			pKeyOut->m_bits[2] = VertexKeyComponent(vert.m_pos.z, scales.m_pos);
+			pKeyOut->m_bits[3] = VertexKeyComponent(vert.m_normal.x, scales.m_normal);
+			pKeyOut->m_bits[4] = VertexKeyComponent(vert.m_normal.y, scales.m_normal);
+			pKeyOut->m_bits[5] = VertexKeyComponent(vert.m_normal.z, scales.m_normal);
+			pKeyOut->m_bits[6] = VertexKeyComponent(vert.m_uv.x, scales.m_uv);
+			pKeyOut->m_bits[7] = VertexKeyComponent(vert.m_uv.y, scales.m_uv);
+		}
+
+		void DeduplicateVerts(Context * pCtx, float weldPosTolerance, float weldNormalTolerance, float weldUVTolerance)
+		{
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(weldPosTolerance >= 0.0f);
+			ASSERT_ERR(weldNormalTolerance >= 0.0f);
+			ASSERT_ERR(weldUVTolerance >= 0.0f);
+
+			// Set up a flat, open-addressed hash table of indices into vertsDeduplicated, sized to
+			// a power of two at least twice the vertex count so probe sequences stay short.
+			// With weld tolerances, verts are matched by the grid cell their components quantize
+			// to, so near-duplicates merge; the first vertex seen in each cell is the one kept.
 
-			struct VertexEqualityTester
+			WeldScales weldScales =
 			{
-				bool operator () (const Vertex & u, const Vertex & v) const
-				{
-					return (all(u.m_pos == v.m_pos) &&
-							all(u.m_normal == v.m_normal) &&
-							all(u.m_uv == v.m_uv));
-					// Note: m_tangent not included because it isn't part of the .obj format,
-					// and hasn't been computed yet at this stage in the compilation process
-				}
+				(weldPosTolerance > 0.0f) ? 1.0f / weldPosTolerance : 0.0f,
+				(weldNormalTolerance > 0.0f) ? 1.0f / weldNormalTolerance : 0.0f,
+				(weldUVTolerance > 0.0f) ? 1.0f / weldUVTolerance : 0.0f,
 			};
 
+			int tableSize = 1;
+			while (tableSize < 2 * int(pCtx->m_verts.size()))
+				tableSize *= 2;
+			int tableMask = tableSize - 1;
+
 			std::vector<Vertex> vertsDeduplicated;
+			std::vector<VertexKey> keysDeduplicated;
 			std::vector<int> remappingTable;
-			std::unordered_map<Vertex, int, VertexHasher, VertexEqualityTester> mapVertToIndex;
+			std::vector<int> table(tableSize, -1);
 			std::vector<int> indicesRemapped;
 
 			vertsDeduplicated.reserve(pCtx->m_verts.size());
+			keysDeduplicated.reserve(pCtx->m_verts.size());
 			remappingTable.resize(pCtx->m_verts.size(), -1);
-			mapVertToIndex.reserve(pCtx->m_verts.size());
 			indicesRemapped.resize(pCtx->m_indices.size());
 
 			// Iterate over indices, so that we automatically skip orphaned vertices
@@ -476,25 +1149,29 @@ namespace Framework
 					continue;
 				}
 
-				// Search the hash table for a match for this vertex
+				// Search the hash table for a match for this vertex, probing linearly
 				const Vertex & vert = pCtx->m_verts[index];
-				auto iter = mapVertToIndex.find(vert);
-				if (iter == mapVertToIndex.end())
+				VertexKey key;
+				MakeVertexKey(vert, weldScales, &key);
+				int iSlot = int(AssetCompiler::HashData(&key, sizeof(key))) & tableMask;
+				while (table[iSlot] >= 0 &&
+					   memcmp(&keysDeduplicated[table[iSlot]], &key, sizeof(key)) != 0)
 				{
-					// Found a new vertex that's not in the table yet
-					int newIndex = int(vertsDeduplicated.size());
-					vertsDeduplicated.push_back(vert);
-					remappingTable[index] = newIndex;
-					mapVertToIndex.insert(std::make_pair(vert, newIndex));
-					indicesRemapped[i] = newIndex;
+					iSlot = (iSlot + 1) & tableMask;
 				}
-				else
+
+				int newIndex = table[iSlot];
+				if (newIndex < 0)
 				{
-					// It's already in the map; re-use the previous index
-					int newIndex = iter->second;
-					remappingTable[index] = newIndex;
-					indicesRemapped[i] = newIndex;
+					// Found a new vertex that's not in the table yet
+					newIndex = int(vertsDeduplicated.size());
+					vertsDeduplicated.push_back(vert);
+					keysDeduplicated.push_back(key);
+					table[iSlot] = newIndex;
 				}
+
+				remappingTable[index] = newIndex;
+				indicesRemapped[i] = newIndex;
 			}
 
 			ASSERT_ERR(vertsDeduplicated.size() <= pCtx->m_verts.size());
@@ -503,126 +1180,383 @@ namespace Framework
 			pCtx->m_indices.swap(indicesRemapped);
 		}
 
-		void CalculateNormals(Context * pCtx)
+		// Build lists of the triangles using each vertex, in CSR form: vertex i's triangles are
+		// (*pTrisOut)[(*pTriStartOut)[i]] up to (*pTriStartOut)[i + 1]
+		static void BuildVertexTriangleLists(
+			const int * indices,
+			int indexCount,
+			int cVert,
+			std::vector<int> * pTriStartOut,
+			std::vector<int> * pTrisOut)
+		{
+			std::vector<int> & triStart = *pTriStartOut;
+			std::vector<int> & tris = *pTrisOut;
+
+			// Count triangles per vertex, and prefix-sum the counts to get the offsets
+			triStart.assign(cVert + 1, 0);
+			for (int i = 0; i < indexCount; ++i)
+				++triStart[indices[i] + 1];
+			for (int i = 0; i < cVert; ++i)
+				triStart[i + 1] += triStart[i];
+
+			// Fill in the triangle lists, using triStart as write cursors and then shifting it back
+			tris.resize(indexCount);
+			for (int i = 0; i < indexCount; ++i)
+				tris[triStart[indices[i]]++] = i / 3;
+			for (int i = cVert; i > 0; --i)
+				triStart[i] = triStart[i - 1];
+			triStart[0] = 0;
+		}
+
+		// Verts or triangles per task, for the normal and tangent kernels
+		static const int s_normalChunkSize = 16384;
+
+		// Angles of a triangle at each of its corners
+		static void CalculateCornerAngles(const float3 facePositions[3], float anglesOut[3])
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				float3 edge0 = facePositions[(i + 1) % 3] - facePositions[i];
+				float3 edge1 = facePositions[(i + 2) % 3] - facePositions[i];
+				float lengthProduct = length(edge0) * length(edge1);
+				anglesOut[i] = (lengthProduct > 0.0f) ? acosf(clamp(dot(edge0, edge1) / lengthProduct, -1.0f, 1.0f)) : 0.0f;
+			}
+		}
+
+		// Which corner of triangle iTri is vertex iVert
+		static inline int FindCorner(const int * indices, int iTri, int iVert)
+		{
+			return (indices[iTri*3] == iVert) ? 0 : (indices[iTri*3 + 1] == iVert) ? 1 : 2;
+		}
+
+		// Face normals and per-corner weights are computed per triangle, then each vertex gathers
+		// from its triangles through a CSR list, so there are no scattered writes to share between
+		// threads, and the sums come out the same however many threads there are.
+		void CalculateNormals(Context * pCtx, NORMALWEIGHT normalWeight)
 		{
 			ASSERT_ERR(pCtx);
 			ASSERT_ERR(pCtx->m_indices.size() % 3 == 0);
+			ASSERT_ERR(normalWeight >= 0 && normalWeight < NORMALWEIGHT_Count);
 
-			// Generate a normal for each triangle, and accumulate onto vertex
-			for (int i = 0, c = int(pCtx->m_indices.size()); i < c; i += 3)
-			{
-				int indices[3] = { pCtx->m_indices[i], pCtx->m_indices[i+1], pCtx->m_indices[i+2] };
+			const int * indices = &pCtx->m_indices[0];
+			int cTri = int(pCtx->m_indices.size()) / 3;
+			int cVert = int(pCtx->m_verts.size());
 
-				// Gather positions for this triangle
-				float3 facePositions[3] =
+			// Generate a unit normal for each triangle, and a weight for each of its corners
+			std::vector<float3> faceNormals(cTri);
+			std::vector<float> cornerWeights(cTri * 3);
+			AssetCompiler::ParallelFor((cTri + s_normalChunkSize - 1) / s_normalChunkSize, 0, [&](int iChunk)
+			{
+				for (int iTri = iChunk * s_normalChunkSize, iTriEnd = min(iTri + s_normalChunkSize, cTri); iTri < iTriEnd; ++iTri)
 				{
-					pCtx->m_verts[indices[0]].m_pos,
-					pCtx->m_verts[indices[1]].m_pos,
-					pCtx->m_verts[indices[2]].m_pos,
-				};
+					// Gather positions for this triangle
+					float3 facePositions[3] =
+					{
+						pCtx->m_verts[indices[iTri*3]].m_pos,
+						pCtx->m_verts[indices[iTri*3 + 1]].m_pos,
+						pCtx->m_verts[indices[iTri*3 + 2]].m_pos,
+					};
 
-				// Calculate edge and normal vectors
-				float3 edge0 = facePositions[1] - facePositions[0];
-				float3 edge1 = facePositions[2] - facePositions[0];
-				float3 normal = normalize(cross(edge0, edge1));
-				ASSERT_WARN(all(isfinite(normal)));
+					// Calculate edge and normal vectors; the cross product's length is twice the area
+					float3 edge0 = facePositions[1] - facePositions[0];
+					float3 edge1 = facePositions[2] - facePositions[0];
+					float3 normal = cross(edge0, edge1);
+					float area = 0.5f * length(normal);
+					ASSERT_WARN(area > 0.0f);
+					faceNormals[iTri] = (area > 0.0f) ? normal * (0.5f / area) : float3(0.0f);
 
-				// Accumulate onto vertices
-				pCtx->m_verts[indices[0]].m_normal += normal;
-				pCtx->m_verts[indices[1]].m_normal += normal;
-				pCtx->m_verts[indices[2]].m_normal += normal;
-			}
+					float * weights = &cornerWeights[iTri*3];
+					switch (normalWeight)
+					{
+					case NORMALWEIGHT_Uniform:	weights[0] = weights[1] = weights[2] = 1.0f;	break;
+					case NORMALWEIGHT_Area:		weights[0] = weights[1] = weights[2] = area;	break;
+					case NORMALWEIGHT_Angle:	CalculateCornerAngles(facePositions, weights);	break;
+					default:
+						ERR("Missing case for NORMALWEIGHT %d", normalWeight);
+						break;
+					}
+				}
+				return true;
+			});
+
+			// Sum up each vertex's weighted face normals
+			std::vector<int> triStart, tris;
+			BuildVertexTriangleLists(indices, int(pCtx->m_indices.size()), cVert, &triStart, &tris);
+			AssetCompiler::ParallelFor((cVert + s_normalChunkSize - 1) / s_normalChunkSize, 0, [&](int iChunk)
+			{
+				for (int iVert = iChunk * s_normalChunkSize, iVertEnd = min(iVert + s_normalChunkSize, cVert); iVert < iVertEnd; ++iVert)
+				{
+					float3 normal(0.0f);
+					for (int j = triStart[iVert], jEnd = triStart[iVert + 1]; j < jEnd; ++j)
+					{
+						int iTri = tris[j];
+						normal += faceNormals[iTri] * cornerWeights[iTri*3 + FindCorner(indices, iTri, iVert)];
+					}
+					pCtx->m_verts[iVert].m_normal = normal;
+				}
+				return true;
+			});
 		}
 
 		void NormalizeNormals(Context * pCtx)
 		{
 			ASSERT_ERR(pCtx);
 
-			// Normalize summed normals
-			for (int i = 0, c = int(pCtx->m_verts.size()); i < c; ++i)
+			// Normalize summed normals.  This is plain scalar code: the normals are strided through
+			// the Vertex structs, so gathering them into SIMD registers would cost more than the
+			// math saves; spreading the chunks across cores is where the speedup comes from.
+			Vertex * verts = &pCtx->m_verts[0];
+			int cVert = int(pCtx->m_verts.size());
+			AssetCompiler::ParallelFor((cVert + s_normalChunkSize - 1) / s_normalChunkSize, 0, [&](int iChunk)
 			{
-				pCtx->m_verts[i].m_normal = normalize(pCtx->m_verts[i].m_normal);
-				ASSERT_WARN(all(isfinite(pCtx->m_verts[i].m_normal)));
-			}
+				for (int iVert = iChunk * s_normalChunkSize, iVertEnd = min(iVert + s_normalChunkSize, cVert); iVert < iVertEnd; ++iVert)
+				{
+					verts[iVert].m_normal = normalize(verts[iVert].m_normal);
+					ASSERT_WARN(all(isfinite(verts[iVert].m_normal)));
+				}
+				return true;
+			});
 		}
 
 #if VERTEX_TANGENT
+		// MikkTSpace-style tangents: each triangle's tangent comes from its UV mapping, and is
+		// flipped where the mapping is mirrored; each vertex then sums its triangles' tangents,
+		// projected perpendicular to its normal and weighted by corner angle.  As in MikkTSpace,
+		// verts where mirrored and unmirrored triangles meet are split, so each side of a mirror
+		// seam gets its own tangent frame, and the bitangent sign records which side it is.
 		void CalculateTangents(Context * pCtx)
 		{
 			ASSERT_ERR(pCtx);
 			ASSERT_ERR(pCtx->m_indices.size() % 3 == 0);
 
-			// Generate a tangent for each triangle, based on triangle's UV mapping,
-			// and accumulate onto vertex
-			for (int i = 0, c = int(pCtx->m_indices.size()); i < c; i += 3)
+			const int * indices = &pCtx->m_indices[0];
+			int cTri = int(pCtx->m_indices.size()) / 3;
+			int cVert = int(pCtx->m_verts.size());
+
+			// Generate a tangent for each triangle, based on triangle's UV mapping.
+			// The weights are signed by whether the mapping is mirrored, and zero if it's degenerate.
+			std::vector<float3> faceTangents(cTri);
+			std::vector<float> cornerWeights(cTri * 3);
+			AssetCompiler::ParallelFor((cTri + s_normalChunkSize - 1) / s_normalChunkSize, 0, [&](int iChunk)
 			{
-				int indices[3] = { pCtx->m_indices[i], pCtx->m_indices[i+1], pCtx->m_indices[i+2] };
+				for (int iTri = iChunk * s_normalChunkSize, iTriEnd = min(iTri + s_normalChunkSize, cTri); iTri < iTriEnd; ++iTri)
+				{
+					const Vertex * faceVerts[3] =
+					{
+						&pCtx->m_verts[indices[iTri*3]],
+						&pCtx->m_verts[indices[iTri*3 + 1]],
+						&pCtx->m_verts[indices[iTri*3 + 2]],
+					};
+					float3 facePositions[3] = { faceVerts[0]->m_pos, faceVerts[1]->m_pos, faceVerts[2]->m_pos };
+
+					// Calculate position and UV space edge vectors
+					float3 edge0 = facePositions[1] - facePositions[0];
+					float3 edge1 = facePositions[2] - facePositions[0];
+					float2 uvEdge0 = faceVerts[1]->m_uv - faceVerts[0]->m_uv;
+					float2 uvEdge1 = faceVerts[2]->m_uv - faceVerts[0]->m_uv;
+
+					// The tangent is the direction of increasing u; solve for it from the edges,
+					// scaled by twice the signed UV area to avoid the division
+					float uvArea = uvEdge0.x * uvEdge1.y - uvEdge1.x * uvEdge0.y;
+					float3 tangent = edge0 * uvEdge1.y - edge1 * uvEdge0.y;
+					faceTangents[iTri] = (uvArea < 0.0f) ? -tangent : tangent;
+
+					float * weights = &cornerWeights[iTri*3];
+					CalculateCornerAngles(facePositions, weights);
+					float sign = (uvArea > 0.0f) ? 1.0f : (uvArea < 0.0f) ? -1.0f : 0.0f;
+					for (int j = 0; j < 3; ++j)
+						weights[j] *= sign;
+				}
+				return true;
+			});
+
+			// Split verts on mirror seams: the mirrored triangles at a vertex that has both kinds
+			// move to a copy of it.  Only the corners of the vertex being split change, so the
+			// triangle lists stay good for the rest of the originals.
+			std::vector<int> triStart, tris;
+			BuildVertexTriangleLists(indices, int(pCtx->m_indices.size()), cVert, &triStart, &tris);
+			for (int iVert = 0; iVert < cVert; ++iVert)
+			{
+				bool hasMirrored = false, hasUnmirrored = false;
+				for (int j = triStart[iVert], jEnd = triStart[iVert + 1]; j < jEnd; ++j)
+				{
+					float weight = cornerWeights[tris[j]*3 + FindCorner(indices, tris[j], iVert)];
+					hasMirrored = hasMirrored || (weight < 0.0f);
+					hasUnmirrored = hasUnmirrored || (weight > 0.0f);
+				}
+				if (!hasMirrored || !hasUnmirrored)
+					continue;
 
-				// Gather positions for this triangle
-				float3 facePositions[3] =
+				int iVertSplit = int(pCtx->m_verts.size());
+				Vertex vert = pCtx->m_verts[iVert];
+				pCtx->m_verts.push_back(vert);
+				for (int j = triStart[iVert], jEnd = triStart[iVert + 1]; j < jEnd; ++j)
 				{
-					pCtx->m_verts[indices[0]].m_pos,
-					pCtx->m_verts[indices[1]].m_pos,
-					pCtx->m_verts[indices[2]].m_pos,
-				};
+					int iCorner = tris[j]*3 + FindCorner(indices, tris[j], iVert);
+					if (cornerWeights[iCorner] < 0.0f)
+						pCtx->m_indices[iCorner] = iVertSplit;
+				}
+			}
+			cVert = int(pCtx->m_verts.size());
 
-				// Calculate edge and normal vectors
-				float3 edge0 = facePositions[1] - facePositions[0];
-				float3 edge1 = facePositions[2] - facePositions[0];
-				float3 normal = cross(edge0, edge1);
+			// Sum up each vertex's tangents; they're all the same handedness now
+			BuildVertexTriangleLists(indices, int(pCtx->m_indices.size()), cVert, &triStart, &tris);
+			AssetCompiler::ParallelFor((cVert + s_normalChunkSize - 1) / s_normalChunkSize, 0, [&](int iChunk)
+			{
+				for (int iVert = iChunk * s_normalChunkSize, iVertEnd = min(iVert + s_normalChunkSize, cVert); iVert < iVertEnd; ++iVert)
+				{
+					Vertex * pVert = &pCtx->m_verts[iVert];
+					float3 tangent = float3(0.0f);
+					bool mirrored = false;
+					for (int j = triStart[iVert], jEnd = triStart[iVert + 1]; j < jEnd; ++j)
+					{
+						int iTri = tris[j];
+						float weight = cornerWeights[iTri*3 + FindCorner(indices, iTri, iVert)];
+						float3 faceTangent = faceTangents[iTri];
+						faceTangent -= pVert->m_normal * dot(pVert->m_normal, faceTangent);
+						float tangentLength = length(faceTangent);
+						if (weight == 0.0f || tangentLength <= 0.0f)
+							continue;
+						tangent += faceTangent * (abs(weight) / tangentLength);
+						mirrored = (weight < 0.0f);
+					}
+
+					if (lengthSquared(tangent) <= 0.0f)
+					{
+						// No usable UV mapping; any direction perpendicular to the normal will do
+						float3 axis = (abs(pVert->m_normal.x) < 0.9f) ? float3(1.0f, 0.0f, 0.0f) : float3(0.0f, 1.0f, 0.0f);
+						tangent = cross(pVert->m_normal, cross(axis, pVert->m_normal));
+					}
+					tangent = normalize(tangent);
+					pVert->m_tangent = float4(tangent.x, tangent.y, tangent.z, mirrored ? -1.0f : 1.0f);
+					ASSERT_WARN(all(isfinite(pVert->m_tangent)));
+				}
+				return true;
+			});
+		}
+#endif // VERTEX_TANGENT
+
+		static uint LookupSortKey(const Context * pCtx, const std::string & mtlName)
+		{
+			auto iter = pCtx->m_sortKeys.find(mtlName);
+			return (iter != pCtx->m_sortKeys.end()) ? iter->second : 0;
+		}
+
+		// Give each material the mesh uses a sort key (see Mesh::s_sortKeyShaderShift), going by
+		// the OBJ's material libs.  The libs get compiled separately too, but as the mesh reads
+		// them here, they're added to its sources so it's recompiled when they change.
+		// Materials that aren't in any lib draw as opaque and untextured.  Fails if there are
+		// more materials or texture sets than the key has bits for, as the runtime tells
+		// where state changes by comparing keys, so they can't be allowed to alias.
+		bool ComputeSortKeys(const char * path, Context * pCtx, std::vector<std::string> * pSourcesOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pSourcesOut);
 
-				// Calculate matrix from unit triangle to position space
-				float3x3 matUnitToPosition = matrixFromRows(edge0, edge1, normal);
+			using AssetCompiler::MtlDrawInfo;
 
-				// Gather UVs for this triangle
-				float2 faceUVs[3] =
+			// Read the material libs, which are relative to the OBJ file
+			std::vector<std::string> mtlLibs;
+			std::vector<MtlDrawInfo> infos;
+			if (ParseOBJMtlLibs(path, &mtlLibs))
+			{
+				std::string dirBase = findDirectory(path);
+				for (int i = 0, c = int(mtlLibs.size()); i < c; ++i)
 				{
-					pCtx->m_verts[indices[0]].m_uv,
-					pCtx->m_verts[indices[1]].m_uv,
-					pCtx->m_verts[indices[2]].m_uv,
-				};
+					std::string pathLib = dirBase + mtlLibs[i];
+					if (GetFileAttributes(pathLib.c_str()) == INVALID_FILE_ATTRIBUTES)
+					{
+						WARN("%s: couldn't find material lib %s; its materials will be drawn unsorted", path, pathLib.c_str());
+						continue;
+					}
+					if (AssetCompiler::ReadMtlDrawInfo(pathLib.c_str(), &infos))
+						pSourcesOut->push_back(pathLib);
+				}
+			}
 
-				// Calculate UV space edge vectors
-				float2 uvEdge0 = faceUVs[1] - faceUVs[0];
-				float2 uvEdge1 = faceUVs[2] - faceUVs[0];
+			// The first definition of a material wins, as at load time
+			std::unordered_map<std::string, const MtlDrawInfo *> infosByName;
+			for (int i = 0, c = int(infos.size()); i < c; ++i)
+				infosByName.insert(std::make_pair(infos[i].m_mtlName, &infos[i]));
+
+			// Gather the materials in use, with their draw info
+			MtlDrawInfo infoDefault = { std::string(), std::string(), false };
+			std::vector<std::pair<std::string, const MtlDrawInfo *>> mtls;
+			std::vector<std::string> textureSets;
+			for (int i = 0, c = int(pCtx->m_mtlRanges.size()); i < c; ++i)
+			{
+				const std::string & mtlName = pCtx->m_mtlRanges[i].m_mtlName;
+				if (pCtx->m_sortKeys.count(mtlName))
+					continue;
+				pCtx->m_sortKeys[mtlName] = 0;
 
-				// Calculate matrix from unit triangle to UV space
-				float3x3 matUnitToUV = float3x3::identity();
-				matUnitToUV[0].xy = uvEdge0;
-				matUnitToUV[1].xy = uvEdge1;
+				auto iter = infosByName.find(mtlName);
+				const MtlDrawInfo * pInfo = (iter != infosByName.end()) ? iter->second : &infoDefault;
+				mtls.push_back(std::make_pair(mtlName, pInfo));
+				textureSets.push_back(pInfo->m_textures);
+			}
 
-				// Calculate matrix from UV space to position space
-				float3x3 matUVToPosition = inverse(matUnitToUV) * matUnitToPosition;
+			// Number the distinct sets of textures
+			std::sort(textureSets.begin(), textureSets.end());
+			textureSets.erase(std::unique(textureSets.begin(), textureSets.end()), textureSets.end());
 
-				// The x-axis of that matrix is the tangent vector
-				float3 tangent = normalize(matUVToPosition[0]);
+			// Order the materials by shader variant, then texture set, then name, and build
+			// keys that sort the same way
+			std::sort(
+				mtls.begin(),
+				mtls.end(),
+				[](const std::pair<std::string, const MtlDrawInfo *> & a, const std::pair<std::string, const MtlDrawInfo *> & b)
+				{
+					if (a.second->m_alphaTest != b.second->m_alphaTest)
+						return b.second->m_alphaTest;
+					if (a.second->m_textures != b.second->m_textures)
+						return a.second->m_textures < b.second->m_textures;
+					return a.first < b.first;
+				});
 
-				// Accumulate onto vertices
-				pCtx->m_verts[indices[0]].m_tangent += tangent;
-				pCtx->m_verts[indices[1]].m_tangent += tangent;
-				pCtx->m_verts[indices[2]].m_tangent += tangent;
+			if (int(textureSets.size()) > int(Mesh::s_sortKeyTexturesMask) + 1)
+			{
+				WARN("%s: uses %d distinct sets of textures; at most %d are supported",
+					path, int(textureSets.size()), int(Mesh::s_sortKeyTexturesMask) + 1);
+				return false;
+			}
+			if (int(mtls.size()) > int(Mesh::s_sortKeyMtlMask) + 1)
+			{
+				WARN("%s: uses %d materials; at most %d are supported",
+					path, int(mtls.size()), int(Mesh::s_sortKeyMtlMask) + 1);
+				return false;
 			}
 
-			// Normalize summed tangents
-			for (int i = 0, c = int(pCtx->m_verts.size()); i < c; ++i)
+			for (int i = 0, c = int(mtls.size()); i < c; ++i)
 			{
-				pCtx->m_verts[i].m_tangent = normalize(pCtx->m_verts[i].m_tangent);
-				ASSERT_WARN(all(isfinite(pCtx->m_verts[i].m_tangent)));
+				const MtlDrawInfo * pInfo = mtls[i].second;
+				uint shaderVariant = pInfo->m_alphaTest ? SHADERVARIANT_AlphaTest : SHADERVARIANT_Opaque;
+				uint textureSet = uint(std::lower_bound(textureSets.begin(), textureSets.end(), pInfo->m_textures) - textureSets.begin());
+				pCtx->m_sortKeys[mtls[i].first] =
+					(shaderVariant << Mesh::s_sortKeyShaderShift) |
+					(textureSet << Mesh::s_sortKeyTexturesShift) |
+					uint(i);
 			}
+
+			return true;
 		}
-#endif // VERTEX_TANGENT
 
 		void SortMaterials(Context * pCtx)
 		{
 			ASSERT_ERR(pCtx);
 
-			// Sort the material ranges by name first, and index second
+			// Sort the material ranges by sort key first, then name, and index last
 			std::sort(
 				pCtx->m_mtlRanges.begin(),
 				pCtx->m_mtlRanges.end(),
-				[](const MtlRange & a, const MtlRange & b)
+				[pCtx](const MtlRange & a, const MtlRange & b)
 				{
-					if (a.m_mtlName != b.m_mtlName)
+					uint keyA = LookupSortKey(pCtx, a.m_mtlName);
+					uint keyB = LookupSortKey(pCtx, b.m_mtlName);
+					if (keyA != keyB)
+						return keyA < keyB;
+					else if (a.m_mtlName != b.m_mtlName)
 						return a.m_mtlName < b.m_mtlName;
 					else
 						return a.m_indexStart < b.m_indexStart;
@@ -685,70 +1619,122 @@ namespace Framework
 			pCtx->m_mtlRanges.swap(mtlRangesMerged);
 		}
 
-		void SortTrianglesForVertexCache(Context * pCtx)
+		// Per-range triangle adjacency shared by the triangle sorters.  Verts are renumbered
+		// densely, in order of first use, so per-vertex working arrays are sized to the range
+		// rather than the whole mesh.
+		struct RangeAdjacency
+		{
+			std::vector<int>	m_localToGlobal;	// Local vertex index -> index into Context::m_verts
+			std::vector<int>	m_indices;			// The range's indices, in local numbering
+			std::vector<int>	m_triStart;			// Per local vertex (plus one), where its triangles start in m_tris
+			std::vector<int>	m_tris;				// Triangles using each vertex, grouped by vertex
+		};
+
+		// pGlobalToLocal is scratch space with an entry per vertex in the mesh, all -1;
+		// it's left that way on return.
+		static void BuildRangeAdjacency(
+			const Context * pCtx,
+			const MtlRange & range,
+			std::vector<int> * pGlobalToLocal,
+			RangeAdjacency * pAdjOut)
 		{
 			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pGlobalToLocal);
+			ASSERT_ERR(pAdjOut);
+			ASSERT_ERR(range.m_indexCount % 3 == 0);
 
-			// Implementation of "Linear-Speed Vertex Cache Optimization" by Tom Forsyth
-			// https://home.comcast.net/~tom_forsyth/papers/fast_vert_cache_opt.html
+			std::vector<int> & globalToLocal = *pGlobalToLocal;
+			const int * indices = &pCtx->m_indices[range.m_indexStart];
 
-			static const int s_cacheSize = 32;
+			// Renumber the verts
+			pAdjOut->m_localToGlobal.clear();
+			pAdjOut->m_indices.resize(range.m_indexCount);
+			for (int i = 0; i < range.m_indexCount; ++i)
+			{
+				int index = indices[i];
+				if (globalToLocal[index] < 0)
+				{
+					globalToLocal[index] = int(pAdjOut->m_localToGlobal.size());
+					pAdjOut->m_localToGlobal.push_back(index);
+				}
+				pAdjOut->m_indices[i] = globalToLocal[index];
+			}
 
-			// Initialize ancillary data that we keep per vertex and per triangle
+			// Put the scratch table back the way we found it
+			for (int i = 0, c = int(pAdjOut->m_localToGlobal.size()); i < c; ++i)
+				globalToLocal[pAdjOut->m_localToGlobal[i]] = -1;
 
-			struct ExtraVertexData
-			{
-				int	cachePosition;
-				float score;
-				int triangles;			// Count of not-yet-sorted triangles using this vertex
-				int iTriStart;			// Index into trianglesByVert where this vertex's triangles start
+			BuildVertexTriangleLists(
+				&pAdjOut->m_indices[0], range.m_indexCount, int(pAdjOut->m_localToGlobal.size()),
+				&pAdjOut->m_triStart, &pAdjOut->m_tris);
+		}
 
-				void RecalcScore()
-				{
-					// Verts with no unsorted triangles remaining are no longer in play
-					if (triangles == 0)
-					{
-						score = -1.0f;
-						return;
-					}
+		// Score tables for Forsyth's algorithm, so the inner loop doesn't have to call powf
+		static const int s_forsythCacheSize = 32;
+		static const int s_forsythMaxValence = 64;		// Verts with more tris than this get their score computed directly
 
-					// Calculate part of score based on cache position
-					float cacheScore;
-					if (cachePosition < 0)
-					{
-						cacheScore = 0.0f;	// Not in the cache: score zero
-					}
-					else if (cachePosition < 3)
+		struct ForsythScoreTables
+		{
+			float	m_cacheScores[s_forsythCacheSize];
+			float	m_valenceScores[s_forsythMaxValence + 1];
+
+			ForsythScoreTables()
+			{
+				for (int i = 0; i < s_forsythCacheSize; ++i)
+				{
+					if (i < 3)
 					{
 						// Fixed score for verts in the latest triangle - disfavors them slightly
 						// relative to other recently-used verts, to avoid excessive strip-ifying
-						cacheScore = 0.75f;
+						m_cacheScores[i] = 0.75f;
 					}
 					else
 					{
-						// Calculate score based on how recently it was used
-						ASSERT_ERR(cachePosition < s_cacheSize);
-						static const float scale = 1.0f / (s_cacheSize - 3);
-						cacheScore = powf(1.0f - (cachePosition - 3) * scale, 1.5f);
+						// Score based on how recently it was used
+						m_cacheScores[i] = powf(1.0f - float(i - 3) / float(s_forsythCacheSize - 3), 1.5f);
 					}
+				}
 
-					// Calculate part of score based on number of triangles that use this vert -
-					// favors verts with only a few triangles left, to favor completing a region of
-					// the mesh before jumping to a new region
-					float valenceScore = 2.0f * powf(float(triangles), -0.5f);
+				// Score based on number of triangles that use this vert - favors verts with only
+				// a few triangles left, to favor completing a region of the mesh before jumping
+				// to a new region
+				m_valenceScores[0] = 0.0f;
+				for (int i = 1; i <= s_forsythMaxValence; ++i)
+					m_valenceScores[i] = 2.0f * powf(float(i), -0.5f);
+			}
+		};
+		static const ForsythScoreTables s_forsythScoreTables;
 
-					score = cacheScore + valenceScore;
-				}
-			};
-			std::vector<ExtraVertexData> extraVertexDatas(pCtx->m_verts.size());
+		static float ForsythVertexScore(int cachePosition, int triangles)
+		{
+			// Verts with no unsorted triangles remaining are no longer in play
+			if (triangles == 0)
+				return -1.0f;
+
+			ASSERT_ERR(cachePosition < s_forsythCacheSize);
+			float cacheScore = (cachePosition < 0) ? 0.0f : s_forsythScoreTables.m_cacheScores[cachePosition];
+			float valenceScore = (triangles <= s_forsythMaxValence) ?
+									s_forsythScoreTables.m_valenceScores[triangles] :
+									2.0f * powf(float(triangles), -0.5f);
+			return cacheScore + valenceScore;
+		}
 
-			struct ExtraTriData
-			{
-				float score;	// Sum of vertex scores, or set to -1 when triangle is sorted
-			};
-			std::vector<ExtraTriData> extraTriDatas;
+		void SortTrianglesForVertexCache(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+
+			// Implementation of "Linear-Speed Vertex Cache Optimization" by Tom Forsyth
+			// https://home.comcast.net/~tom_forsyth/papers/fast_vert_cache_opt.html
+
+			static const int s_cacheSize = s_forsythCacheSize;
 
-			std::vector<int> trianglesByVert;
+			std::vector<int> globalToLocal(pCtx->m_verts.size(), -1);
+			RangeAdjacency adj;
+			std::vector<int> cachePositions;
+			std::vector<int> liveTris;				// Count of not-yet-sorted triangles using each vertex
+			std::vector<float> vertScores;
+			std::vector<float> triScores;			// Sum of vertex scores, or -1 when the triangle is sorted
+			std::vector<int> indicesReordered;
 
 			// Sort each material range's triangles separately
 			for (int iRange = 0, cRange = int(pCtx->m_mtlRanges.size()); iRange < cRange; ++iRange)
@@ -757,116 +1743,76 @@ namespace Framework
 
 				ASSERT_ERR(range.m_indexCount > 0 && range.m_indexCount % 3 == 0);
 
-				memset(&extraVertexDatas[0], 0, sizeof(ExtraVertexData) * extraVertexDatas.size());
-				extraTriDatas.resize(range.m_indexCount / 3);
-				memset(&extraTriDatas[0], 0, sizeof(ExtraTriData) * extraTriDatas.size());
-				trianglesByVert.assign(range.m_indexCount, -1);	// Each triangle is in exactly 3 verts' lists
-
-				// Build table of references from verts to triangles that use them
-
-				// Count triangles per vertex
-				for (int iIdx = range.m_indexStart, iIdxEnd = range.m_indexStart + range.m_indexCount;
-					 iIdx < iIdxEnd; ++iIdx)
+				BuildRangeAdjacency(pCtx, range, &globalToLocal, &adj);
+				int cVert = int(adj.m_localToGlobal.size());
+				int cTri = range.m_indexCount / 3;
+
+				// Calculate initial scores for verts and triangles, and find the best triangle.
+				// As verts' triangles get sorted, they're swapped to the end of the vertex's
+				// list in adj.m_tris, so the first liveTris entries are the unsorted ones.
+				cachePositions.assign(cVert, -1);
+				liveTris.resize(cVert);
+				vertScores.resize(cVert);
+				for (int i = 0; i < cVert; ++i)
 				{
-					++extraVertexDatas[pCtx->m_indices[iIdx]].triangles;
+					liveTris[i] = adj.m_triStart[i + 1] - adj.m_triStart[i];
+					vertScores[i] = ForsythVertexScore(-1, liveTris[i]);
 				}
 
-				// Build list of triangles per vertex, also calculate initial scores for verts
-				// and triangles, and keep track of the best triangle found
-				int trianglesByVertAllocated = 0;
 				int bestTri = -1;
 				float bestTriScore = 0.0f;
-				for (int iIdx = range.m_indexStart, iIdxEnd = range.m_indexStart + range.m_indexCount;
-					 iIdx < iIdxEnd; ++iIdx)
+				triScores.resize(cTri);
+				for (int i = 0; i < cTri; ++i)
 				{
-					ExtraVertexData * pEvd = &extraVertexDatas[pCtx->m_indices[iIdx]];
-					
-					// We reuse cachePosition as the negative index where to store the next triangle
-					// index into the vert's list of triangles.  Negative values indicate the vertex
-					// is not in cache, so this also sets up for the following section.
-					int iTriStore;
-					if (pEvd->cachePosition < 0)
-					{
-						// Find where to add the current triangle to the list
-						iTriStore = pEvd->iTriStart + (-pEvd->cachePosition);
-						--pEvd->cachePosition;
-					}
-					else
-					{
-						// Allocate space for triangle indices
-						pEvd->iTriStart = trianglesByVertAllocated;
-						iTriStore = trianglesByVertAllocated;
-						trianglesByVertAllocated += pEvd->triangles;
-						pEvd->cachePosition = -1;
-
-						// Also calculate initial vertex score
-						pEvd->RecalcScore();
-					}
-
-					// Store the triangle to the array
-					ASSERT_ERR(iTriStore < int(trianglesByVert.size()));
-					ASSERT_ERR(iTriStore - pEvd->iTriStart < pEvd->triangles);
-					ASSERT_ERR(trianglesByVert[iTriStore] == -1);
-					int iTri = (iIdx - range.m_indexStart) / 3;
-					trianglesByVert[iTriStore] = iTri;
-
-					// Add the vertex score into the triangle score
-					ExtraTriData * pEtd = &extraTriDatas[iTri];
-					pEtd->score += pEvd->score;
-
-					// Keep track of the best triangle seen
-					if (pEtd->score > bestTriScore)
+					float triScore = vertScores[adj.m_indices[3*i]] +
+									 vertScores[adj.m_indices[3*i + 1]] +
+									 vertScores[adj.m_indices[3*i + 2]];
+					triScores[i] = triScore;
+					if (triScore > bestTriScore)
 					{
-						bestTri = iTri;
-						bestTriScore = pEtd->score;
+						bestTri = i;
+						bestTriScore = triScore;
 					}
 				}
 
-				ASSERT_ERR(trianglesByVertAllocated == int(trianglesByVert.size()));
-				ASSERT_ERR(bestTri >= 0 && bestTri < int(extraTriDatas.size()));
+				ASSERT_ERR(bestTri >= 0 && bestTri < cTri);
 
 				int vertexCache[2][s_cacheSize + 3] = {};
 				for (int i = 0; i < dim(vertexCache); ++i)
 					for (int j = 0; j < dim(vertexCache[0]); ++j)
 						vertexCache[i][j] = -1;
 
-				std::vector<int> indicesReordered;
+				// Where to resume looking for an unsorted triangle at a dead end;
+				// everything before this is already sorted
+				int iTriDeadEnd = 0;
+
+				indicesReordered.clear();
 				indicesReordered.reserve(range.m_indexCount);
-				
+
 				// Iterate through triangles, picking the one to add to indicesReordered next
-				for (int iTriAdd = 0, cTriAdd = range.m_indexCount/3;;)
+				for (int iTriAdd = 0;;)
 				{
 					// Add the best triangle seen so far to the new indices
-					int indicesAdd[3] =
-					{
-						pCtx->m_indices[range.m_indexStart + 3*bestTri],
-						pCtx->m_indices[range.m_indexStart + 3*bestTri + 1],
-						pCtx->m_indices[range.m_indexStart + 3*bestTri + 2],
-					};
-					indicesReordered.insert(indicesReordered.end(), &indicesAdd[0], &indicesAdd[dim(indicesAdd)]);
+					const int * indicesAdd = &adj.m_indices[3*bestTri];
+					for (int i = 0; i < 3; ++i)
+						indicesReordered.push_back(adj.m_localToGlobal[indicesAdd[i]]);
 
 					++iTriAdd;
-					if (iTriAdd >= cTriAdd)
+					if (iTriAdd >= cTri)
 						break;
 
 					// Reset the triangle's score to indicate that it's been sorted
-					extraTriDatas[bestTri].score = -1.0f;
+					triScores[bestTri] = -1.0f;
 
-					// Update the vertices
-					for (int i = 0; i < dim(indicesAdd); ++i)
+					// Remove the triangle we just added from the vertices' lists of unsorted triangles
+					for (int i = 0; i < 3; ++i)
 					{
-						ExtraVertexData * pEvd = &extraVertexDatas[indicesAdd[i]];
-
-						// Remove the triangle we just added from the vertex's list of triangles
-						auto it = std::find(
-									&trianglesByVert[pEvd->iTriStart], 
-									&trianglesByVert[pEvd->iTriStart] + pEvd->triangles,
-									bestTri);
-						ASSERT_ERR(it < &trianglesByVert[pEvd->iTriStart] + pEvd->triangles);
-						*it = trianglesByVert[pEvd->iTriStart + pEvd->triangles - 1];
-
-						// Decrement the not-yet-sorted-triangles count
-						--pEvd->triangles;
+						int iVert = indicesAdd[i];
+						int * pTris = &adj.m_tris[adj.m_triStart[iVert]];
+						int * it = std::find(pTris, pTris + liveTris[iVert], bestTri);
+						ASSERT_ERR(it < pTris + liveTris[iVert]);
+						std::swap(*it, pTris[liveTris[iVert] - 1]);
+						--liveTris[iVert];
 					}
 
 					// Update the LRU cache, putting the newly used vertices at the top
@@ -892,12 +1838,13 @@ namespace Framework
 					}
 					ASSERT_ERR(iCacheWrite <= dim(vertexCache[0]));
 
-					// Update the cache indices of all the verts and recompute their scores
+					// Update the cache positions of all the verts and recompute their scores
+					// (including the ones that just fell out the bottom of the cache)
 					for (int i = 0; i < iCacheWrite; ++i)
 					{
-						ExtraVertexData * pEvd = &extraVertexDatas[vertexCacheNext[i]];
-						pEvd->cachePosition = (i >= s_cacheSize) ? -1 : i;
-						pEvd->RecalcScore();
+						int iVert = vertexCacheNext[i];
+						cachePositions[iVert] = (i >= s_cacheSize) ? -1 : i;
+						vertScores[iVert] = ForsythVertexScore(cachePositions[iVert], liveTris[iVert]);
 					}
 
 					// Recompute the scores of tris that use verts in the cache,
@@ -906,22 +1853,15 @@ namespace Framework
 					bestTriScore = 0.0f;
 					for (int i = 0; i < iCacheWrite; ++i)
 					{
-						ExtraVertexData * pEvd = &extraVertexDatas[vertexCacheNext[i]];
-
-						// Update all the unsorted tris that use this vertex
-						for (int j = 0; j < pEvd->triangles; ++j)
+						int iVert = vertexCacheNext[i];
+						const int * pTris = &adj.m_tris[adj.m_triStart[iVert]];
+						for (int j = 0, cTriVert = liveTris[iVert]; j < cTriVert; ++j)
 						{
-							int iTri = trianglesByVert[pEvd->iTriStart + j];
-							int indices[3] =
-							{
-								pCtx->m_indices[range.m_indexStart + 3*iTri],
-								pCtx->m_indices[range.m_indexStart + 3*iTri + 1],
-								pCtx->m_indices[range.m_indexStart + 3*iTri + 2],
-							};
-							float triScore = extraVertexDatas[indices[0]].score +
-											 extraVertexDatas[indices[1]].score +
-											 extraVertexDatas[indices[2]].score;
-							extraTriDatas[iTri].score = triScore;
+							int iTri = pTris[j];
+							float triScore = vertScores[adj.m_indices[3*iTri]] +
+											 vertScores[adj.m_indices[3*iTri + 1]] +
+											 vertScores[adj.m_indices[3*iTri + 2]];
+							triScores[iTri] = triScore;
 
 							if (triScore > bestTriScore)
 							{
@@ -931,22 +1871,18 @@ namespace Framework
 						}
 					}
 
-					// If we didn't find a tri above (e.g. because all verts in the cache are
-					// out of unsorted tris) then fallback to searching the entire list of tris
+					// If we didn't find a tri above (all verts in the cache are out of unsorted
+					// tris), we've hit a dead end.  Rather than searching all the tris for the
+					// best score, restart from the next unsorted tri in the original order; the
+					// cursor only ever moves forward, so this is linear over the whole range.
 					if (bestTri < 0)
 					{
-						for (int i = 0, cTri = int(extraTriDatas.size()); i < cTri; ++i)
-						{
-							float triScore = extraTriDatas[i].score;
-							if (triScore > bestTriScore)
-							{
-								bestTri = i;
-								bestTriScore = triScore;
-							}
-						}
+						while (triScores[iTriDeadEnd] < 0.0f)
+							++iTriDeadEnd;
+						bestTri = iTriDeadEnd;
 					}
 
-					ASSERT_ERR(bestTri >= 0 && bestTri < int(extraTriDatas.size()));
+					ASSERT_ERR(bestTri >= 0 && bestTri < cTri);
 				}
 
 				ASSERT_ERR(int(indicesReordered.size()) == range.m_indexCount);
@@ -956,88 +1892,1036 @@ namespace Framework
 			}
 		}
 
-		void SortVerticesForMemoryCache(Context * pCtx)
+		void SortTrianglesForOverdraw(Context * pCtx)
 		{
 			ASSERT_ERR(pCtx);
 
-			std::vector<Vertex> vertsReordered;
-			std::vector<int> remappingTable;
-			std::vector<int> indicesRemapped;
+			// Implementation of "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"
+			// by Sander, Nehab and Barczak (Tipsify).  Triangles are emitted in fans around a
+			// vertex chosen to stay in the cache, which is a little worse than Forsyth for vertex
+			// cache use but linear time with a tiny constant.  The output is then cut into clusters
+			// where the cache runs cold anyway, and the clusters are sorted so the ones facing
+			// outward from the middle of the mesh draw first, as they're the likeliest occluders.
 
-			vertsReordered.reserve(pCtx->m_verts.size());
-			remappingTable.resize(pCtx->m_verts.size(), -1);
-			indicesRemapped.resize(pCtx->m_indices.size());
+			static const int s_cacheSize = 32;
 
-			// Iterate over indices, so that we see vertices in the order they'll be fetched
-			for (int i = 0, c = int(pCtx->m_indices.size()); i < c; ++i)
+			std::vector<int> globalToLocal(pCtx->m_verts.size(), -1);
+			RangeAdjacency adj;
+			std::vector<int> liveTris;				// Count of not-yet-emitted triangles using each vertex
+			std::vector<int> cacheTimes;			// Timestamp when each vertex last entered the cache
+			std::vector<byte> emitted;
+			std::vector<int> deadEndStack;			// Recently used verts, to continue from at a dead end
+			std::vector<int> candidates;			// Verts of the last fan, to pick the next fan vertex from
+			std::vector<int> trisReordered;
+			std::vector<int> clusterStarts;			// Indices into trisReordered
+
+			struct Cluster
 			{
-				int index = pCtx->m_indices[i];
-
-				// If this vertex was already remapped, update the index
-				if (remappingTable[index] >= 0)
-				{
-					indicesRemapped[i] = remappingTable[index];
-					continue;
-				}
-
-				// Append vertex to the reordered buffer and record its new index
-				int newIndex = int(vertsReordered.size());
-				vertsReordered.push_back(pCtx->m_verts[index]);
-				remappingTable[index] = newIndex;
-				indicesRemapped[i] = newIndex;
-			}
+				int		m_start, m_end;				// Range in trisReordered
+				float3	m_centroid;
+				float3	m_normal;
+				float	m_occlusionPotential;
+				bool operator < (const Cluster & other) const
+					{ return m_occlusionPotential > other.m_occlusionPotential; }
+			};
+			std::vector<Cluster> clusters;
+			std::vector<int> indicesReordered;
 
-			ASSERT_ERR(vertsReordered.size() == pCtx->m_verts.size());
+			// Sort each material range's triangles separately
+			for (int iRange = 0, cRange = int(pCtx->m_mtlRanges.size()); iRange < cRange; ++iRange)
+			{
+				MtlRange range = pCtx->m_mtlRanges[iRange];
 
-			pCtx->m_verts.swap(vertsReordered);
-			pCtx->m_indices.swap(indicesRemapped);
-		}
+				ASSERT_ERR(range.m_indexCount > 0 && range.m_indexCount % 3 == 0);
 
-		float ComputeACMR(const Context * pCtx, int cacheSize /*= 32*/)
-		{
-			// Compute the average cache miss rate (ACMR) of the mesh.  This is the number of
-			// vertices per triangle that miss the cache.  Worst case is 3.0, and for typical
-			// connected meshes, values between 0.6 and 0.8 are considered very good.
+				BuildRangeAdjacency(pCtx, range, &globalToLocal, &adj);
+				int cVert = int(adj.m_localToGlobal.size());
+				int cTri = range.m_indexCount / 3;
 
-			// Vertex cache is a FIFO cache rather than LRU (simulates hardware better).
-			std::deque<int> vertexCache;
+				liveTris.resize(cVert);
+				for (int i = 0; i < cVert; ++i)
+					liveTris[i] = adj.m_triStart[i + 1] - adj.m_triStart[i];
+				cacheTimes.assign(cVert, 0);
+				emitted.assign(cTri, 0);
+				deadEndStack.clear();
+				trisReordered.clear();
+				clusterStarts.assign(1, 0);
 
-			int indexCount = int(pCtx->m_indices.size());
-			int missCount = 0;
-			for (int i = 0; i < indexCount; ++i)
-			{
-				int index = pCtx->m_indices[i];
+				// A vertex is in the cache if fewer than s_cacheSize verts have entered since it did
+				int timestamp = s_cacheSize + 1;
+				int iVertCursor = 0;		// Where to resume looking for a vertex with tris left at a dead end
 
-				// If we don't find it in the cache, it's a miss
-				auto it = std::find(vertexCache.begin(), vertexCache.end(), index);
-				if (it == vertexCache.end())
+				for (int iVertFan = 0; iVertFan >= 0;)
 				{
-					// Add it to the back of the FIFO cache
-					++missCount;
-					vertexCache.push_back(index);
-					if (int(vertexCache.size()) > cacheSize)
-						vertexCache.pop_front();
-				}
-			}
+					// Emit all the vertex's remaining triangles
+					candidates.clear();
+					for (int i = adj.m_triStart[iVertFan], iEnd = adj.m_triStart[iVertFan + 1]; i < iEnd; ++i)
+					{
+						int iTri = adj.m_tris[i];
+						if (emitted[iTri])
+							continue;
 
-			ASSERT_ERR(int(vertexCache.size()) <= cacheSize);
+						for (int j = 0; j < 3; ++j)
+						{
+							int iVert = adj.m_indices[3*iTri + j];
+							deadEndStack.push_back(iVert);
+							candidates.push_back(iVert);
+							--liveTris[iVert];
+							if (timestamp - cacheTimes[iVert] > s_cacheSize)
+							{
+								cacheTimes[iVert] = timestamp;
+								++timestamp;
+							}
+						}
 
-			return float(missCount) / float(max(indexCount / 3, 1));
+						emitted[iTri] = 1;
+						trisReordered.push_back(iTri);
+					}
+
+					// Pick the next fan vertex: of the verts just used, the one that's been in the
+					// cache longest but will still be there after its own fan is emitted (each tri
+					// adds at most 2 new verts), or failing that any of them with tris left
+					int iVertNext = -1;
+					int bestPriority = -1;
+					for (int i = 0, c = int(candidates.size()); i < c; ++i)
+					{
+						int iVert = candidates[i];
+						if (liveTris[iVert] <= 0)
+							continue;
+
+						int priority = 0;
+						if (timestamp - cacheTimes[iVert] + 2 * liveTris[iVert] <= s_cacheSize)
+							priority = timestamp - cacheTimes[iVert];
+						if (priority > bestPriority)
+						{
+							iVertNext = iVert;
+							bestPriority = priority;
+						}
+					}
+
+					// Dead end: back up through recently used verts, then through the rest in order
+					if (iVertNext < 0)
+					{
+						while (!deadEndStack.empty())
+						{
+							int iVert = deadEndStack.back();
+							deadEndStack.pop_back();
+							if (liveTris[iVert] > 0)
+							{
+								iVertNext = iVert;
+								break;
+							}
+						}
+					}
+					if (iVertNext < 0)
+					{
+						while (iVertCursor < cVert && liveTris[iVertCursor] == 0)
+							++iVertCursor;
+						if (iVertCursor < cVert)
+							iVertNext = iVertCursor;
+					}
+
+					// If the next fan starts from a vertex that's dropped out of the cache,
+					// the cache is effectively flushed here, so it's free to start a new cluster
+					if (iVertNext >= 0 &&
+						timestamp - cacheTimes[iVertNext] > s_cacheSize &&
+						int(trisReordered.size()) > clusterStarts.back())
+					{
+						clusterStarts.push_back(int(trisReordered.size()));
+					}
+
+					iVertFan = iVertNext;
+				}
+
+				ASSERT_ERR(int(trisReordered.size()) == cTri);
+				clusterStarts.push_back(cTri);
+
+				// Find each cluster's area-weighted centroid and average normal, and the centroid
+				// of the whole range.  A cluster's occlusion potential is how far it faces outward
+				// from the range's centroid.
+				clusters.resize(clusterStarts.size() - 1);
+				float3 rangeCentroidSum(0.0f);
+				float rangeAreaSum = 0.0f;
+				for (int iCluster = 0, cCluster = int(clusters.size()); iCluster < cCluster; ++iCluster)
+				{
+					Cluster * pCluster = &clusters[iCluster];
+					pCluster->m_start = clusterStarts[iCluster];
+					pCluster->m_end = clusterStarts[iCluster + 1];
+
+					float3 centroidSum(0.0f);
+					float3 normalSum(0.0f);
+					float areaSum = 0.0f;
+					for (int i = pCluster->m_start; i < pCluster->m_end; ++i)
+					{
+						const int * indices = &adj.m_indices[3*trisReordered[i]];
+						float3 facePositions[3] =
+						{
+							pCtx->m_verts[adj.m_localToGlobal[indices[0]]].m_pos,
+							pCtx->m_verts[adj.m_localToGlobal[indices[1]]].m_pos,
+							pCtx->m_verts[adj.m_localToGlobal[indices[2]]].m_pos,
+						};
+						float3 normal = cross(facePositions[1] - facePositions[0], facePositions[2] - facePositions[0]);
+						float area = length(normal);		// Twice the area, but it's only used as a weight
+						centroidSum += area * (facePositions[0] + facePositions[1] + facePositions[2]);
+						normalSum += normal;
+						areaSum += area;
+					}
+
+					rangeCentroidSum += centroidSum;
+					rangeAreaSum += areaSum;
+
+					pCluster->m_centroid = (areaSum > 0.0f) ? centroidSum / (3.0f * areaSum) : float3(0.0f);
+					pCluster->m_normal = (lengthSquared(normalSum) > 0.0f) ? normalize(normalSum) : float3(0.0f);
+				}
+
+				float3 rangeCentroid = (rangeAreaSum > 0.0f) ? rangeCentroidSum / (3.0f * rangeAreaSum) : float3(0.0f);
+				for (int iCluster = 0, cCluster = int(clusters.size()); iCluster < cCluster; ++iCluster)
+				{
+					Cluster * pCluster = &clusters[iCluster];
+					pCluster->m_occlusionPotential = dot(pCluster->m_centroid - rangeCentroid, pCluster->m_normal);
+				}
+
+				// Stable sort so the result is deterministic, and clusters with equal
+				// potential keep their cache-friendly order
+				std::stable_sort(clusters.begin(), clusters.end());
+
+				indicesReordered.clear();
+				indicesReordered.reserve(range.m_indexCount);
+				for (int iCluster = 0, cCluster = int(clusters.size()); iCluster < cCluster; ++iCluster)
+				{
+					for (int i = clusters[iCluster].m_start, iEnd = clusters[iCluster].m_end; i < iEnd; ++i)
+					{
+						const int * indices = &adj.m_indices[3*trisReordered[i]];
+						for (int j = 0; j < 3; ++j)
+							indicesReordered.push_back(adj.m_localToGlobal[indices[j]]);
+					}
+				}
+
+				ASSERT_ERR(int(indicesReordered.size()) == range.m_indexCount);
+
+				// Replace the old indices with the new indices for this range
+				memcpy(&pCtx->m_indices[range.m_indexStart], &indicesReordered[0], sizeof(int) * range.m_indexCount);
+			}
+		}
+
+		void SortVerticesForMemoryCache(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+
+			std::vector<Vertex> vertsReordered;
+			std::vector<int> remappingTable;
+			std::vector<int> indicesRemapped;
+
+			vertsReordered.reserve(pCtx->m_verts.size());
+			remappingTable.resize(pCtx->m_verts.size(), -1);
+			indicesRemapped.resize(pCtx->m_indices.size());
+
+			// Iterate over indices, so that we see vertices in the order they'll be fetched
+			for (int i = 0, c = int(pCtx->m_indices.size()); i < c; ++i)
+			{
+				int index = pCtx->m_indices[i];
+
+				// If this vertex was already remapped, update the index
+				if (remappingTable[index] >= 0)
+				{
+					indicesRemapped[i] = remappingTable[index];
+					continue;
+				}
+
+				// Append vertex to the reordered buffer and record its new index
+				int newIndex = int(vertsReordered.size());
+				vertsReordered.push_back(pCtx->m_verts[index]);
+				remappingTable[index] = newIndex;
+				indicesRemapped[i] = newIndex;
+			}
+
+			ASSERT_ERR(vertsReordered.size() == pCtx->m_verts.size());
+
+			pCtx->m_verts.swap(vertsReordered);
+			pCtx->m_indices.swap(indicesRemapped);
+		}
+
+		float ComputeACMR(const Context * pCtx, int cacheSize /*= 32*/)
+		{
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(cacheSize > 0);
+
+			// Compute the average cache miss rate (ACMR) of the mesh.  This is the number of
+			// vertices per triangle that miss the cache.  Worst case is 3.0, and for typical
+			// connected meshes, values between 0.6 and 0.8 are considered very good.
+
+			// Vertex cache is a FIFO cache rather than LRU (simulates hardware better).
+			// Rather than searching the cache, each vertex records the miss count when it was
+			// added; it's still in the cache if fewer than cacheSize misses have happened since.
+			std::vector<int> missCountWhenCached(pCtx->m_verts.size(), -cacheSize);
+
+			int indexCount = int(pCtx->m_indices.size());
+			int missCount = 0;
+			for (int i = 0; i < indexCount; ++i)
+			{
+				int index = pCtx->m_indices[i];
+				if (missCount - missCountWhenCached[index] >= cacheSize)
+				{
+					// It's a miss; add it to the back of the FIFO cache
+					missCountWhenCached[index] = missCount;
+					++missCount;
+				}
+			}
+
+			return float(missCount) / float(max(indexCount / 3, 1));
+		}
+
+		// Map a unit vector onto the octahedron |x| + |y| + |z| = 1, then unfold the lower
+		// half over the upper half, giving a point in [-1, 1]^2
+		static void OctahedralEncode(float3 n, short * pOut)
+		{
+			float sum = abs(n.x) + abs(n.y) + abs(n.z);
+			float2 oct = (sum > 0.0f) ? float2(n.x / sum, n.y / sum) : float2(0.0f);
+			if (n.z < 0.0f)
+			{
+				float2 octUpper = oct;
+				oct.x = (1.0f - abs(octUpper.y)) * (octUpper.x >= 0.0f ? 1.0f : -1.0f);
+				oct.y = (1.0f - abs(octUpper.x)) * (octUpper.y >= 0.0f ? 1.0f : -1.0f);
+			}
+			pOut[0] = short(floor(clamp(oct.x, -1.0f, 1.0f) * 32767.0f + 0.5f));
+			pOut[1] = short(floor(clamp(oct.y, -1.0f, 1.0f) * 32767.0f + 0.5f));
+		}
+
+		// Float to half-float, rounding to nearest even; overflows go to infinity
+		static unsigned short FloatToHalf(float f)
+		{
+			static const mz_uint32 s_f32Infinity = 255 << 23;
+			static const mz_uint32 s_f16Overflow = (127 + 16) << 23;		// 65536, above the largest half
+			static const mz_uint32 s_f16MinNormal = 113 << 23;				// 2^-14
+			static const mz_uint32 s_denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+			mz_uint32 bits;
+			memcpy(&bits, &f, sizeof(bits));
+			mz_uint32 sign = bits & 0x80000000;
+			bits ^= sign;
+
+			mz_uint32 result;
+			if (bits >= s_f16Overflow)
+			{
+				// Infinity, or NaN (quietened)
+				result = (bits > s_f32Infinity) ? 0x7e00 : 0x7c00;
+			}
+			else if (bits < s_f16MinNormal)
+			{
+				// Denormal or zero; adding the magic number makes the FPU do the shift and rounding
+				float magic, value;
+				memcpy(&magic, &s_denormMagic, sizeof(magic));
+				memcpy(&value, &bits, sizeof(value));
+				value += magic;
+				memcpy(&result, &value, sizeof(result));
+				result -= s_denormMagic;
+			}
+			else
+			{
+				// Normal; rebias the exponent and round the mantissa to nearest even
+				mz_uint32 mantissaOdd = (bits >> 13) & 1;
+				bits += (mz_uint32(15 - 127) << 23) + 0xfff + mantissaOdd;
+				result = bits >> 13;
+			}
+
+			return (unsigned short)(result | (sign >> 16));
 		}
 
-		void SerializeMaterialMap(Context * pCtx, std::vector<byte> * pDataOut)
+		void EncodeVerts(const Context * pCtx, const VertexFormat & format, std::vector<byte> * pDataOut)
 		{
 			ASSERT_ERR(pCtx);
 			ASSERT_ERR(pDataOut);
 
-			SerializeHelper sh(pDataOut);
-			for (int i = 0, cRange = int(pCtx->m_mtlRanges.size()); i < cRange; ++i)
+			int vertCount = int(pCtx->m_verts.size());
+			pDataOut->resize(vertCount * format.m_strideBytes);
+
+			switch (format.m_vtxfmt)
+			{
+			case VTXFMT_Float:
+				memcpy(&(*pDataOut)[0], &pCtx->m_verts[0], pDataOut->size());
+				break;
+
+			case VTXFMT_Quantized:
+				{
+					// Scale positions to [0, 65535] across the bounding box; an axis where the box
+					// is flat stays at 0
+					float3 posScaleInv;
+					for (int j = 0; j < 3; ++j)
+						posScaleInv[j] = (format.m_posScale[j] > 0.0f) ? 65535.0f / format.m_posScale[j] : 0.0f;
+
+					VertexQuantized * pVertsOut = (VertexQuantized *)&(*pDataOut)[0];
+					float uvMax = 0.0f;
+					for (int i = 0; i < vertCount; ++i)
+					{
+						const Vertex & vert = pCtx->m_verts[i];
+						VertexQuantized vertOut = {};
+
+						float3 posScaled = (vert.m_pos - format.m_posOffset) * posScaleInv;
+						for (int j = 0; j < 3; ++j)
+							vertOut.m_pos[j] = (unsigned short)floor(clamp(posScaled[j], 0.0f, 65535.0f) + 0.5f);
+
+						OctahedralEncode(vert.m_normal, vertOut.m_normal);
+#if VERTEX_TANGENT
+						OctahedralEncode(vert.m_tangent.xyz, vertOut.m_tangent);
+						vertOut.m_pos[3] = (vert.m_tangent.w < 0.0f) ? 0 : 65535;
+#endif
+
+						vertOut.m_uv[0] = FloatToHalf(vert.m_uv.x);
+						vertOut.m_uv[1] = FloatToHalf(vert.m_uv.y);
+						uvMax = max(uvMax, max(abs(vert.m_uv.x), abs(vert.m_uv.y)));
+
+						pVertsOut[i] = vertOut;
+					}
+
+					// Past 8, half-floats step by 1/128, which is visible on textures of more
+					// than about 128 texels per repeat
+					if (uvMax > 8.0f)
+						WARN("UVs range up to %0.1f, so they'll lose precision as half-floats", uvMax);
+				}
+				break;
+
+			default:
+				ERR("Missing case for VTXFMT %d", format.m_vtxfmt);
+				break;
+			}
+		}
+
+		void SplitForIndex16(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+
+			// Cut each material range into pieces that use at most s_index16VertLimit verts,
+			// in triangle order.  Each piece gets its own contiguous run of verts, in the order
+			// they're first used (as SortVerticesForMemoryCache would do), starting at its
+			// base vertex, and its indices are made relative to that.  Verts shared between
+			// pieces are duplicated.
+
+			std::vector<Vertex> vertsSplit;
+			std::vector<int> indicesSplit;
+			std::vector<MtlRange> mtlRangesSplit;
+			vertsSplit.reserve(pCtx->m_verts.size());
+			indicesSplit.reserve(pCtx->m_indices.size());
+
+			// For each original vert, the piece it was last copied into and its index there
+			std::vector<int> pieceOfVert(pCtx->m_verts.size(), -1);
+			std::vector<int> indexInPiece(pCtx->m_verts.size());
+			int piece = -1;
+
+			for (int iRange = 0, cRange = int(pCtx->m_mtlRanges.size()); iRange < cRange; ++iRange)
+			{
+				const MtlRange & range = pCtx->m_mtlRanges[iRange];
+				ASSERT_ERR(range.m_indexCount % 3 == 0);
+
+				for (int i = range.m_indexStart, iEnd = i + range.m_indexCount; i < iEnd; i += 3)
+				{
+					const int * pTri = &pCtx->m_indices[i];
+
+					// Count how many verts this triangle would add to the current piece
+					int newVerts = 0;
+					if (piece >= 0 && mtlRangesSplit.back().m_mtlName == range.m_mtlName)
+					{
+						for (int j = 0; j < 3; ++j)
+						{
+							if (pieceOfVert[pTri[j]] != piece &&
+								(j < 1 || pTri[j] != pTri[0]) &&
+								(j < 2 || pTri[j] != pTri[1]))
+							{
+								++newVerts;
+							}
+						}
+					}
+
+					// Start a new piece at each range, or when this one's full
+					if (piece < 0 ||
+						mtlRangesSplit.back().m_mtlName != range.m_mtlName ||
+						int(vertsSplit.size()) - mtlRangesSplit.back().m_baseVertex + newVerts > s_index16VertLimit)
+					{
+						MtlRange rangeSplit = { range.m_mtlName, int(indicesSplit.size()), 0, int(vertsSplit.size()), };
+						mtlRangesSplit.push_back(rangeSplit);
+						++piece;
+					}
+
+					MtlRange * pRangeSplit = &mtlRangesSplit.back();
+					for (int j = 0; j < 3; ++j)
+					{
+						int index = pTri[j];
+						if (pieceOfVert[index] != piece)
+						{
+							pieceOfVert[index] = piece;
+							indexInPiece[index] = int(vertsSplit.size()) - pRangeSplit->m_baseVertex;
+							vertsSplit.push_back(pCtx->m_verts[index]);
+						}
+						indicesSplit.push_back(indexInPiece[index]);
+					}
+					pRangeSplit->m_indexCount += 3;
+				}
+			}
+
+			ASSERT_ERR(indicesSplit.size() == pCtx->m_indices.size());
+
+			LOG("Split mesh into %d ranges for 16-bit indices; %d verts -> %d",
+				int(mtlRangesSplit.size()), int(pCtx->m_verts.size()), int(vertsSplit.size()));
+
+			pCtx->m_verts.swap(vertsSplit);
+			pCtx->m_indices.swap(indicesSplit);
+			pCtx->m_mtlRanges.swap(mtlRangesSplit);
+		}
+
+		// Quadric error metric (Garland & Heckbert, "Surface Simplification Using Quadric Error
+		// Metrics"): the sum of squared distances to a set of planes, stored as a symmetric
+		// matrix A, vector b and scalar c, so Q(p) = pAp + 2bp + c.  Planes are weighted by
+		// their triangle's area, and m_weight keeps the total, so Q(p) / m_weight is the
+		// mean squared distance.
+		struct Quadric
+		{
+			double	m_a00, m_a01, m_a02, m_a11, m_a12, m_a22;
+			double	m_b0, m_b1, m_b2;
+			double	m_c;
+			double	m_weight;
+		};
+
+		static void AddPlaneToQuadric(float3 normal, float d, float weight, Quadric * pQ)
+		{
+			double nx = normal.x, ny = normal.y, nz = normal.z, w = weight;
+			pQ->m_a00 += w * nx * nx;
+			pQ->m_a01 += w * nx * ny;
+			pQ->m_a02 += w * nx * nz;
+			pQ->m_a11 += w * ny * ny;
+			pQ->m_a12 += w * ny * nz;
+			pQ->m_a22 += w * nz * nz;
+			pQ->m_b0 += w * nx * d;
+			pQ->m_b1 += w * ny * d;
+			pQ->m_b2 += w * nz * d;
+			pQ->m_c += w * double(d) * d;
+			pQ->m_weight += w;
+		}
+
+		static void AddQuadric(const Quadric & q, Quadric * pQ)
+		{
+			pQ->m_a00 += q.m_a00;	pQ->m_a01 += q.m_a01;	pQ->m_a02 += q.m_a02;
+			pQ->m_a11 += q.m_a11;	pQ->m_a12 += q.m_a12;	pQ->m_a22 += q.m_a22;
+			pQ->m_b0 += q.m_b0;		pQ->m_b1 += q.m_b1;		pQ->m_b2 += q.m_b2;
+			pQ->m_c += q.m_c;
+			pQ->m_weight += q.m_weight;
+		}
+
+		// Mean squared distance from pos to the planes of both quadrics
+		static float EvaluateQuadrics(const Quadric & q0, const Quadric & q1, float3 pos)
+		{
+			double weight = q0.m_weight + q1.m_weight;
+			if (weight <= 0.0)
+				return 0.0f;
+
+			double x = pos.x, y = pos.y, z = pos.z;
+			double result = 0.0;
+			const Quadric * qs[] = { &q0, &q1 };
+			for (int i = 0; i < 2; ++i)
+			{
+				const Quadric & q = *qs[i];
+				result += x * (q.m_a00 * x + 2.0 * (q.m_a01 * y + q.m_a02 * z + q.m_b0)) +
+						  y * (q.m_a11 * y + 2.0 * (q.m_a12 * z + q.m_b1)) +
+						  z * (q.m_a22 * z + 2.0 * q.m_b2) +
+						  q.m_c;
+			}
+			return float(max(result / weight, 0.0));
+		}
+
+		struct Collapse
+		{
+			float	m_cost;
+			int		m_from, m_to;
+
+			bool operator < (const Collapse & other) const
+			{
+				if (m_cost != other.m_cost)
+					return m_cost < other.m_cost;
+				if (m_from != other.m_from)
+					return m_from < other.m_from;
+				return m_to < other.m_to;
+			}
+		};
+
+		// Collapse edges of a triangle list (in local numbering) until it has at most targetTris
+		// triangles, or nothing more can be collapsed.  Half-edge collapses only: a vertex merges
+		// into one of its neighbors, so no new verts are made and the vertex buffer can be shared.
+		// Quadrics accumulate across calls, so costs measure distance from the original surface.
+		// Returns the highest cost of any collapse made.
+		static float SimplifyTriangles(
+			const std::vector<float3> & positions,
+			const std::vector<bool> & locked,
+			int targetTris,
+			std::vector<Quadric> * pQuadrics,
+			std::vector<int> * pIndices)
+		{
+			std::vector<Quadric> & quadrics = *pQuadrics;
+			std::vector<int> & indices = *pIndices;
+			int cVert = int(positions.size());
+
+			std::vector<int> triStart, tris;
+			std::vector<Collapse> collapses;
+			std::vector<int> remap(cVert);
+			std::vector<bool> touched(cVert);
+			float maxCost = 0.0f;
+
+			// Each pass collapses the cheapest edges whose neighborhoods don't overlap, so the
+			// costs and flip checks it computed up front stay valid; around log(n) passes
+			for (;;)
+			{
+				int cTri = int(indices.size()) / 3;
+				if (cTri <= targetTris)
+					break;
+
+				BuildVertexTriangleLists(&indices[0], int(indices.size()), cVert, &triStart, &tris);
+
+				// Cost both directions of each edge; interior edges come up twice, but the
+				// second one is skipped, as its verts are touched by then
+				collapses.clear();
+				for (int i = 0; i < cTri * 3; i += 3)
+				{
+					for (int j = 0; j < 3; ++j)
+					{
+						int a = indices[i + j];
+						int b = indices[i + (j + 1) % 3];
+						if (!locked[a])
+						{
+							Collapse collapse = { EvaluateQuadrics(quadrics[a], quadrics[b], positions[b]), a, b };
+							collapses.push_back(collapse);
+						}
+						if (!locked[b])
+						{
+							Collapse collapse = { EvaluateQuadrics(quadrics[a], quadrics[b], positions[a]), b, a };
+							collapses.push_back(collapse);
+						}
+					}
+				}
+				std::sort(collapses.begin(), collapses.end());
+
+				for (int i = 0; i < cVert; ++i)
+					remap[i] = i;
+				touched.assign(cVert, false);
+
+				int trisToRemove = cTri - targetTris;
+				int trisRemoved = 0;
+				int collapseCount = 0;
+				for (int iCollapse = 0, cCollapse = int(collapses.size()); iCollapse < cCollapse && trisRemoved < trisToRemove; ++iCollapse)
+				{
+					const Collapse & collapse = collapses[iCollapse];
+					int from = collapse.m_from, to = collapse.m_to;
+					if (touched[from] || touched[to])
+						continue;
+
+					// Reject collapses that would flip any of the triangles that stay, or turn them
+					// more than about 75 degrees (which would let repeated collapses flip them)
+					bool flips = false;
+					int trisDying = 0;
+					for (int j = triStart[from], jEnd = triStart[from + 1]; j < jEnd && !flips; ++j)
+					{
+						const int * pTri = &indices[tris[j] * 3];
+						if (pTri[0] == to || pTri[1] == to || pTri[2] == to)
+						{
+							++trisDying;
+							continue;
+						}
+
+						float3 posOld[3], posNew[3];
+						for (int k = 0; k < 3; ++k)
+						{
+							posOld[k] = positions[pTri[k]];
+							posNew[k] = positions[(pTri[k] == from) ? to : pTri[k]];
+						}
+						float3 normalOld = cross(posOld[1] - posOld[0], posOld[2] - posOld[0]);
+						float3 normalNew = cross(posNew[1] - posNew[0], posNew[2] - posNew[0]);
+						flips = (dot(normalOld, normalNew) <= 0.25f * sqrtf(lengthSquared(normalOld) * lengthSquared(normalNew)));
+					}
+					if (flips)
+						continue;
+
+					remap[from] = to;
+					AddQuadric(quadrics[from], &quadrics[to]);
+					maxCost = max(maxCost, collapse.m_cost);
+					trisRemoved += trisDying;
+					++collapseCount;
+
+					// Lock down the neighborhood for the rest of the pass
+					for (int j = triStart[from], jEnd = triStart[from + 1]; j < jEnd; ++j)
+					{
+						const int * pTri = &indices[tris[j] * 3];
+						touched[pTri[0]] = touched[pTri[1]] = touched[pTri[2]] = true;
+					}
+				}
+
+				if (collapseCount == 0)
+					break;
+
+				// Apply the collapses, dropping the triangles that became degenerate
+				int iWrite = 0;
+				for (int i = 0; i < cTri * 3; i += 3)
+				{
+					int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+					if (a == b || b == c || c == a)
+						continue;
+					indices[iWrite++] = a;
+					indices[iWrite++] = b;
+					indices[iWrite++] = c;
+				}
+				indices.resize(iWrite);
+			}
+
+			return maxCost;
+		}
+
+		void GenerateLODs(Context * pCtx, int lodCount, float lodRatio, float * lodErrorsOut)
+		{
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(lodCount > 1 && lodCount <= Mesh::s_maxLods);
+			ASSERT_ERR(lodRatio > 0.0f && lodRatio < 1.0f);
+			ASSERT_ERR(lodErrorsOut);
+
+			// Each material range is simplified on its own, LOD from LOD, so they stay nested.
+			// Verts on open edges are locked: that's the mesh's own borders, the seams between
+			// material ranges, and UV/normal seams (which split the verts there), so none of
+			// those can crack or slide.
+
+			int cRange = int(pCtx->m_mtlRanges.size());
+			std::vector<std::vector<int>> lodIndices(cRange * lodCount);		// [iRange * lodCount + lod], in piece numbering
+			std::vector<int> globalToLocal(pCtx->m_verts.size(), -1);
+			RangeAdjacency adj;
+			std::vector<float3> positions;
+			std::vector<bool> locked;
+			std::vector<Quadric> quadrics;
+			std::vector<int> neighbors;
+			std::vector<int> indices, indicesPrev;
+
+			for (int iRange = 0; iRange < cRange; ++iRange)
+			{
+				const MtlRange & range = pCtx->m_mtlRanges[iRange];
+				const Vertex * pVertsRange = &pCtx->m_verts[range.m_baseVertex];
+
+				BuildRangeAdjacency(pCtx, range, &globalToLocal, &adj);
+				int cVert = int(adj.m_localToGlobal.size());
+				int cTri = range.m_indexCount / 3;
+
+				positions.resize(cVert);
+				for (int i = 0; i < cVert; ++i)
+					positions[i] = pVertsRange[adj.m_localToGlobal[i]].m_pos;
+
+				// Find verts on open (or non-manifold) edges: ones whose neighbors don't each
+				// turn up in exactly two of its triangles
+				locked.assign(cVert, false);
+				for (int i = 0; i < cVert; ++i)
+				{
+					neighbors.clear();
+					for (int j = adj.m_triStart[i], jEnd = adj.m_triStart[i + 1]; j < jEnd; ++j)
+					{
+						const int * pTri = &adj.m_indices[adj.m_tris[j] * 3];
+						for (int k = 0; k < 3; ++k)
+						{
+							if (pTri[k] != i)
+								neighbors.push_back(pTri[k]);
+						}
+					}
+					std::sort(neighbors.begin(), neighbors.end());
+					for (int j = 0, c = int(neighbors.size()); j < c && !locked[i]; )
+					{
+						int jEnd = j;
+						while (jEnd < c && neighbors[jEnd] == neighbors[j])
+							++jEnd;
+						locked[i] = (jEnd - j != 2);
+						j = jEnd;
+					}
+				}
+
+				// Start each vertex's quadric with the planes of its triangles
+				Quadric quadricZero = {};
+				quadrics.assign(cVert, quadricZero);
+				for (int i = 0; i < cTri * 3; i += 3)
+				{
+					const int * pTri = &adj.m_indices[i];
+					float3 normal = cross(positions[pTri[1]] - positions[pTri[0]], positions[pTri[2]] - positions[pTri[0]]);
+					float area = length(normal);
+					if (area <= 0.0f)
+						continue;
+					normal /= area;
+					float d = -dot(normal, positions[pTri[0]]);
+					for (int k = 0; k < 3; ++k)
+						AddPlaneToQuadric(normal, d, area, &quadrics[pTri[k]]);
+				}
+
+				indices = adj.m_indices;
+				float maxCost = 0.0f;
+				for (int lod = 1; lod < lodCount; ++lod)
+				{
+					int targetTris = max(1, int(float(cTri) * powf(lodRatio, float(lod))));
+					indicesPrev = indices;
+					float cost = SimplifyTriangles(positions, locked, targetTris, &quadrics, &indices);
+
+					// Keep it if it got any simpler; otherwise (or if it collapsed away entirely)
+					// this LOD shares the run of the one before
+					if (indices.empty())
+					{
+						indices.swap(indicesPrev);
+						continue;
+					}
+					maxCost = max(maxCost, cost);
+					lodErrorsOut[lod] = max(lodErrorsOut[lod], sqrtf(maxCost));
+					if (indices.size() < indicesPrev.size())
+					{
+						std::vector<int> & indicesOut = lodIndices[iRange * lodCount + lod];
+						indicesOut.resize(indices.size());
+						for (int i = 0, c = int(indices.size()); i < c; ++i)
+							indicesOut[i] = adj.m_localToGlobal[indices[i]];
+					}
+				}
+			}
+
+			// Lay out the LODs' indices after LOD 0's, LOD by LOD, so a whole LOD is contiguous
+			std::vector<MtlRange> lodRangesToSort;
+			for (int lod = 1; lod < lodCount; ++lod)
+			{
+				for (int iRange = 0; iRange < cRange; ++iRange)
+				{
+					MtlRange * pRange = &pCtx->m_mtlRanges[iRange];
+					const std::vector<int> & indicesLod = lodIndices[iRange * lodCount + lod];
+					if (indicesLod.empty())
+					{
+						pRange->m_lodIndexStarts[lod] = (lod > 1) ? pRange->m_lodIndexStarts[lod - 1] : pRange->m_indexStart;
+						pRange->m_lodIndexCounts[lod] = (lod > 1) ? pRange->m_lodIndexCounts[lod - 1] : pRange->m_indexCount;
+						continue;
+					}
+
+					pRange->m_lodIndexStarts[lod] = int(pCtx->m_indices.size());
+					pRange->m_lodIndexCounts[lod] = int(indicesLod.size());
+					pCtx->m_indices.insert(pCtx->m_indices.end(), indicesLod.begin(), indicesLod.end());
+
+					MtlRange rangeSort = { pRange->m_mtlName, pRange->m_lodIndexStarts[lod], pRange->m_lodIndexCounts[lod], pRange->m_baseVertex, };
+					lodRangesToSort.push_back(rangeSort);
+				}
+			}
+
+			// Optimize the new runs for the vertex cache too, by pointing the sorter at them
+			pCtx->m_mtlRanges.swap(lodRangesToSort);
+			SortTrianglesForVertexCache(pCtx);
+			pCtx->m_mtlRanges.swap(lodRangesToSort);
+
+			for (int lod = 1; lod < lodCount; ++lod)
+			{
+				int lodIndexCount = 0;
+				for (int iRange = 0; iRange < cRange; ++iRange)
+					lodIndexCount += pCtx->m_mtlRanges[iRange].m_lodIndexCounts[lod];
+				LOG("LOD %d: %d triangles, error %0.3g", lod, lodIndexCount / 3, lodErrorsOut[lod]);
+			}
+		}
+
+		static const int s_clusterMinTris = 64;
+		static const int s_clusterMaxTris = 128;
+
+		static void FinishCluster(
+			const Context * pCtx,
+			const Vertex * pVertsRange,
+			const std::vector<float3> & triNormals,
+			float3 posTolerance,
+			Mesh::Cluster * pCluster)
+		{
+			int triStart = pCluster->m_indexStart / 3;
+			int triEnd = triStart + pCluster->m_indexCount / 3;
+
+			// Pad the box, then fit a sphere around the verts, centered on the box
+			pCluster->m_bounds.mins -= posTolerance;
+			pCluster->m_bounds.maxs += posTolerance;
+			pCluster->m_sphereCenter = pCluster->m_bounds.center();
+			float radiusSq = 0.0f;
+			for (int i = pCluster->m_indexStart, iEnd = i + pCluster->m_indexCount; i < iEnd; ++i)
+				radiusSq = max(radiusSq, lengthSquared(pVertsRange[pCtx->m_indices[i]].m_pos - pCluster->m_sphereCenter));
+			pCluster->m_sphereRadius = sqrt(radiusSq) + length(posTolerance);
+
+			// The cone axis is the average normal; its half-angle is the worst normal's angle from
+			// that.  The cutoff is the sine of the half-angle, as a view direction must be within
+			// 90 degrees minus the half-angle of the axis to be behind all the triangles.
+			float3 normalSum(0.0f);
+			for (int i = triStart; i < triEnd; ++i)
+				normalSum += triNormals[i];
+			pCluster->m_coneAxis = float3(0.0f);
+			pCluster->m_coneCutoff = 1.0f;
+			if (lengthSquared(normalSum) > 0.0f)
+			{
+				float3 axis = normalize(normalSum);
+				float minDot = 1.0f;
+				for (int i = triStart; i < triEnd; ++i)
+				{
+					if (lengthSquared(triNormals[i]) > 0.0f)
+						minDot = min(minDot, dot(triNormals[i], axis));
+				}
+				pCluster->m_coneAxis = axis;
+				if (minDot > 0.0f)
+					pCluster->m_coneCutoff = sqrt(1.0f - minDot * minDot);
+			}
+		}
+
+		void BuildClusters(Context * pCtx, float3 posTolerance)
+		{
+			ASSERT_ERR(pCtx);
+
+			// Clusters are runs of triangles in the order they're already in, so they can be
+			// drawn straight from the index buffer and keep the vertex cache optimization.
+			// That order is already spatially coherent; a cluster is closed early (once it's
+			// at least s_clusterMinTris) when the next triangle would make it much bigger,
+			// or would bend its normals too far to keep a useful backface cone.
+
+			std::vector<float3> triNormals(pCtx->m_indices.size() / 3);
+
+			pCtx->m_clusters.clear();
+			for (int iRange = 0, cRange = int(pCtx->m_mtlRanges.size()); iRange < cRange; ++iRange)
+			{
+				MtlRange & range = pCtx->m_mtlRanges[iRange];
+				const Vertex * pVertsRange = &pCtx->m_verts[range.m_baseVertex];
+				range.m_clusterStart = int(pCtx->m_clusters.size());
+
+				for (int i = range.m_indexStart, iEnd = i + range.m_indexCount; i < iEnd; i += 3)
+				{
+					const int * pTri = &pCtx->m_indices[i];
+					float3 edge0 = pVertsRange[pTri[1]].m_pos - pVertsRange[pTri[0]].m_pos;
+					float3 edge1 = pVertsRange[pTri[2]].m_pos - pVertsRange[pTri[0]].m_pos;
+					float3 normal = cross(edge0, edge1);
+					triNormals[i / 3] = (lengthSquared(normal) > 0.0f) ? normalize(normal) : float3(0.0f);
+				}
+
+				Mesh::Cluster cluster = {};
+				float3 normalSum(0.0f);
+				for (int i = range.m_indexStart, iEnd = i + range.m_indexCount; i < iEnd; i += 3)
+				{
+					const int * pTri = &pCtx->m_indices[i];
+					const float3 & normal = triNormals[i / 3];
+					box3 boundsTri(pVertsRange[pTri[0]].m_pos, pVertsRange[pTri[0]].m_pos);
+					for (int j = 1; j < 3; ++j)
+					{
+						boundsTri.mins = min(boundsTri.mins, pVertsRange[pTri[j]].m_pos);
+						boundsTri.maxs = max(boundsTri.maxs, pVertsRange[pTri[j]].m_pos);
+					}
+
+					if (cluster.m_indexCount > 0)
+					{
+						int clusterTris = cluster.m_indexCount / 3;
+						box3 boundsGrown(min(cluster.m_bounds.mins, boundsTri.mins), max(cluster.m_bounds.maxs, boundsTri.maxs));
+						bool tooBig = lengthSquared(boundsGrown.diagonal()) > 1.5f * 1.5f * lengthSquared(cluster.m_bounds.diagonal());
+						bool tooBent = (lengthSquared(normalSum) > 0.0f && dot(normal, normalize(normalSum)) < 0.5f);
+						if (clusterTris >= s_clusterMaxTris ||
+							(clusterTris >= s_clusterMinTris && (tooBig || tooBent)))
+						{
+							FinishCluster(pCtx, pVertsRange, triNormals, posTolerance, &cluster);
+							pCtx->m_clusters.push_back(cluster);
+							cluster = Mesh::Cluster();
+							normalSum = float3(0.0f);
+						}
+					}
+
+					if (cluster.m_indexCount == 0)
+					{
+						cluster.m_indexStart = i;
+						cluster.m_bounds = boundsTri;
+					}
+					else
+					{
+						cluster.m_bounds.mins = min(cluster.m_bounds.mins, boundsTri.mins);
+						cluster.m_bounds.maxs = max(cluster.m_bounds.maxs, boundsTri.maxs);
+					}
+					cluster.m_indexCount += 3;
+					normalSum += normal;
+				}
+				if (cluster.m_indexCount > 0)
+				{
+					FinishCluster(pCtx, pVertsRange, triNormals, posTolerance, &cluster);
+					pCtx->m_clusters.push_back(cluster);
+				}
+				range.m_clusterCount = int(pCtx->m_clusters.size()) - range.m_clusterStart;
+			}
+		}
+
+		static MeshSection AppendMeshSection(const void * pData, size_t size, std::vector<byte> * pBlob)
+		{
+			pBlob->resize((pBlob->size() + s_meshBlobAlign - 1) & ~size_t(s_meshBlobAlign - 1));
+			MeshSection section = { int(pBlob->size()), int(size) };
+			if (size > 0)
+				pBlob->insert(pBlob->end(), (const byte *)pData, (const byte *)pData + size);
+			return section;
+		}
+
+		void BuildMeshBlob(const Context * pCtx, const Meta & meta, std::vector<byte> * pBlobOut)
+		{
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pBlobOut);
+
+			std::vector<byte> encodedVerts;
+			EncodeVerts(pCtx, meta.m_vtxFormat, &encodedVerts);
+
+			std::vector<unsigned short> indices16;
+			const void * pIndices = &pCtx->m_indices[0];
+			size_t indicesSize = pCtx->m_indices.size() * sizeof(int);
+			if (meta.m_indexFormat == DXGI_FORMAT_R16_UINT)
+			{
+				indices16.assign(pCtx->m_indices.begin(), pCtx->m_indices.end());
+				pIndices = &indices16[0];
+				indicesSize = indices16.size() * sizeof(unsigned short);
+			}
+
+			// Gather the material names into the string table, once each
+			std::vector<int> stringOffsets;
+			std::vector<char> strings;
+			std::unordered_map<std::string, int> stringIndices;
+			std::vector<MeshBlobMtlRange> mtlRanges(pCtx->m_mtlRanges.size());
+			for (int i = 0, c = int(pCtx->m_mtlRanges.size()); i < c; ++i)
 			{
 				const MtlRange & range = pCtx->m_mtlRanges[i];
-				sh.WriteString(range.m_mtlName);
-				sh.Write(range.m_indexStart);
-				sh.Write(range.m_indexCount);
+				MeshBlobMtlRange * pRangeOut = &mtlRanges[i];
+
+				pRangeOut->m_mtlName = -1;
+				if (!range.m_mtlName.empty())
+				{
+					auto iter = stringIndices.find(range.m_mtlName);
+					if (iter == stringIndices.end())
+					{
+						iter = stringIndices.insert(std::make_pair(range.m_mtlName, int(stringOffsets.size()))).first;
+						stringOffsets.push_back(int(strings.size()));
+						strings.insert(strings.end(), range.m_mtlName.begin(), range.m_mtlName.end());
+						strings.push_back(0);
+					}
+					pRangeOut->m_mtlName = iter->second;
+				}
+
+				pRangeOut->m_indexStart = range.m_indexStart;
+				pRangeOut->m_indexCount = range.m_indexCount;
+				pRangeOut->m_baseVertex = range.m_baseVertex;
+				pRangeOut->m_clusterStart = range.m_clusterStart;
+				pRangeOut->m_clusterCount = range.m_clusterCount;
+				pRangeOut->m_sortKey = LookupSortKey(pCtx, range.m_mtlName);
+				pRangeOut->m_lodIndexStarts[0] = range.m_indexStart;
+				pRangeOut->m_lodIndexCounts[0] = range.m_indexCount;
+				for (int lod = 1; lod < meta.m_lodCount; ++lod)
+				{
+					pRangeOut->m_lodIndexStarts[lod] = range.m_lodIndexStarts[lod];
+					pRangeOut->m_lodIndexCounts[lod] = range.m_lodIndexCounts[lod];
+				}
 			}
+
+			MeshBlobHeader header = {};
+			header.m_magic = s_meshBlobMagic;
+			header.m_version = AssetCompiler::MESHVER_Current;
+			header.m_vertCount = int(pCtx->m_verts.size());
+			header.m_indexCount = int(pCtx->m_indices.size());
+			header.m_mtlRangeCount = int(mtlRanges.size());
+			header.m_clusterCount = int(pCtx->m_clusters.size());
+			header.m_stringCount = int(stringOffsets.size());
+			header.m_meta = meta;
+
+			std::vector<byte> & blob = *pBlobOut;
+			blob.assign(sizeof(header), 0);
+			header.m_sections[MESHSECTION_Verts] = AppendMeshSection(&encodedVerts[0], encodedVerts.size(), &blob);
+			header.m_sections[MESHSECTION_Indices] = AppendMeshSection(pIndices, indicesSize, &blob);
+			header.m_sections[MESHSECTION_MtlRanges] = AppendMeshSection(&mtlRanges[0], mtlRanges.size() * sizeof(MeshBlobMtlRange), &blob);
+			header.m_sections[MESHSECTION_Clusters] = AppendMeshSection(&pCtx->m_clusters[0], pCtx->m_clusters.size() * sizeof(Mesh::Cluster), &blob);
+			header.m_sections[MESHSECTION_StringOffsets] = AppendMeshSection(stringOffsets.empty() ? nullptr : &stringOffsets[0], stringOffsets.size() * sizeof(int), &blob);
+			header.m_sections[MESHSECTION_Strings] = AppendMeshSection(strings.empty() ? nullptr : &strings[0], strings.size(), &blob);
+			header.m_size = int(blob.size());
+			memcpy(&blob[0], &header, sizeof(header));
 		}
 	}
 
@@ -1045,7 +2929,19 @@ namespace Framework
 
 	// Load compiled data into a runtime game object
 
-	bool DeserializeMaterialMap(const byte * pMtlMap, int mtlMapSize, MaterialLib * pMtlLib, Mesh * pMeshOut);
+	namespace OBJMeshCompiler
+	{
+		// Check that a section lies inside the blob, past the header, and is aligned
+		static bool ValidateMeshSection(const MeshBlobHeader * pHeader, MESHSECTION section, i64 expectedSize)
+		{
+			const MeshSection & s = pHeader->m_sections[section];
+			return (s.m_offset >= int(sizeof(MeshBlobHeader)) &&
+					s.m_offset % s_meshBlobAlign == 0 &&
+					s.m_size >= 0 &&
+					s.m_size <= pHeader->m_size - s.m_offset &&
+					(expectedSize < 0 || s.m_size == expectedSize));
+		}
+	}
 
 	bool LoadMeshFromAssetPack(
 		AssetPack * pPack,
@@ -1061,98 +2957,158 @@ namespace Framework
 
 		pMeshOut->m_pPack = pPack;
 
-		// Look for the data in the asset pack
+		// Look for the data in the asset pack.  Everything's used in place from the blob,
+		// so loading is just validation and setting up pointers.
 
-		Meta * pMeta;
-		int metaSize;
-		if (!pPack->LookupFile(path, s_suffixMeta, (void **)&pMeta, &metaSize))
+		byte * pBlob;
+		i64 blobSize;
+		if (!pPack->LookupFile(path, s_suffixMesh, (void **)&pBlob, &blobSize))
 		{
-			WARN("Couldn't find metadata for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			WARN("Couldn't find mesh %s in asset pack %s", path, pPack->m_path.c_str());
 			return false;
 		}
-		if (metaSize != sizeof(Meta))
+		if (blobSize < i64(sizeof(MeshBlobHeader)))
 		{
-			WARN("Metadata for mesh %s in asset pack %s is wrong size, %d bytes (expected %d)",
-				path, pPack->m_path.c_str(), metaSize, sizeof(Meta));
+			WARN("Mesh %s in asset pack %s is too small, %lld bytes", path, pPack->m_path.c_str(), blobSize);
 			return false;
 		}
-		pMeshOut->m_bounds = pMeta->m_bounds;
 
-		int vertsSize;
-		if (!pPack->LookupFile(path, s_suffixVerts, (void **)&pMeshOut->m_pVerts, &vertsSize))
+		const MeshBlobHeader * pHeader = (const MeshBlobHeader *)pBlob;
+		if (pHeader->m_magic != s_meshBlobMagic ||
+			pHeader->m_version != AssetCompiler::MESHVER_Current ||
+			pHeader->m_size != blobSize)
 		{
-			WARN("Couldn't find verts for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			WARN("Mesh %s in asset pack %s has bad header (magic 0x%08x, version %d, size %d; expected version %d, size %lld)",
+				path, pPack->m_path.c_str(), pHeader->m_magic, pHeader->m_version, pHeader->m_size,
+				AssetCompiler::MESHVER_Current, blobSize);
 			return false;
 		}
-		pMeshOut->m_vertCount = vertsSize / sizeof(Vertex);
 
-		int indicesSize;
-		if (!pPack->LookupFile(path, s_suffixIndices, (void **)&pMeshOut->m_pIndices, &indicesSize))
+		const Meta * pMeta = &pHeader->m_meta;
+		if (pMeta->m_vtxFormat.m_vtxfmt < 0 ||
+			pMeta->m_vtxFormat.m_vtxfmt >= VTXFMT_Count ||
+			pMeta->m_vtxFormat.m_strideBytes <= 0)
 		{
-			WARN("Couldn't find indices for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			WARN("Mesh %s in asset pack %s has invalid vertex format %d, stride %d",
+				path, pPack->m_path.c_str(), pMeta->m_vtxFormat.m_vtxfmt, pMeta->m_vtxFormat.m_strideBytes);
 			return false;
 		}
-		pMeshOut->m_indexCount = indicesSize / sizeof(int);
-
-		byte * pMtlMap;
-		int mtlMapSize;
-		if (!pPack->LookupFile(path, s_suffixMtlMap, (void **)&pMtlMap, &mtlMapSize))
+		if (pMeta->m_indexFormat != DXGI_FORMAT_R16_UINT && pMeta->m_indexFormat != DXGI_FORMAT_R32_UINT)
 		{
-			WARN("Couldn't find material map for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			WARN("Mesh %s in asset pack %s has invalid index format %d",
+				path, pPack->m_path.c_str(), pMeta->m_indexFormat);
 			return false;
 		}
-		if (!DeserializeMaterialMap(pMtlMap, mtlMapSize, pMtlLib, pMeshOut))
+		if (pMeta->m_lodCount < 1 || pMeta->m_lodCount > Mesh::s_maxLods)
 		{
-			WARN("Couldn't deserialize material map for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			WARN("Mesh %s in asset pack %s has invalid LOD count %d",
+				path, pPack->m_path.c_str(), pMeta->m_lodCount);
 			return false;
 		}
 
-		LOG("Loaded %s from asset pack %s - %d verts, %d indices, %d materials",
-			path, pPack->m_path.c_str(), pMeshOut->m_vertCount, pMeshOut->m_indexCount, pMeshOut->m_mtlRanges.size());
-
-		return true;
-	}
-
-	bool DeserializeMaterialMap(const byte * pMtlMap, int mtlMapSize, MaterialLib * pMtlLib, Mesh * pMeshOut)
-	{
-		ASSERT_ERR(pMtlMap);
-		ASSERT_ERR(mtlMapSize > 0);
-		ASSERT_ERR(pMeshOut);
-
-		DeserializeHelper dh(pMtlMap, mtlMapSize);
-		while (!dh.AtEOF())
+		int indexBytes = (pMeta->m_indexFormat == DXGI_FORMAT_R16_UINT) ? sizeof(unsigned short) : sizeof(int);
+		if (pHeader->m_vertCount <= 0 ||
+			pHeader->m_indexCount <= 0 ||
+			pHeader->m_mtlRangeCount < 0 ||
+			pHeader->m_clusterCount < 0 ||
+			pHeader->m_stringCount < 0 ||
+			!ValidateMeshSection(pHeader, MESHSECTION_Verts, i64(pHeader->m_vertCount) * pMeta->m_vtxFormat.m_strideBytes) ||
+			!ValidateMeshSection(pHeader, MESHSECTION_Indices, i64(pHeader->m_indexCount) * indexBytes) ||
+			!ValidateMeshSection(pHeader, MESHSECTION_MtlRanges, i64(pHeader->m_mtlRangeCount) * sizeof(MeshBlobMtlRange)) ||
+			!ValidateMeshSection(pHeader, MESHSECTION_Clusters, i64(pHeader->m_clusterCount) * sizeof(Mesh::Cluster)) ||
+			!ValidateMeshSection(pHeader, MESHSECTION_StringOffsets, i64(pHeader->m_stringCount) * sizeof(int)) ||
+			!ValidateMeshSection(pHeader, MESHSECTION_Strings, -1))
 		{
-			Mesh::MtlRange range = {};
+			WARN("Mesh %s in asset pack %s has invalid section table", path, pPack->m_path.c_str());
+			return false;
+		}
 
-			// Read data
-			const char * mtlName;
-			if (!dh.ReadString(&mtlName) ||
-				!dh.Read(&range.m_indexStart) ||
-				!dh.Read(&range.m_indexCount))
+		// Check the string table; every string must be terminated within the section
+		const int * pStringOffsets = (const int *)(pBlob + pHeader->m_sections[MESHSECTION_StringOffsets].m_offset);
+		const char * pStrings = (const char *)(pBlob + pHeader->m_sections[MESHSECTION_Strings].m_offset);
+		int stringsSize = pHeader->m_sections[MESHSECTION_Strings].m_size;
+		if (pHeader->m_stringCount > 0 && (stringsSize == 0 || pStrings[stringsSize - 1] != 0))
+		{
+			WARN("Mesh %s in asset pack %s has unterminated string table", path, pPack->m_path.c_str());
+			return false;
+		}
+		for (int i = 0; i < pHeader->m_stringCount; ++i)
+		{
+			if (pStringOffsets[i] < 0 || pStringOffsets[i] >= stringsSize)
 			{
+				WARN("Mesh %s in asset pack %s has invalid string offset", path, pPack->m_path.c_str());
 				return false;
 			}
+		}
 
-			// Validate data
-			if (range.m_indexStart < 0 ||
-				range.m_indexCount <= 0 ||
-				range.m_indexStart + range.m_indexCount > pMeshOut->m_indexCount)
+		pMeshOut->m_vtxFormat = pMeta->m_vtxFormat;
+		pMeshOut->m_indexFormat = pMeta->m_indexFormat;
+		pMeshOut->m_bounds = pMeta->m_bounds;
+		pMeshOut->m_lodCount = pMeta->m_lodCount;
+		memcpy(pMeshOut->m_lodErrors, pMeta->m_lodErrors, sizeof(pMeshOut->m_lodErrors));
+		pMeshOut->m_pVerts = pBlob + pHeader->m_sections[MESHSECTION_Verts].m_offset;
+		pMeshOut->m_vertCount = pHeader->m_vertCount;
+		pMeshOut->m_pIndices = pBlob + pHeader->m_sections[MESHSECTION_Indices].m_offset;
+		pMeshOut->m_indexCount = pHeader->m_indexCount;
+		pMeshOut->m_pClusters = (Mesh::Cluster *)(pBlob + pHeader->m_sections[MESHSECTION_Clusters].m_offset);
+		pMeshOut->m_clusterCount = pHeader->m_clusterCount;
+
+		// Set up the material ranges.  Each material is looked up just once, however many
+		// ranges use it.
+		const MeshBlobMtlRange * pRanges = (const MeshBlobMtlRange *)(pBlob + pHeader->m_sections[MESHSECTION_MtlRanges].m_offset);
+		std::vector<Material *> mtls(pHeader->m_stringCount, nullptr);
+		if (pMtlLib)
+		{
+			for (int i = 0; i < pHeader->m_stringCount; ++i)
 			{
-				WARN("Corrupt material map: invalid index start/count");
-				return false;
+				const char * mtlName = pStrings + pStringOffsets[i];
+				mtls[i] = pMtlLib->Lookup(mtlName);
+				ASSERT_WARN_MSG(mtls[i], "Couldn't find material %s in material library", mtlName);
 			}
+		}
+
+		pMeshOut->m_mtlRanges.resize(pHeader->m_mtlRangeCount);
+		for (int iRange = 0; iRange < pHeader->m_mtlRangeCount; ++iRange)
+		{
+			const MeshBlobMtlRange & rangeIn = pRanges[iRange];
+			Mesh::MtlRange * pRange = &pMeshOut->m_mtlRanges[iRange];
 
-			// Look up material by name
-			if (pMtlLib && *mtlName)
+			// Validate data
+			bool valid = (rangeIn.m_mtlName >= -1 && rangeIn.m_mtlName < pHeader->m_stringCount &&
+						  rangeIn.m_baseVertex >= 0 && rangeIn.m_baseVertex < pHeader->m_vertCount &&
+						  rangeIn.m_clusterStart >= 0 && rangeIn.m_clusterCount >= 0 &&
+						  rangeIn.m_clusterStart <= pHeader->m_clusterCount - rangeIn.m_clusterCount &&
+						  (rangeIn.m_sortKey >> Mesh::s_sortKeyShaderShift) < uint(SHADERVARIANT_Count));
+			for (int lod = 0; lod < pMeta->m_lodCount && valid; ++lod)
 			{
-				range.m_pMtl = pMtlLib->Lookup(mtlName);
-				ASSERT_WARN_MSG(range.m_pMtl, 
-					"Couldn't find material %s in material library", mtlName);
+				valid = (rangeIn.m_lodIndexStarts[lod] >= 0 &&
+						 rangeIn.m_lodIndexCounts[lod] > 0 &&
+						 rangeIn.m_lodIndexStarts[lod] <= pHeader->m_indexCount - rangeIn.m_lodIndexCounts[lod]);
+			}
+			if (!valid ||
+				rangeIn.m_indexStart != rangeIn.m_lodIndexStarts[0] ||
+				rangeIn.m_indexCount != rangeIn.m_lodIndexCounts[0])
+			{
+				WARN("Mesh %s in asset pack %s has invalid material range %d", path, pPack->m_path.c_str(), iRange);
+				pMeshOut->m_mtlRanges.clear();
+				return false;
 			}
 
-			pMeshOut->m_mtlRanges.push_back(range);
+			pRange->m_pMtl = (rangeIn.m_mtlName >= 0) ? mtls[rangeIn.m_mtlName] : nullptr;
+			pRange->m_indexStart = rangeIn.m_indexStart;
+			pRange->m_indexCount = rangeIn.m_indexCount;
+			pRange->m_baseVertex = rangeIn.m_baseVertex;
+			pRange->m_clusterStart = rangeIn.m_clusterStart;
+			pRange->m_clusterCount = rangeIn.m_clusterCount;
+			pRange->m_sortKey = rangeIn.m_sortKey;
+			memcpy(pRange->m_lodIndexStarts, rangeIn.m_lodIndexStarts, sizeof(pRange->m_lodIndexStarts));
+			memcpy(pRange->m_lodIndexCounts, rangeIn.m_lodIndexCounts, sizeof(pRange->m_lodIndexCounts));
 		}
 
+		LOG("Loaded %s from asset pack %s - %d verts, %d %d-bit indices, %d material ranges, %d clusters, %d LODs",
+			path, pPack->m_path.c_str(), pMeshOut->m_vertCount, pMeshOut->m_indexCount, indexBytes * 8,
+			pMeshOut->m_mtlRanges.size(), pMeshOut->m_clusterCount, pMeshOut->m_lodCount);
+
 		return true;
 	}
 
@@ -1174,8 +3130,8 @@ namespace Framework
 		CHECK_ERR(mz_zip_writer_init_heap(&zipWrite, 0, 0));
 
 		// Compile the mesh to it
-		AssetCompileInfo aci = { path, ACK_OBJMesh };
-		if (!AssetCompiler::CompileFullAssetPackToZip(&aci, 1, &zipWrite))
+		AssetCompileInfo aci = { path, ACK_OBJMesh, TEXFMT_RGBA8 };
+		if (!AssetCompiler::CompileFullAssetPackToZip(&aci, 1, AssetCompileOptions(), &zipWrite))
 		{
 			mz_zip_writer_end(&zipWrite);
 			return false;
@@ -1198,7 +3154,7 @@ namespace Framework
 		AssetPack * pPack = new AssetPack;
 		pPack->m_path = "(in memory)";
 
-		if (!AssetCompiler::LoadAssetPackFromZip(&zipRead, pPack))
+		if (!AssetCompiler::LoadAssetPackFromZip(&zipRead, nullptr, pPack))
 		{
 			mz_zip_writer_end(&zipRead);
 			mz_zip_writer_end(&zipWrite);
@@ -19,6 +19,7 @@ namespace Framework
 			rgb				m_rgbSpecColor;
 			float			m_specPower;
 			float			m_bumpScale;
+			bool			m_alphaTest;		// Has an alpha map ("map_d")
 		};
 
 		struct Context
@@ -37,12 +38,12 @@ namespace Framework
 
 	bool CompileOBJMtlLibAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut)
+		AssetCompiler::CompiledAsset * pAssetOut)
 	{
 		ASSERT_ERR(pACI);
 		ASSERT_ERR(pACI->m_pathSrc);
 		ASSERT_ERR(pACI->m_ack == ACK_OBJMtlLib);
-		ASSERT_ERR(pZipOut);
+		ASSERT_ERR(pAssetOut);
 
 		using namespace AssetCompiler;
 		using namespace OBJMtlLibCompiler;
@@ -57,7 +58,93 @@ namespace Framework
 		std::vector<byte> serializedMtlLib;
 		SerializeMtlLib(&ctx, &serializedMtlLib);
 
-		return WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMtlLib, &serializedMtlLib[0], serializedMtlLib.size(), pZipOut);
+		return WriteAssetData(pACI->m_pathSrc, s_suffixMtlLib, &serializedMtlLib[0], serializedMtlLib.size(), pAssetOut);
+	}
+
+
+
+	// Dependency scanning entry point
+
+	bool ScanOBJMtlLibDependencies(
+		const AssetCompileInfo * pACI,
+		ACK textureAck,
+		TEXFMT textureFormat,
+		std::vector<AssetCompiler::AssetReference> * pRefsOut)
+	{
+		ASSERT_ERR(pACI);
+		ASSERT_ERR(pACI->m_pathSrc);
+		ASSERT_ERR(pACI->m_ack == ACK_OBJMtlLib);
+		ASSERT_ERR(pRefsOut);
+
+		using namespace AssetCompiler;
+		using namespace OBJMtlLibCompiler;
+
+		Context ctx;
+		if (!ParseMTL(pACI->m_pathSrc, &ctx))
+			return false;
+
+		// Height maps are single-channel, so they get BC4 whenever block compression is on
+		TEXFMT heightFormat = (textureFormat == TEXFMT_RGBA8) ? TEXFMT_RGBA8 : TEXFMT_BC4;
+
+		// Textures are relative to the MTL file, the same as when they're looked up at load time
+		std::string dirBase = findDirectory(pACI->m_pathSrc);
+		for (int i = 0, c = int(ctx.m_mtls.size()); i < c; ++i)
+		{
+			const OBJMtlLibCompiler::Material * pMtl = &ctx.m_mtls[i];
+			const std::string * texNames[] =
+			{
+				&pMtl->m_texDiffuseColor,
+				&pMtl->m_texSpecColor,
+				&pMtl->m_texHeight,
+			};
+			const TEXFMT texfmts[] =
+			{
+				textureFormat,
+				textureFormat,
+				heightFormat,
+			};
+			cassert(dim(texfmts) == dim(texNames));
+			for (int iTex = 0; iTex < dim(texNames); ++iTex)
+			{
+				if (texNames[iTex]->empty())
+					continue;
+				AssetReference ref = { dirBase + *texNames[iTex], textureAck, texfmts[iTex] };
+				pRefsOut->push_back(ref);
+			}
+		}
+
+		return true;
+	}
+
+
+
+	// Material info for the mesh compiler
+
+	namespace AssetCompiler
+	{
+		bool ReadMtlDrawInfo(const char * path, std::vector<MtlDrawInfo> * pInfosOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pInfosOut);
+
+			OBJMtlLibCompiler::Context ctx;
+			if (!OBJMtlLibCompiler::ParseMTL(path, &ctx))
+				return false;
+
+			for (int i = 0, c = int(ctx.m_mtls.size()); i < c; ++i)
+			{
+				const OBJMtlLibCompiler::Material * pMtl = &ctx.m_mtls[i];
+				MtlDrawInfo info =
+				{
+					pMtl->m_mtlName,
+					pMtl->m_texDiffuseColor + '\n' + pMtl->m_texSpecColor + '\n' + pMtl->m_texHeight,
+					pMtl->m_alphaTest,
+				};
+				pInfosOut->push_back(info);
+			}
+
+			return true;
+		}
 	}
 
 
@@ -87,6 +174,7 @@ namespace Framework
 				{ 0.0f, 0.0f, 0.0f, },	// m_rgbSpecColor
 				0.0f,					// m_specPower
 				1.0f,					// m_bumpScale
+				false,					// m_alphaTest
 			};
 
 			// Parse line-by-line
@@ -165,6 +253,21 @@ namespace Framework
 					makeLowercase(pMtlCur->m_texHeight);
 					replaceChars(pMtlCur->m_texHeight, '\\', '/');
 				}
+				else if (_stricmp(pToken, "map_d") == 0)
+				{
+					if (!pMtlCur)
+					{
+						WARN("%s: syntax error at line %d: material parameters specified before any \"newmtl\" command; ignoring",
+							path, tph.m_iLine);
+						continue;
+					}
+
+					// Only used to flag the material as alpha-tested; the alpha comes from the
+					// diffuse texture
+					tph.ExpectOneToken("texture name");
+					tph.ExpectEOL();
+					pMtlCur->m_alphaTest = true;
+				}
 				else if (_stricmp(pToken, "Kd") == 0)
 				{
 					char * tokens[3] = {};
@@ -231,6 +334,7 @@ namespace Framework
 				sh.Write(pMtl->m_rgbSpecColor);
 				sh.Write(pMtl->m_specPower);
 				sh.Write(pMtl->m_bumpScale);
+				sh.Write(pMtl->m_alphaTest);
 			}
 		}
 	}
@@ -255,7 +359,7 @@ namespace Framework
 
 		// Look for the data in the asset pack
 		byte * pData;
-		int dataSize;
+		i64 dataSize;
 		if (!pPack->LookupFile(path, s_suffixMtlLib, (void **)&pData, &dataSize))
 		{
 			WARN("Couldn't find data for material lib %s in asset pack %s", path, pPack->m_path.c_str());
@@ -266,7 +370,7 @@ namespace Framework
 		std::string dirBase = findDirectory(path);
 
 		// Deserialize it
-		DeserializeHelper dh(pData, dataSize);
+		DeserializeHelper dh(pData, int(dataSize));
 		while (!dh.AtEOF())
 		{
 			Framework::Material mtl = {};
@@ -282,7 +386,8 @@ namespace Framework
 				!dh.Read(&mtl.m_rgbDiffuseColor) ||
 				!dh.Read(&mtl.m_rgbSpecColor) ||
 				!dh.Read(&mtl.m_specPower) ||
-				!dh.Read(&mtl.m_bumpScale))
+				!dh.Read(&mtl.m_bumpScale) ||
+				!dh.Read(&mtl.m_alphaTest))
 			{
 				return false;
 			}
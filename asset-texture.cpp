@@ -10,16 +10,20 @@
 #include "stb_image_resize.h"
 #pragma warning(pop)
 
+#include <emmintrin.h>
+
 namespace Framework
 {
 	// Infrastructure for compiling textures.
-	//  * All textures are currently in RGBA8 sRGB format, top-down.
+	//  * Textures are top-down, in RGBA8 sRGB format, or block-compressed to one of the BCn
+	//      formats (see asset-bcn.cpp), as chosen by AssetCompileInfo::m_texfmt.
 	//  * Textures are either stored raw, or with mips.  Textures with mips are also
 	//      resampled up to the next pow2 size if necessary.
+	//  * Each mip level is box-filtered from the one above it, in linear space, on several
+	//      threads.  The levels are then block-compressed in parallel.
 	//  * Enable the WRITE_BMP define to additionally write out all images as .bmps
 	//      in the archive, for debugging.
 	//  * !!!UNDONE: Premultiplied alpha
-	//  * !!!UNDONE: BCn compression
 	//  * !!!UNDONE: Other pixel formats: HDR textures, normal maps, etc.
 	//  * !!!UNDONE: Cubemaps, volume textures, sparse tiled textures, etc.
 
@@ -36,21 +40,49 @@ namespace Framework
 			DXGI_FORMAT		m_format;
 		};
 
+		// D3D format for each TEXFMT
+		static const DXGI_FORMAT s_texfmtFormats[] =
+		{
+			DXGI_FORMAT_R8G8B8A8_UNORM_SRGB,		// TEXFMT_RGBA8
+			DXGI_FORMAT_BC1_UNORM_SRGB,				// TEXFMT_BC1
+			DXGI_FORMAT_BC3_UNORM_SRGB,				// TEXFMT_BC3
+			DXGI_FORMAT_BC4_UNORM,					// TEXFMT_BC4
+			DXGI_FORMAT_BC5_UNORM,					// TEXFMT_BC5
+			DXGI_FORMAT_BC7_UNORM_SRGB,				// TEXFMT_BC7
+		};
+		cassert(dim(s_texfmtFormats) == TEXFMT_Count);
+
 		// Prototype various helper functions
-		bool WriteImageToZip(
+		TEXFMT ChooseTexFmt(
+			const AssetCompileInfo * pACI,
+			int2 dims);
+		bool ResampleImage(
+			const byte4 * pPixelsSrc,
+			int2 dimsSrc,
+			byte4 * pPixelsDst,
+			int2 dimsDst,
+			TEXFMT texfmt);
+		bool DownsampleImage(
+			const byte4 * pPixelsSrc,
+			int2 dimsSrc,
+			byte4 * pPixelsDst,
+			int2 dimsDst,
+			TEXFMT texfmt);
+		bool WriteImage(
 			const char * assetPath,
 			int mipLevel,
+			TEXFMT texfmt,
 			const byte4 * pPixels,
 			int2 dims,
-			mz_zip_archive * pZipOut);
+			AssetCompiler::CompiledAsset * pAssetOut);
 
 #if WRITE_BMP
-		bool WriteBMPToZip(
+		bool WriteBMP(
 			const char * assetPath,
 			int mipLevel,
 			const byte4 * pPixels,
 			int2 dims,
-			mz_zip_archive * pZipOut);
+			AssetCompiler::CompiledAsset * pAssetOut);
 #endif
 	}
 
@@ -60,12 +92,12 @@ namespace Framework
 
 	bool CompileTextureRawAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut)
+		AssetCompiler::CompiledAsset * pAssetOut)
 	{
 		ASSERT_ERR(pACI);
 		ASSERT_ERR(pACI->m_pathSrc);
 		ASSERT_ERR(pACI->m_ack == ACK_TextureRaw);
-		ASSERT_ERR(pZipOut);
+		ASSERT_ERR(pAssetOut);
 
 		using namespace AssetCompiler;
 		using namespace TextureCompiler;
@@ -81,16 +113,17 @@ namespace Framework
 		}
 
 		// Fill out the metadata struct
+		TEXFMT texfmt = ChooseTexFmt(pACI, dims);
 		Meta meta =
 		{
 			dims,
 			1,		// mipLevels
-			DXGI_FORMAT_R8G8B8A8_UNORM_SRGB,
+			s_texfmtFormats[texfmt],
 		};
 
 		// Write the data out to the archive
-		if (!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pZipOut) ||
-			!WriteImageToZip(pACI->m_pathSrc, 0, pPixels, dims, pZipOut))
+		if (!WriteAssetData(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pAssetOut) ||
+			!WriteImage(pACI->m_pathSrc, 0, texfmt, pPixels, dims, pAssetOut))
 		{
 			stbi_image_free(pPixels);
 			return false;
@@ -102,12 +135,12 @@ namespace Framework
 
 	bool CompileTextureWithMipsAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut)
+		AssetCompiler::CompiledAsset * pAssetOut)
 	{
 		ASSERT_ERR(pACI);
 		ASSERT_ERR(pACI->m_pathSrc);
 		ASSERT_ERR(pACI->m_ack == ACK_TextureWithMips);
-		ASSERT_ERR(pZipOut);
+		ASSERT_ERR(pAssetOut);
 
 		using namespace AssetCompiler;
 		using namespace TextureCompiler;
@@ -126,16 +159,15 @@ namespace Framework
 		int2 dimsBase;
 		std::vector<byte4> pixelsBase;
 		byte4 * pPixelsBase;
+		int2 dimsPow2 = { pow2_ceil(dims.x), pow2_ceil(dims.y) };
+		TEXFMT texfmt = ChooseTexFmt(pACI, dimsPow2);
 		if (!ispow2(dims.x) || !ispow2(dims.y))
 		{
-			dimsBase = { pow2_ceil(dims.x), pow2_ceil(dims.y) };
+			dimsBase = dimsPow2;
 			pixelsBase.resize(dimsBase.x * dimsBase.y);
 			pPixelsBase = &pixelsBase[0];
 
-			CHECK_ERR(stbir_resize_uint8_srgb(
-						(const byte *)pPixels, dims.x, dims.y, 0,
-						(byte *)pPixelsBase, dimsBase.x, dimsBase.y, 0,
-						4, 3, 0));
+			CHECK_ERR(ResampleImage(pPixels, dims, pPixelsBase, dimsBase, texfmt));
 		}
 		else
 		{
@@ -149,38 +181,54 @@ namespace Framework
 		{
 			dimsBase,
 			mipLevels,
-			DXGI_FORMAT_R8G8B8A8_UNORM_SRGB,
+			s_texfmtFormats[texfmt],
 		};
 
-		// Store the metadata and the base level pixels
-		if (!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pZipOut) ||
-			!WriteImageToZip(pACI->m_pathSrc, 0, pPixelsBase, dimsBase, pZipOut))
+		// Store the metadata
+		if (!WriteAssetData(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pAssetOut))
 		{
 			stbi_image_free(pPixels);
 			return false;
 		}
 
-		// Generate mip levels
-		std::vector<byte4> pixelsMip;
+		// Generate mip levels, each from the one above it
+		std::vector<std::vector<byte4>> pixelsMips(mipLevels);
+		std::vector<const byte4 *> pPixelsLevels(mipLevels);
+		pPixelsLevels[0] = pPixelsBase;
 		for (int level = 1; level < mipLevels; ++level)
 		{
 			int2 dimsMip = CalculateMipDims(dimsBase, level);
-			pixelsMip.resize(dimsMip.x * dimsMip.y);
-			byte4 * pPixelsMip = &pixelsMip[0];
+			pixelsMips[level].resize(dimsMip.x * dimsMip.y);
+			pPixelsLevels[level] = &pixelsMips[level][0];
 
-			CHECK_ERR(stbir_resize_uint8_srgb(
-						(const byte *)pPixels, dims.x, dims.y, 0,
-						(byte *)pPixelsMip, dimsMip.x, dimsMip.y, 0,
-						4, 3, 0));
+			CHECK_ERR(DownsampleImage(
+						pPixelsLevels[level - 1], CalculateMipDims(dimsBase, level - 1),
+						&pixelsMips[level][0], dimsMip,
+						texfmt));
+		}
 
-			if (!WriteImageToZip(pACI->m_pathSrc, level, pPixelsMip, dimsMip, pZipOut))
+		// The levels are independent now, so encode them in parallel, each into its own
+		// buffer, then add them to the asset in order
+		std::vector<CompiledAsset> levelsOut(mipLevels);
+		bool success = ParallelFor(mipLevels, 0, [&](int level)
+		{
+			return WriteImage(pACI->m_pathSrc, level, texfmt, pPixelsLevels[level], CalculateMipDims(dimsBase, level), &levelsOut[level]);
+		});
+
+		stbi_image_free(pPixels);
+		if (!success)
+			return false;
+
+		for (int level = 0; level < mipLevels; ++level)
+		{
+			std::vector<CompiledFile> & files = levelsOut[level].m_files;
+			for (int i = 0, c = int(files.size()); i < c; ++i)
 			{
-				stbi_image_free(pPixels);
-				return false;
+				pAssetOut->m_files.push_back(CompiledFile());
+				std::swap(pAssetOut->m_files.back(), files[i]);
 			}
 		}
 
-		stbi_image_free(pPixels);
 		return true;
 	}
 
@@ -188,18 +236,155 @@ namespace Framework
 
 	namespace TextureCompiler
 	{
-		bool WriteImageToZip(
+		TEXFMT ChooseTexFmt(
+			const AssetCompileInfo * pACI,
+			int2 dims)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pACI->m_texfmt >= 0 && pACI->m_texfmt < TEXFMT_Count);
+
+			// D3D requires the top mip of a block-compressed texture to be whole blocks
+			if (pACI->m_texfmt != TEXFMT_RGBA8 && (dims.x % 4 != 0 || dims.y % 4 != 0))
+			{
+				WARN("Texture %s is %dx%d, not a multiple of 4; compiling it uncompressed",
+					pACI->m_pathSrc, dims.x, dims.y);
+				return TEXFMT_RGBA8;
+			}
+
+			return pACI->m_texfmt;
+		}
+
+		bool ResampleImage(
+			const byte4 * pPixelsSrc,
+			int2 dimsSrc,
+			byte4 * pPixelsDst,
+			int2 dimsDst,
+			TEXFMT texfmt)
+		{
+			// BC4 and BC5 hold linear data, such as heights or normals; everything else is sRGB color
+			if (texfmt == TEXFMT_BC4 || texfmt == TEXFMT_BC5)
+			{
+				return stbir_resize_uint8(
+							(const byte *)pPixelsSrc, dimsSrc.x, dimsSrc.y, 0,
+							(byte *)pPixelsDst, dimsDst.x, dimsDst.y, 0,
+							4) != 0;
+			}
+
+			return stbir_resize_uint8_srgb(
+						(const byte *)pPixelsSrc, dimsSrc.x, dimsSrc.y, 0,
+						(byte *)pPixelsDst, dimsDst.x, dimsDst.y, 0,
+						4, 3, 0) != 0;
+		}
+
+		// Tables for converting between 8-bit and linear float values, either with the sRGB
+		// curve or without.  Going back, linear values are quantized to 12 bits first.
+		struct ConversionTables
+		{
+			float	m_toLinear[256];
+			byte	m_fromLinear[4096];
+
+			ConversionTables(bool sRGB)
+			{
+				for (int i = 0; i < 256; ++i)
+				{
+					float val = float(i) / 255.0f;
+					if (sRGB)
+						val = (val <= 0.04045f) ? val / 12.92f : powf((val + 0.055f) / 1.055f, 2.4f);
+					m_toLinear[i] = val;
+				}
+				for (int i = 0; i < 4096; ++i)
+				{
+					float val = float(i) / 4095.0f;
+					if (sRGB)
+						val = (val <= 0.0031308f) ? val * 12.92f : 1.055f * powf(val, 1.0f / 2.4f) - 0.055f;
+					m_fromLinear[i] = byte(clamp(int(val * 255.0f + 0.5f), 0, 255));
+				}
+			}
+		};
+
+		// These are set up at startup, before any compile threads exist
+		static const ConversionTables s_tablesSRGB(true);
+		static const ConversionTables s_tablesLinear(false);
+
+		bool DownsampleImage(
+			const byte4 * pPixelsSrc,
+			int2 dimsSrc,
+			byte4 * pPixelsDst,
+			int2 dimsDst,
+			TEXFMT texfmt)
+		{
+			ASSERT_ERR(pPixelsSrc);
+			ASSERT_ERR(pPixelsDst);
+			ASSERT_ERR(dimsDst.x == max(dimsSrc.x / 2, 1));
+			ASSERT_ERR(dimsDst.y == max(dimsSrc.y / 2, 1));
+
+			// BC4 and BC5 hold linear data; everything else is sRGB color with linear alpha
+			const ConversionTables & tablesColor = (texfmt == TEXFMT_BC4 || texfmt == TEXFMT_BC5) ? s_tablesLinear : s_tablesSRGB;
+			const ConversionTables & tablesAlpha = s_tablesLinear;
+
+			// Do bands of rows in parallel; small levels come out as a single band, done on this thread
+			static const int s_rowsPerBand = 64;
+			int numBands = (dimsDst.y + s_rowsPerBand - 1) / s_rowsPerBand;
+			return AssetCompiler::ParallelFor(numBands, 0, [&](int iBand)
+			{
+				const __m128 scale = _mm_set1_ps(0.25f * 4095.0f);
+				int yEnd = min((iBand + 1) * s_rowsPerBand, dimsDst.y);
+				for (int y = iBand * s_rowsPerBand; y < yEnd; ++y)
+				{
+					// A dimension that's already down to 1 pixel just gets its one row/column twice
+					const byte4 * pRow0 = pPixelsSrc + min(2 * y, dimsSrc.y - 1) * dimsSrc.x;
+					const byte4 * pRow1 = pPixelsSrc + min(2 * y + 1, dimsSrc.y - 1) * dimsSrc.x;
+					byte4 * pRowDst = pPixelsDst + y * dimsDst.x;
+
+					for (int x = 0; x < dimsDst.x; ++x)
+					{
+						int x0 = min(2 * x, dimsSrc.x - 1);
+						int x1 = min(2 * x + 1, dimsSrc.x - 1);
+						const byte * samples[] =
+						{
+							(const byte *)&pRow0[x0], (const byte *)&pRow0[x1],
+							(const byte *)&pRow1[x0], (const byte *)&pRow1[x1],
+						};
+
+						// Average in linear space, then convert back via the 12-bit table
+						__m128 sum = _mm_setzero_ps();
+						for (int i = 0; i < dim(samples); ++i)
+						{
+							const byte * pSample = samples[i];
+							sum = _mm_add_ps(sum, _mm_set_ps(
+										tablesAlpha.m_toLinear[pSample[3]],
+										tablesColor.m_toLinear[pSample[2]],
+										tablesColor.m_toLinear[pSample[1]],
+										tablesColor.m_toLinear[pSample[0]]));
+						}
+						int indices[4];
+						_mm_storeu_si128((__m128i *)indices, _mm_cvtps_epi32(_mm_mul_ps(sum, scale)));
+
+						byte * pDst = (byte *)&pRowDst[x];
+						pDst[0] = tablesColor.m_fromLinear[indices[0]];
+						pDst[1] = tablesColor.m_fromLinear[indices[1]];
+						pDst[2] = tablesColor.m_fromLinear[indices[2]];
+						pDst[3] = tablesAlpha.m_fromLinear[indices[3]];
+					}
+				}
+				return true;
+			});
+		}
+
+		bool WriteImage(
 			const char * assetPath,
 			int mipLevel,
+			TEXFMT texfmt,
 			const byte4 * pPixels,
 			int2 dims,
-			mz_zip_archive * pZipOut)
+			AssetCompiler::CompiledAsset * pAssetOut)
 		{
 			ASSERT_ERR(assetPath);
 			ASSERT_ERR(mipLevel >= 0);
+			ASSERT_ERR(texfmt >= 0 && texfmt < TEXFMT_Count);
 			ASSERT_ERR(pPixels);
 			ASSERT_ERR(all(dims > 0));
-			ASSERT_ERR(pZipOut);
+			ASSERT_ERR(pAssetOut);
 
 			// Compose the suffix
 			char suffix[16] = {};
@@ -207,28 +392,39 @@ namespace Framework
 
 #if WRITE_BMP
 			// Write a .bmp version of it, too, if we're doing that
-			if (!WriteBMPToZip(assetPath, mipLevel, pPixels, dims, pZipOut))
+			if (!WriteBMP(assetPath, mipLevel, pPixels, dims, pAssetOut))
 				return false;
 #endif
 
-			// Write it to the .zip archive
-			int sizeBytes = dims.x * dims.y * sizeof(byte4);
-			return AssetCompiler::WriteAssetDataToZip(assetPath, suffix, pPixels, sizeBytes, pZipOut);
+			// Write it to the .zip archive, block-compressing it first if necessary
+			if (texfmt == TEXFMT_RGBA8)
+			{
+				int sizeBytes = dims.x * dims.y * sizeof(byte4);
+				return AssetCompiler::WriteAssetData(assetPath, suffix, pPixels, sizeBytes, pAssetOut);
+			}
+
+			std::vector<byte> blocks;
+			if (!AssetCompiler::EncodeBCn(texfmt, pPixels, dims, &blocks))
+			{
+				WARN("Couldn't block-compress mip level %d of texture %s", mipLevel, assetPath);
+				return false;
+			}
+			return AssetCompiler::WriteAssetData(assetPath, suffix, &blocks[0], blocks.size(), pAssetOut);
 		}
 
 #if WRITE_BMP
-		bool WriteBMPToZip(
+		bool WriteBMP(
 			const char * assetPath,
 			int mipLevel,
 			const byte4 * pPixels,
 			int2 dims,
-			mz_zip_archive * pZipOut)
+			AssetCompiler::CompiledAsset * pAssetOut)
 		{
 			ASSERT_ERR(assetPath);
 			ASSERT_ERR(mipLevel >= 0);
 			ASSERT_ERR(pPixels);
 			ASSERT_ERR(all(dims > 0));
-			ASSERT_ERR(pZipOut);
+			ASSERT_ERR(pAssetOut);
 
 			std::vector<byte> buffer;
 			WriteBMPToMemory(pPixels, dims, &buffer);
@@ -238,7 +434,7 @@ namespace Framework
 			sprintf_s(suffix, "/%d.bmp", mipLevel);
 
 			// Write it to the .zip archive
-			return AssetCompiler::WriteAssetDataToZip(assetPath, suffix, &buffer[0], buffer.size(), pZipOut);
+			return AssetCompiler::WriteAssetData(assetPath, suffix, &buffer[0], buffer.size(), pAssetOut);
 		}
 #endif // WRITE_BMP
 	}
@@ -262,7 +458,7 @@ namespace Framework
 
 		// Look for the metadata in the asset pack
 		Meta * pMeta;
-		int metaSize;
+		i64 metaSize;
 		if (!pPack->LookupFile(path, s_suffixMeta, (void **)&pMeta, &metaSize))
 		{
 			WARN("Couldn't find metadata for texture %s in asset pack %s", path, pPack->m_path.c_str());
@@ -270,15 +466,16 @@ namespace Framework
 		}
 		if (metaSize != sizeof(Meta))
 		{
-			WARN("Metadata for texture %s in asset pack %s is wrong size, %d bytes (expected %d)",
-				path, pPack->m_path.c_str(), metaSize, sizeof(Meta));
+			WARN("Metadata for texture %s in asset pack %s is wrong size, %lld bytes (expected %d)",
+				path, pPack->m_path.c_str(), metaSize, int(sizeof(Meta)));
 			return false;
 		}
 		pTexOut->m_dims = pMeta->m_dims;
 		pTexOut->m_mipLevels = pMeta->m_mipLevels;
 		pTexOut->m_format = pMeta->m_format;
 
-		// Look for the individual mipmaps
+		// Look for the individual mipmaps, hashing the path just once for all of them
+		u64 pathHash = HashAssetPath(path);
 		pTexOut->m_apPixels.resize(pTexOut->m_mipLevels);
 		for (int i = 0; i < pTexOut->m_mipLevels; ++i)
 		{
@@ -286,17 +483,16 @@ namespace Framework
 			char suffix[16] = {};
 			sprintf_s(suffix, "/%d", i);
 
-			int pixelsSize;
-			if (!pPack->LookupFile(path, suffix, &pTexOut->m_apPixels[i], &pixelsSize))
+			i64 pixelsSize;
+			if (!pPack->LookupFile(HashAssetPathSuffix(pathHash, suffix), &pTexOut->m_apPixels[i], &pixelsSize))
 			{
 				WARN("Couldn't find mip level %d of texture %s in asset pack %s", i, path, pPack->m_path.c_str());
 				return false;
 			}
-			int2 mipDims = CalculateMipDims(pMeta->m_dims, i);
-			int expectedPixelsSize = mipDims.x * mipDims.y * BitsPerPixel(pMeta->m_format) / 8;
+			int expectedPixelsSize = CalculateMipSizeInBytes(pMeta->m_dims, i, pMeta->m_format);
 			if (pixelsSize != expectedPixelsSize)
 			{
-				WARN("Mip level %d of texture %s in asset pack %s is wrong size, %d bytes (expected %d)",
+				WARN("Mip level %d of texture %s in asset pack %s is wrong size, %lld bytes (expected %d)",
 					i, path, pPack->m_path.c_str(), pixelsSize, expectedPixelsSize);
 				return false;
 			}
@@ -365,8 +561,8 @@ namespace Framework
 		CHECK_ERR(mz_zip_writer_init_heap(&zipWrite, 0, 0));
 
 		// Compile the mesh to it
-		AssetCompileInfo aci = { path, ACK_TextureRaw };
-		if (!AssetCompiler::CompileFullAssetPackToZip(&aci, 1, &zipWrite))
+		AssetCompileInfo aci = { path, ACK_TextureRaw, TEXFMT_RGBA8 };
+		if (!AssetCompiler::CompileFullAssetPackToZip(&aci, 1, AssetCompileOptions(), &zipWrite))
 		{
 			mz_zip_writer_end(&zipWrite);
 			return false;
@@ -389,7 +585,7 @@ namespace Framework
 		AssetPack * pPack = new AssetPack;
 		pPack->m_path = "(in memory)";
 
-		if (!AssetCompiler::LoadAssetPackFromZip(&zipRead, pPack))
+		if (!AssetCompiler::LoadAssetPackFromZip(&zipRead, nullptr, pPack))
 		{
 			mz_zip_writer_end(&zipRead);
 			mz_zip_writer_end(&zipWrite);
@@ -10,26 +10,92 @@ namespace Framework
 	// AssetPack implementation
 
 	AssetPack::AssetPack()
+	:	m_hFile(INVALID_HANDLE_VALUE),
+		m_hMapping(nullptr),
+		m_pMapping(nullptr),
+		m_mappingSize(0),
+		m_pStreamer(nullptr),
+		m_pTrace(nullptr)
 	{
 	}
 
-	bool AssetPack::LookupFile(const char * path, const char * suffix, void ** ppDataOut, int * pSizeOut)
+	AssetPack::~AssetPack()
+	{
+		Reset();
+	}
+
+	bool AssetPack::LookupFile(const char * path, const char * suffix, void ** ppDataOut, i64 * pSizeOut)
 	{
 		ASSERT_ERR(path);
 
-		std::string fullPath = path;
-		if (suffix)
-			fullPath += suffix;
-		CHECK_WARN(AssetCompiler::CheckPathChars(fullPath.c_str()));
-		auto iter = m_directory.find(fullPath);
-		if (iter == m_directory.end())
+		// Check the path really matches, in case of a hash collision with a file that isn't in the pack
+		int iFile = FindFile(HashAssetPath(path, suffix));
+		if (iFile >= 0)
+		{
+			const std::string & filePath = m_files[iFile].m_path;
+			size_t pathLength = strlen(path);
+			if (filePath.compare(0, pathLength, path) != 0 ||
+				strcmp(filePath.c_str() + pathLength, suffix ? suffix : "") != 0)
+			{
+				iFile = -1;
+			}
+		}
+
+		if (iFile < 0)
+		{
+			CHECK_WARN(AssetCompiler::CheckPathChars(path));
+			CHECK_WARN(!suffix || AssetCompiler::CheckPathChars(suffix));
+			return false;
+		}
+
+		return LookupFile(iFile, ppDataOut, pSizeOut);
+	}
+
+	int AssetPack::FindFile(u64 pathHash)
+	{
+		auto iter = std::lower_bound(
+						m_directory.begin(), m_directory.end(), pathHash,
+						[](const DirectoryEntry & entry, u64 hash) { return entry.m_pathHash < hash; });
+		if (iter == m_directory.end() || iter->m_pathHash != pathHash)
+			return -1;
+		return iter->m_iFile;
+	}
+
+	bool AssetPack::LookupFile(u64 pathHash, void ** ppDataOut, i64 * pSizeOut)
+	{
+		int iFile = FindFile(pathHash);
+		if (iFile < 0)
 			return false;
+		return LookupFile(iFile, ppDataOut, pSizeOut);
+	}
+
+	bool AssetPack::LookupFile(int iFile, void ** ppDataOut, i64 * pSizeOut)
+	{
+		ASSERT_ERR(iFile >= 0 && iFile < int(m_files.size()));
 
-		int iFile = iter->second;
 		const FileInfo & fileinfo = m_files[iFile];
 
+		// Note the first lookup of each file, if tracing
+		if (m_pTrace)
+		{
+			std::lock_guard<std::mutex> lock(m_pTrace->m_mutex);
+			if (!m_pTrace->m_accessed[iFile])
+			{
+				m_pTrace->m_accessed[iFile] = 1;
+				m_pTrace->m_order.push_back(iFile);
+			}
+		}
+
+		// On a stack, ask the pack it came from, which waits for it if that's streaming
+		if (!m_layers.empty())
+			return m_layers[fileinfo.m_iLayer]->LookupFile(fileinfo.m_iLayerFile, ppDataOut, pSizeOut);
+
+		// If the pack is still streaming in, wait for this file to land
+		if (m_pStreamer && !m_pStreamer->WaitForFile(iFile))
+			return false;
+
 		if (ppDataOut)
-			*ppDataOut = (fileinfo.m_size > 0) ? &m_data[fileinfo.m_offset] : nullptr;
+			*ppDataOut = (fileinfo.m_size > 0) ? fileinfo.m_pData : nullptr;
 		if (pSizeOut)
 			*pSizeOut = fileinfo.m_size;
 
@@ -41,13 +107,158 @@ namespace Framework
 		return (m_manifest.find(std::string(path)) != m_manifest.end());
 	}
 
+	// The pack in a stack that an asset comes from: the last one that has it, or the
+	// last one overall if none do, so unknown assets get treated as that pack would
+	static AssetPack * FindAssetLayer(AssetPack * pStack, const char * path)
+	{
+		ASSERT_ERR(!pStack->m_layers.empty());
+
+		std::string pathStr(path);
+		for (int i = int(pStack->m_layers.size()) - 1; i >= 0; --i)
+		{
+			if (pStack->m_layers[i]->m_manifest.count(pathStr))
+				return pStack->m_layers[i];
+		}
+		return pStack->m_layers.back();
+	}
+
+	bool AssetPack::IsAssetReady(const char * path)
+	{
+		ASSERT_ERR(path);
+		if (!m_layers.empty())
+			return FindAssetLayer(this, path)->IsAssetReady(path);
+		return !m_pStreamer || m_pStreamer->IsAssetReady(path);
+	}
+
+	void AssetPack::RequestAsset(const char * path)
+	{
+		ASSERT_ERR(path);
+		if (!m_layers.empty())
+			FindAssetLayer(this, path)->RequestAsset(path);
+		else if (m_pStreamer)
+			m_pStreamer->RequestAsset(path);
+	}
+
+	bool AssetPack::WaitForAsset(const char * path)
+	{
+		ASSERT_ERR(path);
+		if (!m_layers.empty())
+			return FindAssetLayer(this, path)->WaitForAsset(path);
+		return !m_pStreamer || m_pStreamer->WaitForAsset(path);
+	}
+
+	bool AssetPack::WaitForAll()
+	{
+		bool success = true;
+		for (int i = 0, c = int(m_layers.size()); i < c; ++i)
+		{
+			if (!m_layers[i]->WaitForAll())
+				success = false;
+		}
+		return success && (!m_pStreamer || m_pStreamer->WaitForAll());
+	}
+
+	void AssetPack::StartAccessTrace()
+	{
+		delete m_pTrace;
+		m_pTrace = new AssetCompiler::AccessTrace;
+		m_pTrace->m_accessed.resize(m_files.size(), 0);
+	}
+
+	bool AssetPack::SaveAccessTrace(const char * tracePath)
+	{
+		ASSERT_ERR(tracePath);
+
+		if (!m_pTrace)
+		{
+			WARN("Asset pack %s isn't being traced", m_path.c_str());
+			return false;
+		}
+
+		FILE * pFile = nullptr;
+		bool success = (fopen_s(&pFile, tracePath, "w") == 0 && pFile);
+		if (success)
+		{
+			for (int i = 0, c = int(m_pTrace->m_order.size()); i < c; ++i)
+				fprintf(pFile, "%s\n", m_files[m_pTrace->m_order[i]].m_path.c_str());
+			success = (fclose(pFile) == 0);
+		}
+		if (!success)
+		{
+			WARN("Couldn't write access trace %s", tracePath);
+		}
+		else
+		{
+			LOG("Saved access trace %s - %d of %d files used",
+				tracePath, int(m_pTrace->m_order.size()), int(m_files.size()));
+		}
+
+		delete m_pTrace;
+		m_pTrace = nullptr;
+		return success;
+	}
+
 	void AssetPack::Reset()
 	{
+		// Stop streaming before anything it might be writing to goes away
+		delete m_pStreamer;
+		m_pStreamer = nullptr;
+		delete m_pTrace;
+		m_pTrace = nullptr;
+
 		m_data.clear();
 		m_files.clear();
 		m_directory.clear();
 		m_manifest.clear();
 		m_path.clear();
+		m_layers.clear();
+
+		if (m_pMapping)
+		{
+			UnmapViewOfFile(m_pMapping);
+			m_pMapping = nullptr;
+		}
+		if (m_hMapping)
+		{
+			CloseHandle(m_hMapping);
+			m_hMapping = nullptr;
+		}
+		if (m_hFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+		}
+		m_mappingSize = 0;
+	}
+
+
+	
+	// Asset path hashing (64-bit FNV-1a)
+
+	namespace AssetCompiler
+	{
+		static const mz_uint64 s_fnvOffsetBasis = 0xcbf29ce484222325ULL;
+		static const mz_uint64 s_fnvPrime = 0x100000001b3ULL;
+
+		static mz_uint64 HashPathChars(mz_uint64 hash, const char * path, size_t length)
+		{
+			for (size_t i = 0; i < length; ++i)
+				hash = (hash ^ byte(path[i])) * s_fnvPrime;
+			return hash;
+		}
+	}
+
+	u64 HashAssetPath(const char * path, const char * suffix /* = nullptr */)
+	{
+		ASSERT_ERR(path);
+		u64 hash = AssetCompiler::HashPathChars(AssetCompiler::s_fnvOffsetBasis, path, strlen(path));
+		return suffix ? HashAssetPathSuffix(hash, suffix) : hash;
+	}
+
+	u64 HashAssetPathSuffix(u64 pathHash, const char * suffix)
+	{
+		ASSERT_ERR(suffix);
+		return AssetCompiler::HashPathChars(pathHash, suffix, strlen(suffix));
 	}
 
 
@@ -56,24 +267,36 @@ namespace Framework
 	{
 		static const char * s_pathVersionInfo = "version";
 		static const char * s_pathManifest = "manifest";
+		static const char * s_pathDirectory = "directory";
 	}
 
 	// Prototype individual compilation functions for different asset types
 
 	bool CompileOBJMeshAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut);
+		AssetCompiler::CompiledAsset * pAssetOut);
 	bool CompileOBJMtlLibAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut);
+		AssetCompiler::CompiledAsset * pAssetOut);
 	bool CompileTextureRawAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut);
+		AssetCompiler::CompiledAsset * pAssetOut);
 	bool CompileTextureWithMipsAsset(
 		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut);
+		AssetCompiler::CompiledAsset * pAssetOut);
+
+	// Prototype dependency scanning functions for asset types that refer to other files
+
+	bool ScanOBJMeshDependencies(
+		const AssetCompileInfo * pACI,
+		std::vector<AssetCompiler::AssetReference> * pRefsOut);
+	bool ScanOBJMtlLibDependencies(
+		const AssetCompileInfo * pACI,
+		ACK textureAck,
+		TEXFMT textureFormat,
+		std::vector<AssetCompiler::AssetReference> * pRefsOut);
 
-	typedef bool (*AssetCompileFunc)(const AssetCompileInfo *, mz_zip_archive *);
+	typedef bool (*AssetCompileFunc)(const AssetCompileInfo *, AssetCompiler::CompiledAsset *);
 	static const AssetCompileFunc s_assetCompileFuncs[] =
 	{
 		&CompileOBJMeshAsset,				// ACK_OBJMesh
@@ -94,13 +317,144 @@ namespace Framework
 
 
 
+	// AssetCompileOptions implementation
+
+	AssetCompileOptions::AssetCompileOptions()
+	:	m_numThreads(0),
+		m_loadAsync(false),
+		m_maxDeadSpace(0.25f),
+		m_dataAlignment(64),
+		m_largeDataAlignment(4096)
+	{
+		for (int i = 0; i < ACK_Count; ++i)
+		{
+			m_compression[i].m_codec = CODEC_None;
+			m_compression[i].m_level = MZ_DEFAULT_LEVEL;
+		}
+	}
+
+
+
+	// Build a list of assets to compile by following references from some root assets.
+	bool FindAssetDependencies(
+		const AssetCompileInfo * roots,
+		int numRoots,
+		ACK textureAck,
+		TEXFMT textureFormat,
+		AssetDependencies * pDepsOut)
+	{
+		ASSERT_ERR(roots);
+		ASSERT_ERR(numRoots > 0);
+		ASSERT_ERR(textureAck == ACK_TextureRaw || textureAck == ACK_TextureWithMips);
+		ASSERT_ERR(textureFormat >= 0 && textureFormat < TEXFMT_Count);
+		ASSERT_ERR(pDepsOut);
+
+		// Build the list with paths as indices into m_paths, since m_paths may still reallocate
+		std::vector<AssetCompileInfo> infos;
+		std::unordered_map<std::string, int> indexForPath;
+		pDepsOut->m_assets.clear();
+		pDepsOut->m_edges.clear();
+		pDepsOut->m_paths.clear();
+
+		for (int i = 0; i < numRoots; ++i)
+		{
+			ASSERT_ERR(roots[i].m_pathSrc);
+			std::string path = roots[i].m_pathSrc;
+			if (indexForPath.insert(std::make_pair(path, int(infos.size()))).second)
+			{
+				pDepsOut->m_paths.push_back(path);
+				infos.push_back(roots[i]);
+			}
+		}
+
+		// Work through the list breadth-first, appending any new assets found along the way
+		std::vector<AssetCompiler::AssetReference> refs;
+		for (int i = 0; i < int(infos.size()); ++i)
+		{
+			pDepsOut->m_edges.push_back(std::vector<int>());
+
+			AssetCompileInfo aci = infos[i];
+			aci.m_pathSrc = pDepsOut->m_paths[i].c_str();
+			refs.clear();
+
+			// Only meshes and material libs refer to other files; only material libs
+			// refer to textures, so they're the only ones that need the texture settings
+			bool scanned;
+			switch (aci.m_ack)
+			{
+			case ACK_OBJMesh:
+				scanned = ScanOBJMeshDependencies(&aci, &refs);
+				break;
+			case ACK_OBJMtlLib:
+				scanned = ScanOBJMtlLibDependencies(&aci, textureAck, textureFormat, &refs);
+				break;
+			default:
+				continue;
+			}
+
+			if (!scanned)
+			{
+				WARN("Couldn't scan %s asset %s for dependencies", s_ackNames[aci.m_ack], aci.m_pathSrc);
+				continue;
+			}
+
+			for (int iRef = 0, cRef = int(refs.size()); iRef < cRef; ++iRef)
+			{
+				const AssetCompiler::AssetReference & ref = refs[iRef];
+
+				auto iter = indexForPath.find(ref.m_path);
+				if (iter == indexForPath.end())
+				{
+					struct _stat refStat;
+					if (_stat(ref.m_path.c_str(), &refStat) != 0)
+					{
+						WARN("%s refers to %s, which doesn't exist; skipping it", pDepsOut->m_paths[i].c_str(), ref.m_path.c_str());
+						continue;
+					}
+
+					iter = indexForPath.insert(std::make_pair(ref.m_path, int(infos.size()))).first;
+					pDepsOut->m_paths.push_back(ref.m_path);
+					AssetCompileInfo info = {};
+					info.m_ack = ref.m_ack;
+					info.m_texfmt = ref.m_texfmt;
+					infos.push_back(info);
+				}
+				else if (infos[iter->second].m_ack != ref.m_ack)
+				{
+					WARN("%s is referred to as both %s and %s; keeping the first",
+						ref.m_path.c_str(), s_ackNames[infos[iter->second].m_ack], s_ackNames[ref.m_ack]);
+				}
+				else if (infos[iter->second].m_texfmt != ref.m_texfmt)
+				{
+					WARN("%s is used as textures of different formats; keeping the first", ref.m_path.c_str());
+				}
+
+				std::vector<int> & edges = pDepsOut->m_edges[i];
+				if (std::find(edges.begin(), edges.end(), iter->second) == edges.end())
+					edges.push_back(iter->second);
+			}
+		}
+
+		// Now the paths are all in place, fill out the compile infos
+		int numAssets = int(infos.size());
+		pDepsOut->m_assets.swap(infos);
+		for (int i = 0; i < numAssets; ++i)
+			pDepsOut->m_assets[i].m_pathSrc = pDepsOut->m_paths[i].c_str();
+
+		LOG("Found %d assets from %d roots", numAssets, numRoots);
+		return true;
+	}
+
+
+
 	// Load an asset pack file, checking that all its assets are present and up to date,
 	// and compiling any that aren't.
 	bool LoadAssetPackOrCompileIfOutOfDate(
 		const char * packPath,
 		const AssetCompileInfo * assets,
 		int numAssets,
-		AssetPack * pPackOut)
+		AssetPack * pPackOut,
+		const AssetCompileOptions * pOptions /* = nullptr */)
 	{
 		ASSERT_ERR(packPath);
 		ASSERT_ERR(assets);
@@ -109,16 +463,23 @@ namespace Framework
 
 		using namespace AssetCompiler;
 
+		AssetCompileOptions optionsDefault;
+		const AssetCompileOptions & options = pOptions ? *pOptions : optionsDefault;
+
+		// Finish off any update that was interrupted before looking at the pack
+		if (!RecoverAssetPack(packPath))
+			return false;
+
 		// Does the asset pack already exist?
 		struct _stat packStat;
 		if (_stat(packPath, &packStat) == 0)
 		{
 			// Check if any assets are out of date
 			std::vector<int> assetsToUpdate;
-			if (!FindOutOfDateAssets(packPath, assets, numAssets, &assetsToUpdate))
+			if (!FindOutOfDateAssets(packPath, assets, numAssets, options, &assetsToUpdate))
 			{
 				LOG("Asset pack %s exists but seems to be corrupt; recompiling it from sources.", packPath);
-				if (!CompileFullAssetPackToFile(packPath, assets, numAssets))
+				if (!CompileFullAssetPackToFile(packPath, assets, numAssets, options))
 					return false;
 			}
 			else if (assetsToUpdate.empty())
@@ -128,226 +489,585 @@ namespace Framework
 			else
 			{
 				LOG("Asset pack %s is out of date; updating.", packPath);
-				if (!UpdateAssetPack(packPath, assets, numAssets, assetsToUpdate))
+				if (!UpdateAssetPack(packPath, assets, numAssets, assetsToUpdate, options))
 					return false;
 			}
 		}
 		else
 		{
 			LOG("Asset pack %s doesn't exist; compiling it from sources.", packPath);
-			if (!CompileFullAssetPackToFile(packPath, assets, numAssets))
+			if (!CompileFullAssetPackToFile(packPath, assets, numAssets, options))
 				return false;
 		}
 
 		// It ought to exist and be up-to-date now, so load it
-		return LoadAssetPack(packPath, pPackOut);
+		return LoadAssetPack(packPath, pPackOut, options.m_loadAsync);
 	}
 
 	// Just load an asset pack file.
 	bool LoadAssetPack(
 		const char * packPath,
-		AssetPack * pPackOut)
+		AssetPack * pPackOut,
+		bool async /* = false */)
 	{
 		ASSERT_ERR(packPath);
 		ASSERT_ERR(pPackOut);
-		
+
+		pPackOut->Reset();
+
+		if (!AssetCompiler::RecoverAssetPack(packPath))
+			return false;
+
+		// Map the whole file into memory; stored files will be used in-place from the mapping.
+		// The view is copy-on-write, so callers are free to scribble on the data they get back
+		// without it going back to disk.
+		pPackOut->m_hFile = CreateFile(
+								packPath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+								OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (pPackOut->m_hFile == INVALID_HANDLE_VALUE)
+		{
+			WARN("Couldn't open asset pack %s", packPath);
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(pPackOut->m_hFile, &fileSize) || fileSize.QuadPart == 0)
+		{
+			WARN("Couldn't get size of asset pack %s, or it's empty", packPath);
+			pPackOut->Reset();
+			return false;
+		}
+		pPackOut->m_mappingSize = fileSize.QuadPart;
+
+		pPackOut->m_hMapping = CreateFileMapping(pPackOut->m_hFile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		if (!pPackOut->m_hMapping)
+		{
+			WARN("Couldn't create file mapping for asset pack %s; error 0x%08x", packPath, GetLastError());
+			pPackOut->Reset();
+			return false;
+		}
+
+		pPackOut->m_pMapping = (byte *)MapViewOfFile(pPackOut->m_hMapping, FILE_MAP_COPY, 0, 0, 0);
+		if (!pPackOut->m_pMapping)
+		{
+			WARN("Couldn't map view of asset pack %s; error 0x%08x", packPath, GetLastError());
+			pPackOut->Reset();
+			return false;
+		}
+
+		pPackOut->m_path = packPath;
+
 		// Load the archive directory
 		mz_zip_archive zip = {};
-		if (!mz_zip_reader_init_file(&zip, packPath, 0))
+		if (!mz_zip_reader_init_mem(&zip, pPackOut->m_pMapping, size_t(pPackOut->m_mappingSize), 0))
 		{
 			WARN("Couldn't load asset pack %s", packPath);
+			pPackOut->Reset();
 			return false;
 		}
 
-		pPackOut->m_path = packPath;
-
-		if (!AssetCompiler::LoadAssetPackFromZip(&zip, pPackOut))
+		std::vector<AssetCompiler::FileExtract> extractsDeferred;
+		if (!AssetCompiler::LoadAssetPackFromZip(&zip, pPackOut->m_pMapping, pPackOut, async ? &extractsDeferred : nullptr))
 		{
 			mz_zip_reader_end(&zip);
+			pPackOut->Reset();
 			return false;
 		}
 
+		if (async)
+		{
+			// The streamer takes over the zip reader from here
+			pPackOut->m_pStreamer = new AssetCompiler::AssetStreamer(pPackOut, &zip, extractsDeferred, 0);
+			LOG("Opened asset pack %s - %dMB mapped, streaming in %d assets",
+				packPath, int(pPackOut->m_mappingSize / 1048576), int(pPackOut->m_manifest.size()));
+			return true;
+		}
+
 		mz_zip_reader_end(&zip);
 
-		LOG("Loaded asset pack %s - %dMB uncompressed", packPath, pPackOut->m_data.size() / 1048576);
+		i64 bytesDecompressed = 0;
+		for (int i = 0, c = int(pPackOut->m_data.size()); i < c; ++i)
+			bytesDecompressed += pPackOut->m_data[i].size();
+		LOG("Loaded asset pack %s - %dMB mapped, %dMB decompressed",
+			packPath, int(pPackOut->m_mappingSize / 1048576), int(bytesDecompressed / 1048576));
 		return true;
 	}
 
+	// Whether a file belongs to any of a set of assets, i.e. its path is one of theirs plus a suffix.
+	static bool IsFileOfAssets(const std::string & path, const std::unordered_set<std::string> & assets)
+	{
+		if (assets.empty())
+			return false;
 
+		for (size_t pos = path.find('/'); pos != std::string::npos; pos = path.find('/', pos + 1))
+		{
+			if (assets.count(path.substr(0, pos)))
+				return true;
+		}
+		return false;
+	}
 
-	namespace AssetCompiler
+	// Mount a stack of loaded asset packs as one.
+	bool MountAssetPacks(
+		AssetPack * const * packs,
+		int numPacks,
+		AssetPack * pPackOut)
 	{
-		// Load an asset pack file from a zip stream (can be in memory or a file).
-		bool LoadAssetPackFromZip(
-			mz_zip_archive * pZip,
-			AssetPack * pPackOut)
+		ASSERT_ERR(packs);
+		ASSERT_ERR(numPacks > 0);
+		ASSERT_ERR(pPackOut);
+
+		// Take references first, in case any of the packs are only held by the old stack
+		std::vector<comptr<AssetPack>> layers(numPacks);
+		for (int i = 0; i < numPacks; ++i)
 		{
-			ASSERT_ERR(pZip);
-			ASSERT_ERR(pPackOut);
+			ASSERT_ERR(packs[i]);
+			ASSERT_ERR(packs[i] != pPackOut);
+			layers[i] = packs[i];
+		}
 
-			const char * packPath = pPackOut->m_path.c_str();
-		
-			int numFiles = int(mz_zip_reader_get_num_files(pZip));
-			pPackOut->m_files.resize(numFiles);
-			pPackOut->m_directory.clear();
-			pPackOut->m_directory.reserve(numFiles);
+		pPackOut->Reset();
 
-			// Run through all the files, build the file list and directory and sum up their sizes
-			int bytesTotal = 0;
-			for (int i = 0; i < numFiles; ++i)
+		// Work down from the top of the stack, taking each file unless a pack above
+		// already supplied its path, or the whole asset it belongs to
+		std::vector<std::vector<AssetPack::DirectoryEntry>> filesTaken(numPacks);
+		std::unordered_map<u64, const std::string *> pathsTaken;
+		std::unordered_set<std::string> assetsAbove;
+		for (int iLayer = numPacks - 1; iLayer >= 0; --iLayer)
+		{
+			AssetPack * pLayer = layers[iLayer];
+			for (int i = 0, c = int(pLayer->m_directory.size()); i < c; ++i)
 			{
-				mz_zip_archive_file_stat fileStat;
-				if (!mz_zip_reader_file_stat(pZip, i, &fileStat))
+				const AssetPack::DirectoryEntry & entry = pLayer->m_directory[i];
+				const std::string & path = pLayer->m_files[entry.m_iFile].m_path;
+
+				auto iter = pathsTaken.find(entry.m_pathHash);
+				if (iter != pathsTaken.end())
 				{
-					WARN("Couldn't read directory entry %d of %d from asset pack %s", i, numFiles, packPath);
-					return false;
+					// Lookups can't tell apart two files with the same hash
+					if (*iter->second != path)
+					{
+						WARN("Files %s and %s in asset pack stack have the same path hash, %016llx",
+							iter->second->c_str(), path.c_str(), entry.m_pathHash);
+						return false;
+					}
+					continue;
 				}
+				if (IsFileOfAssets(path, assetsAbove))
+					continue;
 
-				AssetPack::FileInfo * pFileInfo = &pPackOut->m_files[i];
-				pFileInfo->m_path = fileStat.m_filename;
-				pFileInfo->m_offset = bytesTotal;
-				pFileInfo->m_size = int(fileStat.m_uncomp_size);
-
-				pPackOut->m_directory.insert(std::make_pair(pFileInfo->m_path, i));
-
-				bytesTotal += int(fileStat.m_uncomp_size);
+				pathsTaken[entry.m_pathHash] = &path;
+				filesTaken[iLayer].push_back(entry);
 			}
 
-			// Allocate memory to store the decompressed data
-			pPackOut->m_data.resize(bytesTotal);
+			assetsAbove.insert(pLayer->m_manifest.begin(), pLayer->m_manifest.end());
+		}
 
-			// Decompress all the files
-			for (int i = 0; i < numFiles; ++i)
+		// Build the file list, bottom pack first and in pack order within each, and the
+		// merged directory
+		for (int iLayer = 0; iLayer < numPacks; ++iLayer)
+		{
+			AssetPack * pLayer = layers[iLayer];
+			std::vector<AssetPack::DirectoryEntry> & entries = filesTaken[iLayer];
+			std::sort(entries.begin(), entries.end(), [](const AssetPack::DirectoryEntry & a, const AssetPack::DirectoryEntry & b)
 			{
-				AssetPack::FileInfo * pFileInfo = &pPackOut->m_files[i];
+				return a.m_iFile < b.m_iFile;
+			});
 
-				// Skip zero size files (trailing ones will cause an std::vector assert)
-				if (pFileInfo->m_size == 0)
-					continue;
+			for (int i = 0, c = int(entries.size()); i < c; ++i)
+			{
+				AssetPack::FileInfo fileinfo = pLayer->m_files[entries[i].m_iFile];
+				fileinfo.m_iLayer = iLayer;
+				fileinfo.m_iLayerFile = entries[i].m_iFile;
 
-				if (!mz_zip_reader_extract_to_mem(
-						pZip, i,
-						&pPackOut->m_data[pFileInfo->m_offset],
-						pFileInfo->m_size, 0))
-				{
-					WARN("Couldn't extract file %s (index %d of %d) from asset pack %s",
-						pFileInfo->m_path.c_str(), i, numFiles, packPath);
-					return false;
-				}
+				AssetPack::DirectoryEntry entry = { entries[i].m_pathHash, int(pPackOut->m_files.size()) };
+				pPackOut->m_files.push_back(fileinfo);
+				pPackOut->m_directory.push_back(entry);
 			}
 
-			// Extract the version info
-			VersionInfo * pVerInfo;
-			int verInfoSize;
-			if (!pPackOut->LookupFile(s_pathVersionInfo, nullptr, (void **)&pVerInfo, &verInfoSize))
-			{
-				WARN("Couldn't find version info in asset pack %s", packPath);
-				return false;
-			}
-			if (verInfoSize != sizeof(VersionInfo))
-			{
-				WARN("Version info in asset pack %s is wrong size, %d bytes (expected %d)",
-					packPath, verInfoSize, sizeof(VersionInfo));
-				return false;
-			}
+			pPackOut->m_manifest.insert(pLayer->m_manifest.begin(), pLayer->m_manifest.end());
 
-			// Check that all the versions are correct
-			if (pVerInfo->m_packver != PACKVER_Current)
+			if (iLayer > 0)
+				pPackOut->m_path += " + ";
+			pPackOut->m_path += pLayer->m_path;
+		}
+		std::sort(
+			pPackOut->m_directory.begin(), pPackOut->m_directory.end(),
+			[](const AssetPack::DirectoryEntry & a, const AssetPack::DirectoryEntry & b)
 			{
-				WARN("Asset pack %s has wrong pack version %d (expected %d)", packPath, pVerInfo->m_packver, PACKVER_Current);
-				return false;
-			}
-			if (pVerInfo->m_meshver != MESHVER_Current)
+				return a.m_pathHash < b.m_pathHash;
+			});
+
+		pPackOut->m_layers.swap(layers);
+
+		LOG("Mounted asset pack stack %s - %d files", pPackOut->m_path.c_str(), int(pPackOut->m_files.size()));
+		return true;
+	}
+
+	// Load asset pack files, and mount them as a stack.
+	bool LoadAssetPackStack(
+		const char * const * packPaths,
+		int numPacks,
+		AssetPack * pPackOut,
+		bool async /* = false */)
+	{
+		ASSERT_ERR(packPaths);
+		ASSERT_ERR(numPacks > 0);
+		ASSERT_ERR(pPackOut);
+
+		std::vector<comptr<AssetPack>> layers(numPacks);
+		std::vector<AssetPack *> packs(numPacks);
+		for (int i = 0; i < numPacks; ++i)
+		{
+			layers[i] = new AssetPack;
+			if (!LoadAssetPack(packPaths[i], layers[i], async))
 			{
-				WARN("Asset pack %s has wrong mesh version %d (expected %d)", packPath, pVerInfo->m_meshver, MESHVER_Current);
+				pPackOut->Reset();
 				return false;
 			}
-			if (pVerInfo->m_mtlver != MTLVER_Current)
-			{
-				WARN("Asset pack %s has wrong material version %d (expected %d)", packPath, pVerInfo->m_mtlver, MTLVER_Current);
-				return false;
+			packs[i] = layers[i];
+		}
+
+		return MountAssetPacks(&packs[0], numPacks, pPackOut);
+	}
+
+
+
+	namespace AssetCompiler
+	{
+		// Each asset has a file recording what it was compiled from, consisting of a
+		// SourcesHeader followed by a SourceInfo and path string for each source file.
+		static const char * s_suffixSources = "/sources";
+
+		struct SourcesHeader
+		{
+			mz_uint64	m_optionsHash;		// Hash of the compiler version and options for this asset
+			int			m_numSources;
+			int			m_padding;
+		};
+
+		struct SourceInfo
+		{
+			mz_uint64	m_hash;				// Hash of the file contents
+			int			m_pathLength;		// Path follows immediately, without a terminating zero
+			int			m_padding;
+		};
+
+		// Source files' sizes and mod times, with their content hashes, are cached in a file
+		// next to the pack, consisting of a SourceStatsHeader followed by a SourceStatRecord and
+		// path string for each file.  When a source's size and mod time still match, its hash is
+		// taken from here rather than reading the file.  This stays out of the pack itself, as
+		// it's particular to this machine's copy of the sources.
+		static const char * s_suffixSourceStats = ".srcstat";
+		static const mz_uint32 s_sourceStatsMagic = 0x53534152;		// "RASS"
+
+		struct SourceStat
+		{
+			i64			m_size;
+			i64			m_mtime;
+			mz_uint64	m_hash;
+		};
+		typedef std::unordered_map<std::string, SourceStat> SourceStatMap;
+
+		struct SourceStatsHeader
+		{
+			mz_uint32	m_magic;
+			int			m_numFiles;
+		};
+
+		struct SourceStatRecord
+		{
+			SourceStat	m_stat;
+			int			m_pathLength;		// Path follows immediately, without a terminating zero
+			int			m_padding;
+		};
+
+		// Load the source stat cache for a pack.  If it's missing or malformed, this just comes
+		// back empty, and everything gets hashed.
+		static void LoadSourceStats(const char * packPath, SourceStatMap * pStatsOut)
+		{
+			ASSERT_ERR(packPath);
+			ASSERT_ERR(pStatsOut);
+
+			pStatsOut->clear();
+
+			std::vector<byte> data;
+			std::string statsPath = std::string(packPath) + s_suffixSourceStats;
+			if (GetFileAttributes(statsPath.c_str()) == INVALID_FILE_ATTRIBUTES ||
+				!LoadFile(statsPath.c_str(), &data))
+			{
+				return;
 			}
-			if (pVerInfo->m_texver != TEXVER_Current)
+
+			SourceStatsHeader header;
+			if (data.size() < sizeof(header))
+				return;
+			memcpy(&header, &data[0], sizeof(header));
+			if (header.m_magic != s_sourceStatsMagic)
+				return;
+
+			size_t offset = sizeof(header);
+			for (int i = 0; i < header.m_numFiles; ++i)
 			{
-				WARN("Asset pack %s has wrong texture version %d (expected %d)", packPath, pVerInfo->m_texver, TEXVER_Current);
-				return false;
+				SourceStatRecord record;
+				if (data.size() - offset < sizeof(record))
+					break;
+				memcpy(&record, &data[offset], sizeof(record));
+				offset += sizeof(record);
+
+				if (record.m_pathLength < 0 || data.size() - offset < size_t(record.m_pathLength))
+					break;
+				std::string path((const char *)&data[offset], record.m_pathLength);
+				offset += record.m_pathLength;
+
+				(*pStatsOut)[path] = record.m_stat;
 			}
+		}
 
-			// Extract the manifest
-			const char * pManifest;
-			int manifestSize;
-			if (!pPackOut->LookupFile(s_pathManifest, nullptr, (void **)&pManifest, &manifestSize))
+		// Write out the source stat cache for a pack.  Failing to is only worth a warning.
+		static void SaveSourceStats(const char * packPath, const SourceStatMap & stats)
+		{
+			ASSERT_ERR(packPath);
+
+			SourceStatsHeader header = { s_sourceStatsMagic, int(stats.size()) };
+			std::vector<byte> data((const byte *)&header, (const byte *)(&header + 1));
+			for (auto iter = stats.begin(); iter != stats.end(); ++iter)
 			{
-				WARN("Couldn't find manifest in asset pack %s", packPath);
-				return false;
+				SourceStatRecord record = {};
+				record.m_stat = iter->second;
+				record.m_pathLength = int(iter->first.size());
+				data.insert(data.end(), (const byte *)&record, (const byte *)(&record + 1));
+				data.insert(data.end(), iter->first.begin(), iter->first.end());
 			}
-			ParseManifest(pManifest, manifestSize, packPath, &pPackOut->m_manifest);
 
-			return true;
+			std::string statsPath = std::string(packPath) + s_suffixSourceStats;
+			FILE * pFile = nullptr;
+			bool success = (fopen_s(&pFile, statsPath.c_str(), "wb") == 0 && pFile);
+			if (success)
+			{
+				success = (fwrite(&data[0], 1, data.size(), pFile) == data.size());
+				success = (fclose(pFile) == 0) && success;
+			}
+			if (!success)
+			{
+				WARN("Couldn't write source stat cache %s", statsPath.c_str());
+			}
 		}
 
-		// Check that filenames are printable-ASCII-only, lowercase, and there are no backslashes
-		// (this should really be generalized to allow UTF-8 printable chars)
-		bool CheckPathChars(const char * path)
+		// Hash everything besides the source files that affects how an asset compiles
+		mz_uint64 HashAssetOptions(const AssetCompileInfo * pACI, const AssetCompileOptions & options)
 		{
-			ASSERT_ERR(path);
+			ASSERT_ERR(pACI);
 
-			for (const char * pCh = path; *pCh; ++pCh)
+			ACK ack = pACI->m_ack;
+			int version = 0;
+			switch (ack)
 			{
-				if (*pCh < 32 || (*pCh >= 'A' && *pCh <= 'Z') || *pCh > 126 || *pCh == '\\')
+			case ACK_OBJMesh:				version = MESHVER_Current;	break;
+			case ACK_OBJMtlLib:				version = MTLVER_Current;	break;
+			case ACK_TextureRaw:
+			case ACK_TextureWithMips:		version = TEXVER_Current;	break;
+			default:
+				ERR("Missing case for ACK %d", ack);
+				break;
+			}
+
+			int values[] =
+			{
+				PACKVER_Current,
+				ack,
+				version,
+				options.m_compression[ack].m_codec,
+				options.m_compression[ack].m_level,
+				pACI->m_texfmt,
+				pACI->m_meshopt,
+				pACI->m_vtxfmt,
+				pACI->m_splitForIndex16,
+				pACI->m_lodCount,
+				pACI->m_normalWeight,
+				0,				// m_weldPosTolerance bits
+				0,				// m_weldNormalTolerance bits
+				0,				// m_weldUVTolerance bits
+				0,				// m_lodRatio bits
+			};
+			memcpy(&values[dim(values) - 4], &pACI->m_weldPosTolerance, sizeof(float));
+			memcpy(&values[dim(values) - 3], &pACI->m_weldNormalTolerance, sizeof(float));
+			memcpy(&values[dim(values) - 2], &pACI->m_weldUVTolerance, sizeof(float));
+			memcpy(&values[dim(values) - 1], &pACI->m_lodRatio, sizeof(float));
+			return HashData(values, sizeof(values));
+		}
+
+		// Write out the record of an asset's source files, with their current contents hashed.
+		// This only holds paths and hashes, so the same sources give the same record anywhere.
+		static bool WriteAssetSources(
+			const AssetCompileInfo * pACI,
+			const AssetCompileOptions & options,
+			CompiledAsset * pAsset)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pAsset);
+
+			SourcesHeader header = {};
+			header.m_optionsHash = HashAssetOptions(pACI, options);
+			header.m_numSources = int(pAsset->m_sources.size());
+
+			std::vector<byte> data((const byte *)&header, (const byte *)(&header + 1));
+			for (int i = 0; i < header.m_numSources; ++i)
+			{
+				const std::string & path = pAsset->m_sources[i];
+
+				SourceInfo info = {};
+				if (!HashFile(path.c_str(), &info.m_hash))
 				{
-					WARN("Invalid character %c in path %s", *pCh, path);
+					WARN("Couldn't read source file %s", path.c_str());
 					return false;
 				}
+				info.m_pathLength = int(path.size());
+
+				data.insert(data.end(), (const byte *)&info, (const byte *)(&info + 1));
+				data.insert(data.end(), path.begin(), path.end());
 			}
 
-			return true;
+			return WriteAssetData(pACI->m_pathSrc, s_suffixSources, &data[0], data.size(), pAsset);
 		}
 
-		// Write a memory buffer out to an asset pack .zip file.
-		bool WriteAssetDataToZip(
-			const char * assetPath,
-			const char * assetSuffix,
-			const void * pData,
-			size_t sizeBytes,
-			mz_zip_archive * pZipOut)
+		// Check an asset's source record against the source files on disk.
+		// Returns true if the asset is up to date.  Sources that had to be hashed, as they
+		// weren't in the stat cache or had changed size or mod time, are added to pNewStatsOut.
+		static bool CheckAssetSources(
+			const AssetCompileInfo * pACI,
+			const AssetCompileOptions & options,
+			const std::vector<byte> & sources,
+			const SourceStatMap & stats,
+			SourceStatMap * pNewStatsOut)
 		{
-			ASSERT_ERR(assetPath);
-			ASSERT_ERR(sizeBytes >= 0);
-			ASSERT_ERR(pData || sizeBytes == 0);
-			ASSERT_ERR(pZipOut);
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pNewStatsOut);
 
-			// Compose the path, but detect if it's too long
-			if (assetSuffix)
+			SourcesHeader header;
+			if (sources.size() < sizeof(header))
+				return false;
+			memcpy(&header, &sources[0], sizeof(header));
+
+			if (header.m_optionsHash != HashAssetOptions(pACI, options))
+				return false;
+
+			size_t offset = sizeof(header);
+			for (int i = 0; i < header.m_numSources; ++i)
 			{
-				char zipPath[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1] = {};
-				if (_snprintf_s(zipPath, _TRUNCATE, "%s%s", assetPath, assetSuffix) < 0)
-				{
-					WARN("File path %s%s is too long for .zip format", assetPath, assetSuffix);
+				SourceInfo info;
+				if (sources.size() - offset < sizeof(info))
 					return false;
-				}
+				memcpy(&info, &sources[offset], sizeof(info));
+				offset += sizeof(info);
+
+				if (info.m_pathLength < 0 || sources.size() - offset < size_t(info.m_pathLength))
+					return false;
+				std::string path((const char *)&sources[offset], info.m_pathLength);
+				offset += info.m_pathLength;
 
-				CHECK_WARN(CheckPathChars(zipPath));
+				// If the source file doesn't exist, that's OK!  Asset packs can be
+				// distributed in lieu of source files.
+				struct _stat srcStat;
+				if (_stat(path.c_str(), &srcStat) != 0)
+					continue;
 
-				if (!mz_zip_writer_add_mem(pZipOut, zipPath, pData, sizeBytes, MZ_NO_COMPRESSION))
+				// If size and mod time match the cache, assume the file hasn't changed since it
+				// was hashed; otherwise, hash it again, as it might not have really changed
+				mz_uint64 hash;
+				auto iter = stats.find(path);
+				if (iter != stats.end() &&
+					iter->second.m_size == i64(srcStat.st_size) &&
+					iter->second.m_mtime == i64(srcStat.st_mtime))
 				{
-					WARN("Couldn't add file %s to archive", zipPath);
-					return false;
+					hash = iter->second.m_hash;
 				}
-			}
-			else
-			{
-				if (strlen(assetPath) > MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE)
+				else
 				{
-					WARN("File path %s is too long for .zip format", assetPath);
-					return false;
+					if (!HashFile(path.c_str(), &hash))
+						return false;
+					SourceStat stat = { i64(srcStat.st_size), i64(srcStat.st_mtime), hash };
+					(*pNewStatsOut)[path] = stat;
 				}
 
-				CHECK_WARN(CheckPathChars(assetPath));
+				if (hash != info.m_hash)
+					return false;
+			}
+
+			return true;
+		}
+
+		// Files smaller than this aren't worth compressing
+		static const size_t s_minCompressSize = 256;
+
+		// Files compressed with our LZ codec are marked with this zip file comment
+		static const char s_commentLZ[] = "lz";
 
-				if (!mz_zip_writer_add_mem(pZipOut, assetPath, pData, sizeBytes, MZ_NO_COMPRESSION))
+		// Compress the files in a compiled asset, according to a compression policy.
+		// Files that don't get any smaller are left uncompressed.
+		static bool CompressCompiledAsset(
+			const AssetCompression & compression,
+			CompiledAsset * pAsset)
+		{
+			ASSERT_ERR(compression.m_codec >= 0 && compression.m_codec < CODEC_Count);
+			ASSERT_ERR(pAsset);
+
+			if (compression.m_codec == CODEC_None)
+				return true;
+
+			for (int i = 0, c = int(pAsset->m_files.size()); i < c; ++i)
+			{
+				CompiledFile * pFile = &pAsset->m_files[i];
+				size_t uncompSize = pFile->m_data.size();
+				if (uncompSize < s_minCompressSize)
+					continue;
+
+				switch (compression.m_codec)
 				{
-					WARN("Couldn't add file %s to archive", assetPath);
+				case CODEC_Deflate:
+					{
+						// Raw deflate stream, as zip wants it
+						size_t compSize;
+						void * pComp = tdefl_compress_mem_to_heap(
+											&pFile->m_data[0], uncompSize, &compSize,
+											tdefl_create_comp_flags_from_zip_params(
+												clamp(compression.m_level, 1, int(MZ_UBER_COMPRESSION)),
+												-MZ_DEFAULT_WINDOW_BITS,
+												MZ_DEFAULT_STRATEGY));
+						if (!pComp)
+						{
+							WARN("Couldn't deflate file %s", pFile->m_path.c_str());
+							return false;
+						}
+						if (compSize < uncompSize)
+						{
+							pFile->m_crc = mz_uint32(mz_crc32(MZ_CRC32_INIT, &pFile->m_data[0], uncompSize));
+							pFile->m_uncompSize = uncompSize;
+							pFile->m_codec = CODEC_Deflate;
+							pFile->m_data.assign((const byte *)pComp, (const byte *)pComp + compSize);
+						}
+						mz_free(pComp);
+					}
+					break;
+
+				case CODEC_LZ:
+					{
+						std::vector<byte> comp;
+						if (!LZCompress(&pFile->m_data[0], uncompSize, &comp))
+						{
+							WARN("Couldn't LZ compress file %s", pFile->m_path.c_str());
+							return false;
+						}
+						if (comp.size() < uncompSize)
+						{
+							pFile->m_codec = CODEC_LZ;
+							pFile->m_data.swap(comp);
+						}
+					}
+					break;
+
+				default:
+					ASSERT_ERR(false);
 					return false;
 				}
 			}
@@ -355,248 +1075,2091 @@ namespace Framework
 			return true;
 		}
 
-		// Parse an asset pack manifest (newline-delimited list of names) into a set structure.
-		void ParseManifest(
-			const char * manifest,
-			int manifestSize,
-			const char * path,
-			std::unordered_set<std::string> * pManifestOut)
-		{
-			ASSERT_ERR(manifest);
-			ASSERT_ERR(manifestSize > 0);
-			ASSERT_ERR(pManifestOut);
 
-			// Make a copy so that we can parse destructively
-			std::vector<char> manifestCopy(manifestSize + 1);
-			memcpy(&manifestCopy[0], manifest, manifestSize);
 
-			TextParsingHelper tph(&manifestCopy[0], path);
-			while (tph.NextLine())
+		// Threads busy compiling assets or running ParallelFor work, across the whole process.
+		// ParallelFor only starts threads for cores that aren't already busy, so when it's
+		// nested (the compilers call it from compile queue workers, and texture mip levels
+		// call it again per level) the inner loops run on the calling thread rather than
+		// starting cores-cubed threads, and only spread out once the outer work tails off.
+		static std::atomic<int> s_numBusyThreads(0);
+
+		// Claim up to numWanted idle cores for new threads; returns how many were claimed,
+		// which must be handed back with ReleaseCores
+		static int ClaimCores(int numWanted)
+		{
+			int numCores = max(int(std::thread::hardware_concurrency()), 1);
+			int numBusy = s_numBusyThreads;
+			for (;;)
 			{
-				pManifestOut->insert(std::string(tph.NextToken()));
-				tph.ExpectEOL();
+				int numClaimed = min(numWanted, numCores - numBusy);
+				if (numClaimed <= 0)
+					return 0;
+				if (s_numBusyThreads.compare_exchange_weak(numBusy, numBusy + numClaimed))
+					return numClaimed;
 			}
 		}
 
-		// Compile an entire asset pack from scratch, to a .zip file on disk.
-		bool CompileFullAssetPackToFile(
-			const char * packPath,
+		static void ReleaseCores(int numCores)
+		{
+			s_numBusyThreads -= numCores;
+		}
+
+
+
+		// AssetCompileQueue implementation
+
+		AssetCompileQueue::AssetCompileQueue(
 			const AssetCompileInfo * assets,
-			int numAssets)
+			const int * assetIndices,
+			int numAssetIndices,
+			const AssetCompileOptions & options)
+		:	m_assets(assets),
+			m_options(options),
+			m_assetIndices(assetIndices, assetIndices + numAssetIndices),
+			m_results(numAssetIndices),
+			m_states(numAssetIndices, STATE_Pending),
+			m_iNextToCompile(0),
+			m_iNextToRelease(0),
+			m_maxInFlight(0),
+			m_quit(false)
 		{
-			ASSERT_ERR(packPath);
 			ASSERT_ERR(assets);
-			ASSERT_ERR(numAssets > 0);
+			ASSERT_ERR(assetIndices || numAssetIndices == 0);
 
-			mz_zip_archive zip = {};
-			if (!mz_zip_writer_init_file(&zip, packPath, 0))
+			int numThreads = options.m_numThreads;
+			if (numThreads <= 0)
+				numThreads = max(int(std::thread::hardware_concurrency()), 1);
+			numThreads = min(numThreads, numAssetIndices);
+
+			// With only one thread's worth of work, just compile on the calling thread
+			// as each asset is asked for
+			if (numThreads <= 1)
+				return;
+
+			// Let workers get a little ahead of the consumer, but not arbitrarily far
+			m_maxInFlight = 2 * numThreads;
+
+			m_threads.reserve(numThreads);
+			for (int i = 0; i < numThreads; ++i)
+				m_threads.push_back(std::thread(&AssetCompileQueue::WorkerThreadMain, this));
+		}
+
+		AssetCompileQueue::~AssetCompileQueue()
+		{
 			{
-				WARN("Couldn't open %s for writing", packPath);
-				return false;
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_quit = true;
 			}
+			m_cvWork.notify_all();
 
-			bool success = CompileFullAssetPackToZip(assets, numAssets, &zip);
+			for (int i = 0, c = int(m_threads.size()); i < c; ++i)
+				m_threads[i].join();
+		}
 
-			if (!mz_zip_writer_finalize_archive(&zip))
+		bool AssetCompileQueue::WaitForAsset(int i, CompiledAsset ** ppAssetOut)
+		{
+			ASSERT_ERR(i >= 0 && i < int(m_assetIndices.size()));
+			ASSERT_ERR(i >= m_iNextToRelease);
+			ASSERT_ERR(ppAssetOut);
+
+			*ppAssetOut = &m_results[i];
+
+			if (m_threads.empty())
 			{
-				WARN("Couldn't finalize archive");
-				success = false;
+				if (m_states[i] == STATE_Pending)
+					m_states[i] = CompileAsset(i) ? STATE_Succeeded : STATE_Failed;
+				return (m_states[i] == STATE_Succeeded);
 			}
 
-			mz_zip_writer_end(&zip);
-			return success;
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cvDone.wait(lock, [this, i]() { return m_states[i] == STATE_Succeeded || m_states[i] == STATE_Failed; });
+			return (m_states[i] == STATE_Succeeded);
 		}
 
-		// Compile an entire asset pack from scratch, to a zip stream (can be in memory or a file).
-		bool CompileFullAssetPackToZip(
-			const AssetCompileInfo * assets,
-			int numAssets,
-			mz_zip_archive * pZipOut)
+		void AssetCompileQueue::ReleaseAsset(int i)
 		{
-			ASSERT_ERR(assets);
-			ASSERT_ERR(numAssets > 0);
-			ASSERT_ERR(pZipOut);
+			ASSERT_ERR(i == m_iNextToRelease);
 
-			// !!!UNDONE: not nicely generating entries in the .zip for directories in the internal paths.
-			// Doesn't seem to matter as .zip viewers handle it fine, but maybe we should do that anyway?
+			// Swap with an empty object to really free the memory
+			CompiledAsset().m_files.swap(m_results[i].m_files);
 
-			std::string manifest;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				++m_iNextToRelease;
+			}
+			m_cvWork.notify_all();
+		}
 
-			int numErrors = 0;
-			for (int iAsset = 0; iAsset < numAssets; ++iAsset)
+		void AssetCompileQueue::WorkerThreadMain()
+		{
+			int numAssetIndices = int(m_assetIndices.size());
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			for (;;)
 			{
-				const AssetCompileInfo * pACI = &assets[iAsset];
-				ACK ack = pACI->m_ack;
-				ASSERT_ERR(ack >= 0 && ack < ACK_Count);
-			
-				LOG("[%d/%d] Compiling %s asset %s...", iAsset+1, numAssets, s_ackNames[ack], pACI->m_pathSrc);
+				// Wait for a job that's within the in-flight window
+				m_cvWork.wait(lock, [this, numAssetIndices]()
+				{
+					return m_quit ||
+						   m_iNextToCompile >= numAssetIndices ||
+						   m_iNextToCompile < m_iNextToRelease + m_maxInFlight;
+				});
+				if (m_quit || m_iNextToCompile >= numAssetIndices)
+					return;
+
+				int i = m_iNextToCompile++;
+				m_states[i] = STATE_Compiling;
+
+				lock.unlock();
+				++s_numBusyThreads;
+				bool success = CompileAsset(i);
+				ReleaseCores(1);
+				lock.lock();
+
+				m_states[i] = success ? STATE_Succeeded : STATE_Failed;
+				m_cvDone.notify_all();
+			}
+		}
+
+		bool AssetCompileQueue::CompileAsset(int i)
+		{
+			const AssetCompileInfo * pACI = &m_assets[m_assetIndices[i]];
+			ACK ack = pACI->m_ack;
+			ASSERT_ERR(ack >= 0 && ack < ACK_Count);
+
+			LOG("[%d/%d] Compiling %s asset %s...", i+1, int(m_assetIndices.size()), s_ackNames[ack], pACI->m_pathSrc);
 
-				// Compile the asset
-				if (s_assetCompileFuncs[ack](pACI, pZipOut))
+			// See if someone's compiled this exact asset before
+			mz_uint64 cacheKey = 0;
+			bool useCache = !m_options.m_cacheDirs.empty() &&
+							ComputeCacheKey(pACI, m_options, &cacheKey);
+			if (useCache && LookupCompileCache(pACI, m_options, cacheKey, &m_results[i]))
+			{
+				LOG("Found asset %s in compile cache", pACI->m_pathSrc);
+			}
+			else
+			{
+				m_results[i].m_sources.push_back(pACI->m_pathSrc);
+				if (!s_assetCompileFuncs[ack](pACI, &m_results[i]))
 				{
-					// Write asset name to the manifest
-					manifest += pACI->m_pathSrc;
-					manifest += '\n';
+					WARN("Couldn't compile asset %s", pACI->m_pathSrc);
+					return false;
 				}
-				else
+
+				// Compress here, so it's spread across the worker threads too
+				if (!CompressCompiledAsset(m_options.m_compression[ack], &m_results[i]))
 				{
-					WARN("Couldn't compile asset %s", pACI->m_pathSrc);
-					++numErrors;
+					WARN("Couldn't compress asset %s", pACI->m_pathSrc);
+					return false;
 				}
-			}
 
-			if (numErrors > 0)
-			{
-				WARN("Failed to compile %d of %d assets", numErrors, numAssets);
+				if (useCache)
+					StoreCompileCache(pACI, m_options, cacheKey, &m_results[i]);
 			}
 
-			// Write version info
-			VersionInfo version =
+			// Record what went into it, so we can tell when it needs recompiling
+			if (!WriteAssetSources(pACI, m_options, &m_results[i]))
 			{
-				PACKVER_Current,
-				MESHVER_Current,
-				MTLVER_Current,
-				TEXVER_Current,
-			};
-			if (!WriteAssetDataToZip(s_pathVersionInfo, nullptr, &version, sizeof(version), pZipOut))
-				return false;
-
-			// Write manifest
-			if (!WriteAssetDataToZip(s_pathManifest, nullptr, &manifest[0], manifest.length(), pZipOut))
+				WARN("Couldn't record sources for asset %s", pACI->m_pathSrc);
 				return false;
+			}
 
-			return (numErrors == 0);
+			return true;
 		}
 
-		// Check if any assets in a pack are out of date by version number or mod time,
-		// returning a list of ones that need updating.
-		bool FindOutOfDateAssets(
-			const char * packPath,
-			const AssetCompileInfo * assets,
-			int numAssets,
-			std::vector<int> * pAssetsToUpdateOut)
+
+
+		// AssetStreamer implementation
+
+		AssetStreamer::AssetStreamer(
+			AssetPack * pPack,
+			mz_zip_archive * pZip,
+			const std::vector<FileExtract> & extracts,
+			int numThreads)
+		:	m_pPack(pPack),
+			m_zip(*pZip),
+			m_extracts(extracts),
+			m_extractForFile(pPack->m_files.size(), -1),
+			m_jobForFile(pPack->m_files.size(), -1),
+			m_iNextBackgroundJob(0),
+			m_numJobsDone(0),
+			m_numJobsFailed(0),
+			m_quit(false)
 		{
-			ASSERT_ERR(packPath);
-			ASSERT_ERR(assets);
-			ASSERT_ERR(numAssets > 0);
-			ASSERT_ERR(pAssetsToUpdateOut);
+			ASSERT_ERR(pPack);
+			ASSERT_ERR(pZip);
 
-			// Load the archive directory
-			mz_zip_archive zip = {};
-			if (!mz_zip_reader_init_file(&zip, packPath, 0))
-			{
-				WARN("Couldn't load asset pack %s", packPath);
-				return false;
-			}
+			for (int i = 0, c = int(extracts.size()); i < c; ++i)
+				m_extractForFile[extracts[i].m_iFile] = i;
 
-			// Extract the version info
+			// Group files into jobs by asset; files are named "<asset path>/<suffix>".
+			// Pack-level files with no directory were already loaded, and aren't part of any job.
+			for (int i = 0, c = int(pPack->m_files.size()); i < c; ++i)
+			{
+				const std::string & path = pPack->m_files[i].m_path;
+				size_t iSlash = path.rfind('/');
+				if (iSlash == std::string::npos)
+				{
+					ASSERT_WARN(m_extractForFile[i] < 0);
+					continue;
+				}
+
+				std::string assetPath = path.substr(0, iSlash);
+				auto iter = m_jobForAsset.find(assetPath);
+				if (iter == m_jobForAsset.end())
+				{
+					iter = m_jobForAsset.insert(std::make_pair(assetPath, int(m_jobs.size()))).first;
+					m_jobs.push_back(Job());
+					m_jobs.back().m_assetPath = assetPath;
+					m_jobs.back().m_state = STATE_Pending;
+				}
+
+				m_jobs[iter->second].m_files.push_back(i);
+				m_jobForFile[i] = iter->second;
+			}
+
+			if (numThreads <= 0)
+				numThreads = max(int(std::thread::hardware_concurrency()), 1);
+			numThreads = min(numThreads, int(m_jobs.size()));
+
+			m_threads.reserve(numThreads);
+			for (int i = 0; i < numThreads; ++i)
+				m_threads.push_back(std::thread(&AssetStreamer::WorkerThreadMain, this));
+		}
+
+		AssetStreamer::~AssetStreamer()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_quit = true;
+			}
+
+			for (int i = 0, c = int(m_threads.size()); i < c; ++i)
+				m_threads[i].join();
+
+			mz_zip_reader_end(&m_zip);
+		}
+
+		bool AssetStreamer::WaitForFile(int iFile)
+		{
+			ASSERT_ERR(iFile >= 0 && iFile < int(m_jobForFile.size()));
+
+			int iJob = m_jobForFile[iFile];
+			if (iJob < 0)
+				return true;
+
+			return WaitForJob(iJob);
+		}
+
+		bool AssetStreamer::IsAssetReady(const char * assetPath)
+		{
+			auto iter = m_jobForAsset.find(std::string(assetPath));
+			if (iter == m_jobForAsset.end())
+				return false;
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return (m_jobs[iter->second].m_state == STATE_Succeeded);
+		}
+
+		void AssetStreamer::RequestAsset(const char * assetPath)
+		{
+			auto iter = m_jobForAsset.find(std::string(assetPath));
+			if (iter == m_jobForAsset.end())
+			{
+				WARN("Asset %s isn't in asset pack %s", assetPath, m_pPack->m_path.c_str());
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			RequestJob(iter->second);
+		}
+
+		bool AssetStreamer::WaitForAsset(const char * assetPath)
+		{
+			auto iter = m_jobForAsset.find(std::string(assetPath));
+			if (iter == m_jobForAsset.end())
+			{
+				WARN("Asset %s isn't in asset pack %s", assetPath, m_pPack->m_path.c_str());
+				return false;
+			}
+
+			return WaitForJob(iter->second);
+		}
+
+		bool AssetStreamer::WaitForAll()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			int numJobs = int(m_jobs.size());
+			m_cvDone.wait(lock, [this, numJobs]() { return m_numJobsDone == numJobs; });
+			return (m_numJobsFailed == 0);
+		}
+
+		void AssetStreamer::RequestJob(int iJob)
+		{
+			// Requests are served most-recent first, since that's most likely what
+			// the caller is about to block on
+			if (m_jobs[iJob].m_state == STATE_Pending)
+				m_jobsRequested.push_front(iJob);
+		}
+
+		bool AssetStreamer::WaitForJob(int iJob)
+		{
+			ASSERT_ERR(iJob >= 0 && iJob < int(m_jobs.size()));
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			const Job & job = m_jobs[iJob];
+			RequestJob(iJob);
+
+			m_cvDone.wait(lock, [&job]() { return job.m_state == STATE_Succeeded || job.m_state == STATE_Failed; });
+			return (job.m_state == STATE_Succeeded);
+		}
+
+		void AssetStreamer::WorkerThreadMain()
+		{
+			int numJobs = int(m_jobs.size());
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			for (;;)
+			{
+				// Take the most recent request if there is one, else carry on through the pack
+				int iJob = -1;
+				while (iJob < 0 && !m_quit)
+				{
+					if (!m_jobsRequested.empty())
+					{
+						iJob = m_jobsRequested.front();
+						m_jobsRequested.pop_front();
+					}
+					else if (m_iNextBackgroundJob < numJobs)
+					{
+						iJob = m_iNextBackgroundJob++;
+					}
+					else
+					{
+						// Background work is all handed out; only requests can still turn up,
+						// and only for jobs that are already in progress, so we're done
+						return;
+					}
+
+					// Skip jobs that were requested more than once, or already taken
+					if (m_jobs[iJob].m_state != STATE_Pending)
+						iJob = -1;
+				}
+				if (m_quit)
+					return;
+
+				m_jobs[iJob].m_state = STATE_Loading;
+
+				lock.unlock();
+				bool success = LoadJob(iJob);
+				lock.lock();
+
+				m_jobs[iJob].m_state = success ? STATE_Succeeded : STATE_Failed;
+				++m_numJobsDone;
+				if (!success)
+					++m_numJobsFailed;
+				if (m_numJobsDone == numJobs)
+				{
+					LOG("Finished streaming asset pack %s%s",
+						m_pPack->m_path.c_str(), (m_numJobsFailed > 0) ? " (with errors)" : "");
+				}
+				m_cvDone.notify_all();
+			}
+		}
+
+		bool AssetStreamer::LoadJob(int iJob)
+		{
+			static const int s_pageSize = 4096;
+
+			const Job & job = m_jobs[iJob];
+			for (int i = 0, c = int(job.m_files.size()); i < c; ++i)
+			{
+				int iFile = job.m_files[i];
+				const AssetPack::FileInfo & fileinfo = m_pPack->m_files[iFile];
+				if (fileinfo.m_size == 0)
+					continue;
+
+				int iExtract = m_extractForFile[iFile];
+				if (iExtract >= 0)
+				{
+					const FileExtract & extract = m_extracts[iExtract];
+					for (int iChunk = 0, numChunks = GetNumExtractChunks(extract); iChunk < numChunks; ++iChunk)
+					{
+						if (!ExtractFileChunk(&m_zip, extract, iChunk, m_pPack))
+							return false;
+					}
+				}
+				else
+				{
+					// Touch each page of the file, to fault it in from disk
+					const volatile byte * pTouch = fileinfo.m_pData;
+					for (i64 ofs = 0; ofs < fileinfo.m_size; ofs += s_pageSize)
+						(void)pTouch[ofs];
+					(void)pTouch[fileinfo.m_size - 1];
+				}
+			}
+
+			return true;
+		}
+
+
+
+		// Find where a stored (uncompressed) file's data starts within the archive, by parsing
+		// its local header.  Returns nullptr if the file isn't stored or the header looks bad.
+		static byte * FindStoredFileData(
+			mz_zip_archive * pZip,
+			byte * pArchive,
+			const mz_zip_archive_file_stat & fileStat)
+		{
+			// Only plain stored files can be used in-place
+			if (fileStat.m_method != 0 ||
+				(fileStat.m_bit_flag & 0x1) != 0 ||
+				fileStat.m_comp_size != fileStat.m_uncomp_size)
+			{
+				return nullptr;
+			}
+
+			static const mz_uint32 s_localHeaderSig = 0x04034b50;
+			static const mz_uint64 s_localHeaderSize = 30;
+
+			mz_uint64 ofsHeader = fileStat.m_local_header_ofs;
+			if (ofsHeader + s_localHeaderSize > pZip->m_archive_size)
+				return nullptr;
+
+			const byte * pHeader = pArchive + ofsHeader;
+			mz_uint32 sig = pHeader[0] | (pHeader[1] << 8) | (pHeader[2] << 16) | (mz_uint32(pHeader[3]) << 24);
+			if (sig != s_localHeaderSig)
+				return nullptr;
+
+			// Filename and extra field lengths live at offsets 26 and 28 in the local header
+			mz_uint64 filenameLength = pHeader[26] | (pHeader[27] << 8);
+			mz_uint64 extraLength = pHeader[28] | (pHeader[29] << 8);
+			mz_uint64 ofsData = ofsHeader + s_localHeaderSize + filenameLength + extraLength;
+			if (ofsData + fileStat.m_uncomp_size > pZip->m_archive_size)
+				return nullptr;
+
+			return pArchive + ofsData;
+		}
+
+		// Is this file compressed with our LZ codec?
+		static bool IsLZFile(const mz_zip_archive_file_stat & fileStat)
+		{
+			return (fileStat.m_method == 0 &&
+					fileStat.m_comment_size == strlen(s_commentLZ) &&
+					memcmp(fileStat.m_comment, s_commentLZ, fileStat.m_comment_size) == 0);
+		}
+
+		int GetNumExtractChunks(const FileExtract & extract)
+		{
+			int numChunks = 1;
+			if (extract.m_pLZ)
+				LZReadHeader(extract.m_pLZ, extract.m_lzSize, nullptr, &numChunks);
+			return numChunks;
+		}
+
+		bool ExtractFileChunk(
+			mz_zip_archive * pZip,
+			const FileExtract & extract,
+			int iChunk,
+			AssetPack * pPack)
+		{
+			ASSERT_ERR(pZip);
+			ASSERT_ERR(pPack);
+
+			const AssetPack::FileInfo & fileinfo = pPack->m_files[extract.m_iFile];
+
+			if (extract.m_pLZ)
+			{
+				// LZ files are limited to int sizes by the codec
+				if (!LZDecompressChunk(extract.m_pLZ, extract.m_lzSize, iChunk, fileinfo.m_pData, int(fileinfo.m_size)))
+				{
+					WARN("Couldn't decompress file %s (chunk %d) from asset pack %s; LZ data is corrupt",
+						fileinfo.m_path.c_str(), iChunk, pPack->m_path.c_str());
+					return false;
+				}
+			}
+			else
+			{
+				// Reading from memory, miniz is safe to extract from several threads at once
+				ASSERT_ERR(iChunk == 0);
+				if (!mz_zip_reader_extract_to_mem(pZip, extract.m_iFile, fileinfo.m_pData, size_t(fileinfo.m_size), 0))
+				{
+					WARN("Couldn't extract file %s (index %d of %d) from asset pack %s",
+						fileinfo.m_path.c_str(), extract.m_iFile, int(pPack->m_files.size()), pPack->m_path.c_str());
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		bool ParallelFor(
+			int count,
+			int numThreads,
+			const std::function<bool (int)> & func)
+		{
+			ASSERT_ERR(count >= 0);
+
+			if (numThreads <= 0)
+				numThreads = max(int(std::thread::hardware_concurrency()), 1);
+			numThreads = min(numThreads, count);
+
+			std::atomic<int> iNext(0);
+			std::atomic<int> numFailed(0);
+			auto worker = [&]()
+			{
+				for (int i = iNext++; i < count; i = iNext++)
+				{
+					if (!func(i))
+						++numFailed;
+				}
+			};
+
+			// The calling thread pitches in as well, and new threads only go on idle cores
+			int numNewThreads = ClaimCores(numThreads - 1);
+			std::vector<std::thread> threads;
+			threads.reserve(numNewThreads);
+			for (int i = 0; i < numNewThreads; ++i)
+				threads.push_back(std::thread(worker));
+			worker();
+			for (int i = 0, c = int(threads.size()); i < c; ++i)
+				threads[i].join();
+			ReleaseCores(numNewThreads);
+
+			return (numFailed == 0);
+		}
+
+		// Files that have to be extracted are decoded into blocks of about this size, rather than
+		// one allocation for the lot, so a big pack never needs gigabytes of contiguous memory.
+		// Files bigger than this get a block to themselves.
+		static const i64 s_extractBlockSize = 64 * 1024 * 1024;
+
+		// Extracted files start at a multiple of this in their block, like the default
+		// AssetCompileOptions::m_dataAlignment for files used in-place, so data such as mesh
+		// blobs can be used directly with aligned SIMD loads whichever way they were stored
+		static const i64 s_extractAlignment = 64;
+
+		// Load an asset pack file from a zip stream (can be in memory or a file).
+		// If pArchive is non-null, it must be the whole archive in memory, outliving the pack;
+		// stored files are then pointed at in-place rather than being copied out.
+		bool LoadAssetPackFromZip(
+			mz_zip_archive * pZip,
+			byte * pArchive,
+			AssetPack * pPackOut,
+			std::vector<FileExtract> * pExtractsDeferredOut /* = nullptr */)
+		{
+			ASSERT_ERR(pZip);
+			ASSERT_ERR(pPackOut);
+
+			// Deferred LZ files need their source data to stick around
+			ASSERT_ERR(pArchive || !pExtractsDeferredOut);
+
+			const char * packPath = pPackOut->m_path.c_str();
+		
+			int numFiles = int(mz_zip_reader_get_num_files(pZip));
+			pPackOut->m_files.resize(numFiles);
+			pPackOut->m_directory.clear();
+
+			// The pack's own bookkeeping files, found by name as we go
+			int iVersionInfo = -1;
+			int iManifest = -1;
+			int iDirectory = -1;
+
+			// LZ streams that had to be pulled out of an archive that isn't in memory
+			std::deque<std::vector<byte>> lzBuffers;
+
+			// Run through all the files, build the file list and directory, and locate the ones
+			// we can use in-place
+			std::vector<FileExtract> extracts;
+			for (int i = 0; i < numFiles; ++i)
+			{
+				mz_zip_archive_file_stat fileStat;
+				if (!mz_zip_reader_file_stat(pZip, i, &fileStat))
+				{
+					WARN("Couldn't read directory entry %d of %d from asset pack %s", i, numFiles, packPath);
+					return false;
+				}
+
+				AssetPack::FileInfo * pFileInfo = &pPackOut->m_files[i];
+				pFileInfo->m_path = fileStat.m_filename;
+				pFileInfo->m_pData = nullptr;
+				pFileInfo->m_size = i64(fileStat.m_uncomp_size);
+				pFileInfo->m_iLayer = -1;
+				pFileInfo->m_iLayerFile = -1;
+
+				if (strcmp(fileStat.m_filename, s_pathVersionInfo) == 0)
+					iVersionInfo = i;
+				else if (strcmp(fileStat.m_filename, s_pathManifest) == 0)
+					iManifest = i;
+				else if (strcmp(fileStat.m_filename, s_pathDirectory) == 0)
+					iDirectory = i;
+
+				if (pFileInfo->m_size == 0)
+					continue;
+
+				FileExtract extract = { i, nullptr, 0 };
+				if (IsLZFile(fileStat))
+				{
+					// Find the LZ stream, and get the real size from its header
+					const byte * pLZ = pArchive ? FindStoredFileData(pZip, pArchive, fileStat) : nullptr;
+					if (!pLZ)
+					{
+						lzBuffers.push_back(std::vector<byte>(size_t(pFileInfo->m_size)));
+						if (!mz_zip_reader_extract_to_mem(pZip, i, &lzBuffers.back()[0], size_t(pFileInfo->m_size), 0))
+						{
+							WARN("Couldn't extract file %s (index %d of %d) from asset pack %s",
+								pFileInfo->m_path.c_str(), i, numFiles, packPath);
+							return false;
+						}
+						pLZ = &lzBuffers.back()[0];
+					}
+
+					extract.m_pLZ = pLZ;
+					extract.m_lzSize = size_t(pFileInfo->m_size);
+					int lzUncompSize;
+					if (!LZReadHeader(pLZ, extract.m_lzSize, &lzUncompSize, nullptr))
+					{
+						WARN("File %s (index %d of %d) in asset pack %s has a bad LZ header",
+							pFileInfo->m_path.c_str(), i, numFiles, packPath);
+						return false;
+					}
+					pFileInfo->m_size = lzUncompSize;
+				}
+				else if (pArchive)
+				{
+					pFileInfo->m_pData = FindStoredFileData(pZip, pArchive, fileStat);
+					if (pFileInfo->m_pData)
+						continue;
+				}
+
+				extracts.push_back(extract);
+			}
+
+			// Lay out the files that couldn't be used in-place in blocks, in pack order and
+			// aligned, then allocate the blocks and point the files into them
+			std::vector<i64> blockSizes;
+			std::vector<std::pair<int, i64>> extractLocations;		// Block index and offset in it
+			int iBlockOpen = -1;
+			for (int i = 0, c = int(extracts.size()); i < c; ++i)
+			{
+				i64 size = pPackOut->m_files[extracts[i].m_iFile].m_size;
+				if (size > s_extractBlockSize)
+				{
+					extractLocations.push_back(std::make_pair(int(blockSizes.size()), i64(0)));
+					blockSizes.push_back(size);
+					continue;
+				}
+				i64 offset = (iBlockOpen < 0) ? 0 : (blockSizes[iBlockOpen] + s_extractAlignment - 1) & ~(s_extractAlignment - 1);
+				if (iBlockOpen < 0 || offset + size > s_extractBlockSize)
+				{
+					iBlockOpen = int(blockSizes.size());
+					blockSizes.push_back(0);
+					offset = 0;
+				}
+				extractLocations.push_back(std::make_pair(iBlockOpen, offset));
+				blockSizes[iBlockOpen] = offset + size;
+			}
+
+			// The heap doesn't promise the alignment, so allocate a little extra and skip
+			// ahead to an aligned start in each block
+			pPackOut->m_data.resize(blockSizes.size());
+			for (int i = 0, c = int(blockSizes.size()); i < c; ++i)
+				pPackOut->m_data[i].resize(size_t(blockSizes[i] + s_extractAlignment - 1));
+			for (int i = 0, c = int(extracts.size()); i < c; ++i)
+			{
+				std::vector<byte> & block = pPackOut->m_data[extractLocations[i].first];
+				size_t blockStart = size_t(-intptr_t(&block[0]) & intptr_t(s_extractAlignment - 1));
+				pPackOut->m_files[extracts[i].m_iFile].m_pData = &block[blockStart + size_t(extractLocations[i].second)];
+			}
+
+			// Leave files belonging to assets for the streamer, if we have one
+			if (pExtractsDeferredOut)
+			{
+				pExtractsDeferredOut->clear();
+				std::vector<FileExtract> extractsNow;
+				for (int i = 0, c = int(extracts.size()); i < c; ++i)
+				{
+					if (strchr(pPackOut->m_files[extracts[i].m_iFile].m_path.c_str(), '/'))
+						pExtractsDeferredOut->push_back(extracts[i]);
+					else
+						extractsNow.push_back(extracts[i]);
+				}
+				extracts.swap(extractsNow);
+			}
+
+			// Decompress everything else, spreading big LZ files across threads by chunk
+			std::vector<std::pair<int, int>> chunks;
+			for (int i = 0, c = int(extracts.size()); i < c; ++i)
+			{
+				for (int iChunk = 0, numChunks = GetNumExtractChunks(extracts[i]); iChunk < numChunks; ++iChunk)
+					chunks.push_back(std::make_pair(i, iChunk));
+			}
+			if (!ParallelFor(int(chunks.size()), 0, [&](int i)
+				{
+					return ExtractFileChunk(pZip, extracts[chunks[i].first], chunks[i].second, pPackOut);
+				}))
+			{
+				WARN("Couldn't decompress asset pack %s", packPath);
+				return false;
+			}
+
+			// Extract the version info
+			VersionInfo * pVerInfo;
+			i64 verInfoSize;
+			if (iVersionInfo < 0 || !pPackOut->LookupFile(iVersionInfo, (void **)&pVerInfo, &verInfoSize))
+			{
+				WARN("Couldn't find version info in asset pack %s", packPath);
+				return false;
+			}
+			if (verInfoSize != sizeof(VersionInfo))
+			{
+				WARN("Version info in asset pack %s is wrong size, %lld bytes (expected %d)",
+					packPath, verInfoSize, int(sizeof(VersionInfo)));
+				return false;
+			}
+
+			// Check that all the versions are correct
+			if (pVerInfo->m_packver != PACKVER_Current)
+			{
+				WARN("Asset pack %s has wrong pack version %d (expected %d)", packPath, pVerInfo->m_packver, PACKVER_Current);
+				return false;
+			}
+			if (pVerInfo->m_meshver != MESHVER_Current)
+			{
+				WARN("Asset pack %s has wrong mesh version %d (expected %d)", packPath, pVerInfo->m_meshver, MESHVER_Current);
+				return false;
+			}
+			if (pVerInfo->m_mtlver != MTLVER_Current)
+			{
+				WARN("Asset pack %s has wrong material version %d (expected %d)", packPath, pVerInfo->m_mtlver, MTLVER_Current);
+				return false;
+			}
+			if (pVerInfo->m_texver != TEXVER_Current)
+			{
+				WARN("Asset pack %s has wrong texture version %d (expected %d)", packPath, pVerInfo->m_texver, TEXVER_Current);
+				return false;
+			}
+
+			// Extract the directory, checking it's sorted and covers every other file
+			const PathHashEntry * pDirectory;
+			i64 directorySize;
+			if (iDirectory < 0 || !pPackOut->LookupFile(iDirectory, (void **)&pDirectory, &directorySize))
+			{
+				WARN("Couldn't find directory in asset pack %s", packPath);
+				return false;
+			}
+			if (directorySize != i64(numFiles - 1) * i64(sizeof(PathHashEntry)))
+			{
+				WARN("Directory in asset pack %s is wrong size, %lld bytes (expected %lld)",
+					packPath, directorySize, i64(numFiles - 1) * i64(sizeof(PathHashEntry)));
+				return false;
+			}
+			int numEntries = numFiles - 1;
+			pPackOut->m_directory.resize(numEntries);
+			for (int i = 0; i < numEntries; ++i)
+			{
+				const PathHashEntry & entry = pDirectory[i];
+				if (entry.m_iFile >= mz_uint32(numFiles) ||
+					(i > 0 && entry.m_pathHash <= pDirectory[i - 1].m_pathHash))
+				{
+					WARN("Directory in asset pack %s is corrupt at entry %d of %d", packPath, i, numEntries);
+					pPackOut->m_directory.clear();
+					return false;
+				}
+				pPackOut->m_directory[i].m_pathHash = entry.m_pathHash;
+				pPackOut->m_directory[i].m_iFile = int(entry.m_iFile);
+			}
+
+			// Extract the manifest
+			const char * pManifest;
+			i64 manifestSize;
+			if (iManifest < 0 || !pPackOut->LookupFile(iManifest, (void **)&pManifest, &manifestSize))
+			{
+				WARN("Couldn't find manifest in asset pack %s", packPath);
+				return false;
+			}
+			ParseManifest(pManifest, int(manifestSize), packPath, &pPackOut->m_manifest);
+
+			return true;
+		}
+
+		// Check that filenames are printable-ASCII-only, lowercase, and there are no backslashes
+		// (this should really be generalized to allow UTF-8 printable chars)
+		bool CheckPathChars(const char * path)
+		{
+			ASSERT_ERR(path);
+
+			for (const char * pCh = path; *pCh; ++pCh)
+			{
+				if (*pCh < 32 || (*pCh >= 'A' && *pCh <= 'Z') || *pCh > 126 || *pCh == '\\')
+				{
+					WARN("Invalid character %c in path %s", *pCh, path);
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		// Compose the internal path for an asset's file, and check that it's valid for the .zip.
+		static bool ComposeZipPath(
+			const char * assetPath,
+			const char * assetSuffix,
+			char (&zipPathOut)[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1])
+		{
+			ASSERT_ERR(assetPath);
+
+			// Compose the path, but detect if it's too long
+			if (_snprintf_s(zipPathOut, _TRUNCATE, "%s%s", assetPath, assetSuffix ? assetSuffix : "") < 0)
+			{
+				WARN("File path %s%s is too long for .zip format", assetPath, assetSuffix ? assetSuffix : "");
+				return false;
+			}
+
+			CHECK_WARN(CheckPathChars(zipPathOut));
+
+			return true;
+		}
+
+		// Files at least this big get AssetCompileOptions::m_largeDataAlignment
+		static const size_t s_largeDataSize = 64 * 1024;
+
+		// Alignment for the data of a file stored uncompressed in a pack, so it can be used
+		// in-place from the mapping with aligned loads, or uploaded to the GPU with aligned copies.
+		static mz_uint DataAlignment(size_t sizeBytes, const AssetCompileOptions & options)
+		{
+			int alignment = (sizeBytes >= s_largeDataSize) ? options.m_largeDataAlignment : options.m_dataAlignment;
+			ASSERT_ERR(alignment >= 0 && alignment <= 32768);		// miniz's limit
+			ASSERT_ERR(ispow2(alignment));
+			return mz_uint(alignment);
+		}
+
+		// Write a memory buffer out to an asset pack .zip file.
+		bool WriteAssetDataToZip(
+			const char * assetPath,
+			const char * assetSuffix,
+			const void * pData,
+			size_t sizeBytes,
+			const AssetCompileOptions & options,
+			mz_zip_archive * pZipOut,
+			PathHashDirectory * pDirectory)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(sizeBytes >= 0);
+			ASSERT_ERR(pData || sizeBytes == 0);
+			ASSERT_ERR(pZipOut);
+			ASSERT_ERR(pDirectory);
+
+			char zipPath[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1] = {};
+			if (!ComposeZipPath(assetPath, assetSuffix, zipPath))
+				return false;
+
+			if (!mz_zip_writer_add_mem_ex_aligned(
+					pZipOut, zipPath, pData, sizeBytes, nullptr, 0, MZ_NO_COMPRESSION, 0, 0,
+					DataAlignment(sizeBytes, options)))
+			{
+				WARN("Couldn't add file %s to archive", zipPath);
+				return false;
+			}
+			pDirectory->AddFile(HashAssetPath(zipPath), pZipOut);
+
+			return true;
+		}
+
+		// Copy a memory buffer into a compiled asset, to be written to the pack later.
+		bool WriteAssetData(
+			const char * assetPath,
+			const char * assetSuffix,
+			const void * pData,
+			size_t sizeBytes,
+			CompiledAsset * pAssetOut)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(pData || sizeBytes == 0);
+			ASSERT_ERR(pAssetOut);
+
+			char zipPath[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1] = {};
+			if (!ComposeZipPath(assetPath, assetSuffix, zipPath))
+				return false;
+
+			pAssetOut->m_files.push_back(CompiledFile());
+			CompiledFile * pFile = &pAssetOut->m_files.back();
+			pFile->m_path = zipPath;
+			pFile->m_data.assign((const byte *)pData, (const byte *)pData + sizeBytes);
+			pFile->m_codec = CODEC_None;
+			pFile->m_uncompSize = sizeBytes;
+			pFile->m_crc = 0;
+
+			return true;
+		}
+
+		// Write all the files in a compiled asset out to an asset pack .zip file.
+		// Only files stored uncompressed get aligned; the others are decompressed to the heap anyway.
+		bool WriteCompiledAssetToZip(
+			const CompiledAsset * pAsset,
+			const AssetCompileOptions & options,
+			mz_zip_archive * pZipOut,
+			PathHashDirectory * pDirectory)
+		{
+			ASSERT_ERR(pAsset);
+			ASSERT_ERR(pZipOut);
+			ASSERT_ERR(pDirectory);
+
+			for (int i = 0, c = int(pAsset->m_files.size()); i < c; ++i)
+			{
+				const CompiledFile * pFile = &pAsset->m_files[i];
+				const void * pData = pFile->m_data.empty() ? nullptr : &pFile->m_data[0];
+
+				bool success = false;
+				switch (pFile->m_codec)
+				{
+				case CODEC_None:
+					success = mz_zip_writer_add_mem_ex_aligned(
+								pZipOut, pFile->m_path.c_str(), pData, pFile->m_data.size(),
+								nullptr, 0, MZ_NO_COMPRESSION, 0, 0,
+								DataAlignment(pFile->m_data.size(), options)) != 0;
+					break;
+
+				case CODEC_Deflate:
+					success = mz_zip_writer_add_mem_ex(
+								pZipOut, pFile->m_path.c_str(), pData, pFile->m_data.size(),
+								nullptr, 0, MZ_DEFAULT_LEVEL | MZ_ZIP_FLAG_COMPRESSED_DATA,
+								pFile->m_uncompSize, pFile->m_crc) != 0;
+					break;
+
+				case CODEC_LZ:
+					success = mz_zip_writer_add_mem_ex(
+								pZipOut, pFile->m_path.c_str(), pData, pFile->m_data.size(),
+								s_commentLZ, mz_uint16(strlen(s_commentLZ)), MZ_NO_COMPRESSION,
+								0, 0) != 0;
+					break;
+
+				default:
+					ASSERT_ERR(false);
+					break;
+				}
+
+				if (!success)
+				{
+					WARN("Couldn't add file %s to archive", pFile->m_path.c_str());
+					return false;
+				}
+				pDirectory->AddFile(HashAssetPath(pFile->m_path.c_str()), pZipOut);
+			}
+
+			return true;
+		}
+
+		// PathHashDirectory implementation
+
+		PathHashDirectory::PathHashDirectory()
+		:	m_numFilesBefore(0)
+		{
+		}
+
+		void PathHashDirectory::AddFile(mz_uint64 pathHash, const mz_zip_archive * pZip)
+		{
+			ASSERT_ERR(pZip);
+			ASSERT_ERR(pZip->m_total_files > 0);
+
+			PathHashEntry entry = { pathHash, mz_uint32(m_numFilesBefore) + pZip->m_total_files - 1, 0 };
+			m_entries.push_back(entry);
+		}
+
+		// Sort the directory and write it out to an asset pack .zip file.
+		bool WritePathHashDirectoryToZip(
+			PathHashDirectory * pDirectory,
+			const AssetCompileOptions & options,
+			mz_zip_archive * pZipOut)
+		{
+			ASSERT_ERR(pDirectory);
+			ASSERT_ERR(pZipOut);
+
+			std::vector<PathHashEntry> & entries = pDirectory->m_entries;
+			std::sort(entries.begin(), entries.end(), [](const PathHashEntry & a, const PathHashEntry & b)
+			{
+				return a.m_pathHash < b.m_pathHash;
+			});
+
+			// Lookups can't tell apart two files with the same hash
+			for (int i = 1, c = int(entries.size()); i < c; ++i)
+			{
+				if (entries[i].m_pathHash == entries[i - 1].m_pathHash)
+				{
+					WARN("Files %d and %d in archive have the same path hash, %016llx",
+						entries[i - 1].m_iFile, entries[i].m_iFile, entries[i].m_pathHash);
+					return false;
+				}
+			}
+
+			const void * pData = entries.empty() ? nullptr : &entries[0];
+			size_t sizeBytes = entries.size() * sizeof(PathHashEntry);
+			if (!mz_zip_writer_add_mem_ex_aligned(
+					pZipOut, s_pathDirectory, pData, sizeBytes, nullptr, 0, MZ_NO_COMPRESSION, 0, 0,
+					DataAlignment(sizeBytes, options)))
+			{
+				WARN("Couldn't add file %s to archive", s_pathDirectory);
+				return false;
+			}
+
+			return true;
+		}
+
+		// Parse an asset pack manifest (newline-delimited list of names) into a set structure.
+		void ParseManifest(
+			const char * manifest,
+			int manifestSize,
+			const char * path,
+			std::unordered_set<std::string> * pManifestOut)
+		{
+			ASSERT_ERR(manifest);
+			ASSERT_ERR(manifestSize > 0);
+			ASSERT_ERR(pManifestOut);
+
+			// Make a copy so that we can parse destructively
+			std::vector<char> manifestCopy(manifestSize + 1);
+			memcpy(&manifestCopy[0], manifest, manifestSize);
+
+			TextParsingHelper tph(&manifestCopy[0], path);
+			while (tph.NextLine())
+			{
+				pManifestOut->insert(std::string(tph.NextToken()));
+				tph.ExpectEOL();
+			}
+		}
+
+		// Compile an entire asset pack from scratch, to a .zip file on disk.
+		bool CompileFullAssetPackToFile(
+			const char * packPath,
+			const AssetCompileInfo * assets,
+			int numAssets,
+			const AssetCompileOptions & options)
+		{
+			ASSERT_ERR(packPath);
+			ASSERT_ERR(assets);
+			ASSERT_ERR(numAssets > 0);
+
+			mz_zip_archive zip = {};
+			if (!mz_zip_writer_init_file(&zip, packPath, 0))
+			{
+				WARN("Couldn't open %s for writing", packPath);
+				return false;
+			}
+
+			bool success = CompileFullAssetPackToZip(assets, numAssets, options, &zip);
+
+			if (!mz_zip_writer_finalize_archive(&zip))
+			{
+				WARN("Couldn't finalize archive");
+				success = false;
+			}
+
+			mz_zip_writer_end(&zip);
+			return success;
+		}
+
+		// Compile an entire asset pack from scratch, to a zip stream (can be in memory or a file).
+		bool CompileFullAssetPackToZip(
+			const AssetCompileInfo * assets,
+			int numAssets,
+			const AssetCompileOptions & options,
+			mz_zip_archive * pZipOut)
+		{
+			ASSERT_ERR(assets);
+			ASSERT_ERR(numAssets > 0);
+			ASSERT_ERR(pZipOut);
+
+			// !!!UNDONE: not nicely generating entries in the .zip for directories in the internal paths.
+			// Doesn't seem to matter as .zip viewers handle it fine, but maybe we should do that anyway?
+
+			std::string manifest;
+			PathHashDirectory directory;
+
+			// Kick off compilation of all the assets
+			std::vector<int> assetIndices(numAssets);
+			for (int i = 0; i < numAssets; ++i)
+				assetIndices[i] = i;
+			AssetCompileQueue queue(assets, &assetIndices[0], numAssets, options);
+
+			// Write them out in order as they finish
+			int numErrors = 0;
+			for (int iAsset = 0; iAsset < numAssets; ++iAsset)
+			{
+				const AssetCompileInfo * pACI = &assets[iAsset];
+
+				CompiledAsset * pCompiled;
+				if (queue.WaitForAsset(iAsset, &pCompiled) &&
+					WriteCompiledAssetToZip(pCompiled, options, pZipOut, &directory))
+				{
+					// Write asset name to the manifest
+					manifest += pACI->m_pathSrc;
+					manifest += '\n';
+				}
+				else
+				{
+					++numErrors;
+				}
+
+				queue.ReleaseAsset(iAsset);
+			}
+
+			if (numErrors > 0)
+			{
+				WARN("Failed to compile %d of %d assets", numErrors, numAssets);
+			}
+
+			// Write version info
+			VersionInfo version =
+			{
+				PACKVER_Current,
+				MESHVER_Current,
+				MTLVER_Current,
+				TEXVER_Current,
+			};
+			if (!WriteAssetDataToZip(s_pathVersionInfo, nullptr, &version, sizeof(version), options, pZipOut, &directory))
+				return false;
+
+			// Write manifest
+			if (!WriteAssetDataToZip(s_pathManifest, nullptr, &manifest[0], manifest.length(), options, pZipOut, &directory))
+				return false;
+
+			// Write directory
+			if (!WritePathHashDirectoryToZip(&directory, options, pZipOut))
+				return false;
+
+			return (numErrors == 0);
+		}
+
+		// Check if any assets in a pack are out of date by version number or source contents,
+		// returning a list of ones that need updating.
+		bool FindOutOfDateAssets(
+			const char * packPath,
+			const AssetCompileInfo * assets,
+			int numAssets,
+			const AssetCompileOptions & options,
+			std::vector<int> * pAssetsToUpdateOut)
+		{
+			ASSERT_ERR(packPath);
+			ASSERT_ERR(assets);
+			ASSERT_ERR(numAssets > 0);
+			ASSERT_ERR(pAssetsToUpdateOut);
+
+			// Load the archive directory
+			mz_zip_archive zip = {};
+			if (!mz_zip_reader_init_file(&zip, packPath, 0))
+			{
+				WARN("Couldn't load asset pack %s", packPath);
+				return false;
+			}
+
+			// Extract the version info
 			VersionInfo ver;
 			int fileIndex = mz_zip_reader_locate_file(&zip, s_pathVersionInfo, nullptr, 0);
 			if (fileIndex < 0)
 			{
-				WARN("Couldn't find version info in asset pack %s", packPath);
-				mz_zip_reader_end(&zip);
+				WARN("Couldn't find version info in asset pack %s", packPath);
+				mz_zip_reader_end(&zip);
+				return false;
+			}
+			if (!mz_zip_reader_extract_to_mem(&zip, fileIndex, &ver, sizeof(ver), 0))
+			{
+				WARN("Couldn't extract version info from asset pack %s", packPath);
+				mz_zip_reader_end(&zip);
+				return false;
+			}
+
+			// If the pack version is wrong, we have to recompile the whole thing
+			if (ver.m_packver != PACKVER_Current)
+			{
+				pAssetsToUpdateOut->resize(numAssets);
+				for (int i = 0; i < numAssets; ++i)
+					(*pAssetsToUpdateOut)[i] = i;
+				mz_zip_reader_end(&zip);
+				return true;
+			}
+
+			// Extract the manifest
+			fileIndex = mz_zip_reader_locate_file(&zip, s_pathManifest, nullptr, 0);
+			if (fileIndex < 0)
+			{
+				WARN("Couldn't find manifest in asset pack %s", packPath);
+				mz_zip_reader_end(&zip);
+				return false;
+			}
+			size_t manifestSize;
+			char * pManifest = (char *)mz_zip_reader_extract_to_heap(&zip, fileIndex, &manifestSize, 0);
+			if (!pManifest)
+			{
+				WARN("Couldn't extract manifest from asset pack %s", packPath);
+				mz_zip_reader_end(&zip);
+				return false;
+			}
+			std::unordered_set<std::string> manifest;
+			ParseManifest(pManifest, int(manifestSize), packPath, &manifest);
+			mz_free(pManifest);
+
+			// Go through the assets and check their individual versions, and pull out their source records
+			std::vector<bool> needsUpdate(numAssets, false);
+			std::vector<std::vector<byte>> sources(numAssets);
+			for (int i = 0; i < numAssets; ++i)
+			{
+				// Check the appropriate version number for the asset type
+				const AssetCompileInfo * pACI = &assets[i];
+				switch (pACI->m_ack)
+				{
+				case ACK_OBJMesh:
+					if (ver.m_meshver != MESHVER_Current)
+					{
+						needsUpdate[i] = true;
+						continue;
+					}
+					break;
+
+				case ACK_OBJMtlLib:
+					if (ver.m_mtlver != MTLVER_Current)
+					{
+						needsUpdate[i] = true;
+						continue;
+					}
+					break;
+
+				case ACK_TextureRaw:
+				case ACK_TextureWithMips:
+					if (ver.m_texver != TEXVER_Current)
+					{
+						needsUpdate[i] = true;
+						continue;
+					}
+					break;
+
+				default:
+					ERR("Missing case for ACK %d", pACI->m_ack);
+					break;
+				}
+
+				// Check if the asset exists in the manifest.  If it doesn't, needs to be compiled.
+				if (manifest.find(std::string(pACI->m_pathSrc)) == manifest.end())
+				{
+					needsUpdate[i] = true;
+					continue;
+				}
+
+				// Get the record of what it was compiled from.  If there isn't one, recompile it.
+				std::string sourcesPath = std::string(pACI->m_pathSrc) + s_suffixSources;
+				fileIndex = mz_zip_reader_locate_file(&zip, sourcesPath.c_str(), nullptr, 0);
+				mz_zip_archive_file_stat fileStat;
+				if (fileIndex < 0 ||
+					!mz_zip_reader_file_stat(&zip, fileIndex, &fileStat) ||
+					fileStat.m_uncomp_size == 0)
+				{
+					needsUpdate[i] = true;
+					continue;
+				}
+				sources[i].resize(size_t(fileStat.m_uncomp_size));
+				if (!mz_zip_reader_extract_to_mem(&zip, fileIndex, &sources[i][0], sources[i].size(), 0))
+				{
+					needsUpdate[i] = true;
+					continue;
+				}
+			}
+
+			mz_zip_reader_end(&zip);
+
+			// Check the source files' contents, in parallel since some of them may need hashing
+			SourceStatMap stats;
+			LoadSourceStats(packPath, &stats);
+			std::vector<SourceStatMap> newStats(numAssets);
+			std::vector<byte> sourcesStale(numAssets, 0);
+			ParallelFor(numAssets, 0, [&](int i)
+			{
+				if (!needsUpdate[i] && !CheckAssetSources(&assets[i], options, sources[i], stats, &newStats[i]))
+					sourcesStale[i] = 1;
+				return true;
+			});
+
+			// Refresh the stat cache with whatever got hashed
+			bool statsChanged = false;
+			for (int i = 0; i < numAssets; ++i)
+			{
+				for (auto iter = newStats[i].begin(); iter != newStats[i].end(); ++iter)
+				{
+					stats[iter->first] = iter->second;
+					statsChanged = true;
+				}
+			}
+			if (statsChanged)
+				SaveSourceStats(packPath, stats);
+
+			for (int i = 0; i < numAssets; ++i)
+			{
+				if (needsUpdate[i] || sourcesStale[i])
+					pAssetsToUpdateOut->push_back(i);
+			}
+
+			return true;
+		}
+
+		// Updating packs in place.
+		//
+		// Rather than rewriting the whole pack, an update appends the recompiled assets' files
+		// after the end of the existing pack, followed by a new central directory that lists
+		// them along with the old files that are still live.  The replaced files, and the old
+		// directory, stay in the pack as dead space that nothing refers to.  Once the dead space
+		// would pass AssetCompileOptions::m_maxDeadSpace, the update rewrites the pack from
+		// scratch instead, which compacts it.
+		//
+		// An append leaves the old archive untouched up to its original size, so before writing
+		// anything, that size is recorded in a journal file next to the pack and flushed to disk.
+		// If the process dies partway, the next load finds the journal and truncates the pack
+		// back to that size, which restores the old archive exactly.  Once the new directory is
+		// flushed, deleting the journal commits the update.
+		//
+		// Either way, the pack's directory is indexed by path, so that finding an asset's files
+		// is a binary search rather than a scan over the whole pack.
+
+		static const mz_uint32 s_journalMagic = 0x4e4a4152;		// "RAJN"
+		static const char * s_suffixJournal = ".journal";
+
+		// Bits of the zip format we need to read and write directories ourselves
+		static const mz_uint32 s_zipLocalHeaderSig = 0x04034b50;
+		static const mz_uint32 s_zipDirRecordSig = 0x02014b50;
+		static const mz_uint32 s_zipEndOfDirSig = 0x06054b50;
+		static const mz_uint32 s_zip64EndOfDirSig = 0x06064b50;
+		static const mz_uint32 s_zip64LocatorSig = 0x07064b50;
+		static const int s_zipLocalHeaderSize = 30;
+		static const int s_zipDirRecordSize = 46;
+		static const int s_zipEndOfDirSize = 22;
+		static const int s_zip64EndOfDirSize = 56;
+		static const int s_zip64LocatorSize = 20;
+		static const int s_zipDataDescriptorSize = 16;
+		static const mz_uint64 s_zipMaxDirSize = 0x7fffffff;	// We index the directory with ints
+
+		struct PackJournal
+		{
+			mz_uint32	m_magic;
+			mz_uint32	m_padding;
+			mz_uint64	m_packSize;			// Size of the pack before the update started
+		};
+
+		// One file in a pack's central directory
+		struct PackDirEntry
+		{
+			const char *	m_path;				// Points into the raw directory; not terminated
+			int				m_pathLength;
+			int				m_recordOffset;		// Offset of its record in the raw directory
+			int				m_recordSize;
+			mz_uint64		m_localSize;		// Bytes it takes up in the body of the pack
+			bool			m_live;				// Still in use after the update
+		};
+
+		struct PackDirectory
+		{
+			mz_uint64					m_packSize;
+			mz_uint64					m_dirOffset;
+			std::vector<byte>			m_dir;			// Raw central directory records
+			std::vector<PackDirEntry>	m_entries;		// In directory order, which is the zip reader's file index
+			std::vector<int>			m_sorted;		// Indices into m_entries, sorted by path
+		};
+
+		static bool ReadFileAt(HANDLE hFile, mz_uint64 offset, void * pData, size_t size)
+		{
+			LARGE_INTEGER pos;
+			pos.QuadPart = i64(offset);
+			DWORD bytesRead = 0;
+			return SetFilePointerEx(hFile, pos, nullptr, FILE_BEGIN) &&
+					ReadFile(hFile, pData, DWORD(size), &bytesRead, nullptr) &&
+					bytesRead == size;
+		}
+
+		static bool WriteFileAt(HANDLE hFile, mz_uint64 offset, const void * pData, size_t size)
+		{
+			LARGE_INTEGER pos;
+			pos.QuadPart = i64(offset);
+			DWORD bytesWritten = 0;
+			return SetFilePointerEx(hFile, pos, nullptr, FILE_BEGIN) &&
+					WriteFile(hFile, pData, DWORD(size), &bytesWritten, nullptr) &&
+					bytesWritten == size;
+		}
+
+		static bool TruncateFile(HANDLE hFile, mz_uint64 size)
+		{
+			LARGE_INTEGER pos;
+			pos.QuadPart = i64(size);
+			return SetFilePointerEx(hFile, pos, nullptr, FILE_BEGIN) &&
+					SetEndOfFile(hFile) &&
+					FlushFileBuffers(hFile);
+		}
+
+		static mz_uint16 ReadLE16(const byte * p)
+		{
+			return mz_uint16(p[0] | (p[1] << 8));
+		}
+
+		static mz_uint32 ReadLE32(const byte * p)
+		{
+			return mz_uint32(p[0]) | (mz_uint32(p[1]) << 8) | (mz_uint32(p[2]) << 16) | (mz_uint32(p[3]) << 24);
+		}
+
+		static void WriteLE16(byte * p, mz_uint32 value)
+		{
+			p[0] = byte(value);
+			p[1] = byte(value >> 8);
+		}
+
+		static mz_uint64 ReadLE64(const byte * p)
+		{
+			return mz_uint64(ReadLE32(p)) | (mz_uint64(ReadLE32(p + 4)) << 32);
+		}
+
+		static void WriteLE32(byte * p, mz_uint32 value)
+		{
+			WriteLE16(p, value);
+			WriteLE16(p + 2, value >> 16);
+		}
+
+		static void WriteLE64(byte * p, mz_uint64 value)
+		{
+			WriteLE32(p, mz_uint32(value));
+			WriteLE32(p + 4, mz_uint32(value >> 32));
+		}
+
+		// Compare zip paths case-insensitively, as miniz looks them up
+		static int ComparePaths(const char * a, int lengthA, const char * b, int lengthB)
+		{
+			for (int i = 0, n = min(lengthA, lengthB); i < n; ++i)
+			{
+				int diff = tolower(byte(a[i])) - tolower(byte(b[i]));
+				if (diff != 0)
+					return diff;
+			}
+			return lengthA - lengthB;
+		}
+
+		// Read a pack's central directory, and index it by path.  Our packs never have an
+		// archive comment, so the end-of-directory record is always the last thing in the file.
+		// In Zip64 packs, it's preceded by a locator and a zip64 end record, which hold the real
+		// file count and directory offset, right after the directory.
+		static bool ReadPackDirectory(HANDLE hFile, const char * packPath, PackDirectory * pDirOut)
+		{
+			ASSERT_ERR(pDirOut);
+
+			LARGE_INTEGER fileSize;
+			byte endOfDir[s_zipEndOfDirSize];
+			if (!GetFileSizeEx(hFile, &fileSize) ||
+				fileSize.QuadPart < s_zipEndOfDirSize ||
+				!ReadFileAt(hFile, fileSize.QuadPart - s_zipEndOfDirSize, endOfDir, sizeof(endOfDir)) ||
+				ReadLE32(endOfDir) != s_zipEndOfDirSig)
+			{
+				WARN("Couldn't find the directory of asset pack %s", packPath);
+				return false;
+			}
+
+			mz_uint64 numEntries = ReadLE16(endOfDir + 10);
+			mz_uint64 dirSize = ReadLE32(endOfDir + 12);
+			mz_uint64 dirOffset = ReadLE32(endOfDir + 16);
+			mz_uint64 dirEnd = fileSize.QuadPart - s_zipEndOfDirSize;
+
+			byte locator[s_zip64LocatorSize];
+			if (dirEnd >= mz_uint64(s_zip64LocatorSize) &&
+				ReadFileAt(hFile, dirEnd - s_zip64LocatorSize, locator, sizeof(locator)) &&
+				ReadLE32(locator) == s_zip64LocatorSig)
+			{
+				mz_uint64 endOfDir64Offset = ReadLE64(locator + 8);
+				byte endOfDir64[s_zip64EndOfDirSize];
+				if (endOfDir64Offset + s_zip64EndOfDirSize + s_zip64LocatorSize != dirEnd ||
+					!ReadFileAt(hFile, endOfDir64Offset, endOfDir64, sizeof(endOfDir64)) ||
+					ReadLE32(endOfDir64) != s_zip64EndOfDirSig)
+				{
+					WARN("Asset pack %s has a malformed directory", packPath);
+					return false;
+				}
+				numEntries = ReadLE64(endOfDir64 + 32);
+				dirSize = ReadLE64(endOfDir64 + 40);
+				dirOffset = ReadLE64(endOfDir64 + 48);
+				dirEnd = endOfDir64Offset;
+			}
+
+			pDirOut->m_packSize = fileSize.QuadPart;
+			pDirOut->m_dirOffset = dirOffset;
+			if (dirOffset + dirSize != dirEnd ||
+				dirSize > s_zipMaxDirSize ||
+				numEntries > dirSize / s_zipDirRecordSize)
+			{
+				WARN("Asset pack %s has a malformed directory", packPath);
+				return false;
+			}
+
+			pDirOut->m_dir.resize(size_t(dirSize));
+			if (dirSize > 0 && !ReadFileAt(hFile, dirOffset, &pDirOut->m_dir[0], size_t(dirSize)))
+			{
+				WARN("Couldn't read the directory of asset pack %s", packPath);
+				return false;
+			}
+
+			// Parse the directory records
+			pDirOut->m_entries.resize(size_t(numEntries));
+			int recordOffset = 0;
+			for (int i = 0, c = int(numEntries); i < c; ++i)
+			{
+				const byte * pRecord = &pDirOut->m_dir[recordOffset];
+				if (recordOffset + s_zipDirRecordSize > int(dirSize) ||
+					ReadLE32(pRecord) != s_zipDirRecordSig)
+				{
+					WARN("Asset pack %s has a malformed directory", packPath);
+					return false;
+				}
+
+				int pathLength = ReadLE16(pRecord + 28);
+				int extraLength = ReadLE16(pRecord + 30);
+				int commentLength = ReadLE16(pRecord + 32);
+				int recordSize = s_zipDirRecordSize + pathLength + extraLength + commentLength;
+				if (recordOffset + recordSize > int(dirSize))
+				{
+					WARN("Asset pack %s has a malformed directory", packPath);
+					return false;
+				}
+
+				// Files are under 4GB, so sizes aren't in zip64 fields; the directory's extra field
+				// only holds a zip64 local header offset, when the offset doesn't fit in 32 bits
+				mz_uint64 localOffset = ReadLE32(pRecord + 42);
+				if (localOffset == 0xffffffff)
+				{
+					const byte * pExtra = pRecord + s_zipDirRecordSize + pathLength;
+					for (int j = 0; j + 4 <= extraLength; j += 4 + ReadLE16(pExtra + j + 2))
+					{
+						if (ReadLE16(pExtra + j) == 1 && ReadLE16(pExtra + j + 2) >= 8 && j + 12 <= extraLength)
+						{
+							localOffset = ReadLE64(pExtra + j + 4);
+							break;
+						}
+					}
+				}
+
+				// The local header repeats the path, but its extra field holds the alignment padding,
+				// which the directory's doesn't, so get the lengths from the header itself.  Bit 3 of
+				// the flags means a data descriptor follows the data.
+				byte localHeader[s_zipLocalHeaderSize];
+				if (localOffset + s_zipLocalHeaderSize > dirOffset ||
+					!ReadFileAt(hFile, localOffset, localHeader, sizeof(localHeader)) ||
+					ReadLE32(localHeader) != s_zipLocalHeaderSig)
+				{
+					WARN("Asset pack %s has a malformed directory", packPath);
+					return false;
+				}
+
+				PackDirEntry * pEntry = &pDirOut->m_entries[i];
+				pEntry->m_path = (const char *)pRecord + s_zipDirRecordSize;
+				pEntry->m_pathLength = pathLength;
+				pEntry->m_recordOffset = recordOffset;
+				pEntry->m_recordSize = recordSize;
+				pEntry->m_localSize = s_zipLocalHeaderSize + ReadLE16(localHeader + 26) + ReadLE16(localHeader + 28) + ReadLE32(pRecord + 20);
+				if (ReadLE16(pRecord + 8) & 8)
+					pEntry->m_localSize += s_zipDataDescriptorSize;
+				pEntry->m_live = false;
+
+				recordOffset += recordSize;
+			}
+
+			// Index the entries by path
+			pDirOut->m_sorted.resize(size_t(numEntries));
+			for (int i = 0, c = int(numEntries); i < c; ++i)
+				pDirOut->m_sorted[i] = i;
+			const PackDirEntry * pEntries = pDirOut->m_entries.empty() ? nullptr : &pDirOut->m_entries[0];
+			std::sort(pDirOut->m_sorted.begin(), pDirOut->m_sorted.end(), [pEntries](int a, int b)
+			{
+				return ComparePaths(
+						pEntries[a].m_path, pEntries[a].m_pathLength,
+						pEntries[b].m_path, pEntries[b].m_pathLength) < 0;
+			});
+
+			return true;
+		}
+
+		// Find the files in a pack that belong to an asset, i.e. those under its path as a
+		// directory, and return their indices in directory order.
+		static void FindAssetFiles(const PackDirectory & dir, const char * assetPath, std::vector<int> * pFilesOut)
+		{
+			ASSERT_ERR(assetPath);
+			ASSERT_ERR(pFilesOut);
+
+			std::string prefix = assetPath;
+			prefix += '/';
+			int prefixLength = int(prefix.length());
+
+			pFilesOut->clear();
+			auto iter = std::lower_bound(dir.m_sorted.begin(), dir.m_sorted.end(), prefix, [&dir](int i, const std::string & path)
+			{
+				return ComparePaths(
+						dir.m_entries[i].m_path, dir.m_entries[i].m_pathLength,
+						path.c_str(), int(path.length())) < 0;
+			});
+			for (; iter != dir.m_sorted.end(); ++iter)
+			{
+				const PackDirEntry & entry = dir.m_entries[*iter];
+				if (entry.m_pathLength < prefixLength ||
+					ComparePaths(entry.m_path, prefixLength, prefix.c_str(), prefixLength) != 0)
+				{
+					break;
+				}
+				pFilesOut->push_back(*iter);
+			}
+			std::sort(pFilesOut->begin(), pFilesOut->end());
+		}
+
+		// Compile the assets that need updating and write them to a zip, calling keepAsset for
+		// each of the others; then write the version info, manifest and directory.  Returns false
+		// if the zip couldn't be written; assets that fail to compile are just left out and counted.
+		static bool WriteUpdatedAssetsToZip(
+			const AssetCompileInfo * assets,
+			int numAssets,
+			std::vector<int> const & assetsToUpdate,
+			const AssetCompileOptions & options,
+			const std::function<bool (int iAsset)> & keepAsset,
+			mz_zip_archive * pZipOut,
+			PathHashDirectory * pDirectory,
+			int * pNumErrorsOut)
+		{
+			ASSERT_ERR(pZipOut);
+			ASSERT_ERR(pDirectory);
+			ASSERT_ERR(pNumErrorsOut);
+
+			std::string manifest;
+			int numErrors = 0;
+			int numAssetsToUpdate = int(assetsToUpdate.size());
+
+			// Kick off compilation of the assets that need it
+			AssetCompileQueue queue(
+				assets,
+				assetsToUpdate.empty() ? nullptr : &assetsToUpdate[0],
+				numAssetsToUpdate,
+				options);
+
+			// Iterate over assets, tracking position in both original asset list and
+			// list of assets that need updates (a sorted subset of the original ones)
+			for (int iAsset = 0, iAssetToUpdate = 0; iAsset < numAssets; ++iAsset)
+			{
+				const AssetCompileInfo * pACI = &assets[iAsset];
+
+				// Does this asset need recompiling?
+				ASSERT_ERR(iAssetToUpdate >= numAssetsToUpdate || assetsToUpdate[iAssetToUpdate] >= iAsset);
+				if (iAssetToUpdate < numAssetsToUpdate && assetsToUpdate[iAssetToUpdate] == iAsset)
+				{
+					// Write out the freshly compiled data
+					CompiledAsset * pCompiled;
+					if (queue.WaitForAsset(iAssetToUpdate, &pCompiled) &&
+						WriteCompiledAssetToZip(pCompiled, options, pZipOut, pDirectory))
+					{
+						// Write asset name to the manifest
+						manifest += pACI->m_pathSrc;
+						manifest += '\n';
+					}
+					else
+					{
+						++numErrors;
+					}
+
+					queue.ReleaseAsset(iAssetToUpdate);
+					++iAssetToUpdate;
+				}
+				else
+				{
+					if (!keepAsset(iAsset))
+						return false;
+
+					// Write asset name to the manifest
+					manifest += pACI->m_pathSrc;
+					manifest += '\n';
+				}
+			}
+
+			if (numErrors > 0)
+			{
+				WARN("Failed to compile %d of %d assets", numErrors, numAssetsToUpdate);
+			}
+			*pNumErrorsOut = numErrors;
+
+			// Write version info
+			VersionInfo version =
+			{
+				PACKVER_Current,
+				MESHVER_Current,
+				MTLVER_Current,
+				TEXVER_Current,
+			};
+			if (!WriteAssetDataToZip(s_pathVersionInfo, nullptr, &version, sizeof(version), options, pZipOut, pDirectory))
+				return false;
+
+			// Write manifest
+			if (!WriteAssetDataToZip(s_pathManifest, nullptr, &manifest[0], manifest.length(), options, pZipOut, pDirectory))
+				return false;
+
+			// Write directory
+			if (!WritePathHashDirectoryToZip(pDirectory, options, pZipOut))
+				return false;
+
+			return true;
+		}
+
+		// Generate a temporary filename next to a pack, to write a new version of it to.
+		static void GetTempPackPath(const char * packPath, char (&tempPathOut)[MAX_PATH])
+		{
+			CHECK_WARN(CheckPathChars(packPath));
+			char outDir[MAX_PATH] = {};
+			if (const char * pLastSlash = strrchr(packPath, '/'))
+			{
+				ASSERT_ERR(pLastSlash - packPath < MAX_PATH);
+				memcpy(outDir, packPath, pLastSlash - packPath);
+			}
+			else
+			{
+				outDir[0] = '.';
+			}
+			CHECK_ERR(GetTempFileName(outDir, nullptr, 0, tempPathOut) != 0);
+		}
+
+		// Copy a file from one pack to another.  Files used in-place get realigned, as the
+		// options may have changed.
+		static bool CopyPackFile(
+			mz_zip_archive * pZipSrc,
+			int iFile,
+			const AssetCompileOptions & options,
+			mz_zip_archive * pZipOut)
+		{
+			mz_zip_archive_file_stat fileStat;
+			mz_uint alignment = 0;
+			if (mz_zip_reader_file_stat(pZipSrc, iFile, &fileStat) &&
+				fileStat.m_method == 0 && !IsLZFile(fileStat))
+			{
+				alignment = DataAlignment(size_t(fileStat.m_uncomp_size), options);
+			}
+			return mz_zip_writer_add_from_zip_reader_aligned(pZipOut, pZipSrc, iFile, alignment) != 0;
+		}
+
+		// Update a pack by writing it out again to a temporary file, copying the files of
+		// the assets that aren't being updated, then moving it over the old one.
+		static bool RewriteAssetPack(
+			const char * packPath,
+			const PackDirectory & dir,
+			const AssetCompileInfo * assets,
+			int numAssets,
+			std::vector<int> const & assetsToUpdate,
+			const AssetCompileOptions & options)
+		{
+			// Load the archive directory
+			mz_zip_archive zipSrc = {};
+			if (!mz_zip_reader_init_file(&zipSrc, packPath, 0))
+			{
+				WARN("Couldn't load asset pack %s", packPath);
+				return false;
+			}
+			if (mz_zip_reader_get_num_files(&zipSrc) != dir.m_entries.size())
+			{
+				WARN("Asset pack %s has a malformed directory", packPath);
+				mz_zip_reader_end(&zipSrc);
+				return false;
+			}
+
+			// Open a temporary file for the new archive
+			char tempPath[MAX_PATH];
+			GetTempPackPath(packPath, tempPath);
+			mz_zip_archive zipDest = {};
+			if (!mz_zip_writer_init_file(&zipDest, tempPath, 0))
+			{
+				WARN("Couldn't open temporary file %s for writing", tempPath);
+				mz_zip_reader_end(&zipSrc);
+				return false;
+			}
+
+			// Copy the files of the assets that are staying from the old zip to the new one
+			PathHashDirectory directory;
+			std::vector<int> files;
+			auto keepAsset = [&](int iAsset)
+			{
+				FindAssetFiles(dir, assets[iAsset].m_pathSrc, &files);
+				for (int i : files)
+				{
+					const PackDirEntry & entry = dir.m_entries[i];
+					if (!CopyPackFile(&zipSrc, i, options, &zipDest))
+					{
+						WARN("Couldn't copy file %.*s from asset pack %s to temporary archive %s",
+							entry.m_pathLength, entry.m_path, packPath, tempPath);
+						return false;
+					}
+					directory.AddFile(HashPathChars(s_fnvOffsetBasis, entry.m_path, entry.m_pathLength), &zipDest);
+				}
+				return true;
+			};
+
+			int numErrors = 0;
+			bool success = WriteUpdatedAssetsToZip(
+							assets, numAssets, assetsToUpdate, options, keepAsset,
+							&zipDest, &directory, &numErrors);
+			mz_zip_reader_end(&zipSrc);
+
+			if (success && !mz_zip_writer_finalize_archive(&zipDest))
+			{
+				WARN("Couldn't finalize temporary archive %s", tempPath);
+				success = false;
+			}
+
+			mz_zip_writer_end(&zipDest);
+
+			if (!success)
+			{
+				DeleteFile(tempPath);
 				return false;
 			}
-			if (!mz_zip_reader_extract_to_mem(&zip, fileIndex, &ver, sizeof(ver), 0))
+
+			// Move the new version of the asset pack over the old one
+			if (!MoveFileEx(tempPath, packPath, MOVEFILE_COPY_ALLOWED | MOVEFILE_REPLACE_EXISTING))
 			{
-				WARN("Couldn't extract version info from asset pack %s", packPath);
-				mz_zip_reader_end(&zip);
+				WARN("Couldn't rename temporary file %s over asset pack %s", tempPath, packPath);
 				return false;
 			}
 
-			// If the pack version is wrong, we have to recompile the whole thing
-			if (ver.m_packver != PACKVER_Current)
+			return (numErrors == 0);
+		}
+
+		// Write callback for appending to a pack: files go to the end of the pack file, while
+		// the directory miniz writes at the end is caught in memory, to be merged with the old one.
+		struct PackAppender
+		{
+			HANDLE				m_hFile;
+			mz_uint64			m_dirOffset;	// Writes from here on are caught
+			std::vector<byte>	m_dir;
+		};
+
+		static size_t WritePackAppend(void * pOpaque, mz_uint64 offset, const void * pData, size_t size)
+		{
+			PackAppender * pAppender = (PackAppender *)pOpaque;
+			if (offset < pAppender->m_dirOffset)
+				return WriteFileAt(pAppender->m_hFile, offset, pData, size) ? size : 0;
+
+			// The directory and end record get written in order, one right after the other
+			if (offset - pAppender->m_dirOffset != pAppender->m_dir.size())
+				return 0;
+			pAppender->m_dir.insert(pAppender->m_dir.end(), (const byte *)pData, (const byte *)pData + size);
+			return size;
+		}
+
+		// Append the end-of-directory record for a directory, preceded by the zip64 end record
+		// and locator if the file count or directory offset won't fit in it.
+		static void WriteEndOfDir(mz_uint64 numFiles, mz_uint64 dirSize, mz_uint64 dirOffset, std::vector<byte> * pOut)
+		{
+			ASSERT_ERR(pOut);
+
+			if (numFiles >= 0xffff || dirOffset >= 0xffffffff)
 			{
-				pAssetsToUpdateOut->resize(numAssets);
-				for (int i = 0; i < numAssets; ++i)
-					(*pAssetsToUpdateOut)[i] = i;
-				mz_zip_reader_end(&zip);
-				return true;
+				byte endOfDir64[s_zip64EndOfDirSize] = {};
+				WriteLE32(endOfDir64, s_zip64EndOfDirSig);
+				WriteLE64(endOfDir64 + 4, s_zip64EndOfDirSize - 12);		// Size of the rest of the record
+				WriteLE16(endOfDir64 + 12, 45);								// Version made by and needed: 4.5
+				WriteLE16(endOfDir64 + 14, 45);
+				WriteLE64(endOfDir64 + 24, numFiles);
+				WriteLE64(endOfDir64 + 32, numFiles);
+				WriteLE64(endOfDir64 + 40, dirSize);
+				WriteLE64(endOfDir64 + 48, dirOffset);
+				pOut->insert(pOut->end(), endOfDir64, endOfDir64 + s_zip64EndOfDirSize);
+
+				byte locator[s_zip64LocatorSize] = {};
+				WriteLE32(locator, s_zip64LocatorSig);
+				WriteLE64(locator + 8, dirOffset + dirSize);
+				WriteLE32(locator + 16, 1);									// Total number of disks
+				pOut->insert(pOut->end(), locator, locator + s_zip64LocatorSize);
 			}
 
-			// Extract the manifest
-			fileIndex = mz_zip_reader_locate_file(&zip, s_pathManifest, nullptr, 0);
-			if (fileIndex < 0)
-			{
-				WARN("Couldn't find manifest in asset pack %s", packPath);
-				mz_zip_reader_end(&zip);
+			byte endOfDir[s_zipEndOfDirSize] = {};
+			WriteLE32(endOfDir, s_zipEndOfDirSig);
+			WriteLE16(endOfDir + 8, mz_uint32(min(numFiles, mz_uint64(0xffff))));
+			WriteLE16(endOfDir + 10, mz_uint32(min(numFiles, mz_uint64(0xffff))));
+			WriteLE32(endOfDir + 12, mz_uint32(dirSize));
+			WriteLE32(endOfDir + 16, mz_uint32(min(dirOffset, mz_uint64(0xffffffff))));
+			pOut->insert(pOut->end(), endOfDir, endOfDir + s_zipEndOfDirSize);
+		}
+
+		static bool WriteJournal(const char * journalPath, mz_uint64 packSize)
+		{
+			HANDLE hJournal = CreateFile(
+								journalPath, GENERIC_WRITE, 0, nullptr,
+								CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (hJournal == INVALID_HANDLE_VALUE)
 				return false;
-			}
-			size_t manifestSize;
-			char * pManifest = (char *)mz_zip_reader_extract_to_heap(&zip, fileIndex, &manifestSize, 0);
-			if (!pManifest)
+
+			PackJournal journal = { s_journalMagic, 0, packSize };
+			bool success = WriteFileAt(hJournal, 0, &journal, sizeof(journal)) &&
+							FlushFileBuffers(hJournal);
+			CloseHandle(hJournal);
+			if (!success)
+				DeleteFile(journalPath);
+			return success;
+		}
+
+		// Update a pack by appending the updated assets' files and a new directory to it.
+		// Takes ownership of the pack's file handle.
+		static bool AppendToAssetPack(
+			const char * packPath,
+			HANDLE hPack,
+			const PackDirectory & dir,
+			const AssetCompileInfo * assets,
+			int numAssets,
+			std::vector<int> const & assetsToUpdate,
+			const AssetCompileOptions & options)
+		{
+			std::string journalPath = packPath;
+			journalPath += s_suffixJournal;
+			if (!WriteJournal(journalPath.c_str(), dir.m_packSize))
 			{
-				WARN("Couldn't extract manifest from asset pack %s", packPath);
-				mz_zip_reader_end(&zip);
+				WARN("Couldn't write journal %s for updating asset pack %s", journalPath.c_str(), packPath);
+				CloseHandle(hPack);
 				return false;
 			}
-			std::unordered_set<std::string> manifest;
-			ParseManifest(pManifest, int(manifestSize), packPath, &manifest);
-			mz_free(pManifest);
-
-			mz_zip_reader_end(&zip);
 
-			// Get the mod date of the asset pack
-			struct _stat packStat;
-			CHECK_ERR(_stat(packPath, &packStat) == 0);
+			// Write the updated assets after the end of the pack
+			PackAppender appender = { hPack, ~mz_uint64(0) };
+			mz_zip_archive zipDest = {};
+			zipDest.m_pWrite = &WritePackAppend;
+			zipDest.m_pIO_opaque = &appender;
+			bool success = (mz_zip_writer_init(&zipDest, dir.m_packSize) != 0);
 
-			// Go through the assets and check their individual versions and mod dates
-			for (int i = 0; i < numAssets; ++i)
+			// The live old files will come first in the new directory, ahead of the appended ones
+			PathHashDirectory directory;
+			for (const PackDirEntry & entry : dir.m_entries)
 			{
-				// Check the appropriate version number for the asset type
-				const AssetCompileInfo * pACI = &assets[i];
-				switch (pACI->m_ack)
+				if (!entry.m_live)
+					continue;
+				PathHashEntry hashEntry =
 				{
-				case ACK_OBJMesh:
-					if (ver.m_meshver != MESHVER_Current)
-					{
-						pAssetsToUpdateOut->push_back(i);
-						continue;
-					}
-					break;
+					HashPathChars(s_fnvOffsetBasis, entry.m_path, entry.m_pathLength),
+					mz_uint32(directory.m_entries.size()),
+					0,
+				};
+				directory.m_entries.push_back(hashEntry);
+			}
+			directory.m_numFilesBefore = int(directory.m_entries.size());
 
-				case ACK_OBJMtlLib:
-					if (ver.m_mtlver != MTLVER_Current)
-					{
-						pAssetsToUpdateOut->push_back(i);
-						continue;
-					}
-					break;
+			int numErrors = 0;
+			auto keepAsset = [](int) { return true; };		// Their files were already marked live
+			success = success && WriteUpdatedAssetsToZip(
+									assets, numAssets, assetsToUpdate, options, keepAsset,
+									&zipDest, &directory, &numErrors);
+
+			// Let miniz write its directory for the new files; we keep its records, which
+			// already have the right offsets (and zip64 fields where needed), and drop its
+			// end records.  Its end record says how big the directory is.
+			mz_uint64 newDirOffset = zipDest.m_archive_size;
+			mz_uint64 numNewFiles = zipDest.m_total_files;
+			appender.m_dirOffset = newDirOffset;
+			success = success &&
+						mz_zip_writer_finalize_archive(&zipDest) &&
+						appender.m_dir.size() >= size_t(s_zipEndOfDirSize);
+			mz_zip_writer_end(&zipDest);
 
-				case ACK_TextureRaw:
-				case ACK_TextureWithMips:
-					if (ver.m_texver != TEXVER_Current)
-					{
-						pAssetsToUpdateOut->push_back(i);
+			if (success)
+			{
+				// Merge the live old records with the new ones
+				std::vector<byte> & newDir = appender.m_dir;
+				newDir.resize(ReadLE32(&newDir[newDir.size() - s_zipEndOfDirSize + 12]));
+				std::vector<byte> mergedDir;
+				mergedDir.reserve(dir.m_dir.size() + newDir.size() + s_zip64EndOfDirSize + s_zip64LocatorSize + s_zipEndOfDirSize);
+				mz_uint64 numFiles = numNewFiles;
+				for (const PackDirEntry & entry : dir.m_entries)
+				{
+					if (!entry.m_live)
 						continue;
-					}
-					break;
-
-				default:
-					ERR("Missing case for ACK %d", pACI->m_ack);
-					break;
+					const byte * pRecord = &dir.m_dir[entry.m_recordOffset];
+					mergedDir.insert(mergedDir.end(), pRecord, pRecord + entry.m_recordSize);
+					++numFiles;
 				}
+				mergedDir.insert(mergedDir.end(), newDir.begin(), newDir.end());
+				mz_uint64 mergedDirSize = mergedDir.size();
+				WriteEndOfDir(numFiles, mergedDirSize, newDirOffset, &mergedDir);
 
-				// Check if the asset exists in the manifest.  If it doesn't, needs to be compiled.
-				if (manifest.find(std::string(pACI->m_pathSrc)) == manifest.end())
+				// Write it out, and make sure it's all on disk before committing
+				if (mergedDirSize > s_zipMaxDirSize)
 				{
-					pAssetsToUpdateOut->push_back(i);
-					continue;
+					WARN("Asset pack %s has too many files for its directory", packPath);
+					success = false;
+				}
+				else if (!WriteFileAt(hPack, newDirOffset, &mergedDir[0], mergedDir.size()) ||
+						 !TruncateFile(hPack, newDirOffset + mergedDir.size()))
+				{
+					WARN("Couldn't write the directory of asset pack %s", packPath);
+					success = false;
 				}
+			}
 
-				// Check mod time of the source file against that of the pack
-				// If the source file doesn't exist, that's OK!  Asset packs can be
-				// distributed in lieu of source files.
-				struct _stat srcStat;
-				if (_stat(pACI->m_pathSrc, &srcStat) == 0 &&
-					srcStat.st_mtime > packStat.st_mtime)
+			if (!success)
+			{
+				// Roll back to the old archive.  If even that fails, leave the journal
+				// for RecoverAssetPack to retry on the next load.
+				WARN("Couldn't update asset pack %s; rolling it back", packPath);
+				bool rolledBack = TruncateFile(hPack, dir.m_packSize);
+				CloseHandle(hPack);
+				if (rolledBack)
+					DeleteFile(journalPath.c_str());
+				return false;
+			}
+
+			CloseHandle(hPack);
+
+			// Commit the update
+			if (!DeleteFile(journalPath.c_str()))
+			{
+				WARN("Couldn't delete journal %s; the update to asset pack %s will be rolled back", journalPath.c_str(), packPath);
+				return false;
+			}
+
+			return (numErrors == 0);
+		}
+
+		// Roll back an update to an asset pack that was interrupted partway.
+		bool RecoverAssetPack(const char * packPath)
+		{
+			ASSERT_ERR(packPath);
+
+			std::string journalPath = packPath;
+			journalPath += s_suffixJournal;
+			HANDLE hJournal = CreateFile(
+								journalPath.c_str(), GENERIC_READ, 0, nullptr,
+								OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (hJournal == INVALID_HANDLE_VALUE)
+				return true;		// Nothing was interrupted
+
+			PackJournal journal = {};
+			bool journalValid = ReadFileAt(hJournal, 0, &journal, sizeof(journal)) &&
+								journal.m_magic == s_journalMagic;
+			CloseHandle(hJournal);
+
+			// A journal that didn't make it to disk whole was written before the pack was touched,
+			// and so was one whose pack has since gone away
+			if (journalValid && GetFileAttributes(packPath) != INVALID_FILE_ATTRIBUTES)
+			{
+				LOG("Asset pack %s was left partway through an update; rolling it back.", packPath);
+
+				HANDLE hPack = CreateFile(
+									packPath, GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+									OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+				LARGE_INTEGER fileSize;
+				bool success = (hPack != INVALID_HANDLE_VALUE) &&
+								GetFileSizeEx(hPack, &fileSize) &&
+								(mz_uint64(fileSize.QuadPart) <= journal.m_packSize ||
+								 TruncateFile(hPack, journal.m_packSize));
+				if (hPack != INVALID_HANDLE_VALUE)
+					CloseHandle(hPack);
+				if (!success)
 				{
-					pAssetsToUpdateOut->push_back(i);
-					continue;
+					WARN("Couldn't roll back asset pack %s", packPath);
+					return false;
 				}
 			}
 
+			if (!DeleteFile(journalPath.c_str()))
+			{
+				WARN("Couldn't delete journal %s", journalPath.c_str());
+				return false;
+			}
+
 			return true;
 		}
 
@@ -606,156 +3169,219 @@ namespace Framework
 			const char * packPath,
 			const AssetCompileInfo * assets,
 			int numAssets,
-			std::vector<int> const & assetsToUpdate)
+			std::vector<int> const & assetsToUpdate,
+			const AssetCompileOptions & options)
 		{
 			ASSERT_ERR(packPath);
 			ASSERT_ERR(assets);
 			ASSERT_ERR(numAssets > 0);
-		
-			// Load the archive directory
-			mz_zip_archive zipSrc = {};
-			if (!mz_zip_reader_init_file(&zipSrc, packPath, 0))
-			{
-				WARN("Couldn't load asset pack %s", packPath);
-				return false;
-			}
-			int numSrcFiles = int(mz_zip_reader_get_num_files(&zipSrc));
 
-			// Generate a temporary filename for the new archive
-			CHECK_WARN(CheckPathChars(packPath));
-			char outDir[MAX_PATH] = {};
-			if (const char * pLastSlash = strrchr(packPath, '/'))
-			{
-				ASSERT_ERR(pLastSlash - packPath < MAX_PATH);
-				memcpy(outDir, packPath, pLastSlash - packPath);
-			}
-			else
+			// Read and index the archive directory
+			HANDLE hPack = CreateFile(
+								packPath, GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+								OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (hPack == INVALID_HANDLE_VALUE)
 			{
-				outDir[0] = '.';
+				WARN("Couldn't open asset pack %s for updating", packPath);
+				return false;
 			}
-			char tempPath[MAX_PATH];
-			CHECK_ERR(GetTempFileName(outDir, nullptr, 0, tempPath) != 0);
-
-			// Open the temporary file for writing
-			mz_zip_archive zipDest = {};
-			if (!mz_zip_writer_init_file(&zipDest, tempPath, 0))
+			PackDirectory dir;
+			if (!ReadPackDirectory(hPack, packPath, &dir))
 			{
-				WARN("Couldn't open temporary file %s for writing", packPath);
-				mz_zip_reader_end(&zipSrc);
+				CloseHandle(hPack);
 				return false;
 			}
 
-			std::string manifest;
-			int numErrors = 0;
-			int numAssetsToUpdate = int(assetsToUpdate.size());
-
-			// Iterate over assets, tracking position in both original asset list and
-			// list of assets that need updates (a sorted subset of the original ones)
-			for (int iAsset = 0, iAssetToUpdate = 0; iAsset < numAssets; ++iAsset)
+			// Mark the files of the assets that are staying, and size up the ones being replaced
+			std::vector<byte> updating(numAssets, 0);
+			for (int i : assetsToUpdate)
+				updating[i] = 1;
+			mz_uint64 liveSize = 0;
+			mz_uint64 replacedSize = 0;
+			std::vector<int> files;
+			for (int iAsset = 0; iAsset < numAssets; ++iAsset)
 			{
-				const AssetCompileInfo * pACI = &assets[iAsset];
-
-				// Does this asset need recompiling?
-				while (iAssetToUpdate < numAssetsToUpdate && assetsToUpdate[iAssetToUpdate] < iAsset)
-					++iAssetToUpdate;
-
-				if (iAssetToUpdate < numAssetsToUpdate && assetsToUpdate[iAssetToUpdate] == iAsset)
+				FindAssetFiles(dir, assets[iAsset].m_pathSrc, &files);
+				for (int i : files)
 				{
-					ACK ack = pACI->m_ack;
-					ASSERT_ERR(ack >= 0 && ack < ACK_Count);
-			
-					LOG("[%d/%d] Compiling %s asset %s...",
-						iAssetToUpdate+1, numAssetsToUpdate, s_ackNames[ack], pACI->m_pathSrc);
-
-					// Compile the asset
-					if (s_assetCompileFuncs[ack](pACI, &zipDest))
-					{
-						// Write asset name to the manifest
-						manifest += pACI->m_pathSrc;
-						manifest += '\n';
-					}
-					else
+					PackDirEntry * pEntry = &dir.m_entries[i];
+					if (updating[iAsset])
 					{
-						WARN("Couldn't compile asset %s", pACI->m_pathSrc);
-						++numErrors;
+						replacedSize += pEntry->m_localSize;
 					}
-				}
-				else
-				{
-					// Copy any files prefixed with the asset name from the old zip to the new one
-					// Note, this could be more efficient when there's a large number of files
-					for (int i = 0; i < numSrcFiles; ++i)
+					else if (!pEntry->m_live)
 					{
-						char filename[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE];
-						mz_zip_reader_get_filename(&zipSrc, i, filename, sizeof(filename));
-						if (_strnicmp(filename, pACI->m_pathSrc, strlen(pACI->m_pathSrc)) == 0)
-						{
-							if (!mz_zip_writer_add_from_zip_reader(&zipDest, &zipSrc, i))
-							{
-								WARN("Couldn't copy file %s from asset pack %s to temporary archive %s",
-									filename, packPath, tempPath);
-								mz_zip_reader_end(&zipSrc);
-								mz_zip_writer_end(&zipDest);
-								DeleteFile(tempPath);
-								return false;
-							}
-						}
+						pEntry->m_live = true;
+						liveSize += pEntry->m_localSize;
 					}
-
-					// Write asset name to the manifest
-					manifest += pACI->m_pathSrc;
-					manifest += '\n';
 				}
 			}
 
-			mz_zip_reader_end(&zipSrc);
-
-			if (numErrors > 0)
+			// Append if the dead space stays within bounds, assuming the replacements come out
+			// about the same size as what they replace; otherwise rewrite, to compact the pack
+			mz_uint64 deadSize = dir.m_packSize - liveSize;
+			mz_uint64 estimatedSize = dir.m_packSize + replacedSize;
+			if (options.m_maxDeadSpace > 0.0f &&
+				double(deadSize) <= double(options.m_maxDeadSpace) * double(estimatedSize))
 			{
-				WARN("Failed to compile %d of %d assets", numErrors, numAssetsToUpdate);
+				return AppendToAssetPack(packPath, hPack, dir, assets, numAssets, assetsToUpdate, options);
 			}
 
-			// Write version info
-			VersionInfo version =
-			{
-				PACKVER_Current,
-				MESHVER_Current,
-				MTLVER_Current,
-				TEXVER_Current,
-			};
-			if (!WriteAssetDataToZip(s_pathVersionInfo, nullptr, &version, sizeof(version), &zipDest))
-			{
-				mz_zip_writer_end(&zipDest);
-				DeleteFile(tempPath);
-				return false;
-			}
+			CloseHandle(hPack);
+			return RewriteAssetPack(packPath, dir, assets, numAssets, assetsToUpdate, options);
+		}
+	}
 
-			// Write manifest
-			if (!WriteAssetDataToZip(s_pathManifest, nullptr, &manifest[0], manifest.length(), &zipDest))
+
+
+	// Rewrite an asset pack with its files in the order an access trace first used them.
+	bool RelayoutAssetPack(
+		const char * packPath,
+		const char * tracePath,
+		const AssetCompileOptions * pOptions /* = nullptr */)
+	{
+		ASSERT_ERR(packPath);
+		ASSERT_ERR(tracePath);
+
+		using namespace AssetCompiler;
+
+		AssetCompileOptions optionsDefault;
+		const AssetCompileOptions & options = pOptions ? *pOptions : optionsDefault;
+
+		// Read the trace: a file path per line, in order of first use
+		std::vector<byte> trace;
+		if (!LoadFile(tracePath, &trace, LFK_Text))
+		{
+			WARN("Couldn't load access trace %s", tracePath);
+			return false;
+		}
+		std::unordered_map<std::string, int> traceOrder;
+		TextParsingHelper tph((char *)&trace[0], tracePath);
+		while (tph.NextLine())
+		{
+			traceOrder.insert(std::make_pair(std::string(tph.NextToken()), int(traceOrder.size())));
+			tph.ExpectEOL();
+		}
+
+		if (!RecoverAssetPack(packPath))
+			return false;
+
+		mz_zip_archive zipSrc = {};
+		if (!mz_zip_reader_init_file(&zipSrc, packPath, 0))
+		{
+			WARN("Couldn't load asset pack %s", packPath);
+			return false;
+		}
+
+		// Order the files by when their asset was first used, then by their own first use, then
+		// by where they were before.  The pack's own files go after, except the directory, which
+		// gets rebuilt for the new order.
+		struct LayoutKey
+		{
+			int		m_tier;				// 0 = used by the trace, 1 = not, 2 = pack bookkeeping
+			int		m_assetOrder;
+			int		m_fileOrder;
+			int		m_iFile;
+		};
+		int numFiles = int(mz_zip_reader_get_num_files(&zipSrc));
+		std::vector<std::string> paths(numFiles);
+		std::unordered_map<std::string, int> assetOrder;
+		for (int i = 0; i < numFiles; ++i)
+		{
+			char path[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1];
+			mz_zip_reader_get_filename(&zipSrc, i, path, sizeof(path));
+			paths[i] = path;
+
+			// Files are named "<asset path>/<suffix>"
+			auto iterTrace = traceOrder.find(paths[i]);
+			size_t iSlash = paths[i].rfind('/');
+			if (iterTrace == traceOrder.end() || iSlash == std::string::npos)
+				continue;
+			auto iterAsset = assetOrder.insert(std::make_pair(paths[i].substr(0, iSlash), iterTrace->second)).first;
+			iterAsset->second = min(iterAsset->second, iterTrace->second);
+		}
+
+		std::vector<LayoutKey> layout;
+		layout.reserve(numFiles);
+		for (int i = 0; i < numFiles; ++i)
+		{
+			if (paths[i] == s_pathDirectory)
+				continue;
+
+			LayoutKey key = { 2, 0, 0, i };
+			size_t iSlash = paths[i].rfind('/');
+			if (iSlash != std::string::npos)
 			{
-				mz_zip_writer_end(&zipDest);
-				DeleteFile(tempPath);
-				return false;
+				auto iterAsset = assetOrder.find(paths[i].substr(0, iSlash));
+				auto iterTrace = traceOrder.find(paths[i]);
+				key.m_tier = (iterAsset != assetOrder.end()) ? 0 : 1;
+				key.m_assetOrder = (iterAsset != assetOrder.end()) ? iterAsset->second : 0;
+				key.m_fileOrder = (iterTrace != traceOrder.end()) ? iterTrace->second : int(traceOrder.size());
 			}
+			layout.push_back(key);
+		}
+		std::sort(layout.begin(), layout.end(), [](const LayoutKey & a, const LayoutKey & b)
+		{
+			if (a.m_tier != b.m_tier)
+				return a.m_tier < b.m_tier;
+			if (a.m_assetOrder != b.m_assetOrder)
+				return a.m_assetOrder < b.m_assetOrder;
+			if (a.m_fileOrder != b.m_fileOrder)
+				return a.m_fileOrder < b.m_fileOrder;
+			return a.m_iFile < b.m_iFile;
+		});
+
+		// Copy the files to a temporary file in their new order, with a new directory
+		char tempPath[MAX_PATH];
+		GetTempPackPath(packPath, tempPath);
+		mz_zip_archive zipDest = {};
+		if (!mz_zip_writer_init_file(&zipDest, tempPath, 0))
+		{
+			WARN("Couldn't open temporary file %s for writing", tempPath);
+			mz_zip_reader_end(&zipSrc);
+			return false;
+		}
 
-			if (!mz_zip_writer_finalize_archive(&zipDest))
+		PathHashDirectory directory;
+		bool success = true;
+		for (int i = 0, c = int(layout.size()); i < c && success; ++i)
+		{
+			int iFile = layout[i].m_iFile;
+			if (!CopyPackFile(&zipSrc, iFile, options, &zipDest))
 			{
-				WARN("Couldn't finalize temporary archive %s", tempPath);
-				mz_zip_writer_end(&zipDest);
-				DeleteFile(tempPath);
-				return false;
+				WARN("Couldn't copy file %s from asset pack %s to temporary archive %s",
+					paths[iFile].c_str(), packPath, tempPath);
+				success = false;
+				break;
 			}
+			directory.AddFile(HashAssetPath(paths[iFile].c_str()), &zipDest);
+		}
+		mz_zip_reader_end(&zipSrc);
 
-			mz_zip_writer_end(&zipDest);
+		success = success && WritePathHashDirectoryToZip(&directory, options, &zipDest);
+		if (success && !mz_zip_writer_finalize_archive(&zipDest))
+		{
+			WARN("Couldn't finalize temporary archive %s", tempPath);
+			success = false;
+		}
 
-			// Move the new version of the asset pack over the old one
-			if (!MoveFileEx(tempPath, packPath, MOVEFILE_COPY_ALLOWED | MOVEFILE_REPLACE_EXISTING))
-			{
-				WARN("Couldn't rename temporary file %s over asset pack %s", tempPath, packPath);
-				return false;
-			}
+		mz_zip_writer_end(&zipDest);
 
-			return (numErrors == 0);
+		if (!success)
+		{
+			DeleteFile(tempPath);
+			return false;
+		}
+
+		// Move the new version of the asset pack over the old one
+		if (!MoveFileEx(tempPath, packPath, MOVEFILE_COPY_ALLOWED | MOVEFILE_REPLACE_EXISTING))
+		{
+			WARN("Couldn't rename temporary file %s over asset pack %s", tempPath, packPath);
+			return false;
 		}
+
+		LOG("Laid out asset pack %s by access trace %s - %d assets used, of %d files",
+			packPath, tracePath, int(assetOrder.size()), numFiles);
+		return true;
 	}
 }
@@ -2,28 +2,84 @@
 
 namespace Framework
 {
+	namespace AssetCompiler
+	{
+		class AssetStreamer;
+		struct AccessTrace;
+	}
+
 	class AssetPack : public RefCount
 	{
 	public:
 		struct FileInfo
 		{
 			std::string		m_path;			// Archive internal path
-			int				m_offset;		// Starting offset into m_data
-			int				m_size;			// Size in bytes
+			byte *			m_pData;		// Points into the mapped archive, or into m_data if it had to be decompressed
+			i64				m_size;			// Size in bytes
+			int				m_iLayer;		// Stacks only (see MountAssetPacks): index in m_layers of the
+			int				m_iLayerFile;	// pack the file comes from, and its index in that pack
+		};
+
+		struct DirectoryEntry
+		{
+			u64				m_pathHash;		// HashAssetPath of the file's internal path
+			int				m_iFile;		// Index in m_files
 		};
 
-		std::vector<byte>						m_data;				// Entire uncompressed archive
+		std::vector<std::vector<byte>>			m_data;				// Storage for files that couldn't be used in-place from the mapping,
+																	// in blocks, so big packs needn't find one huge contiguous range
+		HANDLE									m_hFile;			// Pack file, held open while it's mapped
+		HANDLE									m_hMapping;
+		byte *									m_pMapping;			// Copy-on-write view of the whole pack file
+		i64										m_mappingSize;
+		AssetCompiler::AssetStreamer *			m_pStreamer;		// Background loader, for packs loaded asynchronously
+		AssetCompiler::AccessTrace *			m_pTrace;			// Lookups recorded so far, while tracing
 		std::vector<FileInfo>					m_files;			// List of files in the archive
-		std::unordered_map<std::string, int>	m_directory;		// Mapping from internal path to index in m_files
+		std::vector<DirectoryEntry>				m_directory;		// Sorted by path hash; precomputed in the pack
 		std::unordered_set<std::string>			m_manifest;			// List of asset names in the pack
 		std::string								m_path;				// File path where the asset pack was loaded from
+		std::vector<comptr<AssetPack>>			m_layers;			// For stacks, the packs mounted in it, bottom first
 
 		AssetPack();
-		bool LookupFile(const char * path, const char * suffix, void ** pDataOut, int * pSizeOut);
+		~AssetPack();
+
+		// Owns the file and mapping handles, so it can't be copied
+		AssetPack(const AssetPack &) = delete;
+		AssetPack & operator = (const AssetPack &) = delete;
+
+		bool LookupFile(const char * path, const char * suffix, void ** pDataOut, i64 * pSizeOut);
+
+		// Lookups by precomputed path hash (see HashAssetPath), which don't touch any strings.
+		// FindFile returns an index in m_files, or -1 if there's no such file.
+		int FindFile(u64 pathHash);
+		bool LookupFile(u64 pathHash, void ** pDataOut, i64 * pSizeOut);
+		bool LookupFile(int iFile, void ** pDataOut, i64 * pSizeOut);
 		bool HasAsset(const char * path);
 		void Reset();
+
+		// For asynchronously loaded packs.  LookupFile blocks until the file it's asked for is
+		// loaded, so these are only needed to control ordering or to avoid stalls.
+		// On packs loaded synchronously, everything is always ready.  On stacks, these go to
+		// the pack each asset comes from.
+		bool IsAssetReady(const char * path);
+		void RequestAsset(const char * path);		// Move an asset to the front of the queue
+		bool WaitForAsset(const char * path);		// Request an asset and block until it's loaded; false if it failed
+		bool WaitForAll();
+
+		// Access tracing, for laying packs out in the order they get used (see RelayoutAssetPack).
+		// While tracing, LookupFile notes the first lookup of each file.  Saving the trace writes
+		// the paths of the files used, in that order, to a text file, and stops tracing.
+		// Start and save traces while no other threads are using the pack.
+		void StartAccessTrace();
+		bool SaveAccessTrace(const char * tracePath);
 	};
 
+	// Hash of an asset pack internal path, as stored in the pack's directory (64-bit FNV-1a).
+	// Paths can be hashed in pieces: HashAssetPathSuffix(HashAssetPath(path), suffix) is the
+	// same as HashAssetPath(path, suffix), so per-asset hashes can be computed once and reused.
+	u64 HashAssetPath(const char * path, const char * suffix = nullptr);
+	u64 HashAssetPathSuffix(u64 pathHash, const char * suffix);
+
 	enum ACK					// Asset Compile Kind
 	{
 		ACK_OBJMesh,			// .obj mesh, compiled to vtx/idx buffers and mtl map
@@ -34,10 +90,125 @@ namespace Framework
 		ACK_Count
 	};
 
+	enum TEXFMT					// Pixel format to compile a texture to
+	{
+		TEXFMT_RGBA8,			// Uncompressed sRGB color + alpha, 32 bits/pixel
+		TEXFMT_BC1,				// sRGB color with 1-bit alpha, 4 bits/pixel
+		TEXFMT_BC3,				// sRGB color + alpha, 8 bits/pixel
+		TEXFMT_BC4,				// Linear single channel (red), 4 bits/pixel; for height maps, masks, etc.
+		TEXFMT_BC5,				// Linear two channels (red, green), 8 bits/pixel; for normal maps
+		TEXFMT_BC7,				// sRGB color + alpha, 8 bits/pixel; best quality, slowest to compile
+
+		TEXFMT_Count
+	};
+
+	enum MESHOPT				// How to order a mesh's triangles
+	{
+		MESHOPT_VertexCache,	// Best post-transform vertex cache use (Forsyth)
+		MESHOPT_Overdraw,		// Nearly as good for the cache, and draws outward-facing parts first
+								// to cut overdraw (Tipsify); for meshes that overlap themselves a lot
+
+		MESHOPT_Count
+	};
+
+	enum NORMALWEIGHT			// How to weight faces when generating vertex normals, for meshes without them
+	{
+		NORMALWEIGHT_Uniform,	// Each face counts the same
+		NORMALWEIGHT_Area,		// By face area, so slivers count for little
+		NORMALWEIGHT_Angle,		// By the face's angle at the vertex, so tessellation doesn't skew it
+
+		NORMALWEIGHT_Count
+	};
+
 	struct AssetCompileInfo
 	{
 		const char *	m_pathSrc;
 		ACK				m_ack;
+		TEXFMT			m_texfmt;		// Textures only; can be left out of initializers, for RGBA8
+		MESHOPT			m_meshopt;		// Meshes only; can be left out of initializers, for MESHOPT_VertexCache
+		float			m_weldPosTolerance;		// Meshes only: merge verts whose position, normal and UV
+		float			m_weldNormalTolerance;	// components each round to the same multiple of that
+		float			m_weldUVTolerance;		// attribute's tolerance (for near-duplicates in DCC exports);
+										// 0 = exact matches only for that attribute.  All three can be
+										// left out.
+		VTXFMT			m_vtxfmt;		// Meshes only; can be left out of initializers, for VTXFMT_Float
+		bool			m_splitForIndex16;	// Meshes only: meshes of more than 64K verts get 32-bit indices,
+										// unless this is set, which splits their material ranges into
+										// pieces of at most 64K verts each, drawn with a base vertex;
+										// can be left out
+		int				m_lodCount;		// Meshes only: LODs to generate by simplification, including the
+										// full-detail one, up to Mesh::s_maxLods; 0 or 1 = just the one
+		float			m_lodRatio;		// Meshes only: triangle count of each LOD relative to the one before;
+										// 0 = 0.5.  Both of these can be left out.
+		NORMALWEIGHT	m_normalWeight;	// Meshes only; can be left out, for NORMALWEIGHT_Uniform
+	};
+
+	// A list of assets discovered by following references from some root assets.
+	// m_assets points into m_paths, so don't copy this around.
+	struct AssetDependencies
+	{
+		std::vector<AssetCompileInfo>	m_assets;		// Roots first, then what they reference, breadth-first
+		std::vector<std::vector<int>>	m_edges;		// For each asset, indices of the assets it references
+		std::vector<std::string>		m_paths;		// Storage for the paths in m_assets
+	};
+
+	// Build a list of assets to compile by following references from some root assets.
+	// .obj meshes lead to .mtl libraries via "mtllib" lines, and those lead to textures
+	// via "map_Kd", "map_Ks" and "bump"/"map_bump" lines; textures are compiled as textureAck.
+	// Color textures get textureFormat; if that's block-compressed, height maps get BC4.
+	// Referenced files that don't exist are skipped with a warning.
+	bool FindAssetDependencies(
+		const AssetCompileInfo * roots,
+		int numRoots,
+		ACK textureAck,
+		TEXFMT textureFormat,
+		AssetDependencies * pDepsOut);
+
+	enum CODEC					// Compression method for files in an asset pack
+	{
+		CODEC_None,				// Stored as-is; used in-place from the mapped pack, no decompression
+		CODEC_Deflate,			// Zip deflate; smallest, but slowest to decompress
+		CODEC_LZ,				// LZ4-style; bigger than deflate, but much faster to decompress
+
+		CODEC_Count
+	};
+
+	struct AssetCompression
+	{
+		CODEC	m_codec;
+		int		m_level;			// Deflate level, 1 (fastest) to 10 (smallest); ignored by other codecs
+	};
+
+	// Options controlling how asset packs get compiled.
+	// Whatever the options, the same inputs always produce a byte-identical pack
+	// (when it's compiled in full, rather than updated by appending to it).
+	struct AssetCompileOptions
+	{
+		int		m_numThreads;		// Worker threads to compile assets on; 0 = one per logical core
+		bool	m_loadAsync;		// Stream the pack in the background once it's compiled (see LoadAssetPack)
+
+		// Compression policy for each kind of asset; defaults to CODEC_None for everything.
+		// Files that don't get any smaller are stored uncompressed regardless.
+		AssetCompression	m_compression[ACK_Count];
+
+		// Directories of previously compiled assets, searched in order before compiling anything.
+		// Newly compiled assets are added to the first one.  A directory on a network share
+		// lets a team (or a build farm) share compiles.  Empty = no caching.
+		std::vector<std::string>	m_cacheDirs;
+
+		// Updating a pack appends the changed assets to it, leaving their old files behind as
+		// dead space.  When that would make more than this fraction of the pack dead, the pack
+		// is rewritten instead, compacting it.  0 = always rewrite.  Defaults to 0.25.
+		float	m_maxDeadSpace;
+
+		// Files stored uncompressed have their data padded to start at a multiple of this many
+		// bytes in the pack (powers of 2, up to 32K), so it can be used in-place with aligned SIMD
+		// loads or uploaded to the GPU with aligned copies.  Files of 64KB or more get the large
+		// alignment.  0 = no padding.  Defaults to 64 bytes, and 4KB for large files.
+		int		m_dataAlignment;
+		int		m_largeDataAlignment;
+
+		AssetCompileOptions();
 	};
 
 	// Load an asset pack file, checking that all its assets are present and up to date,
@@ -46,10 +217,44 @@ namespace Framework
 		const char * packPath,
 		const AssetCompileInfo * assets,
 		int numAssets,
-		AssetPack * pPackOut);
+		AssetPack * pPackOut,
+		const AssetCompileOptions * pOptions = nullptr);
 
 	// Just load an asset pack file.
+	// If async is set, this returns as soon as the pack's directory and manifest are read, and
+	// the asset data streams in on background threads (in pack order, except that requested
+	// assets jump the queue).
 	bool LoadAssetPack(
 		const char * packPath,
+		AssetPack * pPackOut,
+		bool async = false);
+
+	// Mount a stack of loaded asset packs as one, for patches and DLC: lookups go through a
+	// merged directory, as if the packs were extracted one over another in order.  A pack
+	// overrides the ones before it file by file, and any asset in its manifest hides all of
+	// that asset's files in the ones before, so a patched asset never mixes in stale files.
+	// An overlay is just a pack compiled from the assets it changes or adds.
+	// The packs stay mapped (and streaming) independently; the stack holds references to them.
+	bool MountAssetPacks(
+		AssetPack * const * packs,
+		int numPacks,
 		AssetPack * pPackOut);
+
+	// Load asset pack files, and mount them as a stack, bottom first.
+	bool LoadAssetPackStack(
+		const char * const * packPaths,
+		int numPacks,
+		AssetPack * pPackOut,
+		bool async = false);
+
+	// Rewrite an asset pack with its files in the order an access trace (see AssetPack::
+	// StartAccessTrace) first used them, so loading it is one sequential sweep through the
+	// file, and streaming reads straight ahead.  Each asset's files stay together, ordered by
+	// the asset's first use; files the trace didn't reach go after, in their old order.
+	// Appending updates leaves the layout alone, but full compiles and compactions go back
+	// to asset-list order, so run this again after those.
+	bool RelayoutAssetPack(
+		const char * packPath,
+		const char * tracePath,
+		const AssetCompileOptions * pOptions = nullptr);
 }
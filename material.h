@@ -16,7 +16,7 @@ namespace Framework
 		rgb				m_rgbSpecColor;
 		float			m_specPower;
 		float			m_bumpScale;
-		bool			m_alphaTest;
+		bool			m_alphaTest;		// Has an alpha map ("map_d")
 	};
 
 	class MaterialLib
@@ -7,24 +7,86 @@ namespace Framework
 		m_pIndices(nullptr),
 		m_vertCount(0),
 		m_indexCount(0),
+		m_indexFormat(DXGI_FORMAT_R32_UINT),
+		m_pClusters(nullptr),
+		m_clusterCount(0),
+		m_lodCount(1),
 		m_vtxStrideBytes(0),
 		m_primtopo(D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED),
 		m_bounds(empty)
 	{
+		InitVertexFormat(VTXFMT_Float, m_bounds, &m_vtxFormat);
+		memset(m_lodErrors, 0, sizeof(m_lodErrors));
 	}
 
-	void Mesh::Draw(ID3D11DeviceContext * pCtx)
+	void Mesh::Draw(ID3D11DeviceContext * pCtx, int lod /*= 0*/)
 	{
 		ASSERT_ERR(pCtx);
+		ASSERT_ERR(lod >= 0 && lod < m_lodCount);
 
 		UINT zero = 0;
 		pCtx->IASetVertexBuffers(0, 1, &m_pVtxBuffer, (UINT *)&m_vtxStrideBytes, &zero);
-		pCtx->IASetIndexBuffer(m_pIdxBuffer, DXGI_FORMAT_R32_UINT, 0);
+		pCtx->IASetIndexBuffer(m_pIdxBuffer, m_indexFormat, 0);
 		pCtx->IASetPrimitiveTopology(m_primtopo);
-		pCtx->DrawIndexed(m_indexCount, 0, 0);
+
+		if (m_mtlRanges.empty())
+		{
+			pCtx->DrawIndexed(m_indexCount, 0, 0);
+			return;
+		}
+
+		// Draw runs of consecutive ranges that share a base vertex together; that's the
+		// whole LOD in one go, unless the mesh was split for 16-bit indices
+		int indexStart = m_mtlRanges[0].m_lodIndexStarts[lod];
+		int indexCount = 0;
+		int baseVertex = m_mtlRanges[0].m_baseVertex;
+		for (int i = 0, c = int(m_mtlRanges.size()); i < c; ++i)
+		{
+			const MtlRange * pRange = &m_mtlRanges[i];
+			if (pRange->m_baseVertex != baseVertex || pRange->m_lodIndexStarts[lod] != indexStart + indexCount)
+			{
+				if (indexCount > 0)
+					pCtx->DrawIndexed(indexCount, indexStart, baseVertex);
+				indexStart = pRange->m_lodIndexStarts[lod];
+				indexCount = 0;
+				baseVertex = pRange->m_baseVertex;
+			}
+			indexCount += pRange->m_lodIndexCounts[lod];
+		}
+		if (indexCount > 0)
+			pCtx->DrawIndexed(indexCount, indexStart, baseVertex);
+	}
+
+	void Mesh::DrawMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange, int lod /*= 0*/)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(iMtlRange >= 0 && iMtlRange < int(m_mtlRanges.size()));
+		ASSERT_ERR(lod >= 0 && lod < m_lodCount);
+
+		const MtlRange * pRange = &m_mtlRanges[iMtlRange];
+
+		UINT zero = 0;
+		pCtx->IASetVertexBuffers(0, 1, &m_pVtxBuffer, (UINT *)&m_vtxStrideBytes, &zero);
+		pCtx->IASetIndexBuffer(m_pIdxBuffer, m_indexFormat, 0);
+		pCtx->IASetPrimitiveTopology(m_primtopo);
+		pCtx->DrawIndexed(pRange->m_lodIndexCounts[lod], pRange->m_lodIndexStarts[lod], pRange->m_baseVertex);
+	}
+
+	int Mesh::SelectLOD(float distance, float projScale, float maxErrorPixels) const
+	{
+		// Errors grow with each LOD, so step down until the next one's too coarse
+		float pixelsPerUnit = projScale / max(distance, 1e-6f);
+		int lod = 0;
+		while (lod + 1 < m_lodCount && m_lodErrors[lod + 1] * pixelsPerUnit <= maxErrorPixels)
+			++lod;
+		return lod;
 	}
 
-	void Mesh::DrawMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange)
+	int Mesh::DrawMtlRangeCulled(
+		ID3D11DeviceContext * pCtx,
+		int iMtlRange,
+		const ClusterCullInfo & cullInfo,
+		bool cullBackfaces)
 	{
 		ASSERT_ERR(pCtx);
 		ASSERT_ERR(iMtlRange >= 0 && iMtlRange < int(m_mtlRanges.size()));
@@ -33,9 +95,58 @@ namespace Framework
 
 		UINT zero = 0;
 		pCtx->IASetVertexBuffers(0, 1, &m_pVtxBuffer, (UINT *)&m_vtxStrideBytes, &zero);
-		pCtx->IASetIndexBuffer(m_pIdxBuffer, DXGI_FORMAT_R32_UINT, 0);
+		pCtx->IASetIndexBuffer(m_pIdxBuffer, m_indexFormat, 0);
 		pCtx->IASetPrimitiveTopology(m_primtopo);
-		pCtx->DrawIndexed(pRange->m_indexCount, pRange->m_indexStart, 0);
+
+		// Clusters are in index order, so a run of visible ones is a contiguous run of indices
+		int clustersDrawn = 0;
+		int indexStart = 0;
+		int indexCount = 0;
+		for (int i = pRange->m_clusterStart, iEnd = i + pRange->m_clusterCount; i < iEnd; ++i)
+		{
+			if (!IsClusterVisible(i, cullInfo, cullBackfaces))
+			{
+				if (indexCount > 0)
+					pCtx->DrawIndexed(indexCount, indexStart, pRange->m_baseVertex);
+				indexCount = 0;
+				continue;
+			}
+
+			const Cluster * pCluster = &m_pClusters[i];
+			if (indexCount == 0)
+				indexStart = pCluster->m_indexStart;
+			indexCount += pCluster->m_indexCount;
+			++clustersDrawn;
+		}
+		if (indexCount > 0)
+			pCtx->DrawIndexed(indexCount, indexStart, pRange->m_baseVertex);
+
+		return clustersDrawn;
+	}
+
+	bool Mesh::IsClusterVisible(int iCluster, const ClusterCullInfo & cullInfo, bool cullBackfaces) const
+	{
+		ASSERT_ERR(iCluster >= 0 && iCluster < m_clusterCount);
+
+		const Cluster * pCluster = &m_pClusters[iCluster];
+
+		// Sphere against the frustum planes
+		for (int i = 0; i < dim(cullInfo.m_planes); ++i)
+		{
+			float4 plane = cullInfo.m_planes[i];
+			if (dot(plane.xyz, pCluster->m_sphereCenter) + plane.w < -pCluster->m_sphereRadius)
+				return false;
+		}
+
+		// Backface cone
+		if (cullBackfaces)
+		{
+			float3 vecFromEye = pCluster->m_sphereCenter - cullInfo.m_posEye;
+			if (dot(vecFromEye, pCluster->m_coneAxis) >= pCluster->m_coneCutoff * length(vecFromEye) + pCluster->m_sphereRadius)
+				return false;
+		}
+
+		return true;
 	}
 
 	void Mesh::Reset()
@@ -45,11 +156,18 @@ namespace Framework
 		m_pIndices = nullptr;
 		m_vertCount = 0;
 		m_indexCount = 0;
+		m_indexFormat = DXGI_FORMAT_R32_UINT;
+		m_mtlRanges.clear();
+		m_pClusters = nullptr;
+		m_clusterCount = 0;
+		m_lodCount = 1;
+		memset(m_lodErrors, 0, sizeof(m_lodErrors));
 		m_pVtxBuffer.release();
 		m_pIdxBuffer.release();
 		m_vtxStrideBytes = 0;
 		m_primtopo = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
 		m_bounds = box3(empty);
+		InitVertexFormat(VTXFMT_Float, m_bounds, &m_vtxFormat);
 	}
 
 	void Mesh::UploadToGPU(ID3D11Device * pDevice)
@@ -61,7 +179,7 @@ namespace Framework
 
 		D3D11_BUFFER_DESC vtxBufferDesc =
 		{
-			sizeof(Vertex) * m_vertCount,
+			UINT(m_vtxFormat.m_strideBytes * m_vertCount),
 			D3D11_USAGE_IMMUTABLE,
 			D3D11_BIND_VERTEX_BUFFER,
 			0,	// no cpu access
@@ -73,7 +191,7 @@ namespace Framework
 
 		D3D11_BUFFER_DESC idxBufferDesc =
 		{
-			sizeof(int) * m_indexCount,
+			UINT((m_indexFormat == DXGI_FORMAT_R16_UINT ? sizeof(unsigned short) : sizeof(int)) * m_indexCount),
 			D3D11_USAGE_IMMUTABLE,
 			D3D11_BIND_INDEX_BUFFER,
 			0,	// no cpu access
@@ -83,7 +201,154 @@ namespace Framework
 		D3D11_SUBRESOURCE_DATA idxBufferData = { m_pIndices, 0, 0 };
 		CHECK_D3D(pDevice->CreateBuffer(&idxBufferDesc, &idxBufferData, &m_pIdxBuffer));
 
-		m_vtxStrideBytes = sizeof(Vertex);
+		m_vtxStrideBytes = m_vtxFormat.m_strideBytes;
 		m_primtopo = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 	}
+
+	MtlRangeIterator::MtlRangeIterator(const Mesh * pMesh)
+	:	m_iMtlRange(-1),
+		m_pRange(nullptr),
+		m_shaderVariant(SHADERVARIANT_Opaque),
+		m_changed(0),
+		m_pMesh(pMesh)
+	{
+		ASSERT_ERR(pMesh);
+	}
+
+	bool MtlRangeIterator::Next()
+	{
+		int iNext = m_iMtlRange + 1;
+		if (iNext >= int(m_pMesh->m_mtlRanges.size()))
+			return false;
+
+		// Whatever parts of the sort key differ from the last range's are what changed
+		const Mesh::MtlRange * pNext = &m_pMesh->m_mtlRanges[iNext];
+		if (!m_pRange)
+		{
+			m_changed = DRAWSTATE_Shader | DRAWSTATE_Textures | DRAWSTATE_Material;
+		}
+		else
+		{
+			uint diff = pNext->m_sortKey ^ m_pRange->m_sortKey;
+			m_changed = 0;
+			if (diff >> Mesh::s_sortKeyShaderShift)
+				m_changed |= DRAWSTATE_Shader;
+			if ((diff >> Mesh::s_sortKeyTexturesShift) & Mesh::s_sortKeyTexturesMask)
+				m_changed |= DRAWSTATE_Textures;
+			if (diff & Mesh::s_sortKeyMtlMask)
+				m_changed |= DRAWSTATE_Material;
+		}
+
+		m_iMtlRange = iNext;
+		m_pRange = pNext;
+		m_shaderVariant = SHADERVARIANT(pNext->m_sortKey >> Mesh::s_sortKeyShaderShift);
+		return true;
+	}
+
+	void InitVertexFormat(VTXFMT vtxfmt, const box3 & bounds, VertexFormat * pFormatOut)
+	{
+		ASSERT_ERR(vtxfmt >= 0 && vtxfmt < VTXFMT_Count);
+		ASSERT_ERR(pFormatOut);
+
+		pFormatOut->m_vtxfmt = vtxfmt;
+
+		switch (vtxfmt)
+		{
+		case VTXFMT_Float:
+			pFormatOut->m_strideBytes = sizeof(Vertex);
+			pFormatOut->m_formats[VTXATTR_Pos] = DXGI_FORMAT_R32G32B32_FLOAT;
+			pFormatOut->m_formats[VTXATTR_Normal] = DXGI_FORMAT_R32G32B32_FLOAT;
+			pFormatOut->m_formats[VTXATTR_UV] = DXGI_FORMAT_R32G32_FLOAT;
+			pFormatOut->m_offsets[VTXATTR_Pos] = offsetof(Vertex, m_pos);
+			pFormatOut->m_offsets[VTXATTR_Normal] = offsetof(Vertex, m_normal);
+			pFormatOut->m_offsets[VTXATTR_UV] = offsetof(Vertex, m_uv);
+#if VERTEX_TANGENT
+			pFormatOut->m_formats[VTXATTR_Tangent] = DXGI_FORMAT_R32G32B32A32_FLOAT;
+			pFormatOut->m_offsets[VTXATTR_Tangent] = offsetof(Vertex, m_tangent);
+#endif
+			pFormatOut->m_posScale = float3(1.0f);
+			pFormatOut->m_posOffset = float3(0.0f);
+			break;
+
+		case VTXFMT_Quantized:
+			pFormatOut->m_strideBytes = sizeof(VertexQuantized);
+			pFormatOut->m_formats[VTXATTR_Pos] = DXGI_FORMAT_R16G16B16A16_UNORM;
+			pFormatOut->m_formats[VTXATTR_Normal] = DXGI_FORMAT_R16G16_SNORM;
+			pFormatOut->m_formats[VTXATTR_UV] = DXGI_FORMAT_R16G16_FLOAT;
+			pFormatOut->m_offsets[VTXATTR_Pos] = offsetof(VertexQuantized, m_pos);
+			pFormatOut->m_offsets[VTXATTR_Normal] = offsetof(VertexQuantized, m_normal);
+			pFormatOut->m_offsets[VTXATTR_UV] = offsetof(VertexQuantized, m_uv);
+#if VERTEX_TANGENT
+			pFormatOut->m_formats[VTXATTR_Tangent] = DXGI_FORMAT_R16G16_SNORM;
+			pFormatOut->m_offsets[VTXATTR_Tangent] = offsetof(VertexQuantized, m_tangent);
+#endif
+			pFormatOut->m_posScale = bounds.diagonal();
+			pFormatOut->m_posOffset = bounds.mins;
+			break;
+
+		default:
+			ERR("Missing case for VTXFMT %d", vtxfmt);
+			break;
+		}
+	}
+
+	int MakeInputElementDescs(const VertexFormat & format, D3D11_INPUT_ELEMENT_DESC descsOut[VTXATTR_Count])
+	{
+		ASSERT_ERR(descsOut);
+
+		static const char * s_semantics[] =
+		{
+			"POSITION",
+			"NORMAL",
+			"UV",
+#if VERTEX_TANGENT
+			"TANGENT",
+#endif
+		};
+		cassert(dim(s_semantics) == VTXATTR_Count);
+
+		for (int i = 0; i < VTXATTR_Count; ++i)
+		{
+			D3D11_INPUT_ELEMENT_DESC desc =
+			{
+				s_semantics[i], 0,
+				format.m_formats[i],
+				0, UINT(format.m_offsets[i]),
+				D3D11_INPUT_PER_VERTEX_DATA, 0,
+			};
+			descsOut[i] = desc;
+		}
+
+		return VTXATTR_Count;
+	}
+
+	void InitClusterCullInfo(const float4x4 & matLocalToClip, const float3 & posEye, ClusterCullInfo * pInfoOut)
+	{
+		ASSERT_ERR(pInfoOut);
+
+		// Gribb-Hartmann: with row vectors, clip = pos * M, so each clip-space coordinate is
+		// pos dotted with a column of M, and each frustum plane is a sum or difference of columns
+		float4 cols[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			cols[i] = float4(matLocalToClip[0][i], matLocalToClip[1][i], matLocalToClip[2][i], matLocalToClip[3][i]);
+		}
+
+		pInfoOut->m_planes[0] = cols[3] + cols[0];		// Left:	x >= -w
+		pInfoOut->m_planes[1] = cols[3] - cols[0];		// Right:	x <= w
+		pInfoOut->m_planes[2] = cols[3] + cols[1];		// Bottom:	y >= -w
+		pInfoOut->m_planes[3] = cols[3] - cols[1];		// Top:		y <= w
+		pInfoOut->m_planes[4] = cols[2];				// Near:	z >= 0
+		pInfoOut->m_planes[5] = cols[3] - cols[2];		// Far:		z <= w
+
+		for (int i = 0; i < dim(pInfoOut->m_planes); ++i)
+		{
+			float4 plane = pInfoOut->m_planes[i];
+			float lengthNormal = length(plane.xyz);
+			if (lengthNormal > 0.0f)
+				pInfoOut->m_planes[i] = plane / lengthNormal;
+		}
+
+		pInfoOut->m_posEye = posEye;
+	}
 }
@@ -8,37 +8,155 @@ namespace Framework
 	struct Material;
 	class MaterialLib;
 
-	// Hard-coded vertex struct for now
+	// Uncompressed vertex struct, used while compiling meshes and for VTXFMT_Float
 	struct Vertex
 	{
 		float3	m_pos;
 		float3	m_normal;
 		float2	m_uv;
 #if VERTEX_TANGENT
-		float3	m_tangent;
+		float4	m_tangent;		// w = bitangent sign, MikkTSpace-style: bitangent = w * cross(normal, tangent)
 #endif
 	};
 
+	enum VTXFMT					// Vertex layout a mesh is compiled to
+	{
+		VTXFMT_Float,			// Vertex struct as-is; 32 bytes
+		VTXFMT_Quantized,		// VertexQuantized; 16 bytes
+
+		VTXFMT_Count
+	};
+
+	// Compressed vertex struct for VTXFMT_Quantized.
+	//  * Position is unorm16 within the mesh's bounding box (w unused, as there's no
+	//      3-component 16-bit DXGI format); see VertexFormat::m_posScale/m_posOffset.
+	//  * Normal (and tangent) are octahedral-encoded unit vectors, snorm16 x 2.
+	//      With tangents, the bitangent sign goes in position w: 0 = -1, 65535 = +1.
+	//  * UV is half-float, so it loses precision on UVs that tile a long way.
+	struct VertexQuantized
+	{
+		unsigned short	m_pos[4];
+		short			m_normal[2];
+		unsigned short	m_uv[2];
+#if VERTEX_TANGENT
+		short			m_tangent[2];
+#endif
+	};
+
+	enum VTXATTR				// Vertex attributes, in input layout order
+	{
+		VTXATTR_Pos,			// Semantic "POSITION"
+		VTXATTR_Normal,			// Semantic "NORMAL"
+		VTXATTR_UV,				// Semantic "UV"
+#if VERTEX_TANGENT
+		VTXATTR_Tangent,		// Semantic "TANGENT"
+#endif
+
+		VTXATTR_Count
+	};
+
+	// Describes how a mesh's verts are laid out in memory; stored with the compiled mesh
+	struct VertexFormat
+	{
+		VTXFMT			m_vtxfmt;
+		int				m_strideBytes;
+		DXGI_FORMAT		m_formats[VTXATTR_Count];
+		int				m_offsets[VTXATTR_Count];
+
+		// Object-space position = position as the shader reads it * m_posScale + m_posOffset.
+		// Identity for VTXFMT_Float; maps [0, 1] onto the bounding box for VTXFMT_Quantized.
+		float3			m_posScale;
+		float3			m_posOffset;
+	};
+
+	void InitVertexFormat(VTXFMT vtxfmt, const box3 & bounds, VertexFormat * pFormatOut);
+
+	// Fill out an input layout for a vertex format; returns the number of elements (VTXATTR_Count).
+	// Vertex shaders for VTXFMT_Quantized meshes must decode the normal and dequantize the position.
+	int MakeInputElementDescs(const VertexFormat & format, D3D11_INPUT_ELEMENT_DESC descsOut[VTXATTR_Count]);
+
+	// Frustum and eye position for culling a mesh's clusters, in the mesh's local space
+	struct ClusterCullInfo
+	{
+		float4		m_planes[6];		// Normalized; inside is dot(plane.xyz, pos) + plane.w >= 0
+		float3		m_posEye;
+	};
+
+	// matLocalToClip is a D3D-style (0 <= z <= w) projection, perspective or orthographic
+	void InitClusterCullInfo(const float4x4 & matLocalToClip, const float3 & posEye, ClusterCullInfo * pInfoOut);
+
+	enum SHADERVARIANT			// Shader variant a material range is drawn with
+	{
+		SHADERVARIANT_Opaque,
+		SHADERVARIANT_AlphaTest,	// Material has an alpha map ("map_d"); alpha-tested and double-sided
+
+		SHADERVARIANT_Count
+	};
+
 	class Mesh
 	{
 	public:
+		static const int			s_maxLods = 8;
+
+		// Material range sort keys: the shader variant in the top bits, then the range's set of
+		// textures, then its material, each numbered within the mesh by the mesh compiler
+		static const int			s_sortKeyShaderShift = 28;
+		static const int			s_sortKeyTexturesShift = 12;
+		static const uint			s_sortKeyTexturesMask = 0xffff;
+		static const uint			s_sortKeyMtlMask = 0xfff;
+
 		// Asset pack that this mesh's data is sourced from
 		comptr<AssetPack>			m_pPack;
 
 		// Pointers to vertex and index data in the asset pack
-		Vertex *					m_pVerts;
-		int *						m_pIndices;
+		void *						m_pVerts;			// Laid out as described by m_vtxFormat
+		void *						m_pIndices;			// 16 or 32 bits each, per m_indexFormat
 		int							m_vertCount;
 		int							m_indexCount;
+		VertexFormat				m_vtxFormat;
+		DXGI_FORMAT					m_indexFormat;		// DXGI_FORMAT_R16_UINT or DXGI_FORMAT_R32_UINT
 
 		// Material map
 		struct MtlRange
 		{
 			Material *	m_pMtl;
 			int			m_indexStart, m_indexCount;
+			int			m_baseVertex;		// Added to each index; nonzero if the mesh was split for 16-bit indices
+			int			m_clusterStart, m_clusterCount;
+
+			// Index runs for each LOD; [0] is the same as m_indexStart/m_indexCount.  A run
+			// can be shared with the LOD before, where the range couldn't be simplified further.
+			int			m_lodIndexStarts[s_maxLods], m_lodIndexCounts[s_maxLods];
+
+			// See s_sortKeyShaderShift etc.  m_mtlRanges is in sort key order, so drawing the
+			// ranges in turn changes as little state as possible; see MtlRangeIterator.
+			uint		m_sortKey;
 		};
 		std::vector<MtlRange>		m_mtlRanges;
 
+		// Clusters of about 64-128 triangles, each a contiguous run of indices within a
+		// material range, for culling finer than the whole mesh.  Stored in index order.
+		struct Cluster
+		{
+			int			m_indexStart, m_indexCount;
+			box3		m_bounds;
+			float3		m_sphereCenter;
+			float		m_sphereRadius;
+
+			// Backface cone: every triangle faces away from eye positions p where
+			// dot(m_sphereCenter - p, m_coneAxis) >= m_coneCutoff * length(m_sphereCenter - p) + m_sphereRadius.
+			// m_coneCutoff is 1 for clusters whose normals are too spread out to ever be culled.
+			float3		m_coneAxis;
+			float		m_coneCutoff;
+		};
+		Cluster *					m_pClusters;		// Points into the asset pack; LOD 0 only
+		int							m_clusterCount;
+
+		// Simplified LODs.  They share the vertex buffer, and their indices follow LOD 0's.
+		// Each LOD's error is how far (in local space) its surface may be from LOD 0's.
+		int							m_lodCount;			// At least 1
+		float						m_lodErrors[s_maxLods];
+
 		// GPU resources
 		comptr<ID3D11Buffer>		m_pVtxBuffer;
 		comptr<ID3D11Buffer>		m_pIdxBuffer;
@@ -49,14 +167,57 @@ namespace Framework
 		box3						m_bounds;			// Bounding box in local space
 
 				Mesh();
-		void	Draw(ID3D11DeviceContext * pCtx);
-		void	DrawMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange);
+		void	Draw(ID3D11DeviceContext * pCtx, int lod = 0);
+		void	DrawMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange, int lod = 0);
+
+		// Pick the coarsest LOD whose error, projected to the screen at the given distance,
+		// is at most maxErrorPixels.  projScale converts a size at distance 1 to pixels,
+		// i.e. viewport height / (2 tan(vertical FOV / 2)).
+		int		SelectLOD(float distance, float projScale, float maxErrorPixels) const;
+
+		// Draw just the clusters of a material range (at LOD 0) that are in the frustum, merging runs of
+		// visible clusters into one draw call.  With cullBackfaces, clusters facing entirely away
+		// from the eye are culled too; don't use it for double-sided materials.
+		// Returns the number of clusters drawn.
+		int		DrawMtlRangeCulled(ID3D11DeviceContext * pCtx, int iMtlRange, const ClusterCullInfo & cullInfo, bool cullBackfaces);
+		bool	IsClusterVisible(int iCluster, const ClusterCullInfo & cullInfo, bool cullBackfaces) const;
+
 		void	Reset();
 
 		// Creates the vertex and index buffers on the GPU from m_pVerts and m_pIndices
 		void	UploadToGPU(ID3D11Device * pDevice);
 	};
 
+	enum DRAWSTATE				// State that can change from one material range to the next
+	{
+		DRAWSTATE_Shader	= 0x1,	// Shader variant, and the rasterizer state that goes with it
+		DRAWSTATE_Textures	= 0x2,
+		DRAWSTATE_Material	= 0x4,	// Anything else about the material, e.g. its constants
+	};
+
+	// Walks a mesh's material ranges in order, saying which state changed since the range
+	// before, so only that needs rebinding.  The first range has everything changed.
+	//
+	//		for (MtlRangeIterator iter(&mesh); iter.Next(); )
+	//		{
+	//			if (iter.m_changed & DRAWSTATE_Shader) ...
+	//			mesh.DrawMtlRange(pCtx, iter.m_iMtlRange);
+	//		}
+	class MtlRangeIterator
+	{
+	public:
+		int						m_iMtlRange;
+		const Mesh::MtlRange *	m_pRange;
+		SHADERVARIANT			m_shaderVariant;
+		int						m_changed;			// DRAWSTATE bits
+
+				MtlRangeIterator(const Mesh * pMesh);
+		bool	Next();								// Returns false past the last range
+
+	private:
+		const Mesh *			m_pMesh;
+	};
+
 	// Load a mesh from an asset pack and resolve material references
 	// using the given texture library
 	bool LoadMeshFromAssetPack(
@@ -140,8 +140,9 @@
      possibility that the archive's central directory could be lost with this method if anything goes wrong, though.
 
      - ZIP archive support limitations:
-     No zip64 or spanning support. Extraction functions can only handle unencrypted, stored or deflated files.
+     Zip64 is supported for archives over 4GB or with over 64K files, but not for individual files over 4GB. No spanning support. Extraction functions can only handle unencrypted, stored or deflated files.
      Requires streams capable of seeking.
+     Files' data can be aligned in the archive by padding their local headers' extra field, like Android's zipalign (see mz_zip_writer_add_mem_ex_aligned()).
 
    * This is a header file library, like stb_image.c. To get only a header file, either cut and paste the
      below header, or create miniz.h, #define MINIZ_HEADER_FILE_ONLY, and then include miniz.c from it.
@@ -644,6 +645,10 @@ mz_bool mz_zip_writer_init_from_reader(mz_zip_archive *pZip, const char *pFilena
 mz_bool mz_zip_writer_add_mem(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, mz_uint level_and_flags);
 mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32);
 
+// Like mz_zip_writer_add_mem_ex(), but pads the local header's extra field (the way Android's zipalign does) so the file's data starts at a multiple of data_alignment bytes in the archive.
+// data_alignment must be a power of 2, up to 32768; 0 or 1 means no padding.
+mz_bool mz_zip_writer_add_mem_ex_aligned(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, mz_uint data_alignment);
+
 #ifndef MINIZ_NO_STDIO
 // Adds the contents of a disk file to an archive. This function also records the disk file's modified time into the archive.
 // level_and_flags - compression level (0-10, see MZ_BEST_SPEED, MZ_BEST_COMPRESSION, etc.) logically OR'd with zero or more mz_zip_flags, or just set to MZ_DEFAULT_COMPRESSION.
@@ -654,6 +659,9 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
 // This function fully clones the source file's compressed data (no recompression), along with its full filename, extra data, and comment fields.
 mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint file_index);
 
+// Like mz_zip_writer_add_from_zip_reader(), but replaces any alignment padding in the local header's extra field with padding for where the file's data lands in this archive (see mz_zip_writer_add_mem_ex_aligned()).
+mz_bool mz_zip_writer_add_from_zip_reader_aligned(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint file_index, mz_uint data_alignment);
+
 // Finalizes the archive by writing the central directory records followed by the end of central directory record.
 // After an archive is finalized, the only valid call on the mz_zip_archive struct is mz_zip_writer_end().
 // An archive must be manually finalized by calling this function for it to be valid.
@@ -959,6 +967,7 @@ typedef unsigned char mz_validate_uint64[sizeof(mz_uint64)==8 ? 1 : -1];
   #define MZ_READ_LE16(p) ((mz_uint32)(((const mz_uint8 *)(p))[0]) | ((mz_uint32)(((const mz_uint8 *)(p))[1]) << 8U))
   #define MZ_READ_LE32(p) ((mz_uint32)(((const mz_uint8 *)(p))[0]) | ((mz_uint32)(((const mz_uint8 *)(p))[1]) << 8U) | ((mz_uint32)(((const mz_uint8 *)(p))[2]) << 16U) | ((mz_uint32)(((const mz_uint8 *)(p))[3]) << 24U))
 #endif
+#define MZ_READ_LE64(p) (((mz_uint64)MZ_READ_LE32(p)) | (((mz_uint64)MZ_READ_LE32((const mz_uint8 *)(p) + sizeof(mz_uint32))) << 32U))
 
 #ifdef _MSC_VER
   #define MZ_FORCEINLINE __forceinline
@@ -2964,6 +2973,15 @@ enum
   // End of central directory offsets
   MZ_ZIP_ECDH_SIG_OFS = 0, MZ_ZIP_ECDH_NUM_THIS_DISK_OFS = 4, MZ_ZIP_ECDH_NUM_DISK_CDIR_OFS = 6, MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS = 8,
   MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS = 10, MZ_ZIP_ECDH_CDIR_SIZE_OFS = 12, MZ_ZIP_ECDH_CDIR_OFS_OFS = 16, MZ_ZIP_ECDH_COMMENT_SIZE_OFS = 20,
+  // Extra field used to pad local headers so file data is aligned (as written by Android's zipalign): a 16-bit alignment, then zeros
+  MZ_ZIP_ALIGNMENT_EXTRA_FIELD_ID = 0xD935, MZ_ZIP_ALIGNMENT_EXTRA_MIN_SIZE = 6, MZ_ZIP_MAX_DATA_ALIGNMENT = 0x8000,
+  // Zip64 identifiers, record sizes and offsets
+  MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG = 0x06064b50, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG = 0x07064b50, MZ_ZIP64_EXTENDED_INFO_FIELD_ID = 0x0001,
+  MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE = 56, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE = 20,
+  MZ_ZIP64_ECDH_SIG_OFS = 0, MZ_ZIP64_ECDH_SIZE_OF_RECORD_OFS = 4, MZ_ZIP64_ECDH_VERSION_MADE_BY_OFS = 12, MZ_ZIP64_ECDH_VERSION_NEEDED_OFS = 14,
+  MZ_ZIP64_ECDH_NUM_THIS_DISK_OFS = 16, MZ_ZIP64_ECDH_NUM_DISK_CDIR_OFS = 20, MZ_ZIP64_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS = 24,
+  MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS = 32, MZ_ZIP64_ECDH_CDIR_SIZE_OFS = 40, MZ_ZIP64_ECDH_CDIR_OFS_OFS = 48,
+  MZ_ZIP64_ECDL_SIG_OFS = 0, MZ_ZIP64_ECDL_NUM_DISK_CDIR_OFS = 4, MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS = 8, MZ_ZIP64_ECDL_TOTAL_NUMBER_OF_DISKS_OFS = 16,
 };
 
 typedef struct
@@ -3165,10 +3183,64 @@ static void mz_zip_reader_sort_central_dir_offsets_by_filename(mz_zip_archive *p
   }
 }
 
+// Get a central dir record's sizes and local header offset.  Where the 32-bit fields are
+// saturated, the real values are in the record's zip64 extended information extra field.
+// The caller must have checked that the whole record is in bounds.
+static mz_bool mz_zip_get_cdh_sizes(const mz_uint8 *p, mz_uint64 *pComp_size, mz_uint64 *pUncomp_size, mz_uint64 *pLocal_header_ofs)
+{
+  mz_uint64 comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+  mz_uint64 uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+  mz_uint64 local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+  if ((comp_size == 0xFFFFFFFF) || (uncomp_size == 0xFFFFFFFF) || (local_header_ofs == 0xFFFFFFFF))
+  {
+    const mz_uint8 *pExtra = p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+    mz_uint extra_size_remaining = MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS);
+    for ( ; ; )
+    {
+      mz_uint field_id, field_size;
+      if (extra_size_remaining < 4)
+        return MZ_FALSE;
+      field_id = MZ_READ_LE16(pExtra);
+      field_size = MZ_READ_LE16(pExtra + 2);
+      if (field_size + 4 > extra_size_remaining)
+        return MZ_FALSE;
+      if (field_id == MZ_ZIP64_EXTENDED_INFO_FIELD_ID)
+      {
+        // The field holds only the saturated values, in this order.
+        const mz_uint8 *pField = pExtra + 4, *pField_end = pField + field_size;
+        if (uncomp_size == 0xFFFFFFFF)
+        {
+          if (pField + sizeof(mz_uint64) > pField_end)
+            return MZ_FALSE;
+          uncomp_size = MZ_READ_LE64(pField); pField += sizeof(mz_uint64);
+        }
+        if (comp_size == 0xFFFFFFFF)
+        {
+          if (pField + sizeof(mz_uint64) > pField_end)
+            return MZ_FALSE;
+          comp_size = MZ_READ_LE64(pField); pField += sizeof(mz_uint64);
+        }
+        if (local_header_ofs == 0xFFFFFFFF)
+        {
+          if (pField + sizeof(mz_uint64) > pField_end)
+            return MZ_FALSE;
+          local_header_ofs = MZ_READ_LE64(pField); pField += sizeof(mz_uint64);
+        }
+        break;
+      }
+      pExtra += field_size + 4; extra_size_remaining -= field_size + 4;
+    }
+  }
+  if (pComp_size) *pComp_size = comp_size;
+  if (pUncomp_size) *pUncomp_size = uncomp_size;
+  if (pLocal_header_ofs) *pLocal_header_ofs = local_header_ofs;
+  return MZ_TRUE;
+}
+
 static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 flags)
 {
-  mz_uint cdir_size, num_this_disk, cdir_disk_index;
-  mz_uint64 cdir_ofs;
+  mz_uint num_this_disk, cdir_disk_index;
+  mz_uint64 cdir_size, cdir_ofs;
   mz_int64 cur_file_ofs;
   const mz_uint8 *p;
   mz_uint32 buf_u32[4096 / sizeof(mz_uint32)]; mz_uint8 *pBuf = (mz_uint8 *)buf_u32;
@@ -3207,11 +3279,39 @@ static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 fl
   if (((num_this_disk | cdir_disk_index) != 0) && ((num_this_disk != 1) || (cdir_disk_index != 1)))
     return MZ_FALSE;
 
-  if ((cdir_size = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_SIZE_OFS)) < pZip->m_total_files * MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)
+  cdir_size = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_SIZE_OFS);
+  cdir_ofs = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_OFS_OFS);
+
+  // Zip64 archives have a locator just before the end of central directory record, pointing
+  // to a zip64 end of central directory record that has the real file count, size and offset.
+  if (cur_file_ofs >= MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE)
+  {
+    mz_uint64 zip64_cdir_ofs, zip64_total_files;
+    if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs - MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE, pBuf, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE) != MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE)
+      return MZ_FALSE;
+    if (MZ_READ_LE32(pBuf + MZ_ZIP64_ECDL_SIG_OFS) == MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG)
+    {
+      zip64_cdir_ofs = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS);
+      if ((zip64_cdir_ofs + MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) > (mz_uint64)(cur_file_ofs - MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE))
+        return MZ_FALSE;
+      if (pZip->m_pRead(pZip->m_pIO_opaque, zip64_cdir_ofs, pBuf, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) != MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE)
+        return MZ_FALSE;
+      if (MZ_READ_LE32(pBuf + MZ_ZIP64_ECDH_SIG_OFS) != MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG)
+        return MZ_FALSE;
+      zip64_total_files = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS);
+      if ((zip64_total_files != MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS)) || (zip64_total_files > 0xFFFFFFFF))
+        return MZ_FALSE;
+      pZip->m_total_files = (mz_uint)zip64_total_files;
+      cdir_size = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_SIZE_OFS);
+      cdir_ofs = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_OFS_OFS);
+    }
+  }
+
+  // The central directory itself still has to fit in 4GB, as records are indexed by 32-bit offsets into it.
+  if ((cdir_size < (mz_uint64)pZip->m_total_files * MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) || (cdir_size > 0xFFFFFFFF))
     return MZ_FALSE;
 
-  cdir_ofs = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_OFS_OFS);
-  if ((cdir_ofs + (mz_uint64)cdir_size) > pZip->m_archive_size)
+  if ((cdir_ofs + cdir_size) > pZip->m_archive_size)
     return MZ_FALSE;
 
   pZip->m_central_directory_file_ofs = cdir_ofs;
@@ -3221,7 +3321,7 @@ static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 fl
      mz_uint i, n;
 
     // Read the entire central directory into a heap block, and allocate another heap block to hold the unsorted central dir file record offsets, and another to hold the sorted indices.
-    if ((!mz_zip_array_resize(pZip, &pZip->m_pState->m_central_dir, cdir_size, MZ_FALSE)) ||
+    if ((!mz_zip_array_resize(pZip, &pZip->m_pState->m_central_dir, (size_t)cdir_size, MZ_FALSE)) ||
         (!mz_zip_array_resize(pZip, &pZip->m_pState->m_central_dir_offsets, pZip->m_total_files, MZ_FALSE)))
       return MZ_FALSE;
 
@@ -3231,29 +3331,31 @@ static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 fl
         return MZ_FALSE;
     }
 
-    if (pZip->m_pRead(pZip->m_pIO_opaque, cdir_ofs, pZip->m_pState->m_central_dir.m_p, cdir_size) != cdir_size)
+    if (pZip->m_pRead(pZip->m_pIO_opaque, cdir_ofs, pZip->m_pState->m_central_dir.m_p, (size_t)cdir_size) != cdir_size)
       return MZ_FALSE;
 
-    // Now create an index into the central directory file records, do some basic sanity checking on each record, and check for zip64 entries (which are not yet supported).
+    // Now create an index into the central directory file records, and do some basic sanity checking on each record.
+    // Zip64 sizes and offsets are supported, but the files themselves must still be under 4GB.
     p = (const mz_uint8 *)pZip->m_pState->m_central_dir.m_p;
-    for (n = cdir_size, i = 0; i < pZip->m_total_files; ++i)
+    for (n = (mz_uint)cdir_size, i = 0; i < pZip->m_total_files; ++i)
     {
-      mz_uint total_header_size, comp_size, decomp_size, disk_index;
+      mz_uint total_header_size, disk_index;
+      mz_uint64 comp_size, decomp_size, local_header_ofs;
       if ((n < MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) || (MZ_READ_LE32(p) != MZ_ZIP_CENTRAL_DIR_HEADER_SIG))
         return MZ_FALSE;
       MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_central_dir_offsets, mz_uint32, i) = (mz_uint32)(p - (const mz_uint8 *)pZip->m_pState->m_central_dir.m_p);
       if (sort_central_dir)
         MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_sorted_central_dir_offsets, mz_uint32, i) = i;
-      comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
-      decomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
-      if (((!MZ_READ_LE32(p + MZ_ZIP_CDH_METHOD_OFS)) && (decomp_size != comp_size)) || (decomp_size && !comp_size) || (decomp_size == 0xFFFFFFFF) || (comp_size == 0xFFFFFFFF))
+      if ((total_header_size = MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS)) > n)
+        return MZ_FALSE;
+      if (!mz_zip_get_cdh_sizes(p, &comp_size, &decomp_size, &local_header_ofs))
+        return MZ_FALSE;
+      if (((!MZ_READ_LE32(p + MZ_ZIP_CDH_METHOD_OFS)) && (decomp_size != comp_size)) || (decomp_size && !comp_size) || (decomp_size > 0xFFFFFFFF) || (comp_size > 0xFFFFFFFF))
         return MZ_FALSE;
       disk_index = MZ_READ_LE16(p + MZ_ZIP_CDH_DISK_START_OFS);
       if ((disk_index != num_this_disk) && (disk_index != 1))
         return MZ_FALSE;
-      if (((mz_uint64)MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS) + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + comp_size) > pZip->m_archive_size)
-        return MZ_FALSE;
-      if ((total_header_size = MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS)) > n)
+      if ((local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + comp_size) > pZip->m_archive_size)
         return MZ_FALSE;
       n -= total_header_size; p += total_header_size;
     }
@@ -3414,11 +3516,10 @@ mz_bool mz_zip_reader_file_stat(mz_zip_archive *pZip, mz_uint file_index, mz_zip
   pStat->m_time = mz_zip_dos_to_time_t(MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_TIME_OFS), MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_DATE_OFS));
 #endif
   pStat->m_crc32 = MZ_READ_LE32(p + MZ_ZIP_CDH_CRC32_OFS);
-  pStat->m_comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
-  pStat->m_uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+  if (!mz_zip_get_cdh_sizes(p, &pStat->m_comp_size, &pStat->m_uncomp_size, &pStat->m_local_header_ofs))
+    return MZ_FALSE;
   pStat->m_internal_attr = MZ_READ_LE16(p + MZ_ZIP_CDH_INTERNAL_ATTR_OFS);
   pStat->m_external_attr = MZ_READ_LE32(p + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS);
-  pStat->m_local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
 
   // Copy as much of the filename and comment as possible.
   n = MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS); n = MZ_MIN(n, MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE - 1);
@@ -3693,8 +3794,8 @@ void *mz_zip_reader_extract_to_heap(mz_zip_archive *pZip, mz_uint file_index, si
   if (!p)
     return NULL;
 
-  comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
-  uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+  if (!mz_zip_get_cdh_sizes(p, &comp_size, &uncomp_size, NULL))
+    return NULL;
 
   alloc_size = (flags & MZ_ZIP_FLAG_COMPRESSED_DATA) ? comp_size : uncomp_size;
 #ifdef _MSC_VER
@@ -3970,6 +4071,7 @@ static void mz_write_le16(mz_uint8 *p, mz_uint16 v) { p[0] = (mz_uint8)v; p[1] =
 static void mz_write_le32(mz_uint8 *p, mz_uint32 v) { p[0] = (mz_uint8)v; p[1] = (mz_uint8)(v >> 8); p[2] = (mz_uint8)(v >> 16); p[3] = (mz_uint8)(v >> 24); }
 #define MZ_WRITE_LE16(p, v) mz_write_le16((mz_uint8 *)(p), (mz_uint16)(v))
 #define MZ_WRITE_LE32(p, v) mz_write_le32((mz_uint8 *)(p), (mz_uint32)(v))
+#define MZ_WRITE_LE64(p, v) { mz_uint64 mz_v64 = (mz_uint64)(v); mz_write_le32((mz_uint8 *)(p), (mz_uint32)mz_v64); mz_write_le32((mz_uint8 *)(p) + sizeof(mz_uint32), (mz_uint32)(mz_v64 >> 32U)); }
 
 mz_bool mz_zip_writer_init(mz_zip_archive *pZip, mz_uint64 existing_size)
 {
@@ -4090,7 +4192,7 @@ mz_bool mz_zip_writer_init_from_reader(mz_zip_archive *pZip, const char *pFilena
   if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_READING))
     return MZ_FALSE;
   // No sense in trying to write to an archive that's already at the support max size
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP_LOCAL_DIR_HEADER_SIZE) > 0xFFFFFFFF))
+  if (pZip->m_total_files == 0xFFFFFFFF)
     return MZ_FALSE;
 
   pState = pZip->m_pState;
@@ -4191,27 +4293,43 @@ static mz_bool mz_zip_writer_create_central_dir_header(mz_zip_archive *pZip, mz_
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_EXTRA_LEN_OFS, extra_size);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_COMMENT_LEN_OFS, comment_size);
   MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS, ext_attributes);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_LOCAL_HEADER_OFS, local_header_ofs);
+  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_LOCAL_HEADER_OFS, MZ_MIN(local_header_ofs, 0xFFFFFFFF));
   return MZ_TRUE;
 }
 
+// Fill in a central dir record's zip64 extended information extra field, for a local header
+// offset that doesn't fit in 32 bits.  Returns the field's size, or 0 if it isn't needed.
+// (Sizes always fit, as individual files are still limited to 4GB.)
+static mz_uint mz_zip_writer_create_zip64_extra(mz_uint8 *pDst, mz_uint64 local_header_ofs)
+{
+  if (local_header_ofs < 0xFFFFFFFF)
+    return 0;
+  MZ_WRITE_LE16(pDst, MZ_ZIP64_EXTENDED_INFO_FIELD_ID);
+  MZ_WRITE_LE16(pDst + 2, sizeof(mz_uint64));
+  MZ_WRITE_LE64(pDst + 4, local_header_ofs);
+  return 4 + sizeof(mz_uint64);
+}
+
 static mz_bool mz_zip_writer_add_to_central_dir(mz_zip_archive *pZip, const char *pFilename, mz_uint16 filename_size, const void *pExtra, mz_uint16 extra_size, const void *pComment, mz_uint16 comment_size, mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint32 uncomp_crc32, mz_uint16 method, mz_uint16 bit_flags, mz_uint16 dos_time, mz_uint16 dos_date, mz_uint64 local_header_ofs, mz_uint32 ext_attributes)
 {
   mz_zip_internal_state *pState = pZip->m_pState;
   mz_uint32 central_dir_ofs = (mz_uint32)pState->m_central_dir.m_size;
   size_t orig_central_dir_size = pState->m_central_dir.m_size;
   mz_uint8 central_dir_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
+  mz_uint8 zip64_extra[4 + sizeof(mz_uint64)];
+  mz_uint zip64_extra_size = mz_zip_writer_create_zip64_extra(zip64_extra, local_header_ofs);
 
-  // No zip64 support yet
-  if ((local_header_ofs > 0xFFFFFFFF) || (((mz_uint64)pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + extra_size + comment_size) > 0xFFFFFFFF))
+  // The central directory itself is still limited to 4GB
+  if (((mz_uint)extra_size + zip64_extra_size > 0xFFFF) || (((mz_uint64)pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + extra_size + zip64_extra_size + comment_size) > 0xFFFFFFFF))
     return MZ_FALSE;
 
-  if (!mz_zip_writer_create_central_dir_header(pZip, central_dir_header, filename_size, extra_size, comment_size, uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time, dos_date, local_header_ofs, ext_attributes))
+  if (!mz_zip_writer_create_central_dir_header(pZip, central_dir_header, filename_size, (mz_uint16)(extra_size + zip64_extra_size), comment_size, uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time, dos_date, local_header_ofs, ext_attributes))
     return MZ_FALSE;
 
   if ((!mz_zip_array_push_back(pZip, &pState->m_central_dir, central_dir_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pFilename, filename_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pExtra, extra_size)) ||
+      (!mz_zip_array_push_back(pZip, &pState->m_central_dir, zip64_extra, zip64_extra_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pComment, comment_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir_offsets, &central_dir_ofs, 1)))
   {
@@ -4260,10 +4378,36 @@ static mz_bool mz_zip_writer_write_zeros(mz_zip_archive *pZip, mz_uint64 cur_fil
   return MZ_TRUE;
 }
 
+// Size of the alignment extra field needed for a file's data, which would otherwise start at data_ofs, to start at a multiple of data_alignment; 0 if it's already aligned.
+static mz_uint mz_zip_writer_compute_alignment_extra_size(mz_uint64 data_ofs, mz_uint data_alignment)
+{
+  if ((data_alignment <= 1) || (!(data_ofs & (data_alignment - 1))))
+    return 0;
+  return MZ_ZIP_ALIGNMENT_EXTRA_MIN_SIZE + (mz_uint)((data_alignment - ((data_ofs + MZ_ZIP_ALIGNMENT_EXTRA_MIN_SIZE) & (data_alignment - 1))) & (data_alignment - 1));
+}
+
+static mz_bool mz_zip_writer_write_alignment_extra(mz_zip_archive *pZip, mz_uint64 cur_file_ofs, mz_uint extra_size, mz_uint data_alignment)
+{
+  mz_uint8 field[MZ_ZIP_ALIGNMENT_EXTRA_MIN_SIZE];
+  if (!extra_size)
+    return MZ_TRUE;
+  MZ_WRITE_LE16(field, MZ_ZIP_ALIGNMENT_EXTRA_FIELD_ID);
+  MZ_WRITE_LE16(field + 2, extra_size - 4);
+  MZ_WRITE_LE16(field + 4, data_alignment);
+  if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_file_ofs, field, sizeof(field)) != sizeof(field))
+    return MZ_FALSE;
+  return mz_zip_writer_write_zeros(pZip, cur_file_ofs + sizeof(field), extra_size - sizeof(field));
+}
+
 mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32)
+{
+  return mz_zip_writer_add_mem_ex_aligned(pZip, pArchive_name, pBuf, buf_size, pComment, comment_size, level_and_flags, uncomp_size, uncomp_crc32, 0);
+}
+
+mz_bool mz_zip_writer_add_mem_ex_aligned(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, mz_uint data_alignment)
 {
   mz_uint16 method = 0, dos_time = 0, dos_date = 0;
-  mz_uint level, ext_attributes = 0, num_alignment_padding_bytes;
+  mz_uint level, ext_attributes = 0, num_alignment_padding_bytes, local_extra_size;
   mz_uint64 local_dir_header_ofs = pZip->m_archive_size, cur_archive_file_ofs = pZip->m_archive_size, comp_size = 0;
   size_t archive_name_size;
   mz_uint8 local_dir_header[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
@@ -4276,14 +4420,16 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
   level = level_and_flags & 0xF;
   store_data_uncompressed = ((!level) || (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA));
 
-  if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || ((buf_size) && (!pBuf)) || (!pArchive_name) || ((comment_size) && (!pComment)) || (pZip->m_total_files == 0xFFFF) || (level > MZ_UBER_COMPRESSION))
+  if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || ((buf_size) && (!pBuf)) || (!pArchive_name) || ((comment_size) && (!pComment)) || (pZip->m_total_files == 0xFFFFFFFF) || (level > MZ_UBER_COMPRESSION))
+    return MZ_FALSE;
+  if ((data_alignment & (data_alignment - 1)) || (data_alignment > MZ_ZIP_MAX_DATA_ALIGNMENT))
     return MZ_FALSE;
 
   pState = pZip->m_pState;
 
   if ((!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (uncomp_size))
     return MZ_FALSE;
-  // No zip64 support yet
+  // Files are still limited to 4GB
   if ((buf_size > 0xFFFFFFFF) || (uncomp_size > 0xFFFFFFFF))
     return MZ_FALSE;
   if (!mz_zip_writer_validate_archive_name(pArchive_name))
@@ -4302,8 +4448,7 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
 
   num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
 
-  // no zip64 support yet
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + comment_size + archive_name_size) > 0xFFFFFFFF))
+  if (pZip->m_total_files == 0xFFFFFFFF)
     return MZ_FALSE;
 
   if ((archive_name_size) && (pArchive_name[archive_name_size - 1] == '/'))
@@ -4342,6 +4487,14 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
   }
   cur_archive_file_ofs += archive_name_size;
 
+  local_extra_size = mz_zip_writer_compute_alignment_extra_size(cur_archive_file_ofs, data_alignment);
+  if (!mz_zip_writer_write_alignment_extra(pZip, cur_archive_file_ofs, local_extra_size, data_alignment))
+  {
+    pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
+    return MZ_FALSE;
+  }
+  cur_archive_file_ofs += local_extra_size;
+
   if (!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
   {
     uncomp_crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, (const mz_uint8*)pBuf, buf_size);
@@ -4391,16 +4544,17 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
   pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
   pComp = NULL;
 
-  // no zip64 support yet
-  if ((comp_size > 0xFFFFFFFF) || (cur_archive_file_ofs > 0xFFFFFFFF))
+  // Zip64 is only supported for archive offsets; files are still limited to 4GB
+  if (comp_size > 0xFFFFFFFF)
     return MZ_FALSE;
 
-  if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, 0, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date))
+  if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)local_extra_size, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date))
     return MZ_FALSE;
 
   if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
     return MZ_FALSE;
 
+  // The padding only goes in the local header; the central directory doesn't need it
   if (!mz_zip_writer_add_to_central_dir(pZip, pArchive_name, (mz_uint16)archive_name_size, NULL, 0, pComment, comment_size, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date, local_dir_header_ofs, ext_attributes))
     return MZ_FALSE;
 
@@ -4437,8 +4591,7 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
 
   num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
 
-  // no zip64 support yet
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + comment_size + archive_name_size) > 0xFFFFFFFF))
+  if (pZip->m_total_files == 0xFFFFFFFF)
     return MZ_FALSE;
 
   if (!mz_zip_get_file_modified_time(pSrc_filename, &dos_time, &dos_date))
@@ -4453,7 +4606,7 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
 
   if (uncomp_size > 0xFFFFFFFF)
   {
-    // No zip64 support yet
+    // Files are still limited to 4GB
     MZ_FCLOSE(pSrc_file);
     return MZ_FALSE;
   }
@@ -4569,8 +4722,8 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
 
   MZ_FCLOSE(pSrc_file); pSrc_file = NULL;
 
-  // no zip64 support yet
-  if ((comp_size > 0xFFFFFFFF) || (cur_archive_file_ofs > 0xFFFFFFFF))
+  // Zip64 is only supported for archive offsets; files are still limited to 4GB
+  if (comp_size > 0xFFFFFFFF)
     return MZ_FALSE;
 
   if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, 0, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date))
@@ -4591,28 +4744,40 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
 
 mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint file_index)
 {
-  mz_uint n, bit_flags, num_alignment_padding_bytes;
+  return mz_zip_writer_add_from_zip_reader_aligned(pZip, pSource_zip, file_index, 0);
+}
+
+mz_bool mz_zip_writer_add_from_zip_reader_aligned(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint file_index, mz_uint data_alignment)
+{
+  mz_uint n, bit_flags, num_alignment_padding_bytes, name_size, align_extra_size;
   mz_uint64 comp_bytes_remaining, local_dir_header_ofs;
   mz_uint64 cur_src_file_ofs, cur_dst_file_ofs;
   mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)]; mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
   mz_uint8 central_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
+  mz_uint8 zip64_extra[4 + sizeof(mz_uint64)];
+  mz_uint64 src_comp_size, src_uncomp_size, src_local_header_ofs;
+  mz_uint zip64_extra_size, src_extra_size, field_size, extra_size;
+  mz_bool status;
   size_t orig_central_dir_size;
   mz_zip_internal_state *pState;
-  void *pBuf; const mz_uint8 *pSrc_central_header;
+  void *pBuf; mz_uint8 *pName_extra; const mz_uint8 *pSrc_central_header, *pSrc_extra;
 
   if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING))
     return MZ_FALSE;
+  if ((data_alignment & (data_alignment - 1)) || (data_alignment > MZ_ZIP_MAX_DATA_ALIGNMENT))
+    return MZ_FALSE;
   if (NULL == (pSrc_central_header = mz_zip_reader_get_cdh(pSource_zip, file_index)))
     return MZ_FALSE;
   pState = pZip->m_pState;
 
   num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
 
-  // no zip64 support yet
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) > 0xFFFFFFFF))
+  if (pZip->m_total_files == 0xFFFFFFFF)
     return MZ_FALSE;
 
-  cur_src_file_ofs = MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+  if (!mz_zip_get_cdh_sizes(pSrc_central_header, &src_comp_size, &src_uncomp_size, &src_local_header_ofs))
+    return MZ_FALSE;
+  cur_src_file_ofs = src_local_header_ofs;
   cur_dst_file_ofs = pZip->m_archive_size;
 
   if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
@@ -4627,12 +4792,63 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
   local_dir_header_ofs = cur_dst_file_ofs;
   if (pZip->m_file_offset_alignment) { MZ_ASSERT((local_dir_header_ofs & (pZip->m_file_offset_alignment - 1)) == 0); }
 
-  if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_dst_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
-    return MZ_FALSE;
-  cur_dst_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE;
+  name_size = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS);
+  n = name_size + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
+  comp_bytes_remaining = n + src_comp_size;
+
+  if (data_alignment <= 1)
+  {
+    // The local header, name and extra field are copied along with the data, as-is
+    if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_dst_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
+      return MZ_FALSE;
+    cur_dst_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE;
+  }
+  else
+  {
+    // Drop any alignment padding from the extra field, and pad it again for where the data lands in this archive
+    if (NULL == (pName_extra = (mz_uint8 *)pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, MZ_MAX(n, 1))))
+      return MZ_FALSE;
+    if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pName_extra, n) != n)
+    {
+      pZip->m_pFree(pZip->m_pAlloc_opaque, pName_extra);
+      return MZ_FALSE;
+    }
+    cur_src_file_ofs += n;
+    comp_bytes_remaining = src_comp_size;
+
+    pSrc_extra = pName_extra + name_size;
+    src_extra_size = n - name_size;
+    extra_size = 0;
+    while (src_extra_size >= 4)
+    {
+      field_size = MZ_READ_LE16(pSrc_extra + 2) + 4;
+      if (field_size > src_extra_size)
+        break;
+      if (MZ_READ_LE16(pSrc_extra) != MZ_ZIP_ALIGNMENT_EXTRA_FIELD_ID)
+      {
+        memmove(pName_extra + name_size + extra_size, pSrc_extra, field_size);
+        extra_size += field_size;
+      }
+      pSrc_extra += field_size; src_extra_size -= field_size;
+    }
+    n = name_size + extra_size;
+
+    align_extra_size = mz_zip_writer_compute_alignment_extra_size(cur_dst_file_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + n, data_alignment);
+    if (extra_size + align_extra_size > 0xFFFF)
+    {
+      pZip->m_pFree(pZip->m_pAlloc_opaque, pName_extra);
+      return MZ_FALSE;
+    }
+    MZ_WRITE_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS, extra_size + align_extra_size);
 
-  n = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
-  comp_bytes_remaining = n + MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+    status = (pZip->m_pWrite(pZip->m_pIO_opaque, cur_dst_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) == MZ_ZIP_LOCAL_DIR_HEADER_SIZE) &&
+             (pZip->m_pWrite(pZip->m_pIO_opaque, cur_dst_file_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE, pName_extra, n) == n) &&
+             mz_zip_writer_write_alignment_extra(pZip, cur_dst_file_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + n, align_extra_size, data_alignment);
+    pZip->m_pFree(pZip->m_pAlloc_opaque, pName_extra);
+    if (!status)
+      return MZ_FALSE;
+    cur_dst_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE + n + align_extra_size;
+  }
 
   if (NULL == (pBuf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, (size_t)MZ_MAX(sizeof(mz_uint32) * 4, MZ_MIN(MZ_ZIP_MAX_IO_BUF_SIZE, comp_bytes_remaining)))))
     return MZ_FALSE;
@@ -4679,26 +4895,46 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
   }
   pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
 
-  // no zip64 support yet
-  if (cur_dst_file_ofs > 0xFFFFFFFF)
-    return MZ_FALSE;
-
   orig_central_dir_size = pState->m_central_dir.m_size;
 
+  // Copy the central dir record, with its sizes unsaturated and its zip64 extra field (if any)
+  // replaced by one for where the file is now, keeping any other extra fields.
   memcpy(central_header, pSrc_central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
-  MZ_WRITE_LE32(central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS, local_dir_header_ofs);
-  if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE))
-    return MZ_FALSE;
+  MZ_WRITE_LE32(central_header + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS, src_comp_size);
+  MZ_WRITE_LE32(central_header + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS, src_uncomp_size);
+  MZ_WRITE_LE32(central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS, MZ_MIN(local_dir_header_ofs, 0xFFFFFFFF));
+  zip64_extra_size = mz_zip_writer_create_zip64_extra(zip64_extra, local_dir_header_ofs);
+
+  status = mz_zip_array_push_back(pZip, &pState->m_central_dir, central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) &&
+           mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILENAME_LEN_OFS));
+
+  pSrc_extra = pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+  src_extra_size = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_EXTRA_LEN_OFS);
+  extra_size = zip64_extra_size;
+  while ((status) && (src_extra_size >= 4))
+  {
+    field_size = MZ_READ_LE16(pSrc_extra + 2) + 4;
+    if (field_size > src_extra_size)
+      break;
+    if (MZ_READ_LE16(pSrc_extra) != MZ_ZIP64_EXTENDED_INFO_FIELD_ID)
+    {
+      status = mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_extra, field_size);
+      extra_size += field_size;
+    }
+    pSrc_extra += field_size; src_extra_size -= field_size;
+  }
+
+  status = status &&
+           mz_zip_array_push_back(pZip, &pState->m_central_dir, zip64_extra, zip64_extra_size) &&
+           mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_EXTRA_LEN_OFS), MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_COMMENT_LEN_OFS));
 
-  n = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_COMMENT_LEN_OFS);
-  if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, n))
+  if ((!status) || (extra_size > 0xFFFF) || (pState->m_central_dir.m_size > 0xFFFFFFFF))
   {
     mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
     return MZ_FALSE;
   }
+  MZ_WRITE_LE16((mz_uint8 *)pState->m_central_dir.m_p + orig_central_dir_size + MZ_ZIP_CDH_EXTRA_LEN_OFS, extra_size);
 
-  if (pState->m_central_dir.m_size > 0xFFFFFFFF)
-    return MZ_FALSE;
   n = (mz_uint32)orig_central_dir_size;
   if (!mz_zip_array_push_back(pZip, &pState->m_central_dir_offsets, &n, 1))
   {
@@ -4717,14 +4953,16 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
   mz_zip_internal_state *pState;
   mz_uint64 central_dir_ofs, central_dir_size;
   mz_uint8 hdr[MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE];
+  mz_uint8 zip64_hdr[MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE];
+  mz_uint8 zip64_locator[MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE];
 
   if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING))
     return MZ_FALSE;
 
   pState = pZip->m_pState;
 
-  // no zip64 support yet
-  if ((pZip->m_total_files > 0xFFFF) || ((pZip->m_archive_size + pState->m_central_dir.m_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) > 0xFFFFFFFF))
+  // The central directory itself is still limited to 4GB
+  if (pState->m_central_dir.m_size > 0xFFFFFFFF)
     return MZ_FALSE;
 
   central_dir_ofs = 0;
@@ -4740,13 +4978,40 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
     pZip->m_archive_size += central_dir_size;
   }
 
-  // Write end of central directory record
+  // Write zip64 end of central directory record and locator, only if the counts or offsets
+  // don't fit in the plain record, so small archives are the same as they've always been
+  if ((pZip->m_total_files >= 0xFFFF) || (central_dir_ofs >= 0xFFFFFFFF) || (central_dir_size >= 0xFFFFFFFF))
+  {
+    MZ_CLEAR_OBJ(zip64_hdr);
+    MZ_WRITE_LE32(zip64_hdr + MZ_ZIP64_ECDH_SIG_OFS, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG);
+    MZ_WRITE_LE64(zip64_hdr + MZ_ZIP64_ECDH_SIZE_OF_RECORD_OFS, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE - sizeof(mz_uint32) - sizeof(mz_uint64));
+    MZ_WRITE_LE16(zip64_hdr + MZ_ZIP64_ECDH_VERSION_MADE_BY_OFS, 45);
+    MZ_WRITE_LE16(zip64_hdr + MZ_ZIP64_ECDH_VERSION_NEEDED_OFS, 45);
+    MZ_WRITE_LE64(zip64_hdr + MZ_ZIP64_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS, pZip->m_total_files);
+    MZ_WRITE_LE64(zip64_hdr + MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS, pZip->m_total_files);
+    MZ_WRITE_LE64(zip64_hdr + MZ_ZIP64_ECDH_CDIR_SIZE_OFS, central_dir_size);
+    MZ_WRITE_LE64(zip64_hdr + MZ_ZIP64_ECDH_CDIR_OFS_OFS, central_dir_ofs);
+
+    MZ_CLEAR_OBJ(zip64_locator);
+    MZ_WRITE_LE32(zip64_locator + MZ_ZIP64_ECDL_SIG_OFS, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG);
+    MZ_WRITE_LE64(zip64_locator + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS, pZip->m_archive_size);
+    MZ_WRITE_LE32(zip64_locator + MZ_ZIP64_ECDL_TOTAL_NUMBER_OF_DISKS_OFS, 1);
+
+    if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, zip64_hdr, sizeof(zip64_hdr)) != sizeof(zip64_hdr))
+      return MZ_FALSE;
+    pZip->m_archive_size += sizeof(zip64_hdr);
+    if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, zip64_locator, sizeof(zip64_locator)) != sizeof(zip64_locator))
+      return MZ_FALSE;
+    pZip->m_archive_size += sizeof(zip64_locator);
+  }
+
+  // Write end of central directory record, with fields saturated if they're in the zip64 record
   MZ_CLEAR_OBJ(hdr);
   MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_SIG_OFS, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG);
-  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS, pZip->m_total_files);
-  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS, pZip->m_total_files);
-  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_SIZE_OFS, central_dir_size);
-  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_OFS_OFS, central_dir_ofs);
+  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS, MZ_MIN(pZip->m_total_files, 0xFFFF));
+  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS, MZ_MIN(pZip->m_total_files, 0xFFFF));
+  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_SIZE_OFS, MZ_MIN(central_dir_size, 0xFFFFFFFF));
+  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_OFS_OFS, MZ_MIN(central_dir_ofs, 0xFFFFFFFF));
 
   if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, hdr, sizeof(hdr)) != sizeof(hdr))
     return MZ_FALSE;
@@ -0,0 +1,341 @@
+// Benchmark for the OBJ mesh parser.  Times ParseOBJ against the old single-threaded parser
+// it replaced, on some big synthetic OBJ files and then on any OBJ files named on the command
+// line, and checks the two parsers give the same results.
+//
+// This pulls in the mesh compiler's source to get at its internals, and takes everything else
+// from the framework library.  It's the obj-parser-benchmark console project in the test
+// solutions, so it's built along with the test app and kept in step with the mesh compiler.
+
+#include "../asset-mesh.cpp"
+
+namespace Framework
+{
+	namespace OBJMeshCompiler
+	{
+		// The old single-threaded parser, kept to benchmark and check ParseOBJ against
+		static bool ParseOBJReference(const char * path, Context * pCtxOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pCtxOut);
+
+			// Read the whole file into memory
+			std::vector<byte> data;
+			if (!LoadFile(path, &data, LFK_Text))
+				return false;
+
+			std::vector<float3> positions;
+			std::vector<float3> normals;
+			std::vector<float2> uvs;
+
+			struct OBJVertex { int iPos, iNormal, iUv; };
+			std::vector<OBJVertex> OBJverts;
+
+			struct OBJFace { int iVertStart, iVertEnd, iIdxStart; };
+			std::vector<OBJFace> OBJfaces;
+
+			struct OBJMtlRange { std::string mtlName; int iFaceStart, iFaceEnd; };
+			std::vector<OBJMtlRange> OBJMtlRanges;
+			OBJMtlRange initialRange = { std::string(), 0, 0, };
+			OBJMtlRanges.push_back(initialRange);
+
+			// Parse line-by-line
+			TextParsingHelper tph((char *)&data[0], path);
+			while (tph.NextLine())
+			{
+				char * pToken = tph.NextToken();
+				if (_stricmp(pToken, "v") == 0)
+				{
+					char * tokens[3] = {};
+					tph.ExpectTokens(tokens, dim(tokens), "vertex position");
+					tph.ExpectEOL();
+
+					// Add vertex
+					float3 pos;
+					pos.x = float(atof(tokens[0]));
+					pos.y = float(atof(tokens[1]));
+					pos.z = float(atof(tokens[2]));
+					positions.push_back(pos);
+				}
+				else if (_stricmp(pToken, "vn") == 0)
+				{
+					char * tokens[3] = {};
+					tph.ExpectTokens(tokens, dim(tokens), "normal vector");
+					tph.ExpectEOL();
+
+					// Add normal
+					float3 normal;
+					normal.x = float(atof(tokens[0]));
+					normal.y = float(atof(tokens[1]));
+					normal.z = float(atof(tokens[2]));
+					normals.push_back(normal);
+				}
+				else if (_stricmp(pToken, "vt") == 0)
+				{
+					char * tokens[2] = {};
+					tph.ExpectTokens(tokens, dim(tokens), "UVs");
+
+					// OBJ files can have a third texture coordinate, but
+					// currently we just throw it away if it's there
+					(void)tph.NextToken();
+					tph.ExpectEOL();
+
+					// Add UV, flipping V-axis since OBJ UVs use a bottom-up convention
+					float2 uv;
+					uv.x = float(atof(tokens[0]));
+					uv.y = 1.0f - float(atof(tokens[1]));
+					uvs.push_back(uv);
+				}
+				else if (_stricmp(pToken, "f") == 0)
+				{
+					// Add face
+					OBJFace face = {};
+					face.iVertStart = int(OBJverts.size());
+
+					while (char * pCtxVert = tph.NextToken())
+					{
+						// Parse vertex specification, with slashes separating position, UV, normal indices
+						// Note that some components may be missing and will be set to zero here
+						OBJVertex vert = {};
+
+						char * pIdx = pCtxVert;
+						while (*pCtxVert && *pCtxVert != '/')
+							++pCtxVert;
+						if (*pCtxVert)
+							*(pCtxVert++) = 0;
+						vert.iPos = atoi(pIdx);
+
+						pIdx = pCtxVert;
+						while (*pCtxVert && *pCtxVert != '/')
+							++pCtxVert;
+						if (*pCtxVert)
+							*(pCtxVert++) = 0;
+						vert.iUv = atoi(pIdx);
+
+						vert.iNormal = atoi(pCtxVert);
+
+						// Handle negative indices - a bizarre OBJ feature that lets you reference
+						// verts by counting backward from the most recent one
+						if (vert.iPos < 0)
+							vert.iPos += int(positions.size()) + 1;
+						if (vert.iUv < 0)
+							vert.iUv += int(uvs.size()) + 1;
+						if (vert.iNormal < 0)
+							vert.iNormal += int(normals.size()) + 1;
+
+						OBJverts.push_back(vert);
+					}
+
+					face.iVertEnd = int(OBJverts.size());
+
+					if (face.iVertEnd == face.iVertStart)
+					{
+						WARN("%s: syntax error at line %d: missing faces", path, tph.m_iLine);
+						continue;
+					}
+
+					OBJfaces.push_back(face);
+				}
+				else if (_stricmp(pToken, "usemtl") == 0)
+				{
+					const char * pMtlName = tph.ExpectOneToken("material name");
+					tph.ExpectEOL();
+					if (!pMtlName)
+						continue;
+
+					// Close the previous range
+					OBJMtlRange * pRange = &OBJMtlRanges.back();
+					pRange->iFaceEnd = int(OBJfaces.size());
+
+					// Start a new range if the previous one was nonempty, else overwrite the previous one
+					if (pRange->iFaceEnd > pRange->iFaceStart)
+					{
+						OBJMtlRanges.push_back(OBJMtlRange());
+						pRange = &OBJMtlRanges.back();
+					}
+
+					// Start the new range
+					pRange->mtlName = pMtlName;
+					makeLowercase(pRange->mtlName);
+					pRange->iFaceStart = int(OBJfaces.size());
+				}
+				else
+				{
+					// Unknown command; just ignore
+				}
+			}
+
+			// Close the last material range
+			OBJMtlRanges.back().iFaceEnd = int(OBJfaces.size());
+
+			// Convert OBJ verts to vertex buffer
+			pCtxOut->m_verts.reserve(OBJverts.size());
+			for (int iVert = 0, cVert = int(OBJverts.size()); iVert < cVert; ++iVert)
+			{
+				OBJVertex objv = OBJverts[iVert];
+				Vertex v = {};
+
+				// OBJ indices are 1-based; fix that (missing components are zeros)
+				if (objv.iPos > 0)
+					v.m_pos = positions[objv.iPos - 1];
+				if (objv.iNormal > 0)
+					v.m_normal = normals[objv.iNormal - 1];
+				if (objv.iUv > 0)
+					v.m_uv = uvs[objv.iUv - 1];
+
+				pCtxOut->m_verts.push_back(v);
+			}
+
+			// Convert OBJ faces to index buffer
+			for (int iFace = 0, cFace = int(OBJfaces.size()); iFace < cFace; ++iFace)
+			{
+				OBJFace & face = OBJfaces[iFace];
+
+				// Store where the face ended up in the buffer
+				face.iIdxStart = int(pCtxOut->m_indices.size());
+
+				int iVertBase = face.iVertStart;
+
+				// Triangulate the face
+				for (int iVert = face.iVertStart + 2; iVert < face.iVertEnd; ++iVert)
+				{
+					pCtxOut->m_indices.push_back(iVertBase);
+					pCtxOut->m_indices.push_back(iVert - 1);
+					pCtxOut->m_indices.push_back(iVert);
+				}
+			}
+
+			// Add one more OBJface as a sentinel for the next part
+			OBJFace faceSentinel = { 0, 0, int(pCtxOut->m_indices.size()) };
+			OBJfaces.push_back(faceSentinel);
+
+			// Convert OBJ material ranges (in terms of faces) to ranges in terms of indices
+			for (int iRange = 0, cRange = int(OBJMtlRanges.size()); iRange < cRange; ++iRange)
+			{
+				OBJMtlRange & objrange = OBJMtlRanges[iRange];
+				int iIdxStart = OBJfaces[objrange.iFaceStart].iIdxStart;
+				int iIdxEnd = OBJfaces[objrange.iFaceEnd].iIdxStart;
+				MtlRange range = { objrange.mtlName, iIdxStart, iIdxEnd - iIdxStart, };
+				pCtxOut->m_mtlRanges.push_back(range);
+			}
+
+			pCtxOut->m_bounds = boxAround(int(positions.size()), &positions[0]);
+			pCtxOut->m_hasNormals = !normals.empty();
+
+			return true;
+		}
+
+		// Time the old and new parsers on an OBJ file, and check they give the same results
+		void BenchmarkOBJParser(const char * path)
+		{
+			i64 frequency, timeStart, timeMid, timeEnd;
+			QueryPerformanceFrequency((LARGE_INTEGER *)&frequency);
+
+			Context ctxRef = {};
+			Context ctx = {};
+			QueryPerformanceCounter((LARGE_INTEGER *)&timeStart);
+			bool successRef = ParseOBJReference(path, &ctxRef);
+			QueryPerformanceCounter((LARGE_INTEGER *)&timeMid);
+			bool success = ParseOBJ(path, &ctx);
+			QueryPerformanceCounter((LARGE_INTEGER *)&timeEnd);
+
+			bool match = (successRef && success &&
+						  ctx.m_verts.size() == ctxRef.m_verts.size() &&
+						  ctx.m_indices == ctxRef.m_indices &&
+						  ctx.m_mtlRanges.size() == ctxRef.m_mtlRanges.size() &&
+						  ctx.m_hasNormals == ctxRef.m_hasNormals);
+			if (match && !ctx.m_verts.empty())
+				match = (memcmp(&ctx.m_verts[0], &ctxRef.m_verts[0], ctx.m_verts.size() * sizeof(Vertex)) == 0);
+			for (int i = 0, c = int(ctx.m_mtlRanges.size()); match && i < c; ++i)
+			{
+				match = (ctx.m_mtlRanges[i].m_mtlName == ctxRef.m_mtlRanges[i].m_mtlName &&
+						 ctx.m_mtlRanges[i].m_indexStart == ctxRef.m_mtlRanges[i].m_indexStart &&
+						 ctx.m_mtlRanges[i].m_indexCount == ctxRef.m_mtlRanges[i].m_indexCount);
+			}
+
+			float msRef = 1000.0f * float(timeMid - timeStart) / float(frequency);
+			float ms = 1000.0f * float(timeEnd - timeMid) / float(frequency);
+			LOG("%s: ParseOBJ %0.1f ms, old parser %0.1f ms (%0.1fx faster); results %s",
+				path, ms, msRef, msRef / max(ms, 1e-3f), match ? "match" : "DON'T MATCH");
+		}
+
+		// Write a w x h grid of quads to an OBJ file, with a few materials and some
+		// faces using relative indices, to exercise everything ParseOBJ handles
+		static bool WriteSyntheticOBJ(const char * path, int w, int h)
+		{
+			FILE * pFile = nullptr;
+			if (fopen_s(&pFile, path, "w") != 0 || !pFile)
+				return false;
+
+			int cVert = (w + 1) * (h + 1);
+			for (int y = 0; y <= h; ++y)
+			{
+				for (int x = 0; x <= w; ++x)
+				{
+					fprintf(pFile, "v %f %f %f\n", float(x) / w, 0.05f * sinf(float(x + y)), float(y) / h);
+					fprintf(pFile, "vt %f %f\n", float(x) / w, float(y) / h);
+					fprintf(pFile, "vn %f %f %f\n", 0.05f * cosf(float(x + y)), 1.0f, 0.0f);
+				}
+			}
+
+			for (int y = 0; y < h; ++y)
+			{
+				if (y % 64 == 0)
+					fprintf(pFile, "usemtl material%d\n", (y / 64) % 4);
+
+				for (int x = 0; x < w; ++x)
+				{
+					int corners[4] =
+					{
+						y * (w + 1) + x + 1,
+						y * (w + 1) + x + 2,
+						(y + 1) * (w + 1) + x + 2,
+						(y + 1) * (w + 1) + x + 1,
+					};
+					if (x % 8 == 0)
+					{
+						for (int i = 0; i < dim(corners); ++i)
+							corners[i] -= cVert + 1;
+					}
+					fprintf(pFile, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+						corners[0], corners[0], corners[0], corners[1], corners[1], corners[1],
+						corners[2], corners[2], corners[2], corners[3], corners[3], corners[3]);
+				}
+			}
+
+			return (fclose(pFile) == 0);
+		}
+
+		void BenchmarkOBJParserSynthetic()
+		{
+			char tempDir[MAX_PATH];
+			if (GetTempPath(dim(tempDir), tempDir) == 0)
+				return;
+
+			static const int s_gridSizes[] = { 256, 1024, 2048 };
+			for (int i = 0; i < dim(s_gridSizes); ++i)
+			{
+				char path[MAX_PATH];
+				if (GetTempFileName(tempDir, "obj", 0, path) == 0)
+					return;
+
+				if (WriteSyntheticOBJ(path, s_gridSizes[i], s_gridSizes[i]))
+					BenchmarkOBJParser(path);
+				else
+					WARN("Couldn't write synthetic OBJ file %s", path);
+
+				DeleteFile(path);
+			}
+		}
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	using namespace Framework::OBJMeshCompiler;
+
+	BenchmarkOBJParserSynthetic();
+	for (int i = 1; i < argc; ++i)
+		BenchmarkOBJParser(argv[i]);
+
+	return 0;
+}
@@ -12,6 +12,14 @@ struct Vertex
 	float2		m_uv		: UV;
 };
 
+// Vertex as read from a VTXFMT_Quantized mesh; see DecodeVertex
+struct VertexQuantized
+{
+	float4		m_pos		: POSITION;		// unorm16, within the mesh's bounding box
+	float2		m_normalOct	: NORMAL;		// Octahedral-encoded, snorm16
+	float2		m_uv		: UV;			// Half-float
+};
+
 cbuffer CBFrame : CB_FRAME					// matches struct CBFrame in test.cpp
 {
 	float4x4	g_matWorldToClip;
@@ -27,6 +35,8 @@ cbuffer CBFrame : CB_FRAME					// matches struct CBFrame in test.cpp
 	float		g_shadowSharpening;
 
 	float		g_exposure;					// Exposure multiplier
+	float3		g_posDequantScale;			// Mesh position dequantization; see VertexFormat
+	float3		g_posDequantOffset;
 }
 
 cbuffer CBDebug : CB_DEBUG					// matches struct CBDebug in test.cpp
@@ -43,6 +53,25 @@ float2 square(float2 x) { return x*x; }
 float3 square(float3 x) { return x*x; }
 float4 square(float4 x) { return x*x; }
 
+// Inverse of OctahedralEncode in asset-mesh.cpp: fold the lower half of the octahedron
+// back down, then project out to the sphere
+float3 OctahedralDecode(float2 oct)
+{
+	float3 n = float3(oct, 1.0 - abs(oct.x) - abs(oct.y));
+	float fold = saturate(-n.z);
+	n.xy += (n.xy >= 0.0) ? -fold : fold;
+	return normalize(n);
+}
+
+Vertex DecodeVertex(VertexQuantized vtxQ)
+{
+	Vertex vtx;
+	vtx.m_pos = vtxQ.m_pos.xyz * g_posDequantScale + g_posDequantOffset;
+	vtx.m_normal = OctahedralDecode(vtxQ.m_normalOct);
+	vtx.m_uv = vtxQ.m_uv;
+	return vtx;
+}
+
 float sharpen(float x, float sharpening)
 {
 	if (x < 0.5)
@@ -91,6 +91,9 @@ struct CBFrame								// matches cbuffer CBFrame in shader-common.hlsli
 	float		m_shadowSharpening;
 
 	float		m_exposure;					// Exposure multiplier
+	float3		m_posDequantScale;			// Mesh position dequantization; see VertexFormat
+	float3		m_posDequantOffset;
+	float		m_padding3;
 };
 
 struct CBDebug								// matches cbuffer CBDebug in shader-common.hlsli
@@ -121,7 +124,7 @@ public:
 
 	void				SetRenderTargetDims(int2 dimsNew);
 	void				ResetCamera();
-	void				DrawMaterials(ID3D11PixelShader * pPs, ID3D11PixelShader * pPsAlphaTest);
+	void				DrawMaterials(ID3D11PixelShader * pPs, ID3D11PixelShader * pPsAlphaTest, const ClusterCullInfo & cullInfo, bool cullBackfaces);
 	void				RenderScene();
 	void				RenderShadowMap();
 
@@ -191,75 +194,26 @@ bool TestWindow::Init(HINSTANCE hInstance)
 {
 	super::Init("TestWindow", "Test", hInstance);
 
-	// Ensure the asset pack is up to date
-	static const AssetCompileInfo s_assets[] =
+	// Find all the assets the scene uses, and ensure the asset pack is up to date
+	static const AssetCompileInfo s_assetRoots[] =
 	{
-		{ "crytek-sponza/sponza.obj",								ACK_OBJMesh, },
-		{ "crytek-sponza/sponza.mtl",								ACK_OBJMtlLib, },
-		{ "crytek-sponza/textures/background.tga",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/backgroundbgr.tga",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/background_bump.png",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/chain_texture.tga",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/chain_texture_bump.png",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/chain_texture_mask.png",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/gi_flag.tga",						ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/lion.tga",						ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/lion2_bump.png",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/lion_bump.png",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/spnza_bricks_a_bump.png",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/spnza_bricks_a_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/spnza_bricks_a_spec.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_arch_bump.png",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_arch_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_arch_spec.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_ceiling_a_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_ceiling_a_spec.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_a_bump.png",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_a_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_a_spec.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_b_bump.png",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_b_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_b_spec.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_c_bump.png",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_c_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_column_c_spec.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_curtain_blue_diff.tga",	ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_curtain_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_curtain_green_diff.tga",	ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_details_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_details_spec.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_fabric_blue_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_fabric_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_fabric_green_diff.tga",	ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_fabric_spec.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_flagpole_diff.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_flagpole_spec.tga",		ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_floor_a_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_floor_a_spec.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_roof_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_thorn_bump.png",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_thorn_diff.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_thorn_mask.png",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/sponza_thorn_spec.tga",			ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_bump.png",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_dif.tga",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_hanging.tga",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_plant.tga",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_plant_mask.png",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_plant_spec.tga",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_round.tga",					ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_round_bump.png",				ACK_TextureWithMips, },
-		{ "crytek-sponza/textures/vase_round_spec.tga",				ACK_TextureWithMips, },
+		{ "crytek-sponza/sponza.obj", ACK_OBJMesh, TEXFMT_RGBA8, MESHOPT_VertexCache, 0.0f, 0.0f, 0.0f, VTXFMT_Quantized, true, },
 	};
+	AssetDependencies assets;
+	if (!FindAssetDependencies(s_assetRoots, dim(s_assetRoots), ACK_TextureWithMips, TEXFMT_BC7, &assets))
+	{
+		ERR("Couldn't find Sponza assets");
+		return false;
+	}
 	comptr<AssetPack> pPack = new AssetPack;
-	if (!LoadAssetPackOrCompileIfOutOfDate("crytek-sponza-assets.zip", s_assets, dim(s_assets), pPack))
+	if (!LoadAssetPackOrCompileIfOutOfDate("crytek-sponza-assets.zip", &assets.m_assets[0], int(assets.m_assets.size()), pPack))
 	{
 		ERR("Couldn't load or compile Sponza asset pack");
 		return false;
 	}
 
 	// Load assets
-	if (!LoadTextureLibFromAssetPack(pPack, s_assets, dim(s_assets), &m_texLibSponza))
+	if (!LoadTextureLibFromAssetPack(pPack, &assets.m_assets[0], int(assets.m_assets.size()), &m_texLibSponza))
 	{
 		ERR("Couldn't load Sponza texture library");
 		return false;
@@ -275,19 +229,6 @@ bool TestWindow::Init(HINSTANCE hInstance)
 		return false;
 	}
 
-	// Hardcode a list of alpha-tested materials, for now
-	static const char * s_aMtlAlphaTest[] =
-	{
-		"leaf",
-		"material__57",
-		"chain",
-	};
-	for (int i = 0; i < dim(s_aMtlAlphaTest); ++i)
-	{
-		if (Material * pMtl = m_mtlLibSponza.Lookup(s_aMtlAlphaTest[i]))
-			pMtl->m_alphaTest = true;
-	}
-
 	// Upload all assets to GPU
 	m_meshSponza.UploadToGPU(m_pDevice);
 	m_texLibSponza.UploadAllToGPU(m_pDevice);
@@ -304,14 +245,12 @@ bool TestWindow::Init(HINSTANCE hInstance)
 
 	// Initialize the input layout, and validate it against all the vertex shaders
 
-	D3D11_INPUT_ELEMENT_DESC aInputDescs[] =
-	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, UINT(offsetof(Vertex, m_pos)), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, UINT(offsetof(Vertex, m_normal)), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "UV", 0, DXGI_FORMAT_R32G32_FLOAT, 0, UINT(offsetof(Vertex, m_uv)), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-	};
+	// (world_vs decodes VTXFMT_Quantized, so that's what the mesh must be compiled to)
+	ASSERT_ERR(m_meshSponza.m_vtxFormat.m_vtxfmt == VTXFMT_Quantized);
+	D3D11_INPUT_ELEMENT_DESC aInputDescs[VTXATTR_Count];
+	int numInputDescs = MakeInputElementDescs(m_meshSponza.m_vtxFormat, aInputDescs);
 	CHECK_D3D(m_pDevice->CreateInputLayout(
-							aInputDescs, dim(aInputDescs),
+							aInputDescs, numInputDescs,
 							world_vs_bytecode, dim(world_vs_bytecode),
 							&m_pInputLayout));
 
@@ -668,52 +607,36 @@ void TestWindow::OnRender()
 		DeactivateVR();
 }
 
-void TestWindow::DrawMaterials(ID3D11PixelShader * pPs, ID3D11PixelShader * pPsAlphaTest)
+void TestWindow::DrawMaterials(ID3D11PixelShader * pPs, ID3D11PixelShader * pPsAlphaTest, const ClusterCullInfo & cullInfo, bool cullBackfaces)
 {
-	// Draw the individual material ranges of the mesh
+	// Draw the individual material ranges of the mesh, culling clusters outside the frustum
+	// (and facing away, for single-sided materials).  The ranges are sorted by shader variant
+	// and textures, so just bind what changes from one to the next.
 
-	// Non-alpha-tested materials
-	m_pCtx->PSSetShader(pPs, nullptr, 0);
-	m_pCtx->RSSetState(m_pRsDefault);
-	for (int i = 0, c = int(m_meshSponza.m_mtlRanges.size()); i < c; ++i)
+	ID3D11PixelShader * pPsCur = nullptr;
+	for (MtlRangeIterator iter(&m_meshSponza); iter.Next(); )
 	{
-		Material * pMtl = m_meshSponza.m_mtlRanges[i].m_pMtl;
-		ASSERT_ERR(pMtl);
-
-		if (pMtl->m_alphaTest)
-			continue;
+		bool alphaTest = (iter.m_shaderVariant == SHADERVARIANT_AlphaTest);
 
-		if (pPs)
+		if (iter.m_changed & DRAWSTATE_Shader)
 		{
-			ID3D11ShaderResourceView * pSrv = m_tex1x1White.m_pSrv;
-			if (Texture2D * pTex = pMtl->m_pTexDiffuseColor)
-				pSrv = pTex->m_pSrv;
-			m_pCtx->PSSetShaderResources(TEX_DIFFUSE, 1, &pSrv);
+			pPsCur = alphaTest ? pPsAlphaTest : pPs;
+			m_pCtx->PSSetShader(pPsCur, nullptr, 0);
+			m_pCtx->RSSetState(alphaTest ? m_pRsDoubleSided : m_pRsDefault);
 		}
 
-		m_meshSponza.DrawMtlRange(m_pCtx, i);
-	}
-
-	// Alpha-tested materials
-	m_pCtx->PSSetShader(pPsAlphaTest, nullptr, 0);
-	m_pCtx->RSSetState(m_pRsDoubleSided);
-	for (int i = 0, c = int(m_meshSponza.m_mtlRanges.size()); i < c; ++i)
-	{
-		Material * pMtl = m_meshSponza.m_mtlRanges[i].m_pMtl;
-		ASSERT_ERR(pMtl);
-
-		if (!pMtl->m_alphaTest)
-			continue;
-
-		if (pPsAlphaTest)
+		if ((iter.m_changed & (DRAWSTATE_Shader | DRAWSTATE_Textures)) && pPsCur)
 		{
+			Material * pMtl = iter.m_pRange->m_pMtl;
+			ASSERT_ERR(pMtl);
+
 			ID3D11ShaderResourceView * pSrv = m_tex1x1White.m_pSrv;
 			if (Texture2D * pTex = pMtl->m_pTexDiffuseColor)
 				pSrv = pTex->m_pSrv;
 			m_pCtx->PSSetShaderResources(TEX_DIFFUSE, 1, &pSrv);
 		}
 
-		m_meshSponza.DrawMtlRange(m_pCtx, i);
+		m_meshSponza.DrawMtlRangeCulled(m_pCtx, iter.m_iMtlRange, cullInfo, cullBackfaces && !alphaTest);
 	}
 }
 
@@ -739,6 +662,8 @@ void TestWindow::RenderScene()
 		g_normalOffsetShadow,
 		g_shadowSharpening,
 		g_exposure,
+		m_meshSponza.m_vtxFormat.m_posScale,
+		m_meshSponza.m_vtxFormat.m_posOffset,
 	};
 	m_cbFrame.Bind(m_pCtx, CB_FRAME);
 
@@ -760,7 +685,10 @@ void TestWindow::RenderScene()
 		cbFrame.m_posCamera = m_camera.m_pos;
 		m_cbFrame.Update(m_pCtx, &cbFrame);
 
-		DrawMaterials(m_pPsSimple, m_pPsSimpleAlphaTest);
+		ClusterCullInfo cullInfo;
+		InitClusterCullInfo(cbFrame.m_matWorldToClip, m_camera.m_pos / sceneScale, &cullInfo);
+
+		DrawMaterials(m_pPsSimple, m_pPsSimpleAlphaTest, cullInfo, true);
 	}
 	else
 	{
@@ -817,7 +745,10 @@ void TestWindow::RenderScene()
 			// Set viewport to half of the render target
 			SetViewport(m_pCtx, box2{ float(m_rtSceneMSAA.m_dims.x / 2 * eye), 0.0f, float(m_rtSceneMSAA.m_dims.x / 2 * (eye + 1)), float(m_rtSceneMSAA.m_dims.y) });
 
-			DrawMaterials(m_pPsSimple, m_pPsSimpleAlphaTest);
+			ClusterCullInfo cullInfo;
+			InitClusterCullInfo(worldToClip, cbFrame.m_posCamera / sceneScale, &cullInfo);
+
+			DrawMaterials(m_pPsSimple, m_pPsSimpleAlphaTest, cullInfo, true);
 		}
 	}
 
@@ -857,6 +788,8 @@ void TestWindow::RenderShadowMap()
 	{
 		matSceneScale * m_shmp.m_matWorldToClip,
 	};
+	cbFrame.m_posDequantScale = m_meshSponza.m_vtxFormat.m_posScale;
+	cbFrame.m_posDequantOffset = m_meshSponza.m_vtxFormat.m_posOffset;
 	m_cbFrame.Update(m_pCtx, &cbFrame);
 	m_cbFrame.Bind(m_pCtx, CB_FRAME);
 
@@ -866,7 +799,11 @@ void TestWindow::RenderShadowMap()
 	m_pCtx->VSSetShader(m_pVsWorld, nullptr, 0);
 	m_pCtx->PSSetSamplers(SAMP_DEFAULT, 1, &m_pSsTrilinearRepeatAniso);
 
-	DrawMaterials(nullptr, m_pPsShadowAlphaTest);
+	// The light is directional, so there's no eye position for backface culling
+	ClusterCullInfo cullInfo;
+	InitClusterCullInfo(cbFrame.m_matWorldToClip, float3(0.0f), &cullInfo);
+
+	DrawMaterials(nullptr, m_pPsShadowAlphaTest, cullInfo, false);
 }
 
 bool TestWindow::TryActivateVR()
@@ -102,7 +102,7 @@ namespace Framework
 		{
 			D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[i];
 			pInitialData->pSysMem = m_apPixels[i];
-			pInitialData->SysMemPitch = CalculateMipDims(m_dims.x, i) * BitsPerPixel(m_format) / 8;
+			pInitialData->SysMemPitch = CalculateMipPitchInBytes(m_dims.x, i, m_format);
 			pInitialData->SysMemSlicePitch = 0;
 		}
 
@@ -156,9 +156,10 @@ namespace Framework
 		CHECK_D3D(pCtx->Map(pTexStaging, 0, D3D11_MAP_READ, 0, &mapped));
 
 		// Copy the data out row by row, in case the pitch is different
-		int rowSize = mipDims.x * BitsPerPixel(m_format) / 8;
+		int rowSize = CalculateMipPitchInBytes(m_dims.x, level, m_format);
+		int rowCount = CalculateMipRowCount(m_dims.y, level, m_format);
 		ASSERT_ERR(mapped.RowPitch >= UINT(rowSize));
-		for (int y = 0; y < mipDims.y; ++y)
+		for (int y = 0; y < rowCount; ++y)
 		{
 			memcpy(
 				offsetPtr(pDataOut, y * rowSize),
@@ -276,7 +277,7 @@ namespace Framework
 			{
 				D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[face * m_mipLevels + level];
 				pInitialData->pSysMem = m_apPixels[face * m_mipLevels + level];
-				pInitialData->SysMemPitch = CalculateMipDims(m_cubeSize, level) * BitsPerPixel(m_format) / 8;
+				pInitialData->SysMemPitch = CalculateMipPitchInBytes(m_cubeSize, level, m_format);
 				pInitialData->SysMemSlicePitch = 0;
 			}
 		}
@@ -334,9 +335,10 @@ namespace Framework
 		CHECK_D3D(pCtx->Map(pTexStaging, 0, D3D11_MAP_READ, 0, &mapped));
 
 		// Copy the data out row by row, in case the pitch is different
-		int rowSize = mipDim * BitsPerPixel(m_format) / 8;
+		int rowSize = CalculateMipPitchInBytes(m_cubeSize, level, m_format);
+		int rowCount = CalculateMipRowCount(m_cubeSize, level, m_format);
 		ASSERT_ERR(mapped.RowPitch >= UINT(rowSize));
-		for (int y = 0; y < mipDim; ++y)
+		for (int y = 0; y < rowCount; ++y)
 		{
 			memcpy(
 				offsetPtr(pDataOut, y * rowSize),
@@ -445,11 +447,10 @@ namespace Framework
 		std::vector<D3D11_SUBRESOURCE_DATA> aInitialData(m_mipLevels);
 		for (int i = 0; i < m_mipLevels; ++i)
 		{
-			int3 mipDims = CalculateMipDims(m_dims, i);
 			D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[i];
 			pInitialData->pSysMem = m_apPixels[i];
-			pInitialData->SysMemPitch = mipDims.x * BitsPerPixel(m_format) / 8;
-			pInitialData->SysMemSlicePitch = pInitialData->SysMemPitch * mipDims.y;
+			pInitialData->SysMemPitch = CalculateMipPitchInBytes(m_dims.x, i, m_format);
+			pInitialData->SysMemSlicePitch = pInitialData->SysMemPitch * CalculateMipRowCount(m_dims.y, i, m_format);
 		}
 
 		CHECK_D3D(pDevice->CreateTexture3D(&texDesc, &aInitialData[0], &m_pTex));
@@ -502,13 +503,14 @@ namespace Framework
 		CHECK_D3D(pCtx->Map(pTexStaging, 0, D3D11_MAP_READ, 0, &mapped));
 
 		// Copy the data out slice by slice and row by row, in case the pitches are different
-		int rowSize = mipDims.x * BitsPerPixel(m_format) / 8;
-		int sliceSize = mipDims.y * rowSize;
+		int rowSize = CalculateMipPitchInBytes(m_dims.x, level, m_format);
+		int rowCount = CalculateMipRowCount(m_dims.y, level, m_format);
+		int sliceSize = rowCount * rowSize;
 		ASSERT_ERR(mapped.RowPitch >= UINT(rowSize));
 		ASSERT_ERR(mapped.DepthPitch >= UINT(sliceSize));
 		for (int z = 0; z < mipDims.z; ++z)
 		{
-			for (int y = 0; y < mipDims.y; ++y)
+			for (int y = 0; y < rowCount; ++y)
 			{
 				memcpy(
 					offsetPtr(pDataOut, z * sliceSize + y * rowSize),
@@ -974,6 +976,12 @@ namespace Framework
 		return s_bitsPerPixel[format];
 	}
 
+	bool IsBlockCompressed(DXGI_FORMAT format)
+	{
+		return (format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM) ||
+			   (format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB);
+	}
+
 	DXGI_FORMAT FindTypelessFormat(DXGI_FORMAT format)
 	{
 		static const DXGI_FORMAT s_typelessFormat[] =
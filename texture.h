@@ -5,10 +5,10 @@ namespace Framework
 	// Utility functions for working with texture formats
 	const char * NameOfFormat(DXGI_FORMAT format);
 	int BitsPerPixel(DXGI_FORMAT format);
+	bool IsBlockCompressed(DXGI_FORMAT format);		// BCn formats, stored as 4x4 pixel blocks
 	DXGI_FORMAT FindTypelessFormat(DXGI_FORMAT format);
 
 	// Utility functions for counting mips
-	// Note: these don't take into account minimum block sizes for compressed formats.
 
 	inline int CalculateMipCount(int size)
 		{ return log2_floor(size) + 1; }
@@ -24,12 +24,27 @@ namespace Framework
 	inline int3 CalculateMipDims(int3 baseDims, int level)
 		{ return max(int3(baseDims.x >> level, baseDims.y >> level, baseDims.z >> level), int3(1)); }
 
+	// Bytes per row of the mip, and number of rows.  For block-compressed formats, a row is a
+	// row of 4x4 blocks, and mips smaller than 4x4 still take up a whole block.
+	inline int CalculateMipPitchInBytes(int baseDimX, int level, DXGI_FORMAT format)
+	{
+		int mipDim = CalculateMipDims(baseDimX, level);
+		if (IsBlockCompressed(format))
+			return ((mipDim + 3) / 4) * BitsPerPixel(format) * 2;	// 16 pixels per block
+		return mipDim * BitsPerPixel(format) / 8;
+	}
+	inline int CalculateMipRowCount(int baseDimY, int level, DXGI_FORMAT format)
+	{
+		int mipDim = CalculateMipDims(baseDimY, level);
+		return IsBlockCompressed(format) ? (mipDim + 3) / 4 : mipDim;
+	}
+
 	inline int CalculateMipSizeInBytes(int baseDim, int level, DXGI_FORMAT format)
-		{ return square(CalculateMipDims(baseDim, level)) * BitsPerPixel(format); }
+		{ return CalculateMipPitchInBytes(baseDim, level, format) * CalculateMipRowCount(baseDim, level, format); }
 	inline int CalculateMipSizeInBytes(int2 baseDims, int level, DXGI_FORMAT format)
-		{ int2 mipDims = CalculateMipDims(baseDims, level); return mipDims.x * mipDims.y * BitsPerPixel(format); }
+		{ return CalculateMipPitchInBytes(baseDims.x, level, format) * CalculateMipRowCount(baseDims.y, level, format); }
 	inline int CalculateMipSizeInBytes(int3 baseDims, int level, DXGI_FORMAT format)
-		{ int3 mipDims = CalculateMipDims(baseDims, level); return mipDims.x * mipDims.y * mipDims.z * BitsPerPixel(format); }
+		{ return CalculateMipPitchInBytes(baseDims.x, level, format) * CalculateMipRowCount(baseDims.y, level, format) * CalculateMipDims(baseDims.z, level); }
 
 	inline int CalculateMipPyramidSizeInBytes(int baseDim, DXGI_FORMAT format, int mipLevels = -1)
 	{